@@ -79,6 +79,12 @@ static const int s_sectionForSegment[] = {
 
 static const int SEGMENT_COUNT = sizeof(s_sectionForSegment) / sizeof(s_sectionForSegment[0]);
 
+static const char* s_counterNames[BENCH_COUNTER_COUNT] = {
+	"TerrainCull(us)", "TerrainCullNodes", "TerrainHorizonCulled", "TerrainTilesBaked", "TerrainCachedChunks", "TerrainSubmit(us)",
+	"ScatterInstances", "ScatterChunks", "RenderPackets", "GxmStateIssued",
+	"GxmStateSkipped", "RingWait(us)", "InstanceUpload(B)"
+};
+
 static Vector3f lerp(const Vector3f& a, const Vector3f& b, float t)
 {
 	return {
@@ -109,6 +115,22 @@ void benchmarkInit(BenchmarkState& state)
 	memset(state.segmentTransitions, 0, sizeof(state.segmentTransitions));
 	state.segmentTransitions[0] = 0;
 	state.segmentCount = 1;
+	memset(state.counters, 0, sizeof(state.counters));
+}
+
+void benchmarkSetCounter(BenchmarkState& state, BenchmarkCounter counter, float value)
+{
+	if (!state.active || state.totalFrames >= MAX_BENCH_FRAMES)
+		return;
+
+	state.counters[counter][state.totalFrames] = value;
+}
+
+const char* benchmarkGetCounterName(BenchmarkCounter counter)
+{
+	if (counter < 0 || counter >= BENCH_COUNTER_COUNT)
+		return "Unknown";
+	return s_counterNames[counter];
 }
 
 bool benchmarkUpdate(BenchmarkState& state, float frameTimeMs,
@@ -192,6 +214,15 @@ bool benchmarkUpdate(BenchmarkState& state, float frameTimeMs,
 	sceClibPrintf("Avg frame time: %.2f ms (%.1f FPS)\n", avgFrameTime, avgFps);
 	sceClibPrintf("Min frame time: %.2f ms (%.1f FPS)\n", state.minFrameTime, maxFps);
 	sceClibPrintf("Max frame time: %.2f ms (%.1f FPS)\n", state.maxFrameTime, minFps);
+
+	int counterFrames = std::min(state.totalFrames, MAX_BENCH_FRAMES);
+	for (int c = 0; c < BENCH_COUNTER_COUNT; c++)
+	{
+		float sum = 0.0f;
+		for (int i = 0; i < counterFrames; i++)
+			sum += state.counters[c][i];
+		sceClibPrintf("Avg %s: %.2f\n", s_counterNames[c], counterFrames > 0 ? sum / (float)counterFrames : 0.0f);
+	}
 	sceClibPrintf("=========================\n");
 
 	return false;
@@ -523,7 +554,13 @@ void benchmarkWriteLog(const BenchmarkState& state)
 	buf[len] = '\0';
 	writeStr(fd, buf);
 
-	writeStr(fd, "Timestamp(ms),FrameTime(ms),FPS,Section\n");
+	writeStr(fd, "Timestamp(ms),FrameTime(ms),FPS,Section");
+	for (int c = 0; c < BENCH_COUNTER_COUNT; c++)
+	{
+		writeStr(fd, ",");
+		writeStr(fd, s_counterNames[c]);
+	}
+	writeStr(fd, "\n");
 
 	// Per-frame data
 	float timestamp = 0.0f;
@@ -555,6 +592,11 @@ void benchmarkWriteLog(const BenchmarkState& state)
 			memcpy(buf + len, secName, nameLen);
 			len += nameLen;
 		}
+		for (int c = 0; c < BENCH_COUNTER_COUNT; c++)
+		{
+			buf[len++] = ',';
+			len += formatFloat(buf + len, sizeof(buf) - len, state.counters[c][i], 2);
+		}
 		buf[len++] = '\n';
 		buf[len] = '\0';
 		writeStr(fd, buf);
@@ -568,7 +610,13 @@ void benchmarkWriteLog(const BenchmarkState& state)
 	buf[len] = '\0';
 	writeStr(fd, buf);
 	writeStr(fd, " Section Summary ---\n");
-	writeStr(fd, "# Section, Frames, AvgMS, AvgFPS, MinMS, MaxMS, 1%LowFPS, 0.1%LowFPS\n");
+	writeStr(fd, "# Section, Frames, AvgMS, AvgFPS, MinMS, MaxMS, 1%LowFPS, 0.1%LowFPS");
+	for (int c = 0; c < BENCH_COUNTER_COUNT; c++)
+	{
+		writeStr(fd, ", Avg ");
+		writeStr(fd, s_counterNames[c]);
+	}
+	writeStr(fd, "\n");
 
 	for (int sec = 0; sec < BENCH_SECTION_COUNT; sec++)
 	{
@@ -648,6 +696,15 @@ void benchmarkWriteLog(const BenchmarkState& state)
 		len += formatFloat(buf + len, sizeof(buf) - len, sec1pctFps, 1);
 		memcpy(buf + len, ", ", 2); len += 2;
 		len += formatFloat(buf + len, sizeof(buf) - len, sec01pctFps, 1);
+		// Counter averages follow the frame time columns
+		for (int c = 0; c < BENCH_COUNTER_COUNT; c++)
+		{
+			float counterTotal = 0.0f;
+			for (int i = secStart; i < secEnd && i < frameCount; i++)
+				counterTotal += state.counters[c][i];
+			memcpy(buf + len, ", ", 2); len += 2;
+			len += formatFloat(buf + len, sizeof(buf) - len, counterTotal / (float)secFrames, 2);
+		}
 		buf[len++] = '\n';
 		buf[len] = '\0';
 		writeStr(fd, buf);
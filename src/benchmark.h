@@ -6,6 +6,24 @@ static const int MAX_BENCH_FRAMES = 8192;
 static const int MAX_BENCH_RUNS = 64;
 static const int BENCH_SECTION_COUNT = 8;
 
+// Per-frame values recorded alongside frame times, written as extra CSV columns
+enum BenchmarkCounter {
+	BENCH_COUNTER_TERRAIN_CULL_US = 0,
+	BENCH_COUNTER_TERRAIN_CULL_NODES,
+	BENCH_COUNTER_TERRAIN_HORIZON_CULLED,
+	BENCH_COUNTER_TERRAIN_TILES_BAKED,
+	BENCH_COUNTER_TERRAIN_CACHED_CHUNKS,
+	BENCH_COUNTER_TERRAIN_SUBMIT_US,
+	BENCH_COUNTER_SCATTER_INSTANCES,
+	BENCH_COUNTER_SCATTER_CHUNKS,
+	BENCH_COUNTER_RENDER_PACKETS,
+	BENCH_COUNTER_GXM_STATE_ISSUED,
+	BENCH_COUNTER_GXM_STATE_SKIPPED,
+	BENCH_COUNTER_FRAME_RING_WAIT_US,
+	BENCH_COUNTER_INSTANCE_UPLOAD_BYTES,
+	BENCH_COUNTER_COUNT
+};
+
 struct BenchmarkKeyframe {
 	Vector3f position;
 	Vector3f rotation;  // pitch, yaw, roll in radians
@@ -32,6 +50,8 @@ struct BenchmarkState {
 	float frameTimes[MAX_BENCH_FRAMES];    // per-frame times (32KB)
 	int segmentTransitions[32];             // frame index where each keyframe segment starts
 	int segmentCount;                       // number of transitions recorded
+
+	float counters[BENCH_COUNTER_COUNT][MAX_BENCH_FRAMES];
 };
 
 void benchmarkInit(BenchmarkState& state);
@@ -42,6 +62,13 @@ void benchmarkInit(BenchmarkState& state);
 bool benchmarkUpdate(BenchmarkState& state, float frameTimeMs,
 	Vector3f& outPosition, Vector3f& outRotation);
 
+// Record a counter for the current frame (the one whose time the next benchmarkUpdate receives).
+// Ignored while the benchmark isn't running.
+void benchmarkSetCounter(BenchmarkState& state, BenchmarkCounter counter, float value);
+
+// Returns the CSV column name for a counter.
+const char* benchmarkGetCounterName(BenchmarkCounter counter);
+
 // Returns the built-in keyframe count.
 int benchmarkGetKeyframeCount();
 
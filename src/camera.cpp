@@ -58,6 +58,11 @@ Matrix4x4& Camera::getViewMatrix()
 	return viewMatrix;
 }
 
+Matrix4x4 Camera::getViewMatrixRelativeTo(const Vector3f& origin) const
+{
+	return createViewMatrix(position - origin, rotation);
+}
+
 Vector3f Camera::getForwardVector() const
 {
 	return this->forward;
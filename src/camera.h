@@ -17,6 +17,9 @@ public:
 	~Camera();
 
 	Matrix4x4& getViewMatrix();
+	// View matrix for positions given relative to origin (camera-relative rendering passes the camera position,
+	// leaving only the rotation so no large translation is rounded away)
+	Matrix4x4 getViewMatrixRelativeTo(const Vector3f& origin) const;
 	Matrix4x4& getProjectionMatrix();
 
 	Vector3f getForwardVector() const;
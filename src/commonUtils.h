@@ -2,6 +2,7 @@
 
 #include <cmath>
 #include <cstdint>
+#include <cstring>
 
 #define PI 3.1415926535897932384626433832795028841971693993751f
 
@@ -176,20 +177,40 @@ inline int16_t floatToS16N(float v)
 	return (int16_t)(v * 32767.0f);
 }
 
+// Helper to convert float to half precision (values below the normal half range flush to zero)
+inline uint16_t floatToF16(float v)
+{
+	uint32_t bits;
+	memcpy(&bits, &v, sizeof(bits));
+	uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+	int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFF;
+
+	if (exponent <= 0)
+		return sign;
+	if (exponent >= 31)
+		return sign | 0x7BFF; // clamp to the largest finite half
+
+	uint16_t half = (uint16_t)(sign | (exponent << 10) | (mantissa >> 13));
+	if (mantissa & 0x1000)
+		half++; // round to nearest, a carry into the exponent is still correct
+	return half;
+}
+
 // Compressed terrain PBR vertex: position + UV as float32, normal + tangent as signed 16-bit normalized
 // Handedness is precomputed on CPU and stored in tangent.w, eliminating bitangent from vertex data
 // S16N provides full precision for normalized vectors in the -1 to 1 range
 struct TerrainPBRVertex
 {
 	TerrainPBRVertex() : x(0.0f), y(0.0f), z(0.0f), u(0.0f), v(0.0f),
-		nx(0), ny(0), nz(0), tx(0), ty(0), tz(0), tw(0), _pad(0) {};
+		nx(0), ny(0), nz(0), tx(0), ty(0), tz(0), tw(0), morphDelta(0) {};
 
 	TerrainPBRVertex(Vector3f inPos, Vector2f inUV, Vector3f inNormal,
 		Vector3f inTangent, Vector3f inBitangent)
 		: x(inPos.x), y(inPos.y), z(inPos.z), u(inUV.x), v(inUV.y),
 		  nx(floatToS16N(inNormal.x)), ny(floatToS16N(inNormal.y)), nz(floatToS16N(inNormal.z)),
 		  tx(floatToS16N(inTangent.x)), ty(floatToS16N(inTangent.y)), tz(floatToS16N(inTangent.z)),
-		  _pad(0)
+		  morphDelta(0)
 	{
 		// Compute handedness: +1 if (NxT)·B > 0, else -1
 		Vector3f c = {
@@ -206,9 +227,19 @@ struct TerrainPBRVertex
 	int16_t nx, ny, nz;         // 6 bytes - normal (S16N)
 	int16_t tx, ty, tz;         // 6 bytes - tangent xyz (S16N)
 	int16_t tw;                 // 2 bytes - tangent w = handedness sign (S16N)
-	int16_t _pad;               // 2 bytes - padding for 4-byte alignment
+	uint16_t morphDelta;        // 2 bytes - F16 height of the next coarser LOD minus this vertex's height
 };                              // 36 bytes total
 
+// Chunk-local quantized terrain vertex for per-chunk meshes, dequantized in terrain_v.cg
+// x/z are LOD_0 grid offsets from the chunk origin, height is stored in steps above a per-chunk base,
+// UV and tangent are derived from position and normal in the shader
+struct TerrainCompactVertex
+{
+	uint16_t gx, h, gz;         // 6 bytes - grid x, quantized height, grid z (U16)
+	uint16_t morphDelta;        // 2 bytes - F16 height of the next coarser LOD minus this vertex's height
+	int16_t octX, octZ;         // 4 bytes - octahedral normal, Y-up hemisphere (S16N)
+};                              // 12 bytes total
+
 inline Vector3f operator+(const Vector3f& left, const Vector3f& right)
 {
 	return Vector3f(left.x + right.x, left.y + right.y, left.z + right.z);
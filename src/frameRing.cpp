@@ -0,0 +1,102 @@
+#include "frameRing.h"
+#include "memory.h"
+#include <psp2/kernel/clib.h>
+#include <psp2/kernel/processmgr.h>
+
+FrameRing::FrameRing()
+	: memoryUID(-1), memory(nullptr), sliceSize(0), frame(0), offset(0)
+{
+}
+
+FrameRing::~FrameRing()
+{
+	release();
+}
+
+bool FrameRing::init(int frameCount, unsigned int sliceSizeIn, int firstNotification)
+{
+	release();
+	if (frameCount <= 0 || firstNotification < 0 || firstNotification + frameCount > SCE_GXM_NOTIFICATION_COUNT)
+	{
+		sceClibPrintf("Frame ring: invalid frame count %d\n", frameCount);
+		return false;
+	}
+
+	sliceSize = ALIGN(sliceSizeIn, ALIGNMENT);
+	memory = (uint8_t*)gpuAllocMap(frameCount * sliceSize, SCE_KERNEL_MEMBLOCK_TYPE_USER_RW_UNCACHE,
+		SCE_GXM_MEMORY_ATTRIB_READ, &memoryUID);
+	if (!memory)
+	{
+		sceClibPrintf("Frame ring: allocation failed\n");
+		memoryUID = -1;
+		return false;
+	}
+
+	volatile unsigned int* region = sceGxmGetNotificationRegion();
+	fences.resize(frameCount);
+	for (int i = 0; i < frameCount; i++)
+	{
+		fences[i].address = region + firstNotification + i;
+		fences[i].value = 0;
+		*fences[i].address = 0;
+	}
+
+	frame = 0;
+	offset = 0;
+	sceClibPrintf("Frame ring: %d slices of %u bytes\n", frameCount, sliceSize);
+	return true;
+}
+
+void FrameRing::release()
+{
+	if (memory)
+	{
+		gpuFreeUnmap(memoryUID);
+		memory = nullptr;
+		memoryUID = -1;
+	}
+	fences.clear();
+}
+
+unsigned int FrameRing::beginFrame(int frameIn)
+{
+	frame = frameIn;
+	offset = 0;
+	if (fences.empty())
+		return 0;
+
+	const SceGxmNotification& fence = fences[frame];
+	if (*fence.address == fence.value)
+		return 0;
+
+	SceUInt64 start = sceKernelGetProcessTimeWide();
+	sceGxmNotificationWait(&fence);
+	return (unsigned int)(sceKernelGetProcessTimeWide() - start);
+}
+
+void* FrameRing::allocate(unsigned int size, unsigned int alignment)
+{
+	unsigned int start = ALIGN(offset, alignment);
+	if (!memory || start + size > sliceSize)
+	{
+		sceClibPrintf("Frame ring: slice full, %u bytes requested with %u of %u used\n", size, offset, sliceSize);
+		return nullptr;
+	}
+
+	offset = start + size;
+	return memory + (size_t)frame * sliceSize + start;
+}
+
+const SceGxmNotification* FrameRing::endFrame()
+{
+	if (fences.empty())
+		return NULL;
+
+	fences[frame].value++;
+	return &fences[frame];
+}
+
+unsigned int FrameRing::getUsedBytes() const
+{
+	return offset;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <psp2/gxm.h>
+#include <psp2/types.h>
+#include <vector>
+#include <cstdint>
+
+// GPU memory for data the CPU rewrites every frame, one slice per frame in flight
+// A frame bump-allocates from its slice. The frame's last scene signals a notification once its fragment work is
+// done, and beginFrame waits on it before handing the slice out again, so the CPU never overwrites data the GPU
+// may still be reading. By then the GPU has normally long finished, the wait only costs when it is a frame behind
+class FrameRing
+{
+public:
+	static const unsigned int ALIGNMENT = 16;
+
+	FrameRing();
+	~FrameRing();
+
+	// frameCount slices of sliceSize bytes, fenced through the notification words from firstNotification on
+	bool init(int frameCount, unsigned int sliceSize, int firstNotification);
+	void release();
+
+	// Wait for the GPU to finish the frame that last filled frame's slice, then start filling it again
+	// Returns the time spent waiting in microseconds
+	unsigned int beginFrame(int frame);
+	// size bytes from the frame's slice, nullptr when it is full
+	void* allocate(unsigned int size, unsigned int alignment = ALIGNMENT);
+	template<class T>
+	T* allocate(unsigned int count = 1)
+	{
+		return (T*)allocate(count * sizeof(T));
+	}
+	// The frame's fence, pass it as the fragment notification of the frame's last scene
+	const SceGxmNotification* endFrame();
+
+	// Bytes allocated from the current slice
+	unsigned int getUsedBytes() const;
+
+private:
+	SceUID memoryUID;
+	uint8_t* memory;
+	unsigned int sliceSize;
+	int frame;
+	unsigned int offset;
+	std::vector<SceGxmNotification> fences;	// value is the last one the slice's frame was submitted with
+};
@@ -0,0 +1,151 @@
+#include "frustumCull.h"
+#include <cfloat>
+#include <cmath>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FRUSTUM_CULL_NEON 1
+#endif
+
+void FrustumPlanes::extractFromMatrix(const Matrix4x4& viewProjMatrix)
+{
+	// Row-major layout:
+	// row0 = m[0],m[1],m[2],m[3]   row1 = m[4]..m[7]
+	// row2 = m[8]..m[11]           row3 = m[12]..m[15]
+	const float* m = viewProjMatrix.getData();
+
+	planes[0] = { m[12]+m[0], m[13]+m[1], m[14]+m[2],  m[15]+m[3]  }; // LEFT
+	planes[1] = { m[12]-m[0], m[13]-m[1], m[14]-m[2],  m[15]-m[3]  }; // RIGHT
+	planes[2] = { m[12]+m[4], m[13]+m[5], m[14]+m[6],  m[15]+m[7]  }; // BOTTOM
+	planes[3] = { m[12]-m[4], m[13]-m[5], m[14]-m[6],  m[15]-m[7]  }; // TOP
+	planes[4] = { m[12]+m[8], m[13]+m[9], m[14]+m[10], m[15]+m[11] }; // NEAR
+	planes[5] = { m[12]-m[8], m[13]-m[9], m[14]-m[10], m[15]-m[11] }; // FAR
+
+	// Normalize all 6 planes once (instead of per-chunk)
+	for (int i = 0; i < 6; ++i)
+	{
+		float invLen = 1.0f / sqrtf(
+			planes[i].a * planes[i].a +
+			planes[i].b * planes[i].b +
+			planes[i].c * planes[i].c
+		);
+		planes[i].a *= invLen;
+		planes[i].b *= invLen;
+		planes[i].c *= invLen;
+		planes[i].d *= invLen;
+	}
+}
+
+SphereBoundsSoA::SphereBoundsSoA()
+	: count(0)
+{
+
+}
+
+void SphereBoundsSoA::clear()
+{
+	centerX.clear();
+	centerY.clear();
+	centerZ.clear();
+	radius.clear();
+	ids.clear();
+	count = 0;
+}
+
+void SphereBoundsSoA::add(float x, float y, float z, float r, uint16_t id)
+{
+	// Overwrite the padding left by the previous add, then pad back up to a whole vector
+	centerX.resize(count);
+	centerY.resize(count);
+	centerZ.resize(count);
+	radius.resize(count);
+	ids.resize(count);
+
+	centerX.push_back(x);
+	centerY.push_back(y);
+	centerZ.push_back(z);
+	radius.push_back(r);
+	ids.push_back(id);
+	count++;
+
+	// Padding spheres have a radius so negative that every plane rejects them
+	size_t padded = (count + 3) & ~3;
+	centerX.resize(padded, 0.0f);
+	centerY.resize(padded, 0.0f);
+	centerZ.resize(padded, 0.0f);
+	radius.resize(padded, -FLT_MAX);
+	ids.resize(padded, 0);
+}
+
+int SphereBoundsSoA::size() const
+{
+	return count;
+}
+
+int SphereBoundsSoA::capacity() const
+{
+	return (int)ids.size();
+}
+
+int SphereBoundsSoA::cull(const FrustumPlanes& frustum, uint16_t* outIds) const
+{
+#ifdef FRUSTUM_CULL_NEON
+	int visible = 0;
+	for (int i = 0; i < count; i += 4)
+	{
+		const float32x4_t x = vld1q_f32(&centerX[i]);
+		const float32x4_t y = vld1q_f32(&centerY[i]);
+		const float32x4_t z = vld1q_f32(&centerZ[i]);
+		const float32x4_t negRadius = vnegq_f32(vld1q_f32(&radius[i]));
+		uint32x4_t inside = vdupq_n_u32(0xFFFFFFFF);
+
+		for (int p = 0; p < 6; p++)
+		{
+			const FrustumPlanes::Plane& plane = frustum.planes[p];
+			float32x4_t dist = vmulq_n_f32(x, plane.a);
+			dist = vmlaq_n_f32(dist, y, plane.b);
+			dist = vmlaq_n_f32(dist, z, plane.c);
+			dist = vaddq_f32(dist, vdupq_n_f32(plane.d));
+			inside = vbicq_u32(inside, vcltq_f32(dist, negRadius));
+		}
+
+		// Branchless compaction: every lane writes its id, only visible lanes advance the cursor
+		outIds[visible] = ids[i];
+		visible += vgetq_lane_u32(inside, 0) & 1;
+		outIds[visible] = ids[i + 1];
+		visible += vgetq_lane_u32(inside, 1) & 1;
+		outIds[visible] = ids[i + 2];
+		visible += vgetq_lane_u32(inside, 2) & 1;
+		outIds[visible] = ids[i + 3];
+		visible += vgetq_lane_u32(inside, 3) & 1;
+	}
+	return visible;
+#else
+	return cullScalar(frustum, outIds);
+#endif
+}
+
+int SphereBoundsSoA::cullScalar(const FrustumPlanes& frustum, uint16_t* outIds) const
+{
+	int visible = 0;
+	for (int i = 0; i < count; i++)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6; p++)
+		{
+			const FrustumPlanes::Plane& plane = frustum.planes[p];
+			float dist = plane.a * centerX[i] + plane.b * centerY[i] + plane.c * centerZ[i] + plane.d;
+			if (dist < -radius[i])
+			{
+				inside = false;
+				break;
+			}
+		}
+
+		if (inside)
+		{
+			outIds[visible++] = ids[i];
+		}
+	}
+	return visible;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "matrix.h"
+#include <vector>
+#include <cstdint>
+
+// Pre-extracted frustum planes — extract once per frame, test against all chunks
+struct FrustumPlanes
+{
+	struct Plane { float a, b, c, d; };
+	Plane planes[6];
+
+	void extractFromMatrix(const Matrix4x4& viewProjMatrix);
+};
+
+// Bounding spheres in structure-of-arrays form, tested four at a time against FrustumPlanes
+// Arrays are padded to a multiple of 4 so the vector path never needs a tail loop
+// Both paths evaluate the plane distance in the same order as TerrainChunk::isInFrustum,
+// so they agree with it exactly
+class SphereBoundsSoA
+{
+public:
+	SphereBoundsSoA();
+
+	void clear();
+	void add(float x, float y, float z, float radius, uint16_t id);
+	int size() const;
+	// size() rounded up to whole vectors
+	int capacity() const;
+
+	// Write the ids of spheres touching the frustum to outIds (room for capacity() entries), returns the count
+	int cull(const FrustumPlanes& frustum, uint16_t* outIds) const;
+	// Reference path, used on targets without NEON and by the host test
+	int cullScalar(const FrustumPlanes& frustum, uint16_t* outIds) const;
+
+private:
+	std::vector<float> centerX, centerY, centerZ, radius;
+	std::vector<uint16_t> ids;
+	int count;
+};
@@ -0,0 +1,118 @@
+#include "gxmStateCache.h"
+#include <string.h>
+
+GxmStateCache::GxmStateCache()
+	: issuedCount(0), skippedCount(0)
+{
+	invalidate();
+}
+
+// Count the call, true when it must be issued
+bool GxmStateCache::filter(bool redundant)
+{
+	if (redundant)
+	{
+		skippedCount++;
+		return false;
+	}
+	issuedCount++;
+	return true;
+}
+
+void GxmStateCache::setVertexProgram(SceGxmContext* context, const SceGxmVertexProgram* program)
+{
+	if (filter(program == vertexProgram))
+	{
+		sceGxmSetVertexProgram(context, program);
+		vertexProgram = program;
+	}
+}
+
+void GxmStateCache::setFragmentProgram(SceGxmContext* context, const SceGxmFragmentProgram* program)
+{
+	if (filter(program == fragmentProgram))
+	{
+		sceGxmSetFragmentProgram(context, program);
+		fragmentProgram = program;
+	}
+}
+
+void GxmStateCache::setFragmentTexture(SceGxmContext* context, unsigned int unit, const SceGxmTexture* texture)
+{
+	if (unit >= (unsigned int)TEXTURE_UNITS)
+	{
+		sceGxmSetFragmentTexture(context, unit, texture);
+		return;
+	}
+
+	if (filter(textureValid[unit] && memcmp(&textures[unit], texture, sizeof(SceGxmTexture)) == 0))
+	{
+		sceGxmSetFragmentTexture(context, unit, texture);
+		textures[unit] = *texture;
+		textureValid[unit] = true;
+	}
+}
+
+void GxmStateCache::setDepthFunc(SceGxmContext* context, SceGxmDepthFunc func)
+{
+	if (filter(depthFuncValid && func == depthFunc))
+	{
+		sceGxmSetFrontDepthFunc(context, func);
+		sceGxmSetBackDepthFunc(context, func);
+		depthFunc = func;
+		depthFuncValid = true;
+	}
+}
+
+void GxmStateCache::setDepthWriteEnable(SceGxmContext* context, SceGxmDepthWriteMode mode)
+{
+	if (filter(depthWriteValid && mode == depthWrite))
+	{
+		sceGxmSetFrontDepthWriteEnable(context, mode);
+		sceGxmSetBackDepthWriteEnable(context, mode);
+		depthWrite = mode;
+		depthWriteValid = true;
+	}
+}
+
+void GxmStateCache::setPolygonMode(SceGxmContext* context, SceGxmPolygonMode mode)
+{
+	if (filter(polygonModeValid && mode == polygonMode))
+	{
+		sceGxmSetFrontPolygonMode(context, mode);
+		sceGxmSetBackPolygonMode(context, mode);
+		polygonMode = mode;
+		polygonModeValid = true;
+	}
+}
+
+void GxmStateCache::invalidate()
+{
+	vertexProgram = nullptr;
+	fragmentProgram = nullptr;
+	memset(textures, 0, sizeof(textures));
+	for (int i = 0; i < TEXTURE_UNITS; i++)
+	{
+		textureValid[i] = false;
+	}
+	depthFunc = SCE_GXM_DEPTH_FUNC_ALWAYS;
+	depthWrite = SCE_GXM_DEPTH_WRITE_ENABLED;
+	polygonMode = SCE_GXM_POLYGON_MODE_TRIANGLE_FILL;
+	depthFuncValid = depthWriteValid = polygonModeValid = false;
+}
+
+void GxmStateCache::resetCounters()
+{
+	issuedCount = 0;
+	skippedCount = 0;
+}
+
+int GxmStateCache::getIssuedCount() const
+{
+	return issuedCount;
+}
+
+int GxmStateCache::getSkippedCount() const
+{
+	return skippedCount;
+}
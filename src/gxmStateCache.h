@@ -0,0 +1,46 @@
+#pragma once
+
+#include <psp2/gxm.h>
+
+// Shadow of the GXM context state set between draws, dropping calls that would set what is already set
+// Programs are compared by pointer and textures by their control words, so a texture rewritten in place is
+// bound again. Anything that sets this state without going through the cache (or re-patches a program it may
+// hold) must invalidate it
+class GxmStateCache
+{
+public:
+	GxmStateCache();
+
+	void setVertexProgram(SceGxmContext* context, const SceGxmVertexProgram* program);
+	void setFragmentProgram(SceGxmContext* context, const SceGxmFragmentProgram* program);
+	void setFragmentTexture(SceGxmContext* context, unsigned int unit, const SceGxmTexture* texture);
+	// Front and back faces together, as every draw here sets them
+	void setDepthFunc(SceGxmContext* context, SceGxmDepthFunc func);
+	void setDepthWriteEnable(SceGxmContext* context, SceGxmDepthWriteMode mode);
+	void setPolygonMode(SceGxmContext* context, SceGxmPolygonMode mode);
+
+	// Forget everything, the next call of each kind is issued
+	void invalidate();
+	// Reset the counters, once per frame
+	void resetCounters();
+	// Calls passed to GXM and dropped since resetCounters
+	int getIssuedCount() const;
+	int getSkippedCount() const;
+
+private:
+	static const int TEXTURE_UNITS = SCE_GXM_MAX_TEXTURE_UNITS;
+
+	bool filter(bool redundant);
+
+	const SceGxmVertexProgram* vertexProgram;
+	const SceGxmFragmentProgram* fragmentProgram;
+	SceGxmTexture textures[TEXTURE_UNITS];
+	bool textureValid[TEXTURE_UNITS];
+	SceGxmDepthFunc depthFunc;
+	SceGxmDepthWriteMode depthWrite;
+	SceGxmPolygonMode polygonMode;
+	bool depthFuncValid, depthWriteValid, polygonModeValid;
+
+	int issuedCount;
+	int skippedCount;
+};
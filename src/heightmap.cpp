@@ -0,0 +1,254 @@
+#include "heightmap.h"
+#include <psp2/kernel/clib.h>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef __vita__
+#include <psp2/io/fcntl.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Heightmap::Heightmap()
+	: samples(nullptr), width(0), height(0), texelsPerGridUnit(1.0f),
+	heightScale(1.0f), heightOffset(0.0f), fileData(nullptr), fileSize(0)
+{
+
+}
+
+Heightmap::~Heightmap()
+{
+	unload();
+}
+
+bool Heightmap::load(const char* path, int gridExtent, float scale, float offset)
+{
+	unload();
+
+#ifdef __vita__
+	SceUID fd = sceIoOpen(path, SCE_O_RDONLY, 0);
+	if (fd < 0)
+	{
+		sceClibPrintf("Heightmap: could not open %s (0x%08X)\n", path, fd);
+		return false;
+	}
+
+	SceOff size = sceIoLseek(fd, 0, SCE_SEEK_END);
+	sceIoLseek(fd, 0, SCE_SEEK_SET);
+
+	fileData = (size > 0) ? malloc((size_t)size) : nullptr;
+	if (!fileData || sceIoRead(fd, fileData, (SceSize)size) != size)
+	{
+		sceClibPrintf("Heightmap: failed to read %s\n", path);
+		sceIoClose(fd);
+		unload();
+		return false;
+	}
+	sceIoClose(fd);
+	fileSize = (size_t)size;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		sceClibPrintf("Heightmap: could not open %s\n", path);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void* mapped = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		sceClibPrintf("Heightmap: failed to map %s\n", path);
+		return false;
+	}
+	fileData = mapped;
+	fileSize = (size_t)st.st_size;
+#endif
+
+	if (!parse((const uint8_t*)fileData, fileSize))
+	{
+		sceClibPrintf("Heightmap: %s is not a 16-bit PGM or square raw heightmap\n", path);
+		unload();
+		return false;
+	}
+
+	texelsPerGridUnit = (float)(std::max(width, height) - 1) / (float)gridExtent;
+	heightScale = scale;
+	heightOffset = offset;
+
+	sceClibPrintf("Heightmap: loaded %s (%dx%d)\n", path, width, height);
+	return true;
+}
+
+void Heightmap::unload()
+{
+	if (fileData)
+	{
+#ifdef __vita__
+		free(fileData);
+#else
+		munmap(fileData, fileSize);
+#endif
+	}
+
+	fileData = nullptr;
+	fileSize = 0;
+	samples = nullptr;
+	width = height = 0;
+}
+
+bool Heightmap::isLoaded() const
+{
+	return samples != nullptr;
+}
+
+int Heightmap::getWidth() const
+{
+	return width;
+}
+
+int Heightmap::getHeight() const
+{
+	return height;
+}
+
+uint32_t Heightmap::getContentHash() const
+{
+	uint32_t hash = hashTerrainData(&width, sizeof(width), 0x484D4150u);
+	hash = hashTerrainData(&height, sizeof(height), hash);
+	hash = hashTerrainData(&texelsPerGridUnit, sizeof(texelsPerGridUnit), hash);
+	hash = hashTerrainData(&heightScale, sizeof(heightScale), hash);
+	hash = hashTerrainData(&heightOffset, sizeof(heightOffset), hash);
+	if (samples)
+	{
+		hash = hashTerrainData(samples, (size_t)width * height * sizeof(uint16_t), hash);
+	}
+	return hash;
+}
+
+// Reads a whitespace separated decimal from a PGM header, skipping comments
+static bool readPgmInt(const uint8_t* data, size_t size, size_t& pos, int& value)
+{
+	while (pos < size)
+	{
+		if (data[pos] == '#')
+		{
+			while (pos < size && data[pos] != '\n')
+				pos++;
+		}
+		else if (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\r' || data[pos] == '\n')
+		{
+			pos++;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if (pos >= size || data[pos] < '0' || data[pos] > '9')
+		return false;
+
+	value = 0;
+	while (pos < size && data[pos] >= '0' && data[pos] <= '9')
+	{
+		value = value * 10 + (data[pos] - '0');
+		pos++;
+	}
+	return true;
+}
+
+bool Heightmap::parse(const uint8_t* data, size_t size)
+{
+	// Samples are converted in place, so the file buffer is always writable (private mapping or heap block)
+	uint8_t* bytes = (uint8_t*)data;
+
+	if (size >= 2 && data[0] == 'P' && data[1] == '5')
+	{
+		size_t pos = 2;
+		int maxValue = 0;
+		if (!readPgmInt(data, size, pos, width) || !readPgmInt(data, size, pos, height) ||
+			!readPgmInt(data, size, pos, maxValue) || width < 2 || height < 2)
+		{
+			return false;
+		}
+		pos++; // single whitespace before the raster
+
+		size_t count = (size_t)width * height;
+		// 8-bit maps terrace visibly once stretched over the terrain, only 16-bit is accepted
+		if (maxValue < 256 || maxValue > 65535)
+			return false;
+		if (pos + count * 2 > size)
+			return false;
+
+		// 16-bit PGM rasters are big-endian, and the raster may not be 2-byte aligned in the file
+		uint8_t* raster = bytes + pos;
+		float toFull = 65535.0f / maxValue;
+		samples = (uint16_t*)(((uintptr_t)raster) & ~(uintptr_t)1);
+		for (size_t i = 0; i < count; i++)
+		{
+			uint16_t value = (uint16_t)((raster[i * 2] << 8) | raster[i * 2 + 1]);
+			samples[i] = (uint16_t)std::min(65535.0f, value * toFull);
+		}
+		return true;
+	}
+
+	// Raw: square, 16-bit little-endian, no header
+	size_t count = size / 2;
+	int side = (int)sqrtf((float)count);
+	while ((size_t)side * side < count)
+		side++;
+	if (side < 2 || (size_t)side * side != count || (size & 1))
+		return false;
+
+	width = height = side;
+	samples = (uint16_t*)bytes;
+	for (size_t i = 0; i < count; i++)
+	{
+		samples[i] = (uint16_t)(bytes[i * 2] | (bytes[i * 2 + 1] << 8));
+	}
+	return true;
+}
+
+float Heightmap::texel(int x, int z) const
+{
+	x = std::clamp(x, 0, width - 1);
+	z = std::clamp(z, 0, height - 1);
+	return samples[z * width + x] * (1.0f / 65535.0f);
+}
+
+void Heightmap::sampleRow(int gridX0, int gridZ, int stride, int count, float* out) const
+{
+	if (!samples)
+	{
+		for (int i = 0; i < count; i++)
+			out[i] = heightOffset;
+		return;
+	}
+
+	float tz = gridZ * texelsPerGridUnit;
+	int z0 = (int)floorf(tz);
+	float fz = tz - z0;
+
+	for (int i = 0; i < count; i++)
+	{
+		float tx = (gridX0 + i * stride) * texelsPerGridUnit;
+		int x0 = (int)floorf(tx);
+		float fx = tx - x0;
+
+		float top = texel(x0, z0) + (texel(x0 + 1, z0) - texel(x0, z0)) * fx;
+		float bottom = texel(x0, z0 + 1) + (texel(x0 + 1, z0 + 1) - texel(x0, z0 + 1)) * fx;
+		out[i] = heightOffset + (top + (bottom - top) * fz) * heightScale;
+	}
+}
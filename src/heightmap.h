@@ -0,0 +1,38 @@
+#pragma once
+
+#include "terrainGenerator.h"
+#include <psp2/types.h>
+#include <cstdint>
+
+// 16-bit heightmap loaded from a binary PGM (P5) or a headerless little-endian raw file
+// The map is stretched over the whole terrain grid and sampled bilinearly
+class Heightmap : public TerrainHeightSource
+{
+public:
+	Heightmap();
+	~Heightmap();
+
+	// gridExtent is the terrain size in grid units, heights map to [heightOffset, heightOffset + heightScale]
+	bool load(const char* path, int gridExtent, float heightScale, float heightOffset = 0.0f);
+	void unload();
+
+	bool isLoaded() const;
+	int getWidth() const;
+	int getHeight() const;
+
+	void sampleRow(int gridX0, int gridZ, int stride, int count, float* out) const override;
+	uint32_t getContentHash() const override;
+
+private:
+	bool parse(const uint8_t* data, size_t size);
+	float texel(int x, int z) const;
+
+	uint16_t* samples;	// native-endian samples, width * height
+	int width, height;
+	float texelsPerGridUnit;
+	float heightScale, heightOffset;
+
+	// Backing memory of the file: memory-mapped on the host build, read into a heap block on device
+	void* fileData;
+	size_t fileSize;
+};
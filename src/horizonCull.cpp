@@ -0,0 +1,129 @@
+#include "horizonCull.h"
+#include <cfloat>
+#include <algorithm>
+
+// Footprints closer than this are treated as containing the camera
+static const float HORIZON_MIN_DISTANCE = 1e-3f;
+
+static inline int wrapColumn(int column)
+{
+	column %= HorizonBuffer::COLUMNS;
+	return column < 0 ? column + HorizonBuffer::COLUMNS : column;
+}
+
+HorizonBuffer::HorizonBuffer()
+{
+	reset(Vector3f());
+}
+
+void HorizonBuffer::reset(const Vector3f& newCamera)
+{
+	camera = newCamera;
+	for (int i = 0; i < COLUMNS; i++)
+	{
+		slopes[i] = -FLT_MAX;
+	}
+}
+
+bool HorizonBuffer::getColumnSpan(float x0, float z0, float x1, float z1, float& start, float& end) const
+{
+	if (camera.x >= x0 && camera.x <= x1 && camera.z >= z0 && camera.z <= z1)
+		return false;
+
+	// Corner angles relative to the center's, a footprint outside the camera spans less than PI
+	float centerAngle = atan2f((z0 + z1) * 0.5f - camera.z, (x0 + x1) * 0.5f - camera.x);
+	const float cornerX[4] = { x0, x1, x0, x1 };
+	const float cornerZ[4] = { z0, z0, z1, z1 };
+	float lo = FLT_MAX, hi = -FLT_MAX;
+	for (int i = 0; i < 4; i++)
+	{
+		float angle = atan2f(cornerZ[i] - camera.z, cornerX[i] - camera.x) - centerAngle;
+		if (angle > PI)
+			angle -= 2.0f * PI;
+		else if (angle < -PI)
+			angle += 2.0f * PI;
+		lo = std::min(lo, angle);
+		hi = std::max(hi, angle);
+	}
+
+	const float columnsPerRadian = COLUMNS / (2.0f * PI);
+	start = (centerAngle + lo) * columnsPerRadian;
+	end = (centerAngle + hi) * columnsPerRadian;
+	return true;
+}
+
+bool HorizonBuffer::isOccluded(float x0, float z0, float x1, float z1, float maxHeight) const
+{
+	float start, end;
+	if (!getColumnSpan(x0, z0, x1, z1, start, end))
+		return false;
+
+	// Steepest slope toward any point of the box: the nearest point when it rises above the camera, the
+	// farthest corner otherwise
+	float nearX = std::min(std::max(camera.x, x0), x1) - camera.x;
+	float nearZ = std::min(std::max(camera.z, z0), z1) - camera.z;
+	float farX = std::max(std::abs(x0 - camera.x), std::abs(x1 - camera.x));
+	float farZ = std::max(std::abs(z0 - camera.z), std::abs(z1 - camera.z));
+	float nearDistance = sqrtf(nearX * nearX + nearZ * nearZ);
+	if (nearDistance < HORIZON_MIN_DISTANCE)
+		return false;
+
+	float rise = maxHeight - camera.y;
+	float slope = rise / (rise >= 0.0f ? nearDistance : sqrtf(farX * farX + farZ * farZ));
+
+	// Every column the span touches, even partly
+	int last = (int)floorf(end);
+	for (int column = (int)floorf(start); column <= last; column++)
+	{
+		if (slope >= slopes[wrapColumn(column)])
+			return false;
+	}
+	return true;
+}
+
+void HorizonBuffer::addOccluder(float x0, float z0, float x1, float z1, float minHeight)
+{
+	float start, end;
+	if (!getColumnSpan(x0, z0, x1, z1, start, end))
+		return;
+
+	// A ray is blocked when it is under minHeight somewhere between entering and leaving the footprint.
+	// Above the camera that is easiest at the entry point, which is no farther than the farthest corner.
+	// Below it, at the exit point, which is no nearer than the nearest edge a ray can leave through
+	// (one facing away from the camera)
+	float rise = minHeight - camera.y;
+	float distance;
+	if (rise >= 0.0f)
+	{
+		float farX = std::max(std::abs(x0 - camera.x), std::abs(x1 - camera.x));
+		float farZ = std::max(std::abs(z0 - camera.z), std::abs(z1 - camera.z));
+		distance = sqrtf(farX * farX + farZ * farZ);
+	}
+	else
+	{
+		float exitSq = FLT_MAX;
+		float alongZ = std::min(std::max(camera.z, z0), z1) - camera.z;
+		float alongX = std::min(std::max(camera.x, x0), x1) - camera.x;
+		if (camera.x < x1)
+			exitSq = std::min(exitSq, (x1 - camera.x) * (x1 - camera.x) + alongZ * alongZ);
+		if (camera.x > x0)
+			exitSq = std::min(exitSq, (x0 - camera.x) * (x0 - camera.x) + alongZ * alongZ);
+		if (camera.z < z1)
+			exitSq = std::min(exitSq, (z1 - camera.z) * (z1 - camera.z) + alongX * alongX);
+		if (camera.z > z0)
+			exitSq = std::min(exitSq, (z0 - camera.z) * (z0 - camera.z) + alongX * alongX);
+		distance = sqrtf(exitSq);
+	}
+	if (distance < HORIZON_MIN_DISTANCE)
+		return;
+
+	float slope = rise / distance;
+
+	// Only columns lying entirely inside the span, every ray in them crosses the footprint
+	int last = (int)floorf(end) - 1;
+	for (int column = (int)ceilf(start); column <= last; column++)
+	{
+		float& stored = slopes[wrapColumn(column)];
+		stored = std::max(stored, slope);
+	}
+}
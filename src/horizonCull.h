@@ -0,0 +1,33 @@
+#pragma once
+
+#include "commonUtils.h"
+
+// Occlusion horizon for heightfield terrain, built front to back around the camera
+// Columns are azimuth bins on the XZ plane, so a column covers the same screen column at any pitch or roll.
+// Each column stores the steepest slope (height gain per horizontal distance) below which every ray
+// in the column is already blocked by a nearer occluder
+// Footprints are axis-aligned [x0, x1] x [z0, z1] boxes. Tests overestimate and occluders underestimate,
+// so a box is only reported hidden when every ray toward it hits nearer terrain first
+class HorizonBuffer
+{
+public:
+	static const int COLUMNS = 512;
+
+	HorizonBuffer();
+
+	// Start an empty horizon around a new camera position
+	void reset(const Vector3f& camera);
+	// True when nothing in the footprint up to maxHeight can be seen past the horizon
+	// A footprint containing the camera is never hidden
+	bool isOccluded(float x0, float z0, float x1, float z1, float maxHeight) const;
+	// Raise the horizon with the solid under a surface that is nowhere below minHeight over the footprint
+	// Callers add occluders nearest first, and only after testing everything that could lie in front of them
+	void addOccluder(float x0, float z0, float x1, float z1, float minHeight);
+
+private:
+	// Azimuth span of a footprint in (unwrapped) column units, false when the camera is inside it
+	bool getColumnSpan(float x0, float z0, float x1, float z1, float& start, float& end) const;
+
+	Vector3f camera;
+	float slopes[COLUMNS];
+};
@@ -0,0 +1,191 @@
+#include "instanceBuffer.h"
+#include "memory.h"
+#include <psp2/kernel/clib.h>
+#include <string.h>
+
+InstanceBuffer::InstanceBuffer()
+	: memoryUID(-1), memory(nullptr), capacity(0), copyCount(0), origin(0.0f, 0.0f, 0.0f), count(0), dirtyWords(0)
+{
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+	release();
+}
+
+bool InstanceBuffer::init(int capacityIn, int copyCountIn, const Vector3f& originIn)
+{
+	release();
+	if (capacityIn <= 0 || copyCountIn <= 0)
+		return false;
+
+	memory = (InstanceData*)gpuAllocMap((size_t)capacityIn * copyCountIn * sizeof(InstanceData),
+		SCE_KERNEL_MEMBLOCK_TYPE_USER_RW_UNCACHE, SCE_GXM_MEMORY_ATTRIB_READ, &memoryUID);
+	if (!memory)
+	{
+		sceClibPrintf("Instance buffer: allocation failed\n");
+		memoryUID = -1;
+		return false;
+	}
+
+	capacity = capacityIn;
+	copyCount = copyCountIn;
+	origin = originIn;
+	instances.resize(capacity);
+	indexToHandle.resize(capacity);
+	handleToIndex.clear();
+	freeHandles.clear();
+	count = 0;
+	const int blocks = (capacity + DIRTY_BLOCK_INSTANCES - 1) / DIRTY_BLOCK_INSTANCES;
+	dirtyWords = (blocks + 63) / 64;
+	dirtyBits.assign((size_t)dirtyWords * copyCount, 0);
+	return true;
+}
+
+void InstanceBuffer::release()
+{
+	if (memory)
+	{
+		gpuFreeUnmap(memoryUID);
+		memory = nullptr;
+		memoryUID = -1;
+	}
+	instances.clear();
+	indexToHandle.clear();
+	handleToIndex.clear();
+	freeHandles.clear();
+	dirtyBits.clear();
+	capacity = copyCount = count = dirtyWords = 0;
+}
+
+InstanceBuffer::Handle InstanceBuffer::add(const Matrix4x4& modelMatrix)
+{
+	if (count == capacity)
+		return INVALID_HANDLE;
+
+	Handle handle;
+	if (!freeHandles.empty())
+	{
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+	}
+	else
+	{
+		handle = (Handle)handleToIndex.size();
+		handleToIndex.push_back(-1);
+	}
+
+	int index = count++;
+	handleToIndex[handle] = index;
+	indexToHandle[index] = handle;
+	store(index, modelMatrix);
+	return handle;
+}
+
+void InstanceBuffer::remove(Handle handle)
+{
+	if (handle < 0 || handle >= (Handle)handleToIndex.size() || handleToIndex[handle] < 0)
+		return;
+
+	// The last instance fills the gap, only its new block needs uploading
+	int index = handleToIndex[handle];
+	int last = --count;
+	if (index != last)
+	{
+		instances[index] = instances[last];
+		indexToHandle[index] = indexToHandle[last];
+		handleToIndex[indexToHandle[index]] = index;
+		markDirty(index);
+	}
+	handleToIndex[handle] = -1;
+	freeHandles.push_back(handle);
+}
+
+void InstanceBuffer::set(Handle handle, const Matrix4x4& modelMatrix)
+{
+	if (handle < 0 || handle >= (Handle)handleToIndex.size() || handleToIndex[handle] < 0)
+		return;
+
+	store(handleToIndex[handle], modelMatrix);
+}
+
+unsigned int InstanceBuffer::upload(int copy)
+{
+	uint64_t* bits = &dirtyBits[(size_t)copy * dirtyWords];
+	InstanceData* dst = memory + (size_t)copy * capacity;
+	unsigned int bytes = 0;
+
+	// Runs of dirty blocks go as one copy, blocks past the last instance hold nothing to draw
+	auto copyRun = [&](int firstBlock, int endBlock)
+	{
+		int first = firstBlock * DIRTY_BLOCK_INSTANCES;
+		int end = endBlock * DIRTY_BLOCK_INSTANCES < count ? endBlock * DIRTY_BLOCK_INSTANCES : count;
+		memcpy(dst + first, &instances[first], (end - first) * sizeof(InstanceData));
+		bytes += (end - first) * sizeof(InstanceData);
+	};
+
+	const int blocks = (count + DIRTY_BLOCK_INSTANCES - 1) / DIRTY_BLOCK_INSTANCES;
+	int runStart = -1;
+	for (int block = 0; block < blocks; block++)
+	{
+		uint64_t word = bits[block >> 6];
+		if (runStart < 0 && word == 0)
+		{
+			block |= 63;	// the whole word is clean
+			continue;
+		}
+
+		bool dirty = (word >> (block & 63)) & 1;
+		if (dirty && runStart < 0)
+		{
+			runStart = block;
+		}
+		else if (!dirty && runStart >= 0)
+		{
+			copyRun(runStart, block);
+			runStart = -1;
+		}
+	}
+	if (runStart >= 0)
+	{
+		copyRun(runStart, blocks);
+	}
+
+	memset(bits, 0, dirtyWords * sizeof(uint64_t));
+	return bytes;
+}
+
+const InstanceData* InstanceBuffer::getInstances(int copy) const
+{
+	return memory + (size_t)copy * capacity;
+}
+
+int InstanceBuffer::getCount() const
+{
+	return count;
+}
+
+const Vector3f& InstanceBuffer::getOrigin() const
+{
+	return origin;
+}
+
+void InstanceBuffer::store(int index, const Matrix4x4& modelMatrix)
+{
+	//ROW MAJOR ORDER, the translation is the last column
+	InstanceData& instance = instances[index];
+	memcpy(instance.modelMatrix, modelMatrix.getData(), sizeof(instance.modelMatrix));
+	instance.modelMatrix[3] -= origin.x;
+	instance.modelMatrix[7] -= origin.y;
+	instance.modelMatrix[11] -= origin.z;
+	markDirty(index);
+}
+
+void InstanceBuffer::markDirty(int index)
+{
+	int block = index / DIRTY_BLOCK_INSTANCES;
+	for (int copy = 0; copy < copyCount; copy++)
+	{
+		dirtyBits[(size_t)copy * dirtyWords + (block >> 6)] |= 1ull << (block & 63);
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "matrix.h"
+#include <psp2/types.h>
+#include <vector>
+#include <cstdint>
+
+// Per-instance vertex stream of the lit instanced shader: the top three rows of a row-major affine model matrix,
+// the last row is always (0, 0, 0, 1)
+struct InstanceData
+{
+	float modelMatrix[12];
+};
+static_assert(sizeof(InstanceData) == 48, "InstanceData stream stride mismatch");
+
+// Persistent instance stream for objects that rarely move
+// Instances live in a CPU array and in one GPU copy per frame in flight. A change marks its block of
+// DIRTY_BLOCK_INSTANCES dirty in every copy, and upload writes only the dirty blocks of the copy being drawn, so
+// static instances cost nothing per frame. Removal moves the last instance into the gap, keeping the array
+// dense; handles stay valid across it
+// Translations are stored relative to the buffer's origin, the draw adds origin - render origin in the shader
+class InstanceBuffer
+{
+public:
+	typedef int Handle;
+	static const Handle INVALID_HANDLE = -1;
+	static const int DIRTY_BLOCK_INSTANCES = 64;
+
+	InstanceBuffer();
+	~InstanceBuffer();
+
+	// Room for capacity instances in copyCount GPU copies, the copy in use must be fenced by the caller
+	bool init(int capacity, int copyCount, const Vector3f& origin);
+	void release();
+
+	// INVALID_HANDLE when full
+	Handle add(const Matrix4x4& modelMatrix);
+	void remove(Handle handle);
+	void set(Handle handle, const Matrix4x4& modelMatrix);
+
+	// Write copy's dirty blocks from the CPU array, returns the bytes written
+	unsigned int upload(int copy);
+	const InstanceData* getInstances(int copy) const;
+	int getCount() const;
+	const Vector3f& getOrigin() const;
+
+private:
+	void store(int index, const Matrix4x4& modelMatrix);
+	void markDirty(int index);
+
+	SceUID memoryUID;
+	InstanceData* memory;	// copyCount copies of capacity instances
+	int capacity;
+	int copyCount;
+	Vector3f origin;
+
+	std::vector<InstanceData> instances;	// dense, count in use
+	int count;
+	std::vector<int> handleToIndex;			// -1 for free handles
+	std::vector<Handle> indexToHandle;
+	std::vector<Handle> freeHandles;
+	std::vector<uint64_t> dirtyBits;		// per copy, a bit per block
+	int dirtyWords;							// words per copy
+};
@@ -16,6 +16,15 @@
 #include "camera.h"
 #include "light.h"
 #include "terrain.h"
+#include "terrainMaterialCache.h"
+#include "terrainScatter.h"
+#include "terrainDrawRecords.h"
+#include "renderQueue.h"
+#include "gxmStateCache.h"
+#include "frameRing.h"
+#include "instanceBuffer.h"
+#include "heightmap.h"
+#include "terrainNoise.h"
 #include "texture.h"
 #include "EMP_Logo.h"
 #include "EMP_Logo_Alpha.h"
@@ -43,6 +52,39 @@ static const SceGxmMultisampleMode msaaModes[] = {
 };
 static const char* msaaModeNames[] = { "None", "2X", "4X" };
 static bool wireFrame = false;
+static bool proceduralTerrain = true; // noise terrain when no heightmap file is found
+// Terrain triangle budget follows frame time, the target sits between the 60 and 30 fps vsync steps
+static const float terrainFrameTargetMs = 18.0f;
+static const int terrainMinTriangles = 8000;
+static const int terrainMaxTriangles = 160000;
+static const float terrainStreamUploadBudgetMs = 1.0f; // streamed chunk uploads per frame
+static bool terrainQuadtreeCulling = true; // false tests every chunk, for comparing cull cost in the benchmark
+static bool terrainHorizonCulling = true; // false draws every frustum-visible chunk, for comparing against occlusion
+static const int terrainBuildThreads = 3; // 1 builds the chunks serially, for comparing startup time
+static const char* const terrainCachePath = "ux0:/data/nativeRenderTerrain.cache"; // nullptr always generates the terrain
+static const int terrainMaterialCacheTilesPerFrame = 4; // 0 lights every distant chunk per pixel, for comparing
+static bool terrainPrecomputedDraws = true; // false submits every chunk through sceGxmDraw, for comparing submission time
+
+// Render queue ids of the programs and texture sets packets are grouped by, lower ids draw first
+enum RenderProgramId {
+	RENDER_PROGRAM_TERRAIN = 0,
+	RENDER_PROGRAM_BASIC,
+	RENDER_PROGRAM_TEXTURED_LIT,
+	RENDER_PROGRAM_TEXTURED,
+	RENDER_PROGRAM_SCREEN,
+	RENDER_PROGRAM_INDICATOR
+};
+
+enum RenderTextureSetId {
+	RENDER_TEXTURES_NONE = 0,
+	RENDER_TEXTURES_WHITE,
+	RENDER_TEXTURES_GRAVEL,
+	RENDER_TEXTURES_LOGO,
+	RENDER_TEXTURES_LOGO_ALPHA
+};
+static const int terrainScatterMaxInstances = 2048; // rocks drawn per frame over the near chunks, 0 skips them for comparing
+static const int litCubeInstanceCapacity = 1024; // room in the lit cube instance buffer for cubes added at runtime
+static bool cameraRelativeRendering = true; // false renders lit geometry in world space, for comparing precision far from the origin
 static BenchmarkState benchmarkState = {};
 static uint32_t prevButtons = 0; // For edge detection on button presses
 
@@ -71,6 +113,7 @@ static SceUID fragmentRingBufferUID;
 static SceUID fragmentUsseRingBufferUID;
 
 static SceGxmContext* gxmContext = NULL; // Graphics context
+static GxmStateCache gxmState; // Filters redundant program, texture, depth and polygon mode sets on gxmContext
 static SceGxmRenderTarget* gxmRenderTarget = NULL; // Graphics render target
 
 static SceGxmColorSurface gxmColorSurfaces[DISPLAY_BUFFER_COUNT]; // Color surfaces
@@ -155,8 +198,10 @@ extern unsigned char _binary_texturedLit_v_gxp_start;
 extern unsigned char _binary_texturedLit_f_gxp_start;
 extern unsigned char _binary_texturedLitInstanced_v_gxp_start;
 extern unsigned char _binary_terrain_v_gxp_start;
+extern unsigned char _binary_terrainInstanced_v_gxp_start;
 extern unsigned char _binary_terrain_f_gxp_start;
 extern unsigned char _binary_terrainSimple_f_gxp_start;
+extern unsigned char _binary_terrainCached_f_gxp_start;
 
 static const SceGxmProgram* const gxmProgClearVertexGxp = (SceGxmProgram*)&_binary_clear_v_gxp_start;
 static const SceGxmProgram* const gxmProgClearFragmentGxp = (SceGxmProgram*)&_binary_clear_f_gxp_start;
@@ -170,8 +215,10 @@ static const SceGxmProgram* const gxmProgTexturedLitVertexGxp = (SceGxmProgram*)
 static const SceGxmProgram* const gxmProgTexturedLitFragmentGxp = (SceGxmProgram*)&_binary_texturedLit_f_gxp_start;
 static const SceGxmProgram* const gxmProgTexturedLitInstancedVertexGxp = (SceGxmProgram*)&_binary_texturedLitInstanced_v_gxp_start;
 static const SceGxmProgram* const gxmProgTerrainVertexGxp = (SceGxmProgram*)&_binary_terrain_v_gxp_start;
+static const SceGxmProgram* const gxmProgTerrainInstancedVertexGxp = (SceGxmProgram*)&_binary_terrainInstanced_v_gxp_start;
 static const SceGxmProgram* const gxmProgTerrainFragmentGxp = (SceGxmProgram*)&_binary_terrain_f_gxp_start;
 static const SceGxmProgram* const gxmProgTerrainSimpleFragmentGxp = (SceGxmProgram*)&_binary_terrainSimple_f_gxp_start;
+static const SceGxmProgram* const gxmProgTerrainCachedFragmentGxp = (SceGxmProgram*)&_binary_terrainCached_f_gxp_start;
 
 static SceGxmShaderPatcherId gxmClearVertexProgramID;
 static SceGxmShaderPatcherId gxmClearFragmentProgramID;
@@ -245,21 +292,22 @@ static const SceGxmProgramParameter* gxmTexturedLitInstancedVertexProgram_normal
 static const SceGxmProgramParameter* gxmTexturedLitInstancedVertexProgram_i_m0Param;
 static const SceGxmProgramParameter* gxmTexturedLitInstancedVertexProgram_i_m1Param;
 static const SceGxmProgramParameter* gxmTexturedLitInstancedVertexProgram_i_m2Param;
-static const SceGxmProgramParameter* gxmTexturedLitInstancedVertexProgram_i_m3Param;
 static const SceGxmProgramParameter* gxmTexturedLitInstancedVertexProgram_u_viewMatrixParam;
 static const SceGxmProgramParameter* gxmTexturedLitInstancedVertexProgram_u_projectionMatrixParam;
+static const SceGxmProgramParameter* gxmTexturedLitInstancedVertexProgram_u_instanceOffsetParam;
 static SceGxmVertexProgram* gxmTexturedLitInstancedVertexProgramPatched;
 
 static SceGxmShaderPatcherId gxmTerrainVertexProgramID;
 static SceGxmShaderPatcherId gxmTerrainFragmentProgramID;
 static const SceGxmProgramParameter* gxmTerrainVertexProgram_positionParam;
-static const SceGxmProgramParameter* gxmTerrainVertexProgram_texCoordParam;
 static const SceGxmProgramParameter* gxmTerrainVertexProgram_normalParam;
-static const SceGxmProgramParameter* gxmTerrainVertexProgram_tangentParam;
 static const SceGxmProgramParameter* gxmTerrainVertexProgram_u_viewMatrixParam;
 static const SceGxmProgramParameter* gxmTerrainVertexProgram_u_projectionMatrixParam;
 static const SceGxmProgramParameter* gxmTerrainVertexProgram_u_cameraPositionParam;
-static const SceGxmProgramParameter* gxmTerrainVertexProgram_u_modelMatrixParam;
+static const SceGxmProgramParameter* gxmTerrainVertexProgram_morphDeltaParam;
+static const SceGxmProgramParameter* gxmTerrainVertexProgram_u_chunkOriginParam;
+static const SceGxmProgramParameter* gxmTerrainVertexProgram_u_cacheParamsParam;
+static const SceGxmProgramParameter* gxmTerrainVertexProgram_u_lodParam;
 static const SceGxmProgramParameter* gxmTerrainFragmentProgram_u_lightCountParam;
 static const SceGxmProgramParameter* gxmTerrainFragmentProgram_u_lightPositionsParam;
 static const SceGxmProgramParameter* gxmTerrainFragmentProgram_u_lightColorsParam;
@@ -269,15 +317,27 @@ static const SceGxmProgramParameter* gxmTerrainFragmentProgram_u_F0Param;
 static SceGxmVertexProgram* gxmTerrainVertexProgramPatched;
 static SceGxmFragmentProgram* gxmTerrainFragmentProgramPatched;
 
+// Instanced terrain vertex shader (one shared mesh per LOD, chunk origin per instance)
+static SceGxmShaderPatcherId gxmTerrainInstancedVertexProgramID;
+static const SceGxmProgramParameter* gxmTerrainInstancedVertexProgram_positionParam;
+static const SceGxmProgramParameter* gxmTerrainInstancedVertexProgram_texCoordParam;
+static const SceGxmProgramParameter* gxmTerrainInstancedVertexProgram_normalParam;
+static const SceGxmProgramParameter* gxmTerrainInstancedVertexProgram_tangentParam;
+static const SceGxmProgramParameter* gxmTerrainInstancedVertexProgram_i_chunkOriginParam;
+static const SceGxmProgramParameter* gxmTerrainInstancedVertexProgram_u_viewMatrixParam;
+static const SceGxmProgramParameter* gxmTerrainInstancedVertexProgram_u_modelMatrixParam;
+static SceGxmVertexProgram* gxmTerrainInstancedVertexProgramPatched;
+
 // Simple terrain fragment shader (for distant LOD chunks)
 static SceGxmShaderPatcherId gxmTerrainSimpleFragmentProgramID;
 static const SceGxmProgramParameter* gxmTerrainSimpleFragmentProgram_u_F0Param;
 static SceGxmFragmentProgram* gxmTerrainSimpleFragmentProgramPatched;
+// The same shader patched for baking the material cache, whose render target has no multisampling
+static SceGxmFragmentProgram* gxmTerrainBakeFragmentProgramPatched;
 
-struct InstanceData
-{
-	float modelMatrix[16];
-};
+// Cached terrain fragment shader (distant chunks sampling the material cache)
+static SceGxmShaderPatcherId gxmTerrainCachedFragmentProgramID;
+static SceGxmFragmentProgram* gxmTerrainCachedFragmentProgramPatched;
 
 //Used by Lit Textured Shader
 struct PerFrameVertexUniforms
@@ -303,8 +363,13 @@ struct PerFrameTerrainVertexUniforms
 	float viewMatrix[16];
 	float projectionMatrix[16];
 	float cameraPosition[3];
+	float padding;
+	// Read by the per-chunk program only, whose chunk defaults are baked into precomputed state
+	float modelMatrix[16];
+	float morphParams[TerrainChunk::LOD_COUNT][4];	// Terrain::getMorphParams per LOD
+	float gridParams[3];
 };
-static_assert(sizeof(PerFrameTerrainVertexUniforms) == 140, "PerFrameTerrainVertexUniforms buffer size mismatch");
+static_assert(sizeof(PerFrameTerrainVertexUniforms) == 300, "PerFrameTerrainVertexUniforms buffer size mismatch");
 
 struct PerFrameTerrainFragmentUniforms
 {
@@ -317,16 +382,17 @@ struct PerFrameTerrainFragmentUniforms
 };
 static_assert(sizeof(PerFrameTerrainFragmentUniforms) == 328, "PerFrameTerrainFragmentUniforms buffer size mismatch");
 
-SceUID perFrameVertexUniformBufferUID;
-SceUID perFrameFragmentUniformBufferUID;
-SceUID perFrameTerrainVertexUniformBufferUID;
-SceUID perFrameTerrainFragmentUniformBufferUID;
-SceUID instanceDataBufferUID;
+SceUID terrainInstanceBufferUID;
+SceUID scatterInstanceBufferUID;
 PerFrameVertexUniforms* perFrameVertexUniformBuffer;
 PerFrameFragmentUniforms* perFrameFragmentUniformBuffer;
 PerFrameTerrainVertexUniforms* perFrameTerrainVertexUniformBuffer;
 PerFrameTerrainFragmentUniforms* perFrameTerrainFragmentUniformBuffer;
-InstanceData* instanceDataBuffer;
+// The per-frame blocks above come from this frame's slice, one slice per display buffer
+static FrameRing frameRing;
+static const unsigned int FRAME_RING_SLICE_SIZE = 4 * 1024; // per-frame uniforms, with room to spare
+TerrainInstanceData* terrainInstanceBuffer; // one set of chunk instances per display buffer
+InstanceData* scatterInstanceBuffer; // one block of detail instances per display buffer
 
 // Holds terrain chunk GPU data for each LOD
 struct ChunkGPUData
@@ -384,38 +450,40 @@ static void patcherHostFreeCallback(void* obj, void* ptr)
 	return free(ptr);
 }
 
-//used for the reused/persistent uniform buffers by the lit textured shader
-void initializeUniformBuffers()
+//used for the per-frame uniform buffers, rewritten every frame
+bool initializeUniformBuffers()
 {
-	perFrameVertexUniformBuffer = (PerFrameVertexUniforms*)gpuAllocMap(
-		sizeof(PerFrameVertexUniforms), 
-		SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, //SCE_KERNEL_MEMBLOCK_TYPE_USER_CDRAM_RW (test which is faster)
-		SCE_GXM_MEMORY_ATTRIB_READ, 
-		&perFrameVertexUniformBufferUID);
-
-	perFrameFragmentUniformBuffer = (PerFrameFragmentUniforms*)gpuAllocMap(
-		sizeof(PerFrameFragmentUniforms),
-		SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, //SCE_KERNEL_MEMBLOCK_TYPE_USER_CDRAM_RW
-		SCE_GXM_MEMORY_ATTRIB_READ,
-		&perFrameFragmentUniformBufferUID);
-
-	perFrameTerrainVertexUniformBuffer = (PerFrameTerrainVertexUniforms*)gpuAllocMap(
-		sizeof(PerFrameTerrainVertexUniforms),
-		SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, //SCE_KERNEL_MEMBLOCK_TYPE_USER_CDRAM_RW (test which is faster)
-		SCE_GXM_MEMORY_ATTRIB_READ,
-		&perFrameTerrainVertexUniformBufferUID);
-
-	perFrameTerrainFragmentUniformBuffer = (PerFrameTerrainFragmentUniforms*)gpuAllocMap(
-		sizeof(PerFrameTerrainFragmentUniforms),
-		SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, //SCE_KERNEL_MEMBLOCK_TYPE_USER_CDRAM_RW
-		SCE_GXM_MEMORY_ATTRIB_READ,
-		&perFrameTerrainFragmentUniformBufferUID);
+	if (!frameRing.init(DISPLAY_BUFFER_COUNT, FRAME_RING_SLICE_SIZE, 0))
+	{
+		sceClibPrintf("ERROR: frame ring allocation failed\n");
+		return false;
+	}
+	return true;
 }
 
 void freeUniformBuffers()
 {
-	gpuFreeUnmap(perFrameVertexUniformBufferUID);
-	gpuFreeUnmap(perFrameFragmentUniformBufferUID);
+	frameRing.release();
+}
+
+// Take this frame's uniform blocks from its ring slice, uniforms zeroed so unused lights stay off
+bool allocateFrameBuffers()
+{
+	perFrameVertexUniformBuffer = frameRing.allocate<PerFrameVertexUniforms>();
+	perFrameFragmentUniformBuffer = frameRing.allocate<PerFrameFragmentUniforms>();
+	perFrameTerrainVertexUniformBuffer = frameRing.allocate<PerFrameTerrainVertexUniforms>();
+	perFrameTerrainFragmentUniformBuffer = frameRing.allocate<PerFrameTerrainFragmentUniforms>();
+	if (!perFrameVertexUniformBuffer || !perFrameFragmentUniformBuffer || !perFrameTerrainVertexUniformBuffer ||
+		!perFrameTerrainFragmentUniformBuffer)
+	{
+		return false;
+	}
+
+	memset(perFrameVertexUniformBuffer, 0, sizeof(PerFrameVertexUniforms));
+	memset(perFrameFragmentUniformBuffer, 0, sizeof(PerFrameFragmentUniforms));
+	memset(perFrameTerrainVertexUniformBuffer, 0, sizeof(PerFrameTerrainVertexUniforms));
+	memset(perFrameTerrainFragmentUniformBuffer, 0, sizeof(PerFrameTerrainFragmentUniforms));
+	return true;
 }
 
 
@@ -678,6 +746,7 @@ void reinitDisplaySurfaces(SceGxmMultisampleMode newMode)
 	sceGxmShaderPatcherReleaseFragmentProgram(gxmShaderPatcher, gxmTexturedLitFragmentProgramPatched);
 	sceGxmShaderPatcherReleaseFragmentProgram(gxmShaderPatcher, gxmTerrainFragmentProgramPatched);
 	sceGxmShaderPatcherReleaseFragmentProgram(gxmShaderPatcher, gxmTerrainSimpleFragmentProgramPatched);
+	sceGxmShaderPatcherReleaseFragmentProgram(gxmShaderPatcher, gxmTerrainCachedFragmentProgramPatched);
 
 	// Blend info for textured shader
 	SceGxmBlendInfo blendInfo;
@@ -704,6 +773,8 @@ void reinitDisplaySurfaces(SceGxmMultisampleMode newMode)
 		SCE_GXM_OUTPUT_REGISTER_FORMAT_UCHAR4, newMode, NULL, terrainVertexProgram, &gxmTerrainFragmentProgramPatched);
 	sceGxmShaderPatcherCreateFragmentProgram(gxmShaderPatcher, gxmTerrainSimpleFragmentProgramID,
 		SCE_GXM_OUTPUT_REGISTER_FORMAT_UCHAR4, newMode, NULL, terrainVertexProgram, &gxmTerrainSimpleFragmentProgramPatched);
+	sceGxmShaderPatcherCreateFragmentProgram(gxmShaderPatcher, gxmTerrainCachedFragmentProgramID,
+		SCE_GXM_OUTPUT_REGISTER_FORMAT_UCHAR4, newMode, NULL, terrainVertexProgram, &gxmTerrainCachedFragmentProgramPatched);
 
 	// Reset buffer indices
 	gxmFrontBufferIndex = DISPLAY_BUFFER_COUNT - 1;
@@ -1268,9 +1339,9 @@ void createShaders()
 	findGxmShaderAttributeByName(texturedLitInstancedVertexProgram, "i_m0", &gxmTexturedLitInstancedVertexProgram_i_m0Param);
 	findGxmShaderAttributeByName(texturedLitInstancedVertexProgram, "i_m1", &gxmTexturedLitInstancedVertexProgram_i_m1Param);
 	findGxmShaderAttributeByName(texturedLitInstancedVertexProgram, "i_m2", &gxmTexturedLitInstancedVertexProgram_i_m2Param);
-	findGxmShaderAttributeByName(texturedLitInstancedVertexProgram, "i_m3", &gxmTexturedLitInstancedVertexProgram_i_m3Param);
 	findGxmShaderAttributeByName(texturedLitInstancedVertexProgram, "u_perVFrame.u_viewMatrix", &gxmTexturedLitInstancedVertexProgram_u_viewMatrixParam);
 	findGxmShaderAttributeByName(texturedLitInstancedVertexProgram, "u_perVFrame.u_projectionMatrix", &gxmTexturedLitInstancedVertexProgram_u_projectionMatrixParam);
+	findGxmShaderUniformByName(texturedLitInstancedVertexProgram, "u_instanceOffset", &gxmTexturedLitInstancedVertexProgram_u_instanceOffsetParam);
 
 	sceClibPrintf("texturedLitInstanced PositionParam at address: %p\n", (void*)gxmTexturedLitInstancedVertexProgram_positionParam);
 	sceClibPrintf("texturedLitInstanced TexCoordParam at address: %p\n", (void*)gxmTexturedLitInstancedVertexProgram_texCoordParam);
@@ -1278,11 +1349,11 @@ void createShaders()
 	sceClibPrintf("texturedLitInstanced i_m0Param at address: %p\n", (void*)gxmTexturedLitInstancedVertexProgram_i_m0Param);
 	sceClibPrintf("texturedLitInstanced i_m1Param at address: %p\n", (void*)gxmTexturedLitInstancedVertexProgram_i_m1Param);
 	sceClibPrintf("texturedLitInstanced i_m2Param at address: %p\n", (void*)gxmTexturedLitInstancedVertexProgram_i_m2Param);
-	sceClibPrintf("texturedLitInstanced i_m3Param at address: %p\n", (void*)gxmTexturedLitInstancedVertexProgram_i_m3Param);
 	sceClibPrintf("texturedLitInstanced ViewMatrixParam at address: %p\n", (void*)gxmTexturedLitInstancedVertexProgram_u_viewMatrixParam);
 	sceClibPrintf("texturedLitInstanced ProjectionMatrixParam at address: %p\n", (void*)gxmTexturedLitInstancedVertexProgram_u_projectionMatrixParam);
+	sceClibPrintf("texturedLitInstanced InstanceOffsetParam at address: %p\n", (void*)gxmTexturedLitInstancedVertexProgram_u_instanceOffsetParam);
 
-	SceGxmVertexAttribute texturedLitInstanced_vertex_attributes[7];
+	SceGxmVertexAttribute texturedLitInstanced_vertex_attributes[6];
 	SceGxmVertexStream texturedLitInstanced_vertex_streams[2];
 
 	// Position, TexCoord, Normal (Per-Vertex Data)
@@ -1329,24 +1400,17 @@ void createShaders()
 	texturedLitInstanced_vertex_attributes[5].regIndex = sceGxmProgramParameterGetResourceIndex(
 		gxmTexturedLitInstancedVertexProgram_i_m2Param);
 
-	texturedLitInstanced_vertex_attributes[6].streamIndex = 1;
-	texturedLitInstanced_vertex_attributes[6].offset = 48; // row 3
-	texturedLitInstanced_vertex_attributes[6].format = SCE_GXM_ATTRIBUTE_FORMAT_F32;
-	texturedLitInstanced_vertex_attributes[6].componentCount = 4;
-	texturedLitInstanced_vertex_attributes[6].regIndex = sceGxmProgramParameterGetResourceIndex(
-		gxmTexturedLitInstancedVertexProgram_i_m3Param);
-
 	// Stream 0: Per-Vertex Data (indexed by vertex index)
 	texturedLitInstanced_vertex_streams[0].stride = sizeof(struct TexturedVertex);
 	texturedLitInstanced_vertex_streams[0].indexSource = SCE_GXM_INDEX_SOURCE_INDEX_16BIT;
 
 	// Stream 1: Instance ID (automatically incremented)
-	texturedLitInstanced_vertex_streams[1].stride = sizeof(InstanceData); // 64 bytes (4x float4)
+	texturedLitInstanced_vertex_streams[1].stride = sizeof(InstanceData); // 48 bytes (3x float4)
 	texturedLitInstanced_vertex_streams[1].indexSource = SCE_GXM_INDEX_SOURCE_INSTANCE_16BIT;
 
 	err = sceGxmShaderPatcherCreateVertexProgram(gxmShaderPatcher,
 		gxmTexturedLitInstancedVertexProgramID, 
-		texturedLitInstanced_vertex_attributes, 7, 
+		texturedLitInstanced_vertex_attributes, 6, 
 		texturedLitInstanced_vertex_streams, 2, 
 		&gxmTexturedLitInstancedVertexProgramPatched);
 
@@ -1385,10 +1449,11 @@ void createShaders()
 	*/
 
 	findGxmShaderAttributeByName(terrainVertexProgram, "in_position", &gxmTerrainVertexProgram_positionParam);
-	findGxmShaderAttributeByName(terrainVertexProgram, "in_texCoord", &gxmTerrainVertexProgram_texCoordParam);
 	findGxmShaderAttributeByName(terrainVertexProgram, "in_normal", &gxmTerrainVertexProgram_normalParam);
-	findGxmShaderAttributeByName(terrainVertexProgram, "in_tangent", &gxmTerrainVertexProgram_tangentParam);
-	findGxmShaderUniformByName(terrainVertexProgram, "u_modelMatrix", &gxmTerrainVertexProgram_u_modelMatrixParam);
+	findGxmShaderAttributeByName(terrainVertexProgram, "in_morphDelta", &gxmTerrainVertexProgram_morphDeltaParam);
+	findGxmShaderUniformByName(terrainVertexProgram, "u_chunkOrigin", &gxmTerrainVertexProgram_u_chunkOriginParam);
+	findGxmShaderUniformByName(terrainVertexProgram, "u_cacheParams", &gxmTerrainVertexProgram_u_cacheParamsParam);
+	findGxmShaderUniformByName(terrainVertexProgram, "u_lod", &gxmTerrainVertexProgram_u_lodParam);
 	findGxmShaderUniformByName(terrainVertexProgram, "u_perVFrame.u_viewMatrix", &gxmTerrainVertexProgram_u_viewMatrixParam);
 	findGxmShaderUniformByName(terrainVertexProgram, "u_perVFrame.u_projectionMatrix", &gxmTerrainVertexProgram_u_projectionMatrixParam);
 	findGxmShaderUniformByName(terrainFragmentProgram, "u_perPFrame.u_lightCount", &gxmTerrainFragmentProgram_u_lightCountParam);
@@ -1399,9 +1464,8 @@ void createShaders()
 	findGxmShaderUniformByName(terrainFragmentProgram, "u_F0", &gxmTerrainFragmentProgram_u_F0Param);
 
 	sceClibPrintf("terrain PositionParam at address: %p\n", (void*)gxmTerrainVertexProgram_positionParam);
-	sceClibPrintf("terrain TexCoordParam at address: %p\n", (void*)gxmTerrainVertexProgram_texCoordParam);
 	sceClibPrintf("terrain NormalParam at address: %p\n", (void*)gxmTerrainVertexProgram_normalParam);
-	sceClibPrintf("terrain ModelMatrixParam at address: %p\n", (void*)gxmTerrainVertexProgram_u_modelMatrixParam);
+	sceClibPrintf("terrain LODParam at address: %p\n", (void*)gxmTerrainVertexProgram_u_lodParam);
 	sceClibPrintf("terrain ViewMatrixParam at address: %p\n", (void*)gxmTerrainVertexProgram_u_viewMatrixParam);
 	sceClibPrintf("terrain ProjectionMatrixParam at address: %p\n", (void*)gxmTerrainVertexProgram_u_projectionMatrixParam);
 	sceClibPrintf("terrain LightCountParam at address: %p\n", (void*)gxmTerrainFragmentProgram_u_lightCountParam);
@@ -1411,39 +1475,34 @@ void createShaders()
 	sceClibPrintf("terrain LightRadiiParam at address: %p\n", (void*)gxmTerrainFragmentProgram_u_lightRadiiParam);
 	sceClibPrintf("terrain F0 at address: %p\n", (void*)gxmTerrainFragmentProgram_u_F0Param);
 
-	SceGxmVertexAttribute terrain_vertex_attributes[4];
+	// Per-chunk terrain meshes use the quantized TerrainCompactVertex layout
+	SceGxmVertexAttribute terrain_vertex_attributes[3];
 	SceGxmVertexStream terrain_vertex_stream;
 	terrain_vertex_attributes[0].streamIndex = 0;
-	terrain_vertex_attributes[0].offset = 0;
-	terrain_vertex_attributes[0].format = SCE_GXM_ATTRIBUTE_FORMAT_F32;
-	terrain_vertex_attributes[0].componentCount = 3;
+	terrain_vertex_attributes[0].offset = offsetof(TerrainCompactVertex, gx);
+	terrain_vertex_attributes[0].format = SCE_GXM_ATTRIBUTE_FORMAT_U16;
+	terrain_vertex_attributes[0].componentCount = 3; // grid x, height steps, grid z
 	terrain_vertex_attributes[0].regIndex = sceGxmProgramParameterGetResourceIndex(
 		gxmTerrainVertexProgram_positionParam);
 	terrain_vertex_attributes[1].streamIndex = 0;
-	terrain_vertex_attributes[1].offset = offsetof(TerrainPBRVertex, u);
-	terrain_vertex_attributes[1].format = SCE_GXM_ATTRIBUTE_FORMAT_F32;
-	terrain_vertex_attributes[1].componentCount = 2;
+	terrain_vertex_attributes[1].offset = offsetof(TerrainCompactVertex, octX);
+	terrain_vertex_attributes[1].format = SCE_GXM_ATTRIBUTE_FORMAT_S16N;
+	terrain_vertex_attributes[1].componentCount = 2; // octahedral normal
 	terrain_vertex_attributes[1].regIndex = sceGxmProgramParameterGetResourceIndex(
-		gxmTerrainVertexProgram_texCoordParam);
+		gxmTerrainVertexProgram_normalParam);
 	terrain_vertex_attributes[2].streamIndex = 0;
-	terrain_vertex_attributes[2].offset = offsetof(TerrainPBRVertex, nx);
-	terrain_vertex_attributes[2].format = SCE_GXM_ATTRIBUTE_FORMAT_S16N;
-	terrain_vertex_attributes[2].componentCount = 3;
+	terrain_vertex_attributes[2].offset = offsetof(TerrainCompactVertex, morphDelta);
+	terrain_vertex_attributes[2].format = SCE_GXM_ATTRIBUTE_FORMAT_F16;
+	terrain_vertex_attributes[2].componentCount = 1;
 	terrain_vertex_attributes[2].regIndex = sceGxmProgramParameterGetResourceIndex(
-		gxmTerrainVertexProgram_normalParam);
-	terrain_vertex_attributes[3].streamIndex = 0;
-	terrain_vertex_attributes[3].offset = offsetof(TerrainPBRVertex, tx);
-	terrain_vertex_attributes[3].format = SCE_GXM_ATTRIBUTE_FORMAT_S16N;
-	terrain_vertex_attributes[3].componentCount = 4; // xyz = tangent, w = handedness
-	terrain_vertex_attributes[3].regIndex = sceGxmProgramParameterGetResourceIndex(
-		gxmTerrainVertexProgram_tangentParam);
-
-	terrain_vertex_stream.stride = sizeof(struct TerrainPBRVertex);
+		gxmTerrainVertexProgram_morphDeltaParam);
+
+	terrain_vertex_stream.stride = sizeof(struct TerrainCompactVertex);
 	terrain_vertex_stream.indexSource = SCE_GXM_INDEX_SOURCE_INDEX_32BIT;
 
 	err = sceGxmShaderPatcherCreateVertexProgram(gxmShaderPatcher,
 		gxmTerrainVertexProgramID, terrain_vertex_attributes,
-		4, &terrain_vertex_stream, 1, &gxmTerrainVertexProgramPatched);
+		3, &terrain_vertex_stream, 1, &gxmTerrainVertexProgramPatched);
 	if (err == 0)
 	{
 		sceClibPrintf("Terrain VertexProgram created at address: %p\n", (void*)gxmTerrainVertexProgramPatched);
@@ -1491,8 +1550,254 @@ void createShaders()
 		sceClibPrintf("TerrainSimple FragmentProgram creation failed\n");
 	}
 
-	//Now allocate persistent memory for the per-frame uniforms used by the lit shader
-	initializeUniformBuffers();
+	err = sceGxmShaderPatcherCreateFragmentProgram(gxmShaderPatcher,
+		gxmTerrainSimpleFragmentProgramID, SCE_GXM_OUTPUT_REGISTER_FORMAT_UCHAR4,
+		SCE_GXM_MULTISAMPLE_NONE, NULL, terrainVertexProgram,
+		&gxmTerrainBakeFragmentProgramPatched);
+	if (err == 0)
+	{
+		sceClibPrintf("TerrainBake FragmentProgram created at address: %p\n", (void*)gxmTerrainBakeFragmentProgramPatched);
+	}
+	else
+	{
+		sceClibPrintf("TerrainBake FragmentProgram creation failed\n");
+	}
+
+	/*
+	*	Cached Terrain Fragment Shader (distant chunks baked into the material cache)
+	*/
+	err = sceGxmShaderPatcherRegisterProgram(gxmShaderPatcher, gxmProgTerrainCachedFragmentGxp, &gxmTerrainCachedFragmentProgramID);
+	sceClibPrintf("sceGxmShaderPatcherRegisterProgram(terrainCachedFragmentProgramGxp): 0x%08X\n", err);
+
+	err = sceGxmShaderPatcherCreateFragmentProgram(gxmShaderPatcher,
+		gxmTerrainCachedFragmentProgramID, SCE_GXM_OUTPUT_REGISTER_FORMAT_UCHAR4,
+		gxmMultisampleMode, NULL, terrainVertexProgram,
+		&gxmTerrainCachedFragmentProgramPatched);
+	if (err == 0)
+	{
+		sceClibPrintf("TerrainCached FragmentProgram created at address: %p\n", (void*)gxmTerrainCachedFragmentProgramPatched);
+	}
+	else
+	{
+		sceClibPrintf("TerrainCached FragmentProgram creation failed\n");
+	}
+
+	/*
+	*	Instanced Terrain Shader (shares the terrain fragment programs, same outputs as terrain_v)
+	*/
+	err = sceGxmShaderPatcherRegisterProgram(gxmShaderPatcher, gxmProgTerrainInstancedVertexGxp, &gxmTerrainInstancedVertexProgramID);
+	sceClibPrintf("sceGxmShaderPatcherRegisterProgram(terrainInstancedVertexProgramGxp): 0x%08X\n", err);
+
+	const SceGxmProgram* terrainInstancedVertexProgram =
+		sceGxmShaderPatcherGetProgramFromId(gxmTerrainInstancedVertexProgramID);
+
+	findGxmShaderAttributeByName(terrainInstancedVertexProgram, "in_position", &gxmTerrainInstancedVertexProgram_positionParam);
+	findGxmShaderAttributeByName(terrainInstancedVertexProgram, "in_texCoord", &gxmTerrainInstancedVertexProgram_texCoordParam);
+	findGxmShaderAttributeByName(terrainInstancedVertexProgram, "in_normal", &gxmTerrainInstancedVertexProgram_normalParam);
+	findGxmShaderAttributeByName(terrainInstancedVertexProgram, "in_tangent", &gxmTerrainInstancedVertexProgram_tangentParam);
+	findGxmShaderAttributeByName(terrainInstancedVertexProgram, "i_chunkOrigin", &gxmTerrainInstancedVertexProgram_i_chunkOriginParam);
+	findGxmShaderUniformByName(terrainInstancedVertexProgram, "u_modelMatrix", &gxmTerrainInstancedVertexProgram_u_modelMatrixParam);
+	findGxmShaderUniformByName(terrainInstancedVertexProgram, "u_perVFrame.u_viewMatrix", &gxmTerrainInstancedVertexProgram_u_viewMatrixParam);
+
+	sceClibPrintf("terrainInstanced i_chunkOriginParam at address: %p\n", (void*)gxmTerrainInstancedVertexProgram_i_chunkOriginParam);
+	sceClibPrintf("terrainInstanced ModelMatrixParam at address: %p\n", (void*)gxmTerrainInstancedVertexProgram_u_modelMatrixParam);
+
+	SceGxmVertexAttribute terrainInstanced_vertex_attributes[5];
+	SceGxmVertexStream terrainInstanced_vertex_streams[2];
+
+	// Per-vertex data on stream 0 (same layout as the per-chunk terrain program)
+	terrainInstanced_vertex_attributes[0].streamIndex = 0;
+	terrainInstanced_vertex_attributes[0].offset = 0;
+	terrainInstanced_vertex_attributes[0].format = SCE_GXM_ATTRIBUTE_FORMAT_F32;
+	terrainInstanced_vertex_attributes[0].componentCount = 3;
+	terrainInstanced_vertex_attributes[0].regIndex = sceGxmProgramParameterGetResourceIndex(
+		gxmTerrainInstancedVertexProgram_positionParam);
+	terrainInstanced_vertex_attributes[1].streamIndex = 0;
+	terrainInstanced_vertex_attributes[1].offset = offsetof(TerrainPBRVertex, u);
+	terrainInstanced_vertex_attributes[1].format = SCE_GXM_ATTRIBUTE_FORMAT_F32;
+	terrainInstanced_vertex_attributes[1].componentCount = 2;
+	terrainInstanced_vertex_attributes[1].regIndex = sceGxmProgramParameterGetResourceIndex(
+		gxmTerrainInstancedVertexProgram_texCoordParam);
+	terrainInstanced_vertex_attributes[2].streamIndex = 0;
+	terrainInstanced_vertex_attributes[2].offset = offsetof(TerrainPBRVertex, nx);
+	terrainInstanced_vertex_attributes[2].format = SCE_GXM_ATTRIBUTE_FORMAT_S16N;
+	terrainInstanced_vertex_attributes[2].componentCount = 3;
+	terrainInstanced_vertex_attributes[2].regIndex = sceGxmProgramParameterGetResourceIndex(
+		gxmTerrainInstancedVertexProgram_normalParam);
+	terrainInstanced_vertex_attributes[3].streamIndex = 0;
+	terrainInstanced_vertex_attributes[3].offset = offsetof(TerrainPBRVertex, tx);
+	terrainInstanced_vertex_attributes[3].format = SCE_GXM_ATTRIBUTE_FORMAT_S16N;
+	terrainInstanced_vertex_attributes[3].componentCount = 4; // xyz = tangent, w = handedness
+	terrainInstanced_vertex_attributes[3].regIndex = sceGxmProgramParameterGetResourceIndex(
+		gxmTerrainInstancedVertexProgram_tangentParam);
+
+	// Per-instance chunk origin on stream 1
+	terrainInstanced_vertex_attributes[4].streamIndex = 1;
+	terrainInstanced_vertex_attributes[4].offset = 0;
+	terrainInstanced_vertex_attributes[4].format = SCE_GXM_ATTRIBUTE_FORMAT_F32;
+	terrainInstanced_vertex_attributes[4].componentCount = 4;
+	terrainInstanced_vertex_attributes[4].regIndex = sceGxmProgramParameterGetResourceIndex(
+		gxmTerrainInstancedVertexProgram_i_chunkOriginParam);
+
+	terrainInstanced_vertex_streams[0].stride = sizeof(struct TerrainPBRVertex);
+	terrainInstanced_vertex_streams[0].indexSource = SCE_GXM_INDEX_SOURCE_INDEX_16BIT;
+	terrainInstanced_vertex_streams[1].stride = sizeof(TerrainInstanceData); // 16 bytes (1x float4)
+	terrainInstanced_vertex_streams[1].indexSource = SCE_GXM_INDEX_SOURCE_INSTANCE_16BIT;
+
+	err = sceGxmShaderPatcherCreateVertexProgram(gxmShaderPatcher,
+		gxmTerrainInstancedVertexProgramID,
+		terrainInstanced_vertex_attributes, 5,
+		terrainInstanced_vertex_streams, 2,
+		&gxmTerrainInstancedVertexProgramPatched);
+
+	if (err == 0)
+	{
+		sceClibPrintf("TerrainInstanced VertexProgram created at address: %p\n", (void*)gxmTerrainInstancedVertexProgramPatched);
+	}
+	else
+	{
+		sceClibPrintf("TerrainInstanced VertexProgram creation failed\n");
+	}
+}
+
+// Draws every chunk of one LOD batch with a single instanced call, returns the number of chunks drawn
+int drawTerrainInstanceBatch(const TerrainChunk::Mesh* mesh, const Terrain::IndexVariant* indices,
+	void* vertexPoolBase, void* indexPoolBase, const TerrainInstanceData* instances, const Terrain::InstanceBatch& batch)
+{
+	if (batch.instanceCount == 0)
+		return 0;
+
+	void* vertexData = (uint8_t*)vertexPoolBase + mesh->vertexAlloc.offset;
+	void* indexData = (uint8_t*)indexPoolBase + indices->indexAlloc.offset;
+
+	sceGxmSetVertexStream(gxmContext, 0, vertexData);
+	sceGxmSetVertexStream(gxmContext, 1, instances + batch.firstInstance);
+	sceGxmDrawInstanced(gxmContext,
+		SCE_GXM_PRIMITIVE_TRIANGLES,
+		SCE_GXM_INDEX_FORMAT_U16,
+		indexData,
+		indices->indexCount * batch.instanceCount, // Total number of indices to render
+		indices->indexCount); // Index wrap count (restart after one chunk mesh)
+
+	return batch.instanceCount;
+}
+
+// Reserves the terrain vertex defaults for one per-chunk draw: the chunk's dequantization origin, its material
+// cache tile and the LOD picking its morph range from the per-frame buffer
+void setTerrainVertexDefaults(const float chunkOrigin[3], const float cacheParams[3], TerrainChunk::LODLevel lod)
+{
+	float lodIndex = (float)lod;
+	void* terrainVertexDefaultBuffer;
+	sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &terrainVertexDefaultBuffer);
+	sceGxmSetUniformDataF(terrainVertexDefaultBuffer, gxmTerrainVertexProgram_u_chunkOriginParam, 0, 3, chunkOrigin);
+	sceGxmSetUniformDataF(terrainVertexDefaultBuffer, gxmTerrainVertexProgram_u_cacheParamsParam, 0, 3, cacheParams);
+	sceGxmSetUniformDataF(terrainVertexDefaultBuffer, gxmTerrainVertexProgram_u_lodParam, 0, 1, &lodIndex);
+}
+
+// Per-frame values of the per-chunk terrain program: the terrain's model matrix, every LOD's morph range
+// and the compact vertex scales. The view, projection and camera are set by the caller
+void setTerrainFrameUniforms(PerFrameTerrainVertexUniforms* uniforms, const Terrain& terrain, const Matrix4x4& modelMatrix,
+	bool morph)
+{
+	memcpy(uniforms->modelMatrix, modelMatrix.getData(), sizeof(float) * 16);
+	for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
+	{
+		float params[3] = { 0.0f, 0.0f, 0.0f };
+		if (morph)
+		{
+			terrain.getMorphParams((TerrainChunk::LODLevel)lod, params);
+		}
+		uniforms->morphParams[lod][0] = params[0];
+		uniforms->morphParams[lod][1] = params[1];
+		uniforms->morphParams[lod][2] = params[2];
+		uniforms->morphParams[lod][3] = 0.0f;
+	}
+	Terrain::getCompactVertexParams(uniforms->gridParams);
+}
+
+// Bakes this frame's material cache tiles with the distant terrain shading, each tile in its own scene on the
+// cache render target with a valid region around it. Must run before the frame's main scene begins, scenes are
+// processed in order so the main scene samples the new tiles. bakeUniforms holds one block per tile baked this frame
+// modelMatrix and cameraPosition are in the frame's render space, the same ones the main scene uses
+// Returns the number of tiles baked
+int bakeTerrainMaterialTiles(Terrain& terrain, TerrainMaterialCache& cache, const Texture& diffuseTex,
+	PerFrameTerrainVertexUniforms* bakeUniforms, unsigned int vertexContainer, unsigned int fragmentContainer,
+	TerrainChunk::LODLevel minLOD, const Matrix4x4& modelMatrix, const Vector3f& cameraPosition)
+{
+	const float* model = modelMatrix.getData();
+	Vector3f localCam(cameraPosition.x - model[3], cameraPosition.y - model[7], cameraPosition.z - model[11]);
+	TerrainChunk* tiles[TerrainMaterialCache::MAX_TILES_PER_FRAME];
+	int tileCount = cache.selectTiles(terrain, minLOD, localCam, tiles);
+	if (tileCount == 0)
+		return 0;
+
+	// Full detail from above: LOD_0 indices with the morph factor held at 0
+	const float noCache[3] = { 0.0f, 0.0f, 0.0f };
+	// The projection alone maps the world onto the atlas
+	static const float identity[16] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+	const Terrain::IndexVariant* indices = terrain.getIndexVariant(TerrainChunk::LOD_0, 0);
+	void* vertexPoolBase = terrain.getBufferPool()->getVertexPoolBase();
+	void* indexData = (uint8_t*)terrain.getBufferPool()->getIndexPoolBase() + indices->indexAlloc.offset;
+	const SceGxmPrimitiveType primitive = terrain.usesTriangleStrips() ? SCE_GXM_PRIMITIVE_TRIANGLE_STRIP : SCE_GXM_PRIMITIVE_TRIANGLES;
+
+	for (int i = 0; i < tileCount; i++)
+	{
+		TerrainChunk* chunk = tiles[i];
+
+		PerFrameTerrainVertexUniforms* uniforms = bakeUniforms + i;
+		Matrix4x4 projection;
+		cache.getBakeProjection(chunk, modelMatrix, projection);
+		memcpy(uniforms->viewMatrix, identity, sizeof(identity));
+		memcpy(uniforms->projectionMatrix, projection.getData(), sizeof(float) * 16);
+		uniforms->cameraPosition[0] = cameraPosition.x;
+		uniforms->cameraPosition[1] = cameraPosition.y;
+		uniforms->cameraPosition[2] = cameraPosition.z;
+		setTerrainFrameUniforms(uniforms, terrain, modelMatrix, false);
+
+		SceGxmValidRegion region;
+		cache.getBakeRegion(chunk, region);
+		sceGxmBeginScene(gxmContext,
+			0, //flags
+			cache.getRenderTarget(),
+			&region,
+			NULL, //vertex sync object
+			NULL, //fragment sync object
+			cache.getColorSurface(),
+			NULL); //no depth, the heightfield seen from above never overlaps itself
+
+		// Every triangle faces up and covers its own texels, so no culling or depth test
+		gxmState.setPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_FILL);
+		sceGxmSetCullMode(gxmContext, SCE_GXM_CULL_NONE);
+		gxmState.setDepthFunc(gxmContext, SCE_GXM_DEPTH_FUNC_ALWAYS);
+		gxmState.setDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_DISABLED);
+
+		gxmState.setVertexProgram(gxmContext, gxmTerrainVertexProgramPatched);
+		gxmState.setFragmentProgram(gxmContext, gxmTerrainBakeFragmentProgramPatched);
+		gxmState.setFragmentTexture(gxmContext, 0, diffuseTex.getTexture());
+		sceGxmSetVertexUniformBuffer(gxmContext, vertexContainer, uniforms);
+		sceGxmSetFragmentUniformBuffer(gxmContext, fragmentContainer, perFrameTerrainFragmentUniformBuffer);
+
+		float chunkOrigin[3];
+		chunk->getVertexOrigin(chunkOrigin);
+		setTerrainVertexDefaults(chunkOrigin, noCache, TerrainChunk::LOD_0);
+
+		sceGxmSetVertexStream(gxmContext, 0, (uint8_t*)vertexPoolBase + chunk->getMesh()->vertexAlloc.offset);
+		sceGxmDraw(gxmContext, primitive, SCE_GXM_INDEX_FORMAT_U16, indexData, indices->indexCount);
+
+		sceGxmEndScene(gxmContext, NULL, NULL);
+		cache.markBaked(chunk);
+	}
+
+	// Back to the main scene's state
+	sceGxmSetCullMode(gxmContext, SCE_GXM_CULL_CW);
+	gxmState.setDepthFunc(gxmContext, SCE_GXM_DEPTH_FUNC_LESS_EQUAL);
+	gxmState.setDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_ENABLED);
+	if (wireFrame)
+	{
+		gxmState.setPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_LINE);
+	}
+
+	return tileCount;
 }
 
 void clearScreen()
@@ -1510,13 +1815,12 @@ void clearScreen()
 	// Get previous fill mode, clear screen requires to be set to FILL
 	bool previousMode = wireFrame;
 
-	sceGxmSetFrontPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_FILL);
-	sceGxmSetBackPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_FILL);
+	gxmState.setPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_FILL);
 	
 	//clear the screen
 	{
-		sceGxmSetVertexProgram(gxmContext, gxmClearVertexProgramPatched);
-		sceGxmSetFragmentProgram(gxmContext, gxmClearFragmentProgramPatched);
+		gxmState.setVertexProgram(gxmContext, gxmClearVertexProgramPatched);
+		gxmState.setFragmentProgram(gxmContext, gxmClearFragmentProgramPatched);
 
 		float clear[4] = { clearColor.r, clearColor.g, clearColor.b, clearColor.a };
 		//float clearDepthValue = depthValue * 2 - 1;
@@ -1542,8 +1846,7 @@ void clearScreen()
 	//restore previous mode if necessary
 	if (wireFrame)
 	{
-		sceGxmSetFrontPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_LINE);
-		sceGxmSetBackPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_LINE);
+		gxmState.setPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_LINE);
 	}
 }
 
@@ -1552,17 +1855,14 @@ void clearScreen()
 void drawMsaaIndicator()
 {
 	// Must be in FILL mode to draw the quad
-	sceGxmSetFrontPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_FILL);
-	sceGxmSetBackPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_FILL);
+	gxmState.setPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_FILL);
 
 	// Disable depth testing so indicator draws on top of everything
-	sceGxmSetFrontDepthFunc(gxmContext, SCE_GXM_DEPTH_FUNC_ALWAYS);
-	sceGxmSetBackDepthFunc(gxmContext, SCE_GXM_DEPTH_FUNC_ALWAYS);
-	sceGxmSetFrontDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_DISABLED);
-	sceGxmSetBackDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_DISABLED);
+	gxmState.setDepthFunc(gxmContext, SCE_GXM_DEPTH_FUNC_ALWAYS);
+	gxmState.setDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_DISABLED);
 
-	sceGxmSetVertexProgram(gxmContext, gxmClearVertexProgramPatched);
-	sceGxmSetFragmentProgram(gxmContext, gxmClearFragmentProgramPatched);
+	gxmState.setVertexProgram(gxmContext, gxmClearVertexProgramPatched);
+	gxmState.setFragmentProgram(gxmContext, gxmClearFragmentProgramPatched);
 
 	// Set color based on MSAA mode: Red = None, Yellow = 2X, Green = 4X
 	float indicatorColor[4];
@@ -1588,23 +1888,20 @@ void drawMsaaIndicator()
 	sceGxmDraw(gxmContext, SCE_GXM_PRIMITIVE_TRIANGLE_STRIP, SCE_GXM_INDEX_FORMAT_U16, msaaIndicatorIndices, 4);
 
 	// Restore depth testing state
-	sceGxmSetFrontDepthFunc(gxmContext, SCE_GXM_DEPTH_FUNC_LESS_EQUAL);
-	sceGxmSetBackDepthFunc(gxmContext, SCE_GXM_DEPTH_FUNC_LESS_EQUAL);
-	sceGxmSetFrontDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_ENABLED);
-	sceGxmSetBackDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_ENABLED);
+	gxmState.setDepthFunc(gxmContext, SCE_GXM_DEPTH_FUNC_LESS_EQUAL);
+	gxmState.setDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_ENABLED);
 
 	// Restore wireframe mode if it was enabled
 	if (wireFrame)
 	{
-		sceGxmSetFrontPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_LINE);
-		sceGxmSetBackPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_LINE);
+		gxmState.setPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_LINE);
 	}
 }
 
 void swapBuffers()
 {
-	//end scene
-	sceGxmEndScene(gxmContext, NULL, NULL);
+	//end scene, its fragment notification fences the frame's ring slice
+	sceGxmEndScene(gxmContext, NULL, frameRing.endFrame());
 	//PA heartbeat to notify end of frame
 	sceGxmPadHeartbeat(&gxmColorSurfaces[gxmBackBufferIndex], gxmSyncObjs[gxmBackBufferIndex]);
 
@@ -1654,6 +1951,13 @@ int main()
 	initShaderPatcher();
 	createShaders();
 
+	//Now allocate persistent memory for the per-frame uniforms, nothing can be drawn without it
+	if (!initializeUniformBuffers())
+	{
+		sceKernelExitProcess(0);
+		return 0;
+	}
+
 	//initialize controller data
 	//enable analog stick
 	SceCtrlData ctrlData;
@@ -1841,8 +2145,74 @@ int main()
 		3, 1, 2
 	};
 
+	// Heights come from a heightmap file when present, otherwise from procedural noise
+	// With proceduralTerrain off and no file the terrain stays flat and uses the instanced path
+	Heightmap heightmap;
+	NoiseHeightSource terrainNoise;
+	const TerrainHeightSource* terrainHeightSource = nullptr;
+	if (heightmap.load("ux0:/data/nativeRenderHeightmap.pgm", Terrain::TERRAIN_GRID_SIZE, 16.0f, -2.0f))
+	{
+		terrainHeightSource = &heightmap;
+	}
+	else if (proceduralTerrain)
+	{
+		terrainHeightSource = &terrainNoise;
+	}
+
 	Terrain terrain;
-	terrain.initialize();
+	terrain.setBuildThreadCount(terrainBuildThreads);
+	terrain.setCachePath(terrainCachePath);
+	terrain.initialize(Terrain::RENDER_MODE_INSTANCED, terrainHeightSource);
+	terrain.setAutoTriangleBudget(terrainFrameTargetMs, terrainMinTriangles, terrainMaxTriangles);
+	terrain.setHierarchicalCulling(terrainQuadtreeCulling);
+	terrain.setHorizonCulling(terrainHorizonCulling);
+
+	// A heightmap is a single tile whose heights are baked into the chunk meshes, noise and flat
+	// terrain go on forever so the chunk window follows the camera
+	if (terrainHeightSource == &heightmap)
+	{
+		heightmap.unload();
+	}
+	else
+	{
+		// The GPU can still be reading the frames queued for display plus the one being built
+		terrain.enableStreaming(DISPLAY_BUFFER_COUNT + 1, terrainStreamUploadBudgetMs);
+	}
+
+	// Instance data for the shared-mesh terrain path, one block per display buffer so the CPU
+	// never rewrites instances the GPU may still be reading
+	const int terrainChunkCount = Terrain::CHUNKS_PER_SIDE * Terrain::CHUNKS_PER_SIDE;
+	terrainInstanceBuffer = (TerrainInstanceData*)gpuAllocMap(
+		DISPLAY_BUFFER_COUNT * terrainChunkCount * sizeof(TerrainInstanceData),
+		SCE_KERNEL_MEMBLOCK_TYPE_USER_RW_UNCACHE,
+		SCE_GXM_MEMORY_ATTRIB_READ,
+		&terrainInstanceBufferUID);
+
+	// Detail rocks over the near chunks, rewritten every frame relative to the camera like the terrain instances
+	TerrainScatter terrainScatter;
+	scatterInstanceBuffer = nullptr;
+	if (terrainScatterMaxInstances > 0)
+	{
+		scatterInstanceBuffer = (InstanceData*)gpuAllocMap(
+			DISPLAY_BUFFER_COUNT * terrainScatterMaxInstances * sizeof(InstanceData),
+			SCE_KERNEL_MEMBLOCK_TYPE_USER_RW_UNCACHE,
+			SCE_GXM_MEMORY_ATTRIB_READ,
+			&scatterInstanceBufferUID);
+	}
+
+	// Distant per-chunk terrain samples the baked material cache, the instanced path has no cache coordinates
+	TerrainMaterialCache terrainMaterialCache;
+	PerFrameTerrainVertexUniforms* terrainBakeUniformBuffer = nullptr; // one block of tile projections per display buffer
+	SceUID terrainBakeUniformBufferUID = -1;
+	if (terrain.getRenderMode() == Terrain::RENDER_MODE_PER_CHUNK && terrainMaterialCacheTilesPerFrame > 0 &&
+		terrainMaterialCache.init(terrainMaterialCacheTilesPerFrame))
+	{
+		terrainBakeUniformBuffer = (PerFrameTerrainVertexUniforms*)gpuAllocMap(
+			DISPLAY_BUFFER_COUNT * TerrainMaterialCache::MAX_TILES_PER_FRAME * sizeof(PerFrameTerrainVertexUniforms),
+			SCE_KERNEL_MEMBLOCK_TYPE_USER_RW_UNCACHE,
+			SCE_GXM_MEMORY_ATTRIB_READ,
+			&terrainBakeUniformBufferUID);
+	}
 
 	//allocate memory for the vertex data
 	sceClibPrintf("Allocating memory for the vertex data...\n");
@@ -2166,6 +2536,7 @@ int main()
 		Vector3f rotation;
 		Vector3f scale;
 		Matrix4x4 modelMatrix;
+		InstanceBuffer::Handle instance;
 	};
 
 	std::random_device rd;
@@ -2219,13 +2590,15 @@ int main()
 		_litCubes.push_back(newCube);
 	}
 
-	// Allocate instance data buffer
-	instanceDataBuffer = (InstanceData*)gpuAllocMap(
-		_litCubes.size() * sizeof(InstanceData),
-		SCE_KERNEL_MEMBLOCK_TYPE_USER_CDRAM_RW,
-		SCE_GXM_MEMORY_ATTRIB_READ,
-		&instanceDataBufferUID
-	);
+	// The cubes don't move, their instances are uploaded once per display buffer and then only when changed
+	InstanceBuffer litCubeInstances;
+	if (litCubeInstances.init(litCubeInstanceCapacity, DISPLAY_BUFFER_COUNT, Vector3f(0.0f, 0.0f, 0.0f)))
+	{
+		for (LitCube& cube : _litCubes)
+		{
+			cube.instance = litCubeInstances.add(cube.modelMatrix);
+		}
+	}
 
 	//create a few lights
 	Light firstLight = Light(Vector3f(0.0f, 2.0f, -7.0f), Color(1.0f, 0.0f, 0.0f, 1.0f));
@@ -2251,6 +2624,7 @@ int main()
 	unsigned int perFrameVertexInstancedContainer = sceGxmProgramParameterGetContainerIndex(gxmTexturedLitInstancedVertexProgram_u_viewMatrixParam);
 	unsigned int perFrameTerrainVertexContainer = sceGxmProgramParameterGetContainerIndex(gxmTerrainVertexProgram_u_viewMatrixParam);
 	unsigned int perFrameTerrainFragmentContainer = sceGxmProgramParameterGetContainerIndex(gxmTerrainFragmentProgram_u_lightCountParam);
+	unsigned int perFrameTerrainInstancedVertexContainer = sceGxmProgramParameterGetContainerIndex(gxmTerrainInstancedVertexProgram_u_viewMatrixParam);
 	sceClibPrintf("Per-frame vertex container: %d\n", perFrameVertexContainer);
 	sceClibPrintf("Per-frame fragment container: %d\n", perFrameFragmentContainer);
 	sceClibPrintf("Size of PerFrameVertexUniformBuffer: %u bytes\n", sizeof(PerFrameVertexUniforms));
@@ -2260,11 +2634,38 @@ int main()
 	sceClibPrintf("Size of PerFrameTerrainVertexUniformBuffer: %u bytes\n", sizeof(PerFrameTerrainVertexUniforms));
 	sceClibPrintf("Size of PerFrameTerrainFragmentUniformBuffer: %u bytes\n", sizeof(PerFrameTerrainFragmentUniforms));
 
-	//Initialize the per-frame uniform buffers to avoid garbage data
-	memset(perFrameVertexUniformBuffer, 0, sizeof(PerFrameVertexUniforms));
-	memset(perFrameFragmentUniformBuffer, 0, sizeof(PerFrameFragmentUniforms));
-	memset(perFrameTerrainVertexUniformBuffer, 0, sizeof(PerFrameTerrainVertexUniforms));
-	memset(perFrameTerrainFragmentUniformBuffer, 0, sizeof(PerFrameTerrainFragmentUniforms));
+	// The frame's draw packets, sorted by key before they're drawn
+	RenderQueue renderQueue;
+
+	// Precomputed per-chunk terrain draws, one set of records per display buffer
+	TerrainDrawRecords terrainDrawRecords;
+	auto initTerrainFragmentStates = [&]()
+	{
+		TerrainDrawRecords::PassDesc passes[TerrainDrawRecords::PASS_COUNT] = {};
+		passes[TerrainDrawRecords::PASS_FULL].program = gxmTerrainFragmentProgramPatched;
+		passes[TerrainDrawRecords::PASS_FULL].textures[0] = terrainDiffuseTex.getTexture();
+		passes[TerrainDrawRecords::PASS_FULL].textures[1] = terrainNormalTex.getTexture();
+		passes[TerrainDrawRecords::PASS_FULL].textures[2] = terrainRoughTex.getTexture();
+		passes[TerrainDrawRecords::PASS_FULL].usesPerFrameBuffer = true;
+		passes[TerrainDrawRecords::PASS_FULL].f0Param = gxmTerrainFragmentProgram_u_F0Param;
+		passes[TerrainDrawRecords::PASS_FULL].f0[0] = passes[TerrainDrawRecords::PASS_FULL].f0[1] =
+			passes[TerrainDrawRecords::PASS_FULL].f0[2] = 0.04f;
+		passes[TerrainDrawRecords::PASS_CACHED].program = terrainMaterialCache.isInitialized() ? gxmTerrainCachedFragmentProgramPatched : nullptr;
+		passes[TerrainDrawRecords::PASS_CACHED].textures[3] = terrainMaterialCache.getTexture();
+		passes[TerrainDrawRecords::PASS_SIMPLE].program = gxmTerrainSimpleFragmentProgramPatched;
+		passes[TerrainDrawRecords::PASS_SIMPLE].textures[0] = terrainDiffuseTex.getTexture();
+		passes[TerrainDrawRecords::PASS_SIMPLE].usesPerFrameBuffer = true;
+		if (!terrainDrawRecords.initFragmentStates(passes, perFrameTerrainFragmentContainer))
+		{
+			terrainDrawRecords.release();
+		}
+	};
+	if (terrain.getRenderMode() == Terrain::RENDER_MODE_PER_CHUNK && terrainDrawRecords.init(terrain, DISPLAY_BUFFER_COUNT,
+		gxmTerrainVertexProgramPatched, gxmTerrainVertexProgram_u_chunkOriginParam, gxmTerrainVertexProgram_u_cacheParamsParam,
+		gxmTerrainVertexProgram_u_lodParam, perFrameTerrainVertexContainer, &terrainMaterialCache))
+	{
+		initTerrainFragmentStates();
+	}
 
 	sceClibPrintf("Entering main loop...\n");
 	bool running = true;
@@ -2324,13 +2725,11 @@ int main()
 
 				if (wireFrame)
 				{
-					sceGxmSetFrontPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_LINE);
-					sceGxmSetBackPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_LINE);
+					gxmState.setPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_LINE);
 				}
 				else
 				{
-					sceGxmSetFrontPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_FILL);
-					sceGxmSetBackPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_FILL);
+					gxmState.setPolygonMode(gxmContext, SCE_GXM_POLYGON_MODE_TRIANGLE_FILL);
 				}
 			}
 
@@ -2472,40 +2871,69 @@ int main()
 			lightThreeCenter.y,
 			lightThreeCenter.z + lightThreeRadius * sinf(lightThreeAngle)));
 
-		// Update terrain LODs
-		terrain.updateLODs(cameraPosition, camera.getForwardVector());
-
 		// Get view-projection matrix for frustum culling (only used on terrain for now)
 		// incorporate the terrain's model transform into the cull test
 		Matrix4x4 viewProjMatrix = camera.getProjectionMatrix() * camera.getViewMatrix() * terrain.getModelMatrix();
 
+		// Lit geometry is drawn relative to the camera: model and view lose the camera translation on the CPU, so
+		// positions and light vectors reaching the half precision varyings stay small anywhere on the terrain
+		// Culling and LOD selection above stay in world space
+		const Vector3f renderOrigin = cameraRelativeRendering ? cameraPosition : Vector3f(0.0f, 0.0f, 0.0f);
+		const Vector3f renderCameraPosition = cameraPosition - renderOrigin;
+		Matrix4x4 renderViewMatrix = camera.getViewMatrixRelativeTo(renderOrigin);
+		Matrix4x4 terrainRenderModelMatrix = rebaseTransformationMatrix(terrain.getModelMatrix(), renderOrigin);
+
+		// Update terrain LODs, the triangle budget reacts to the last frame's time
+		terrain.updateStreaming(cameraPosition);
+		terrain.updateTriangleBudget(deltaTime);
+		terrain.updateLODs(cameraPosition, camera.getProjectionMatrix(), viewProjMatrix, DISPLAY_HEIGHT);
+
 		// Get visible terrain chunks, sorted front-to-back (returns const ref to internal cache — no heap allocation)
 		const std::vector<TerrainChunk*>& visibleChunks = terrain.getVisibleChunks(viewProjMatrix, cameraPosition);
+		benchmarkSetCounter(benchmarkState, BENCH_COUNTER_TERRAIN_CULL_US, terrain.getCullTimeUs());
+		benchmarkSetCounter(benchmarkState, BENCH_COUNTER_TERRAIN_CULL_NODES, (float)terrain.getCullNodesVisited());
+		benchmarkSetCounter(benchmarkState, BENCH_COUNTER_TERRAIN_HORIZON_CULLED, (float)terrain.getHorizonCulledCount());
 
-		clearScreen();
+		// Detail lists follow the LODs just selected: generated as chunks come near, freed as they leave
+		if (scatterInstanceBuffer)
+		{
+			terrainScatter.update(terrain, terrain.getModelMatrix(), cameraPosition);
+		}
 
-		//render
+		const bool terrainInstanced = (terrain.getRenderMode() == Terrain::RENDER_MODE_INSTANCED);
+		const SceGxmPrimitiveType terrainPrimitive = terrain.usesTriangleStrips() ? SCE_GXM_PRIMITIVE_TRIANGLE_STRIP : SCE_GXM_PRIMITIVE_TRIANGLES;
 
-		//terrain first
-		sceGxmSetVertexProgram(gxmContext, gxmTerrainVertexProgramPatched);
+		// LOD threshold: chunks at this LOD level or higher use the material cache, or the simple shader until their tile is baked
+		const TerrainChunk::LODLevel SIMPLE_SHADER_LOD = TerrainChunk::LOD_2;
 
-		void* terrainVertexDefaultBuffer;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &terrainVertexDefaultBuffer);
-		sceGxmSetUniformDataF(terrainVertexDefaultBuffer, gxmTerrainVertexProgram_u_modelMatrixParam, 0, 16, (float*)terrain.getModelMatrix().getData());
+		// This frame's slice of the ring, free once the GPU has finished the frame that last filled it
+		unsigned int frameRingWaitUs = frameRing.beginFrame(gxmBackBufferIndex);
+		if (!allocateFrameBuffers())
+		{
+			sceClibPrintf("ERROR: frame ring slice too small for the per-frame data\n");
+			break;
+		}
+		benchmarkSetCounter(benchmarkState, BENCH_COUNTER_FRAME_RING_WAIT_US, (float)frameRingWaitUs);
+		if (terrainDrawRecords.isInitialized())
+		{
+			terrainDrawRecords.beginFrame(gxmBackBufferIndex, perFrameTerrainVertexUniformBuffer, perFrameTerrainFragmentUniformBuffer);
+		}
 
-		//populate per-frame uniform data (shared by both terrain shaders)
-		memcpy(perFrameTerrainVertexUniformBuffer->viewMatrix, camera.getViewMatrix().getData(), sizeof(float) * 16);
+		//populate per-frame uniform data (shared by both terrain shaders and the material cache bake)
+		memcpy(perFrameTerrainVertexUniformBuffer->viewMatrix, renderViewMatrix.getData(), sizeof(float) * 16);
 		memcpy(perFrameTerrainVertexUniformBuffer->projectionMatrix, camera.getProjectionMatrix().getData(), sizeof(float) * 16);
-		perFrameTerrainVertexUniformBuffer->cameraPosition[0] = cameraPosition.x;
-		perFrameTerrainVertexUniformBuffer->cameraPosition[1] = cameraPosition.y;
-		perFrameTerrainVertexUniformBuffer->cameraPosition[2] = cameraPosition.z;
+		perFrameTerrainVertexUniformBuffer->cameraPosition[0] = renderCameraPosition.x;
+		perFrameTerrainVertexUniformBuffer->cameraPosition[1] = renderCameraPosition.y;
+		perFrameTerrainVertexUniformBuffer->cameraPosition[2] = renderCameraPosition.z;
+		setTerrainFrameUniforms(perFrameTerrainVertexUniformBuffer, terrain, terrainRenderModelMatrix, true);
 
 		perFrameTerrainFragmentUniformBuffer->lightCount = 3;
 		for (int i = 0; i < 3; i++)
 		{
-			perFrameTerrainFragmentUniformBuffer->lightPositions[i][0] = lights[i].getPosition().x;
-			perFrameTerrainFragmentUniformBuffer->lightPositions[i][1] = lights[i].getPosition().y;
-			perFrameTerrainFragmentUniformBuffer->lightPositions[i][2] = lights[i].getPosition().z;
+			Vector3f lightPosition = lights[i].getPosition() - renderOrigin;
+			perFrameTerrainFragmentUniformBuffer->lightPositions[i][0] = lightPosition.x;
+			perFrameTerrainFragmentUniformBuffer->lightPositions[i][1] = lightPosition.y;
+			perFrameTerrainFragmentUniformBuffer->lightPositions[i][2] = lightPosition.z;
 			perFrameTerrainFragmentUniformBuffer->lightPositions[i][3] = 1.0f; //padding
 			perFrameTerrainFragmentUniformBuffer->lightColors[i][0] = lights[i].getColor().r;
 			perFrameTerrainFragmentUniformBuffer->lightColors[i][1] = lights[i].getColor().g;
@@ -2516,115 +2944,244 @@ int main()
 			perFrameTerrainFragmentUniformBuffer->lightRadii[i] = lights[i].getRadius();
 		}
 
-		// Inactive lights (3-7) stay zero from pre-loop memset — no per-frame zeroing needed
+		// Inactive lights (3-7) stay zero from the memset at allocation
 
-		//bind the per-frame uniform buffer (shared by both terrain fragment shaders - same BUFFER[0] layout)
-		sceGxmSetVertexUniformBuffer(gxmContext, perFrameTerrainVertexContainer, perFrameTerrainVertexUniformBuffer);
-		sceGxmSetFragmentUniformBuffer(gxmContext, perFrameTerrainFragmentContainer, perFrameTerrainFragmentUniformBuffer);
+		gxmState.resetCounters();
 
-		//Get buffer pool base address (terrain meshes are pooled into common ALIGN'ed chunks)
-		void* vertexPoolBase = terrain.getBufferPool()->getVertexPoolBase();
-		void* indexPoolBase = terrain.getBufferPool()->getIndexPoolBase();
+		// Refresh a few material cache tiles in their own scenes before the frame's scene begins
+		int bakedTiles = 0;
+		if (terrainMaterialCache.isInitialized())
+		{
+			bakedTiles = bakeTerrainMaterialTiles(terrain, terrainMaterialCache, terrainDiffuseTex,
+				terrainBakeUniformBuffer + gxmBackBufferIndex * TerrainMaterialCache::MAX_TILES_PER_FRAME,
+				perFrameTerrainVertexContainer, perFrameTerrainFragmentContainer, SIMPLE_SHADER_LOD,
+				terrainRenderModelMatrix, renderCameraPosition);
+			terrainMaterialCache.endFrame();
+		}
+		benchmarkSetCounter(benchmarkState, BENCH_COUNTER_TERRAIN_TILES_BAKED, (float)bakedTiles);
 
-		//Default F0 for non-metallic materials
-		float F0[3] = { 0.04f, 0.04f, 0.04f };
+		clearScreen();
 
-		// LOD threshold: chunks at this LOD level or higher use the simple shader
-		const TerrainChunk::LODLevel SIMPLE_SHADER_LOD = TerrainChunk::LOD_2;
+		//render
 
-		// Pass 1: Close chunks (LOD_0, LOD_1) — full PBR shader with 3 textures
-		sceGxmSetFragmentProgram(gxmContext, gxmTerrainFragmentProgramPatched);
+		// The terrain passes set their own programs and textures, one packet ahead of the other opaque draws
+		auto drawTerrain = [&](SceGxmContext*)
 		{
-			void* terrainFragmentDefaultBuffer;
-			sceGxmReserveFragmentDefaultUniformBuffer(gxmContext, &terrainFragmentDefaultBuffer);
-			sceGxmSetUniformDataF(terrainFragmentDefaultBuffer, gxmTerrainFragmentProgram_u_F0Param, 0, 3, F0);
-		}
-		sceGxmSetFragmentTexture(gxmContext, 0, terrainDiffuseTex.getTexture());
-		sceGxmSetFragmentTexture(gxmContext, 1, terrainNormalTex.getTexture());
-		sceGxmSetFragmentTexture(gxmContext, 2, terrainRoughTex.getTexture());
+			// Timed from here to the last terrain draw for the submission cost
+			SceUInt64 terrainSubmitStart = sceKernelGetProcessTimeWide();
+			const bool terrainUseDrawRecords = !terrainInstanced && terrainPrecomputedDraws && terrainDrawRecords.isInitialized();
+			gxmState.setVertexProgram(gxmContext, terrainInstanced ? gxmTerrainInstancedVertexProgramPatched : gxmTerrainVertexProgramPatched);
 
-		int renderedChunks = 0;
-		bool hasSimpleChunks = false;
-		for (TerrainChunk* chunk : visibleChunks)
-		{
-			if (chunk->getCurrentLOD() >= SIMPLE_SHADER_LOD)
+			// Per-chunk draws reserve their defaults for every chunk, each has its own dequantization origin
+			if (terrainInstanced)
 			{
-				hasSimpleChunks = true;
-				continue;
+				void* terrainVertexDefaultBuffer;
+				sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &terrainVertexDefaultBuffer);
+				sceGxmSetUniformDataF(terrainVertexDefaultBuffer, gxmTerrainInstancedVertexProgram_u_modelMatrixParam,
+					0, 16, (float*)terrainRenderModelMatrix.getData());
 			}
 
-			const TerrainChunk::LODMesh* lodMesh = chunk->getCurrentLODMesh();
-			void* vertexData = (uint8_t*)vertexPoolBase + lodMesh->vertexAlloc.offset;
-			void* indexData = (uint8_t*)indexPoolBase + lodMesh->indexAlloc.offset;
+			//bind the per-frame uniform buffer (shared by both terrain fragment shaders - same BUFFER[0] layout)
+			sceGxmSetVertexUniformBuffer(gxmContext,
+				terrainInstanced ? perFrameTerrainInstancedVertexContainer : perFrameTerrainVertexContainer,
+				perFrameTerrainVertexUniformBuffer);
+			sceGxmSetFragmentUniformBuffer(gxmContext, perFrameTerrainFragmentContainer, perFrameTerrainFragmentUniformBuffer);
 
-			sceGxmSetVertexStream(gxmContext, 0, vertexData);
-			sceGxmDraw(gxmContext, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U16, indexData, lodMesh->indexCount);
-			renderedChunks++;
-		}
+			//Get buffer pool base address (terrain meshes are pooled into common ALIGN'ed chunks)
+			void* vertexPoolBase = terrain.getBufferPool()->getVertexPoolBase();
+			void* indexPoolBase = terrain.getBufferPool()->getIndexPoolBase();
 
-		// Pass 2: Distant chunks (LOD_2+) — simple Lambertian shader, 1 texture sample
-		if (hasSimpleChunks)
-		{
-			sceGxmSetFragmentProgram(gxmContext, gxmTerrainSimpleFragmentProgramPatched);
-			// TEXUNIT0 (diffuse) already bound from PBR pass
+			//Default F0 for non-metallic materials
+			float F0[3] = { 0.04f, 0.04f, 0.04f };
 
-			for (TerrainChunk* chunk : visibleChunks)
+			// Instanced mode: group the visible chunks by LOD into this frame's instance block
+			Terrain::InstanceBatch terrainBatches[TerrainChunk::LOD_COUNT];
+			TerrainInstanceData* frameTerrainInstances = terrainInstanceBuffer + gxmBackBufferIndex * terrainChunkCount;
+			if (terrainInstanced)
 			{
-				if (chunk->getCurrentLOD() < SIMPLE_SHADER_LOD)
-					continue;
+				terrain.buildInstanceBatches(visibleChunks, frameTerrainInstances, terrainBatches);
+			}
+
+			// One per-chunk draw, cacheParams locates the chunk's material cache tile (unused outside the cached pass)
+			// The precomputed record of the chunk and LOD already holds all of it
+			auto drawTerrainChunk = [&](const TerrainChunk* chunk, const float cacheParams[3])
+			{
+				if (terrainUseDrawRecords)
+				{
+					terrainDrawRecords.draw(gxmContext, gxmBackBufferIndex, terrain, chunk);
+					return;
+				}
 
-				const TerrainChunk::LODMesh* lodMesh = chunk->getCurrentLODMesh();
-				void* vertexData = (uint8_t*)vertexPoolBase + lodMesh->vertexAlloc.offset;
-				void* indexData = (uint8_t*)indexPoolBase + lodMesh->indexAlloc.offset;
+				float chunkOrigin[3];
+				chunk->getVertexOrigin(chunkOrigin);
+				setTerrainVertexDefaults(chunkOrigin, cacheParams, chunk->getCurrentLOD());
+
+				const TerrainChunk::Mesh* mesh = chunk->getMesh();
+				const Terrain::IndexVariant* indices = terrain.getRenderIndices(chunk);
+				void* vertexData = (uint8_t*)vertexPoolBase + mesh->vertexAlloc.offset;
+				void* indexData = (uint8_t*)indexPoolBase + indices->indexAlloc.offset;
 
 				sceGxmSetVertexStream(gxmContext, 0, vertexData);
-				sceGxmDraw(gxmContext, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U16, indexData, lodMesh->indexCount);
-				renderedChunks++;
+				sceGxmDraw(gxmContext, terrainPrimitive, SCE_GXM_INDEX_FORMAT_U16, indexData, indices->indexCount);
+			};
+			const float noCacheParams[3] = { 0.0f, 0.0f, 0.0f };
+
+			// Pass 1: Close chunks (LOD_0, LOD_1) — full PBR shader with 3 textures
+			gxmState.setFragmentProgram(gxmContext, gxmTerrainFragmentProgramPatched);
+			{
+				void* terrainFragmentDefaultBuffer;
+				sceGxmReserveFragmentDefaultUniformBuffer(gxmContext, &terrainFragmentDefaultBuffer);
+				sceGxmSetUniformDataF(terrainFragmentDefaultBuffer, gxmTerrainFragmentProgram_u_F0Param, 0, 3, F0);
+			}
+			gxmState.setFragmentTexture(gxmContext, 0, terrainDiffuseTex.getTexture());
+			gxmState.setFragmentTexture(gxmContext, 1, terrainNormalTex.getTexture());
+			gxmState.setFragmentTexture(gxmContext, 2, terrainRoughTex.getTexture());
+			if (terrainUseDrawRecords)
+			{
+				terrainDrawRecords.setFragmentState(gxmContext, gxmBackBufferIndex, TerrainDrawRecords::PASS_FULL);
 			}
-		}
 
-		//sceClibPrintf("Rendered %d/%d chunks\n", renderedChunks, Terrain::CHUNKS_PER_SIDE * Terrain::CHUNKS_PER_SIDE);
+			int renderedChunks = 0;
+			int cachedChunks = 0;
+			bool hasSimpleChunks = false;
+			if (terrainInstanced)
+			{
+				// One instanced draw per LOD, every chunk of that LOD shares the same mesh
+				for (int lod = 0; lod < SIMPLE_SHADER_LOD; lod++)
+				{
+					renderedChunks += drawTerrainInstanceBatch(terrain.getSharedMesh(),
+						terrain.getIndexVariant((TerrainChunk::LODLevel)lod, 0),
+						vertexPoolBase, indexPoolBase, frameTerrainInstances, terrainBatches[lod]);
+				}
+				for (int lod = SIMPLE_SHADER_LOD; lod < TerrainChunk::LOD_COUNT; lod++)
+				{
+					hasSimpleChunks |= (terrainBatches[lod].instanceCount > 0);
+				}
+			}
+			else
+			{
+				bool hasDistantChunks = false;
+				for (TerrainChunk* chunk : visibleChunks)
+				{
+					if (chunk->getCurrentLOD() >= SIMPLE_SHADER_LOD)
+					{
+						hasDistantChunks = true;
+						continue;
+					}
+
+					drawTerrainChunk(chunk, noCacheParams);
+					renderedChunks++;
+				}
 
-		//then basic cubes
-		sceGxmSetVertexProgram(gxmContext, gxmBasicVertexProgramPatched);
-		sceGxmSetFragmentProgram(gxmContext, gxmBasicFragmentProgramPatched);
+				// Pass 2: Distant chunks with a baked tile — one material cache sample, no lighting
+				if (hasDistantChunks && terrainMaterialCache.isInitialized())
+				{
+					gxmState.setFragmentProgram(gxmContext, gxmTerrainCachedFragmentProgramPatched);
+					gxmState.setFragmentTexture(gxmContext, 3, terrainMaterialCache.getTexture());
+					if (terrainUseDrawRecords)
+					{
+						terrainDrawRecords.setFragmentState(gxmContext, gxmBackBufferIndex, TerrainDrawRecords::PASS_CACHED);
+					}
+
+					for (TerrainChunk* chunk : visibleChunks)
+					{
+						if (chunk->getCurrentLOD() < SIMPLE_SHADER_LOD)
+							continue;
+						if (!terrainMaterialCache.isBaked(chunk))
+						{
+							hasSimpleChunks = true;
+							continue;
+						}
+
+						float cacheParams[3];
+						terrainMaterialCache.getTileParams(chunk, cacheParams);
+						drawTerrainChunk(chunk, cacheParams);
+						renderedChunks++;
+						cachedChunks++;
+					}
+				}
+				else
+				{
+					hasSimpleChunks = hasDistantChunks;
+				}
+			}
+			benchmarkSetCounter(benchmarkState, BENCH_COUNTER_TERRAIN_CACHED_CHUNKS, (float)cachedChunks);
+
+			// Pass 3: Distant chunks without a baked tile (LOD_2+) — simple Lambertian shader, 1 texture sample
+			if (hasSimpleChunks)
+			{
+				gxmState.setFragmentProgram(gxmContext, gxmTerrainSimpleFragmentProgramPatched);
+				// TEXUNIT0 (diffuse) already bound from PBR pass
+				if (terrainUseDrawRecords)
+				{
+					terrainDrawRecords.setFragmentState(gxmContext, gxmBackBufferIndex, TerrainDrawRecords::PASS_SIMPLE);
+				}
+
+				if (terrainInstanced)
+				{
+					for (int lod = SIMPLE_SHADER_LOD; lod < TerrainChunk::LOD_COUNT; lod++)
+					{
+						renderedChunks += drawTerrainInstanceBatch(terrain.getSharedMesh(),
+							terrain.getIndexVariant((TerrainChunk::LODLevel)lod, 0),
+							vertexPoolBase, indexPoolBase, frameTerrainInstances, terrainBatches[lod]);
+					}
+				}
+				else
+				{
+					for (TerrainChunk* chunk : visibleChunks)
+					{
+						if (chunk->getCurrentLOD() < SIMPLE_SHADER_LOD || terrainMaterialCache.isBaked(chunk))
+							continue;
+
+						drawTerrainChunk(chunk, noCacheParams);
+						renderedChunks++;
+					}
+				}
+			}
 
-		void* basicVertexBufferA;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &basicVertexBufferA);
-		sceGxmSetUniformDataF(basicVertexBufferA, gxmBasicVertexProgram_u_modelMatrixParam, 0, 16, (float*)colorCubeModelMatrix.getData());
+			if (terrainUseDrawRecords)
+			{
+				terrainDrawRecords.clearState(gxmContext);
+			}
+			benchmarkSetCounter(benchmarkState, BENCH_COUNTER_TERRAIN_SUBMIT_US, (float)(sceKernelGetProcessTimeWide() - terrainSubmitStart));
 
-		void* basicVertexBufferB;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &basicVertexBufferB);
-		sceGxmSetUniformDataF(basicVertexBufferB, gxmBasicVertexProgram_u_viewMatrixParam, 0, 16, (float*)camera.getViewMatrix().getData());
+			//sceClibPrintf("Rendered %d/%d chunks\n", renderedChunks, Terrain::CHUNKS_PER_SIDE * Terrain::CHUNKS_PER_SIDE);
+		};
 
-		void* basicVertexBufferC;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &basicVertexBufferC);
-		sceGxmSetUniformDataF(basicVertexBufferC, gxmBasicVertexProgram_u_projectionMatrixParam, 0, 16, (float*)camera.getProjectionMatrix().getData());
+		// Colour cube
+		auto drawColorCube = [&](SceGxmContext* context)
+		{
+			void* basicVertexBufferA;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &basicVertexBufferA);
+			sceGxmSetUniformDataF(basicVertexBufferA, gxmBasicVertexProgram_u_modelMatrixParam, 0, 16, (float*)colorCubeModelMatrix.getData());
 
-		sceGxmSetVertexStream(gxmContext, 0, cVertexData);
-		sceGxmDraw(gxmContext, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U16, indexData, 36);
+			void* basicVertexBufferB;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &basicVertexBufferB);
+			sceGxmSetUniformDataF(basicVertexBufferB, gxmBasicVertexProgram_u_viewMatrixParam, 0, 16, (float*)camera.getViewMatrix().getData());
 
-		// render lit textured cubes
-		sceGxmSetVertexProgram(gxmContext, gxmTexturedLitInstancedVertexProgramPatched);
-		sceGxmSetFragmentProgram(gxmContext, gxmTexturedLitFragmentProgramPatched);
+			void* basicVertexBufferC;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &basicVertexBufferC);
+			sceGxmSetUniformDataF(basicVertexBufferC, gxmBasicVertexProgram_u_projectionMatrixParam, 0, 16, (float*)camera.getProjectionMatrix().getData());
 
+			sceGxmSetVertexStream(context, 0, cVertexData);
+			sceGxmDraw(context, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U16, indexData, 36);
+		};
+
+		// lit textured cubes
 		//populate per-frame uniform data
-		memcpy(perFrameVertexUniformBuffer->viewMatrix, camera.getViewMatrix().getData(), sizeof(float) * 16);
+		memcpy(perFrameVertexUniformBuffer->viewMatrix, renderViewMatrix.getData(), sizeof(float) * 16);
 		memcpy(perFrameVertexUniformBuffer->projectionMatrix, camera.getProjectionMatrix().getData(), sizeof(float) * 16);
-		// Update instance data buffer with model matrices
-		for (int i = 0; i < _litCubes.size(); i++) 
-		{
-			memcpy(instanceDataBuffer[i].modelMatrix,
-				_litCubes[i].modelMatrix.getData(),
-				sizeof(float) * 16);
-		}
+		// Bring this display buffer's copy of the instances up to date, nothing to write while the cubes stay put
+		unsigned int instanceUploadBytes = litCubeInstances.upload(gxmBackBufferIndex);
+		benchmarkSetCounter(benchmarkState, BENCH_COUNTER_INSTANCE_UPLOAD_BYTES, (float)instanceUploadBytes);
 
 		perFrameFragmentUniformBuffer->lightCount = 3;
 		for (int i = 0; i < 3; i++)
 		{
-			perFrameFragmentUniformBuffer->lightPositions[i][0] = lights[i].getPosition().x;
-			perFrameFragmentUniformBuffer->lightPositions[i][1] = lights[i].getPosition().y;
-			perFrameFragmentUniformBuffer->lightPositions[i][2] = lights[i].getPosition().z;
+			Vector3f lightPosition = lights[i].getPosition() - renderOrigin;
+			perFrameFragmentUniformBuffer->lightPositions[i][0] = lightPosition.x;
+			perFrameFragmentUniformBuffer->lightPositions[i][1] = lightPosition.y;
+			perFrameFragmentUniformBuffer->lightPositions[i][2] = lightPosition.z;
 			perFrameFragmentUniformBuffer->lightPositions[i][3] = 1.0f; //padding
 			perFrameFragmentUniformBuffer->lightColors[i][0] = lights[i].getColor().r;
 			perFrameFragmentUniformBuffer->lightColors[i][1] = lights[i].getColor().g;
@@ -2635,126 +3192,175 @@ int main()
 			perFrameFragmentUniformBuffer->lightRadii[i] = lights[i].getRadius();
 		}
 
-		// Inactive lights (3-7) stay zero from pre-loop memset
-
-		perFrameFragmentUniformBuffer->cameraPosition[0] = cameraPosition.x;
-		perFrameFragmentUniformBuffer->cameraPosition[1] = cameraPosition.y;
-		perFrameFragmentUniformBuffer->cameraPosition[2] = cameraPosition.z;
-		
-		//bind the per-frame uniform buffer (container 0 from BUFFER[0] in the shader)
-		sceGxmSetVertexUniformBuffer(gxmContext, perFrameVertexInstancedContainer, perFrameVertexUniformBuffer);
-		sceGxmSetFragmentUniformBuffer(gxmContext, perFrameFragmentContainer, perFrameFragmentUniformBuffer);
-
-		//set texture
-		sceGxmSetFragmentTexture(gxmContext, 0, &allWhiteTexture);
-
-		//set vertex streams
-		sceGxmSetVertexStream(gxmContext, 0, ltVertexData);
-		sceGxmSetVertexStream(gxmContext, 1, instanceDataBuffer);
-
-		//draw the cubes
-		// TO DO: Change to instanced rendering
-		//for (int i = 0; i < _litCubes.size(); i++)
-		//{
-		//	LitCube& cube = _litCubes[i];
-
-		//	void* litCubeDefaultVUniformBuffer;
-		//	sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &litCubeDefaultVUniformBuffer);
+		// Inactive lights (3-7) stay zero from the memset at allocation
 
-		//	sceGxmSetUniformDataF(litCubeDefaultVUniformBuffer, gxmTexturedLitVertexProgram_u_modelMatrixParam, 0, 16, (float*)cube.modelMatrix.getData());
+		perFrameFragmentUniformBuffer->cameraPosition[0] = renderCameraPosition.x;
+		perFrameFragmentUniformBuffer->cameraPosition[1] = renderCameraPosition.y;
+		perFrameFragmentUniformBuffer->cameraPosition[2] = renderCameraPosition.z;
 
-		//	sceGxmDraw(gxmContext, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U16, texturedIndexData, 36);
-		//}
-
-		sceGxmDrawInstanced(gxmContext, 
-			SCE_GXM_PRIMITIVE_TRIANGLES, 
-			SCE_GXM_INDEX_FORMAT_U16, 
-			texturedIndexData, // Index buffer for one cube
-			36 * _litCubes.size(), // Total number of indices to render
-			36); // Index wrap count (restart after 36 indices, i.e. one cube)
-
-		// render textured cube
-		sceGxmSetVertexProgram(gxmContext, gxmTexturedVertexProgramPatched);
-		sceGxmSetFragmentProgram(gxmContext, gxmTexturedFragmentProgramPatched);
-
-		void* texturedVertexBufferA;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &texturedVertexBufferA);
-		sceGxmSetUniformDataF(texturedVertexBufferA, gxmTexturedVertexProgram_u_modelMatrixParam, 0, 16, (float*)texturedCubeModelMatrix.getData());
-
-		void* texturedVertexBufferB;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &texturedVertexBufferB);
-		sceGxmSetUniformDataF(texturedVertexBufferB, gxmTexturedVertexProgram_u_viewMatrixParam, 0, 16, (float*)camera.getViewMatrix().getData());
+		// Both lit batches draw the cube mesh with their own instance stream, offset moves their instances
+		// relative to the camera
+		auto drawLitInstances = [&](SceGxmContext* context, const InstanceData* instances, int instanceCount,
+			const Vector3f& offset)
+		{
+			void* instancedVertexDefaultBuffer;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &instancedVertexDefaultBuffer);
+			sceGxmSetUniformDataF(instancedVertexDefaultBuffer, gxmTexturedLitInstancedVertexProgram_u_instanceOffsetParam,
+				0, 3, &offset.x);
+
+			//bind the per-frame uniform buffer (container 0 from BUFFER[0] in the shader)
+			sceGxmSetVertexUniformBuffer(context, perFrameVertexInstancedContainer, perFrameVertexUniformBuffer);
+			sceGxmSetFragmentUniformBuffer(context, perFrameFragmentContainer, perFrameFragmentUniformBuffer);
+
+			sceGxmSetVertexStream(context, 0, ltVertexData);
+			sceGxmSetVertexStream(context, 1, instances);
+
+			sceGxmDrawInstanced(context, 
+				SCE_GXM_PRIMITIVE_TRIANGLES, 
+				SCE_GXM_INDEX_FORMAT_U16, 
+				texturedIndexData, // Index buffer for one cube
+				36 * instanceCount, // Total number of indices to render
+				36); // Index wrap count (restart after 36 indices, i.e. one cube)
+		};
+		auto drawLitCubes = [&](SceGxmContext* context)
+		{
+			drawLitInstances(context, litCubeInstances.getInstances(gxmBackBufferIndex), litCubeInstances.getCount(),
+				litCubeInstances.getOrigin() - renderOrigin);
+		};
+
+		// Rocks on the visible near chunks, the same cube mesh and lighting in the gravel texture
+		int scatterInstances = 0;
+		InstanceData* frameScatterInstances = nullptr;
+		if (scatterInstanceBuffer)
+		{
+			frameScatterInstances = scatterInstanceBuffer + gxmBackBufferIndex * terrainScatterMaxInstances;
+			scatterInstances = terrainScatter.writeInstances(visibleChunks, terrain.getModelMatrix(), renderOrigin,
+				frameScatterInstances[0].modelMatrix, terrainScatterMaxInstances);
+		}
+		benchmarkSetCounter(benchmarkState, BENCH_COUNTER_SCATTER_INSTANCES, (float)scatterInstances);
+		benchmarkSetCounter(benchmarkState, BENCH_COUNTER_SCATTER_CHUNKS, (float)terrainScatter.getActiveChunkCount());
+		auto drawScatter = [&](SceGxmContext* context)
+		{
+			// Written relative to the camera already
+			drawLitInstances(context, frameScatterInstances, scatterInstances, Vector3f(0.0f, 0.0f, 0.0f));
+		};
 
-		void* texturedVertexBufferC;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &texturedVertexBufferC);
-		sceGxmSetUniformDataF(texturedVertexBufferC, gxmTexturedVertexProgram_u_projectionMatrixParam, 0, 16, (float*)camera.getProjectionMatrix().getData());
+		// textured cube
+		auto drawTexturedCube = [&](SceGxmContext* context)
+		{
+			void* texturedVertexBufferA;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &texturedVertexBufferA);
+			sceGxmSetUniformDataF(texturedVertexBufferA, gxmTexturedVertexProgram_u_modelMatrixParam, 0, 16, (float*)texturedCubeModelMatrix.getData());
 
-		sceGxmSetFragmentTexture(gxmContext, 0, &texture);
-		sceGxmSetVertexStream(gxmContext, 0, tVertexData);
-		sceGxmDraw(gxmContext, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U16, texturedIndexData, 36);
+			void* texturedVertexBufferB;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &texturedVertexBufferB);
+			sceGxmSetUniformDataF(texturedVertexBufferB, gxmTexturedVertexProgram_u_viewMatrixParam, 0, 16, (float*)camera.getViewMatrix().getData());
 
-		// render alpha cube
+			void* texturedVertexBufferC;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &texturedVertexBufferC);
+			sceGxmSetUniformDataF(texturedVertexBufferC, gxmTexturedVertexProgram_u_projectionMatrixParam, 0, 16, (float*)camera.getProjectionMatrix().getData());
 
-		//Disable backface culling and depth writes
-		sceGxmSetTwoSidedEnable(gxmContext, SCE_GXM_TWO_SIDED_ENABLED);
-		sceGxmSetFrontDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_DISABLED);
-		sceGxmSetBackDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_DISABLED);
+			sceGxmSetVertexStream(context, 0, tVertexData);
+			sceGxmDraw(context, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U16, texturedIndexData, 36);
+		};
 
-		// First pass, render the back faces of the cube
-		sceGxmSetCullMode(gxmContext, SCE_GXM_CULL_CCW);
+		// alpha cube
+		auto drawAlphaCube = [&](SceGxmContext* context)
+		{
+			//Disable backface culling and depth writes
+			sceGxmSetTwoSidedEnable(context, SCE_GXM_TWO_SIDED_ENABLED);
+			gxmState.setDepthWriteEnable(context, SCE_GXM_DEPTH_WRITE_DISABLED);
 
-		// Reserve new uniforms for the alpha cube draw call:
-		void* alphaVertexBufferA;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &alphaVertexBufferA);
-		sceGxmSetUniformDataF(alphaVertexBufferA, gxmTexturedVertexProgram_u_modelMatrixParam, 0, 16, (float*)alphaCubeModelMatrix.getData());
+			// First pass, render the back faces of the cube
+			sceGxmSetCullMode(context, SCE_GXM_CULL_CCW);
 
-		void* alphaVertexBufferB;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &alphaVertexBufferB);
-		sceGxmSetUniformDataF(alphaVertexBufferB, gxmTexturedVertexProgram_u_viewMatrixParam, 0, 16, (float*)camera.getViewMatrix().getData());
+			// Reserve new uniforms for the alpha cube draw call:
+			void* alphaVertexBufferA;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &alphaVertexBufferA);
+			sceGxmSetUniformDataF(alphaVertexBufferA, gxmTexturedVertexProgram_u_modelMatrixParam, 0, 16, (float*)alphaCubeModelMatrix.getData());
 
-		void* alphaVertexBufferC;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &alphaVertexBufferC);
-		sceGxmSetUniformDataF(alphaVertexBufferC, gxmTexturedVertexProgram_u_projectionMatrixParam, 0, 16, (float*)camera.getProjectionMatrix().getData());
+			void* alphaVertexBufferB;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &alphaVertexBufferB);
+			sceGxmSetUniformDataF(alphaVertexBufferB, gxmTexturedVertexProgram_u_viewMatrixParam, 0, 16, (float*)camera.getViewMatrix().getData());
 
-		// Reuse the same texture and vertex stream
-		sceGxmSetFragmentTexture(gxmContext, 0, &alphaTexture);
-		sceGxmSetVertexStream(gxmContext, 0, tVertexData);
+			void* alphaVertexBufferC;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &alphaVertexBufferC);
+			sceGxmSetUniformDataF(alphaVertexBufferC, gxmTexturedVertexProgram_u_projectionMatrixParam, 0, 16, (float*)camera.getProjectionMatrix().getData());
 
-		sceGxmDraw(gxmContext, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U16, texturedIndexData, 36);
+			sceGxmSetVertexStream(context, 0, tVertexData);
 
-		// Second pass, render the front faces of the cube
-		sceGxmSetCullMode(gxmContext, SCE_GXM_CULL_CW);
+			sceGxmDraw(context, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U16, texturedIndexData, 36);
 
-		// Reuse the same uniforms and texture
-		sceGxmDraw(gxmContext, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U16, texturedIndexData, 36);
+			// Second pass, render the front faces of the cube
+			sceGxmSetCullMode(context, SCE_GXM_CULL_CW);
 
-		// Re-enable backface culling and depth writes
-		sceGxmSetTwoSidedEnable(gxmContext, SCE_GXM_TWO_SIDED_DISABLED);
-		sceGxmSetFrontDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_ENABLED);
-		sceGxmSetBackDepthWriteEnable(gxmContext, SCE_GXM_DEPTH_WRITE_ENABLED);
+			// Reuse the same uniforms and texture
+			sceGxmDraw(context, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U16, texturedIndexData, 36);
 
-		// render surface
-		sceGxmSetVertexProgram(gxmContext, gxmTexturedScreenLiteralVertexProgramPatched);
-		sceGxmSetFragmentProgram(gxmContext, gxmTexturedScreenLiteralFragmentProgramPatched);
+			// Re-enable backface culling and depth writes
+			sceGxmSetTwoSidedEnable(context, SCE_GXM_TWO_SIDED_DISABLED);
+			gxmState.setDepthWriteEnable(context, SCE_GXM_DEPTH_WRITE_ENABLED);
+		};
 
-		void* surfaceVertexBufferA;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &surfaceVertexBufferA);
-		sceGxmSetUniformDataF(surfaceVertexBufferA, gxmTexturedScreenLiteralVertexProgram_u_alphaParam, 0, 1, &alpha);
+		// surface
+		auto drawSurface = [&](SceGxmContext* context)
+		{
+			void* surfaceVertexBufferA;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &surfaceVertexBufferA);
+			sceGxmSetUniformDataF(surfaceVertexBufferA, gxmTexturedScreenLiteralVertexProgram_u_alphaParam, 0, 1, &alpha);
 
-		void* surfaceVertexBufferB;
-		sceGxmReserveVertexDefaultUniformBuffer(gxmContext, &surfaceVertexBufferB);
-		sceGxmSetUniformDataF(surfaceVertexBufferB, gxmTexturedScreenLiteralVertexProgram_u_transformParam, 0, 16, (float*)surfaceTransformationMatrix.getData());
+			void* surfaceVertexBufferB;
+			sceGxmReserveVertexDefaultUniformBuffer(context, &surfaceVertexBufferB);
+			sceGxmSetUniformDataF(surfaceVertexBufferB, gxmTexturedScreenLiteralVertexProgram_u_transformParam, 0, 16, (float*)surfaceTransformationMatrix.getData());
 
-		sceGxmSetFragmentTexture(gxmContext, 0, &texture);
-		sceGxmSetVertexStream(gxmContext, 0, sVertexData);
+			sceGxmSetVertexStream(context, 0, sVertexData);
 
-		sceGxmDraw(gxmContext, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U32, surfaceIndexData, 6);
+			sceGxmDraw(context, SCE_GXM_PRIMITIVE_TRIANGLES, SCE_GXM_INDEX_FORMAT_U32, surfaceIndexData, 6);
+		};
 
-		// Draw MSAA indicator (skip during benchmark to avoid skewing results)
-		if (!benchmarkState.active)
+		// MSAA indicator, sets its own programs
+		auto drawIndicator = [](SceGxmContext*)
 		{
 			drawMsaaIndicator();
+		};
+
+		// Submit in any order, the keys decide it
+		renderQueue.begin();
+		renderQueue.submit(RenderQueue::makeKey(RenderQueue::PASS_OPAQUE, RENDER_PROGRAM_TERRAIN, RENDER_TEXTURES_NONE, 0.0f),
+			nullptr, nullptr, nullptr, drawTerrain);
+		renderQueue.submit(RenderQueue::makeKey(RenderQueue::PASS_OPAQUE, RENDER_PROGRAM_BASIC, RENDER_TEXTURES_NONE,
+			(colorCubePosition - cameraPosition).length()),
+			gxmBasicVertexProgramPatched, gxmBasicFragmentProgramPatched, nullptr, drawColorCube);
+		if (litCubeInstances.getCount() > 0)
+		{
+			renderQueue.submit(RenderQueue::makeKey(RenderQueue::PASS_OPAQUE, RENDER_PROGRAM_TEXTURED_LIT, RENDER_TEXTURES_WHITE, 0.0f),
+				gxmTexturedLitInstancedVertexProgramPatched, gxmTexturedLitFragmentProgramPatched, &allWhiteTexture, drawLitCubes);
+		}
+		if (scatterInstances > 0)
+		{
+			renderQueue.submit(RenderQueue::makeKey(RenderQueue::PASS_OPAQUE, RENDER_PROGRAM_TEXTURED_LIT, RENDER_TEXTURES_GRAVEL, 0.0f),
+				gxmTexturedLitInstancedVertexProgramPatched, gxmTexturedLitFragmentProgramPatched, terrainDiffuseTex.getTexture(),
+				drawScatter);
 		}
+		renderQueue.submit(RenderQueue::makeKey(RenderQueue::PASS_OPAQUE, RENDER_PROGRAM_TEXTURED, RENDER_TEXTURES_LOGO,
+			(texturedCubePosition - cameraPosition).length()),
+			gxmTexturedVertexProgramPatched, gxmTexturedFragmentProgramPatched, &texture, drawTexturedCube);
+		renderQueue.submit(RenderQueue::makeKey(RenderQueue::PASS_TRANSPARENT, RENDER_PROGRAM_TEXTURED, RENDER_TEXTURES_LOGO_ALPHA,
+			(alphaCubePosition - cameraPosition).length()),
+			gxmTexturedVertexProgramPatched, gxmTexturedFragmentProgramPatched, &alphaTexture, drawAlphaCube);
+		renderQueue.submit(RenderQueue::makeKey(RenderQueue::PASS_OVERLAY, RENDER_PROGRAM_SCREEN, RENDER_TEXTURES_LOGO, 0.0f),
+			gxmTexturedScreenLiteralVertexProgramPatched, gxmTexturedScreenLiteralFragmentProgramPatched, &texture, drawSurface);
+		// skip during benchmark to avoid skewing results
+		if (!benchmarkState.active)
+		{
+			renderQueue.submit(RenderQueue::makeKey(RenderQueue::PASS_OVERLAY, RENDER_PROGRAM_INDICATOR, RENDER_TEXTURES_NONE, 1.0f),
+				nullptr, nullptr, nullptr, drawIndicator);
+		}
+
+		renderQueue.execute(gxmContext, gxmState);
+		benchmarkSetCounter(benchmarkState, BENCH_COUNTER_RENDER_PACKETS, (float)renderQueue.getPacketCount());
+		benchmarkSetCounter(benchmarkState, BENCH_COUNTER_GXM_STATE_ISSUED, (float)gxmState.getIssuedCount());
+		benchmarkSetCounter(benchmarkState, BENCH_COUNTER_GXM_STATE_SKIPPED, (float)gxmState.getSkippedCount());
 
 		// Update previous button state for edge detection
 		prevButtons = ctrlData.buttons;
@@ -2769,6 +3375,13 @@ int main()
 			gxmMsaaModeChangeRequested = -1;
 			SceGxmMultisampleMode modes[] = { SCE_GXM_MULTISAMPLE_NONE, SCE_GXM_MULTISAMPLE_2X, SCE_GXM_MULTISAMPLE_4X };
 			reinitDisplaySurfaces(modes[gxmMsaaModeIndex]);
+			// Re-patched programs may reuse the old ones' addresses
+			gxmState.invalidate();
+			// The terrain fragment programs were re-patched, the GPU is idle
+			if (terrainDrawRecords.isInitialized())
+			{
+				initTerrainFragmentStates();
+			}
 		}
 	}
 
@@ -2799,6 +3412,19 @@ int main()
 	gpuFreeUnmap(colorCubeVertexDataUID);
 	gpuFreeUnmap(texturedCubeVertexDataUID);
 	gpuFreeUnmap(indexDataUID);
+	freeUniformBuffers();
+	litCubeInstances.release();
+	gpuFreeUnmap(terrainInstanceBufferUID);
+	if (scatterInstanceBuffer)
+	{
+		gpuFreeUnmap(scatterInstanceBufferUID);
+	}
+	if (terrainBakeUniformBuffer)
+	{
+		gpuFreeUnmap(terrainBakeUniformBufferUID);
+	}
+	terrainMaterialCache.release();
+	terrainDrawRecords.release();
 
 	//unregister programs and destroy shader patcher
 
@@ -2812,8 +3438,11 @@ int main()
 
 	sceClibPrintf("Releasing terrain shader programs\n");
 	sceGxmShaderPatcherReleaseVertexProgram(gxmShaderPatcher, gxmTerrainVertexProgramPatched);
+	sceGxmShaderPatcherReleaseVertexProgram(gxmShaderPatcher, gxmTerrainInstancedVertexProgramPatched);
 	sceGxmShaderPatcherReleaseFragmentProgram(gxmShaderPatcher, gxmTerrainFragmentProgramPatched);
 	sceGxmShaderPatcherReleaseFragmentProgram(gxmShaderPatcher, gxmTerrainSimpleFragmentProgramPatched);
+	sceGxmShaderPatcherReleaseFragmentProgram(gxmShaderPatcher, gxmTerrainBakeFragmentProgramPatched);
+	sceGxmShaderPatcherReleaseFragmentProgram(gxmShaderPatcher, gxmTerrainCachedFragmentProgramPatched);
 
 	sceClibPrintf("Unregistering clear shader programs\n");
 	sceGxmShaderPatcherUnregisterProgram(gxmShaderPatcher, gxmClearVertexProgramID);
@@ -2825,8 +3454,10 @@ int main()
 
 	sceClibPrintf("Unregistering terrain shader programs\n");
 	sceGxmShaderPatcherUnregisterProgram(gxmShaderPatcher, gxmTerrainVertexProgramID);
+	sceGxmShaderPatcherUnregisterProgram(gxmShaderPatcher, gxmTerrainInstancedVertexProgramID);
 	sceGxmShaderPatcherUnregisterProgram(gxmShaderPatcher, gxmTerrainFragmentProgramID);
 	sceGxmShaderPatcherUnregisterProgram(gxmShaderPatcher, gxmTerrainSimpleFragmentProgramID);
+	sceGxmShaderPatcherUnregisterProgram(gxmShaderPatcher, gxmTerrainCachedFragmentProgramID);
 
 	sceClibPrintf("Destroying GXM Shader Patcher\n");
 	sceGxmShaderPatcherDestroy(gxmShaderPatcher);
@@ -147,6 +147,17 @@ Matrix4x4 createViewMatrix(Vector3f position, Vector3f rotation)
 	return viewMatrix;
 }
 
+Matrix4x4 rebaseTransformationMatrix(const Matrix4x4& transform, Vector3f origin)
+{
+	//ROW MAJOR ORDER, the translation is the last column
+	Matrix4x4 rebased = transform;
+	rebased.getData()[3] -= origin.x;
+	rebased.getData()[7] -= origin.y;
+	rebased.getData()[11] -= origin.z;
+
+	return rebased;
+}
+
 Matrix4x4 createProjectionMatrix(float fov, float aspectRatio, float nearPlane, float farPlane)
 {
 	Matrix4x4 projectionMatrix;
@@ -156,6 +156,8 @@ inline Vector3f operator*(const Matrix4x4& mat, const Vector3f vec)
 
 Matrix4x4 createTransformationMatrix(Vector3f translation, Vector3f rotation, Vector3f scale);
 Matrix4x4 createViewMatrix(Vector3f position, Vector3f rotation);
+// Affine transform whose output is relative to origin instead of the world origin (camera-relative rendering)
+Matrix4x4 rebaseTransformationMatrix(const Matrix4x4& transform, Vector3f origin);
 Matrix4x4 createProjectionMatrix(float fov, float aspectRatio, float nearPlane, float farPlane);
 Matrix4x4 createOrthographicProjectionMatrix(float left, float right, float top, float bottom, float nearPlane, float farPlane);
 
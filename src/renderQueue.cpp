@@ -0,0 +1,133 @@
+#include "renderQueue.h"
+#include <string.h>
+
+// Keys are submitted with their packet index in the low 16 bits, already ascending, so sorting starts at byte 2
+static const int SORT_FIRST_BYTE = 2;
+
+// Distance as 24 ordered bits: the bit pattern of a non-negative float grows with its value
+static uint64_t quantizeDepth(float depth)
+{
+	if (!(depth > 0.0f))
+		return 0;
+
+	uint32_t bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	return (bits >> 7) & 0xFFFFFF;
+}
+
+RenderQueue::RenderQueue()
+{
+}
+
+uint64_t RenderQueue::makeKey(Pass pass, unsigned int program, unsigned int textureSet, float depth)
+{
+	uint64_t key = (uint64_t)pass << 60;
+	uint64_t state = ((uint64_t)(program & 0xFF) << 12) | (textureSet & 0xFFF);
+	uint64_t distance = quantizeDepth(depth);
+
+	switch (pass)
+	{
+	case PASS_OPAQUE:
+		key |= (state << 40) | (distance << 16);
+		break;
+	case PASS_TRANSPARENT:
+		key |= ((~distance & 0xFFFFFF) << 36) | (state << 16);
+		break;
+	case PASS_OVERLAY:
+		key |= (distance << 36) | (state << 16);
+		break;
+	}
+	return key;
+}
+
+void RenderQueue::begin()
+{
+	packets.clear();
+	keys.clear();
+}
+
+bool RenderQueue::submit(uint64_t key, const Packet& packet)
+{
+	if ((int)packets.size() == MAX_PACKETS)
+		return false;
+
+	keys.push_back(key | packets.size());
+	packets.push_back(packet);
+	return true;
+}
+
+void RenderQueue::execute(SceGxmContext* context, GxmStateCache& state)
+{
+	sortKeys();
+
+	for (uint64_t key : keys)
+	{
+		const Packet& packet = packets[key & 0xFFFF];
+		if (packet.vertexProgram)
+		{
+			state.setVertexProgram(context, packet.vertexProgram);
+			state.setFragmentProgram(context, packet.fragmentProgram);
+			if (packet.texture)
+			{
+				state.setFragmentTexture(context, 0, packet.texture);
+			}
+		}
+
+		packet.draw(context, packet.data);
+	}
+}
+
+int RenderQueue::getPacketCount() const
+{
+	return (int)keys.size();
+}
+
+// LSD radix sort, a byte per pass. One scan builds every pass's histogram, and bytes all keys share are skipped
+void RenderQueue::sortKeys()
+{
+	const size_t count = keys.size();
+	if (count < 2)
+		return;
+
+	unsigned int histograms[8][256];
+	memset(histograms, 0, sizeof(histograms));
+	for (uint64_t key : keys)
+	{
+		for (int byte = SORT_FIRST_BYTE; byte < 8; byte++)
+		{
+			histograms[byte][(key >> (byte * 8)) & 0xFF]++;
+		}
+	}
+
+	scratch.resize(count);
+	uint64_t* src = keys.data();
+	uint64_t* dst = scratch.data();
+	for (int byte = SORT_FIRST_BYTE; byte < 8; byte++)
+	{
+		unsigned int* histogram = histograms[byte];
+		if (histogram[(src[0] >> (byte * 8)) & 0xFF] == count)
+			continue;
+
+		unsigned int offset = 0;
+		for (int i = 0; i < 256; i++)
+		{
+			unsigned int bucket = histogram[i];
+			histogram[i] = offset;
+			offset += bucket;
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			uint64_t key = src[i];
+			dst[histogram[(key >> (byte * 8)) & 0xFF]++] = key;
+		}
+
+		uint64_t* swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	if (src != keys.data())
+	{
+		keys.swap(scratch);
+	}
+}
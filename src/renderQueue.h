@@ -0,0 +1,75 @@
+#pragma once
+
+#include "gxmStateCache.h"
+#include <psp2/gxm.h>
+#include <stdint.h>
+#include <vector>
+
+// Per-frame list of draw packets, executed in the order of their 64-bit sort keys
+// Systems submit packets in any order. execute radix sorts the keys once and replays the packets, setting their
+// programs and unit 0 texture through the state cache, so packets sharing a program and texture set run back to
+// back without rebinding as object counts grow
+// Key layout, most significant first, by pass:
+//	opaque		pass:4 program:8 textureSet:12 depth:24 (front to back within a state)
+//	transparent	pass:4 ~depth:24 program:8 textureSet:12 (back to front)
+//	overlay		pass:4 layer:24 program:8 textureSet:12 (ascending layer, for screen space draws)
+// The low 16 bits hold the packet's index, so equal keys keep their submission order
+class RenderQueue
+{
+public:
+	enum Pass
+	{
+		PASS_OPAQUE = 0,
+		PASS_TRANSPARENT,
+		PASS_OVERLAY
+	};
+
+	static const int MAX_PACKETS = 1 << 16;
+
+	typedef void (*DrawFunction)(SceGxmContext* context, const void* data);
+
+	struct Packet
+	{
+		const SceGxmVertexProgram* vertexProgram;		// nullptr when the draw sets its own programs and textures
+		const SceGxmFragmentProgram* fragmentProgram;
+		const SceGxmTexture* texture;					// unit 0, nullptr leaves it as it is
+		DrawFunction draw;
+		const void* data;
+	};
+
+	RenderQueue();
+
+	// Pack a key for pass, program and textureSet are the caller's ids (8 and 12 bits) of the state the packet
+	// sets, depth its distance from the camera (or the layer in the overlay pass)
+	static uint64_t makeKey(Pass pass, unsigned int program, unsigned int textureSet, float depth);
+
+	// Start a frame's list
+	void begin();
+	// Add a packet calling draw(context) at execute. draw must live until then. Returns false when the queue is full
+	template<class F>
+	bool submit(uint64_t key, const SceGxmVertexProgram* vertexProgram, const SceGxmFragmentProgram* fragmentProgram,
+		const SceGxmTexture* texture, const F& draw)
+	{
+		Packet packet = { vertexProgram, fragmentProgram, texture, &invokeDraw<F>, &draw };
+		return submit(key, packet);
+	}
+	bool submit(uint64_t key, const Packet& packet);
+	// Sort the packets and draw them, state is the cache in front of context
+	void execute(SceGxmContext* context, GxmStateCache& state);
+
+	// Packets drawn by the last execute
+	int getPacketCount() const;
+
+private:
+	template<class F>
+	static void invokeDraw(SceGxmContext* context, const void* data)
+	{
+		(*(const F*)data)(context);
+	}
+
+	void sortKeys();
+
+	std::vector<Packet> packets;
+	std::vector<uint64_t> keys;
+	std::vector<uint64_t> scratch;	// radix sort ping-pong buffer
+};
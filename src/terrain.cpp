@@ -1,11 +1,123 @@
 #include "terrain.h"
+#include "terrainStream.h"
+#include "terrainCache.h"
 #include "memory.h"
 #include <psp2/kernel/clib.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/threadmgr.h>
+#include <atomic>
 #include <cmath>
+#include <cfloat>
 #include <algorithm>
 
 // Vertices per side for each LOD (densest first)
 static const int LOD_VERTICES[TerrainChunk::LOD_COUNT] = { 65, 33, 17, 9, 3, };
+static_assert(TerrainHeightField::CELLS == Terrain::CHUNK_GRID_SIZE, "height field tiles must match the LOD_0 grid");
+
+// LOD selection tuning
+static const float DEFAULT_PIXEL_ERROR = 1.0f;
+// Error floor per LOD as a fraction of its vertex spacing, so flat terrain still refines near the camera
+// (shading and texture filtering change with density even when heights don't)
+static const float ERROR_FLOOR_PER_SPACING = 0.02f;
+// Last fraction of each LOD range spent morphing toward the next LOD
+static const float MORPH_FRACTION = 0.35f;
+// Budget controller: frame time smoothing, and how fast the budget may shrink or grow per frame
+static const float BUDGET_SMOOTHING = 0.1f;
+static const float BUDGET_MAX_SHRINK = 0.9f;
+static const float BUDGET_GROWTH = 1.01f;
+// Frame times within this fraction of the target leave the budget alone, so a settled budget stops
+// changing and updateLODs can skip reselecting while the view holds still
+static const float BUDGET_DEAD_BAND = 0.05f;
+// The window recenters once the camera is this many chunks off its center (hysteresis against
+// recentering back and forth on a chunk border)
+static const float WINDOW_RECENTER_CHUNKS = 0.75f;
+// Fraction past a LOD's switch distance a chunk must reach before it drops to that coarser LOD
+static const float LOD_HYSTERESIS = 0.1f;
+// Below these changes the view counts as unchanged and the last cull and LOD results are kept
+static const float VIEW_POSITION_EPSILON = 0.001f;
+static const float VIEW_MATRIX_EPSILON = 1e-5f;
+
+// Ratio of a LOD's vertex spacing to the next coarser LOD's (1 for the coarsest LOD)
+static int getNextLODRatio(int lod)
+{
+	if (lod + 1 >= TerrainChunk::LOD_COUNT)
+	{
+		return 1;
+	}
+
+	return (LOD_VERTICES[lod] - 1) / (LOD_VERTICES[lod + 1] - 1);
+}
+
+// Smallest error used for a LOD, see ERROR_FLOOR_PER_SPACING
+static float getErrorFloor(int lod)
+{
+	if (lod == TerrainChunk::LOD_0)
+	{
+		return 0.0f;
+	}
+
+	return Terrain::CHUNK_SIZE / (LOD_VERTICES[lod] - 1) * ERROR_FLOOR_PER_SPACING;
+}
+
+// True when a view matches the one the cached results were built for
+static bool isSameView(const Matrix4x4& viewProj, const Vector3f& cameraPos, const Matrix4x4& cachedViewProj, const Vector3f& cachedCameraPos)
+{
+	Vector3f d = cameraPos - cachedCameraPos;
+	if (d.x * d.x + d.y * d.y + d.z * d.z > VIEW_POSITION_EPSILON * VIEW_POSITION_EPSILON)
+	{
+		return false;
+	}
+
+	const float* a = viewProj.getData();
+	const float* b = cachedViewProj.getData();
+	for (int i = 0; i < 16; i++)
+	{
+		if (std::abs(a[i] - b[i]) > VIEW_MATRIX_EPSILON)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Initial chunk builds: the calling thread plus workers on the other user cores, pulling chunks off a shared counter
+static const int MAX_BUILD_THREADS = 3;
+static const int BUILD_THREAD_PRIORITY = 0x10000100;
+static const int BUILD_THREAD_STACK_SIZE = 64 * 1024;
+static const int BUILD_THREAD_CPU_MASKS[MAX_BUILD_THREADS] = { 0 /* calling thread */, SCE_KERNEL_CPU_MASK_USER_1, SCE_KERNEL_CPU_MASK_USER_2 };
+
+struct TerrainBuildWorker
+{
+	std::vector<std::unique_ptr<TerrainChunk>>* chunks;
+	const TerrainHeightSource* heightSource;
+	std::atomic<int>* nextChunk;
+	TerrainHeightField* heightField;
+	TerrainChunk::BuildScratch scratch;
+	SceUInt64 busyUs;
+	int builtCount;
+};
+
+static void runBuildWorker(TerrainBuildWorker& worker)
+{
+	const int chunkCount = (int)worker.chunks->size();
+	int index;
+	while ((index = worker.nextChunk->fetch_add(1)) < chunkCount)
+	{
+		SceUInt64 startTime = sceKernelGetProcessTimeWide();
+		TerrainChunk* chunk = (*worker.chunks)[index].get();
+		chunk->buildInPlace(worker.heightSource, worker.scratch);
+		worker.heightField->setTile(chunk->getChunkX(), chunk->getChunkZ(), &worker.scratch.vertices[0].y, sizeof(TerrainPBRVertex));
+		worker.busyUs += sceKernelGetProcessTimeWide() - startTime;
+		worker.builtCount++;
+	}
+}
+
+static int buildThreadEntry(SceSize /*args*/, void* argp)
+{
+	TerrainBuildWorker* worker = *(TerrainBuildWorker**)argp;
+	runBuildWorker(*worker);
+	return 0; // buildChunks waits for the thread to end and deletes it
+}
 
 TerrainBufferPool::TerrainBufferPool()
 	: vertexPoolUID(-1), indexPoolUID(-1),
@@ -106,165 +218,283 @@ void* TerrainBufferPool::getIndexPoolBase() const
 }
 
 TerrainChunk::TerrainChunk(int chunkXin, int chunkZin, float chunkWorldSize, float terrainHeight)
-	: chunkX(chunkXin), chunkZ(chunkZin), chunkSize(chunkWorldSize), currentLOD(LOD_0), bufferPool(nullptr)
+	: bufferPool(nullptr), heightSource(nullptr), chunkX(chunkXin), chunkZ(chunkZin), chunkSize(chunkWorldSize),
+	currentLOD(LOD_0), stitchMask(0), resident(false), vertexFormat(VERTEX_FORMAT_FLOAT)
 {
 	// Calculate world position of chunk center
 	center.x = (chunkX + 0.5f) * chunkSize;
-	center.y = (terrainHeight);
 	center.z = (chunkZ + 0.5f) * chunkSize;
 
-	// Bounding radius for frustum culling
-	boundingRadius = chunkSize * 0.707f; // sqrt(2)/2
+	// Bounding sphere for frustum culling, refit once heights are generated
+	updateBounds(terrainHeight, terrainHeight);
 
-	// Generate all LODs
 	for (int i = 0; i < LOD_COUNT; i++)
 	{
-		//generateLODMesh(LOD_VERTICES[i], lodMeshes[i]);
-		lodMeshes[i].tempVertices = new std::vector<TerrainPBRVertex>();
-		lodMeshes[i].tempIndices = new std::vector<uint16_t>();
+		geometricError[i] = 0.0f;
 	}
+
+	// Meshes are only generated for chunks that own them (see Terrain::createChunks)
+	mesh.vertexAlloc = {};
+	mesh.vertexCount = 0;
+	mesh.tempVertices = nullptr;
 }
 
 TerrainChunk::~TerrainChunk()
 {
+	releaseCPUData();
 }
 
-void TerrainChunk::initializeWithPool(TerrainBufferPool* pool)
+void TerrainChunk::allocateFromPool(TerrainBufferPool* pool, VertexFormat format)
 {
 	bufferPool = pool;
+	vertexFormat = format;
 
-	// Generate all LODs
-	for (int i = 0; i < LOD_COUNT; i++)
-	{
-		generateLODMesh(LOD_VERTICES[i], lodMeshes[i]);
+	//Allocate GPU memory from pool, every LOD draws from the LOD_0 grid
+	mesh.vertexCount = LOD_VERTICES[LOD_0] * LOD_VERTICES[LOD_0];
+	mesh.vertexAlloc = bufferPool->allocateVertices(mesh.vertexCount * getVertexStride(vertexFormat));
+}
 
-		//Allocate GPU memory from pool
-		size_t vertexSize = lodMeshes[i].vertexCount * sizeof(TerrainPBRVertex);
-		size_t indexSize = lodMeshes[i].indexCount * sizeof(uint16_t);
+void TerrainChunk::generate(const TerrainHeightSource* source)
+{
+	heightSource = source;
 
-		lodMeshes[i].vertexAlloc = bufferPool->allocateVertices(vertexSize);
-		lodMeshes[i].indexAlloc = bufferPool->allocateIndices(indexSize);
+	if (!mesh.tempVertices)
+	{
+		mesh.tempVertices = new std::vector<TerrainPBRVertex>();
 	}
+	mesh.tempVertices->resize(LOD_VERTICES[LOD_0] * LOD_VERTICES[LOD_0]);
+	mesh.vertexCount = mesh.tempVertices->size();
+
+	std::vector<float> heights;
+	generateGrid(mesh.tempVertices->data(), heights);
 }
 
-void TerrainChunk::calculateMemoryRequirements(size_t& vertexSize, size_t& indexSize)
+void TerrainChunk::buildInPlace(const TerrainHeightSource* source, BuildScratch& scratch)
 {
-	vertexSize = 0;
-	indexSize = 0;
+	heightSource = source;
 
-	for (int lod = 0; lod < LOD_COUNT; lod++)
-	{
-		int verticesPerSide = LOD_VERTICES[lod];
-		int vertexCount = verticesPerSide * verticesPerSide;
-		int gridSize = verticesPerSide - 1;
-		int indexCount = gridSize * gridSize * 6;
+	if (!mesh.vertexAlloc.gpuData)
+		return;
 
-		vertexSize += vertexCount * sizeof(TerrainPBRVertex);
-		indexSize += indexCount * sizeof(uint16_t);
-	}
+	scratch.vertices.resize(LOD_VERTICES[LOD_0] * LOD_VERTICES[LOD_0]);
+	generateGrid(scratch.vertices.data(), scratch.heights);
+	writeVertices(scratch.vertices.data());
 }
 
-//Upload mesh data to GPU pool
-void TerrainChunk::uploadToGPU()
+void TerrainChunk::restoreBuild(const TerrainHeightSource* source, float gridMinHeight, float gridMaxHeight,
+	const float errors[LOD_COUNT])
 {
+	heightSource = source;
+	updateBounds(gridMinHeight, gridMaxHeight);
 	for (int i = 0; i < LOD_COUNT; i++)
 	{
-		auto& mesh = lodMeshes[i];
+		geometricError[i] = errors[i];
+	}
+}
 
-		// Copy vertex data to GPU
-		if (mesh.tempVertices && mesh.vertexAlloc.gpuData)
+void TerrainChunk::readPoolHeights(float* out) const
+{
+	const int count = LOD_VERTICES[LOD_0] * LOD_VERTICES[LOD_0];
+	if (vertexFormat == VERTEX_FORMAT_COMPACT)
+	{
+		const TerrainCompactVertex* vertices = (const TerrainCompactVertex*)mesh.vertexAlloc.gpuData;
+		const float heightBase = getTerrainHeightQuantBase(minHeight);
+		for (int i = 0; i < count; i++)
 		{
-			memcpy(mesh.vertexAlloc.gpuData,
-				mesh.tempVertices->data(),
-				mesh.tempVertices->size() * sizeof(TerrainPBRVertex));
+			out[i] = heightBase + (float)vertices[i].h * TERRAIN_HEIGHT_QUANT_STEP;
 		}
-
-		// Copy index data to GPU
-		if (mesh.tempIndices && mesh.indexAlloc.gpuData)
+	}
+	else
+	{
+		const TerrainPBRVertex* vertices = (const TerrainPBRVertex*)mesh.vertexAlloc.gpuData;
+		for (int i = 0; i < count; i++)
 		{
-			memcpy(mesh.indexAlloc.gpuData,
-				mesh.tempIndices->data(),
-				mesh.tempIndices->size() * sizeof(uint16_t));
+			out[i] = vertices[i].y;
 		}
 	}
 }
 
-//Release temporary CPU data after upload
-void TerrainChunk::releaseCPUData()
+void TerrainChunk::generateGrid(TerrainPBRVertex* vertices, std::vector<float>& heightScratch)
 {
-	for (int i = 0; i < LOD_COUNT; i++)
+	// Heights, normals and tangents (Y is up and grid is on XZ plane), the coarser LODs are subsets of this grid
+	float gridMinHeight, gridMaxHeight;
+	generateTerrainGrid(heightSource, getGridParams(LOD_0), vertices, gridMinHeight, gridMaxHeight, heightScratch);
+
+	updateBounds(gridMinHeight, gridMaxHeight);
+	computeMorphTargets(vertices);
+}
+
+void TerrainChunk::computeMorphTargets(TerrainPBRVertex* vertices)
+{
+	const int side = LOD_VERTICES[LOD_0];
+
+	geometricError[LOD_0] = 0.0f;
+	for (int lod = LOD_1; lod < LOD_COUNT; lod++)
+	{
+		int step = getGridStep((LODLevel)lod);
+
+		float error = geometricError[lod - 1];
+		for (int z = 0; z < side; z++)
+		{
+			for (int x = 0; x < side; x++)
+			{
+				float coarseHeight = sampleCoarseGridHeight(vertices, side, step, x, z);
+				error = std::max(error, std::abs(vertices[z * side + x].y - coarseHeight));
+			}
+		}
+		geometricError[lod] = error;
+	}
+
+	// A vertex lies on the surface of every LOD up to the coarsest one containing it, so that LOD is the
+	// only one that morphs it. Fully morphed, it lies on the next LOD's surface (the coarsest LOD keeps zero deltas)
+	for (int z = 0; z < side; z++)
 	{
-		delete lodMeshes[i].tempVertices;
-		delete lodMeshes[i].tempIndices;
-		lodMeshes[i].tempVertices = nullptr;
-		lodMeshes[i].tempIndices = nullptr;
+		for (int x = 0; x < side; x++)
+		{
+			int lod = LOD_0;
+			while (lod < LOD_COUNT - 1 && x % getGridStep((LODLevel)(lod + 1)) == 0 && z % getGridStep((LODLevel)(lod + 1)) == 0)
+			{
+				lod++;
+			}
+
+			TerrainPBRVertex& v = vertices[z * side + x];
+			v.morphDelta = 0;
+			if (lod < LOD_COUNT - 1)
+			{
+				int nextStep = getGridStep((LODLevel)(lod + 1));
+				v.morphDelta = floatToF16(sampleCoarseGridHeight(vertices, side, nextStep, x, z) - v.y);
+			}
+		}
 	}
 }
 
-// Calculates LOD based on cylinder from center for horizontal distance plus height for vertical LOD reduction
-TerrainChunk::LODLevel TerrainChunk::calculateLOD(const Vector3f& cameraPos, const Vector3f& viewDir) const
+void TerrainChunk::calculateMemoryRequirements(size_t& vertexSize, VertexFormat format)
+{
+	// One LOD_0 grid, the coarser LODs index into it
+	int vertexCount = LOD_VERTICES[LOD_0] * LOD_VERTICES[LOD_0];
+	vertexSize = ALIGN(vertexCount * getVertexStride(format), 16);
+}
+
+size_t TerrainChunk::getVertexStride(VertexFormat format)
 {
-	// Horizontal edge (Square footprint)
-	float half = chunkSize * 0.5f;
-	// signed distance along each axis
-	float dx = std::abs(cameraPos.x - center.x) - half;
-	float dz = std::abs(cameraPos.z - center.z) - half;
-	//Only outside counts
-	float ex = std::max(dx, 0.0f);
-	float ez = std::max(dz, 0.0f);
-	//True euclidean distance outside of sqaure
-	float horizontalEdge = std::sqrt(ex * ex + ez * ez);
+	return (format == VERTEX_FORMAT_COMPACT) ? sizeof(TerrainCompactVertex) : sizeof(TerrainPBRVertex);
+}
+
+int TerrainChunk::getVerticesPerSide(LODLevel lod)
+{
+	return LOD_VERTICES[lod];
+}
 
-	// Vertical height above chunk top
-	float heightAbove = cameraPos.y - center.y;
-	heightAbove = std::max(heightAbove, 0.0f);
+int TerrainChunk::getGridStep(LODLevel lod)
+{
+	return Terrain::CHUNK_GRID_SIZE / (LOD_VERTICES[lod] - 1);
+}
+
+TerrainGridParams TerrainChunk::getGridParams(LODLevel lod) const
+{
+	// Vertices are addressed on the LOD_0 grid so shared edges match exactly between chunks and LODs
+	TerrainGridParams params;
+	params.gridX0 = chunkX * Terrain::CHUNK_GRID_SIZE;
+	params.gridZ0 = chunkZ * Terrain::CHUNK_GRID_SIZE;
+	params.step = getGridStep(lod);
+	params.verticesPerSide = LOD_VERTICES[lod];
+	params.gridSpacing = chunkSize / Terrain::CHUNK_GRID_SIZE;
+	// For correct tiling of texture
+	params.uvScale = Terrain::TEXTURE_TILE_COUNT / Terrain::TERRAIN_SIZE;
+	return params;
+}
 
-	// Height should have an effect on horizontal distance calculation too
-	const float horizontalMinHeight = 3.0f;
-	const float horizontalRampHeight = 25.0f; // ramp fully over this height
-	const float maxHorizontalHeightBoost = 3.0f;
+TerrainChunk::VertexFormat TerrainChunk::getVertexFormat() const
+{
+	return vertexFormat;
+}
 
-	// how far into the ramp we are [0�1]
-	float hb = std::clamp((heightAbove - horizontalMinHeight) / horizontalRampHeight, 0.0f, 1.0f);
-	float horizontalBoost = 1.0f + hb * (maxHorizontalHeightBoost - 1.0f);
+void TerrainChunk::getVertexOrigin(float origin[3]) const
+{
+	origin[0] = (float)(chunkX * Terrain::CHUNK_GRID_SIZE);
+	origin[1] = (float)(chunkZ * Terrain::CHUNK_GRID_SIZE);
+	origin[2] = getTerrainHeightQuantBase(minHeight);
+}
 
-	// Only consider height when we're looking down
-	// View angle boost from how much we're looking down (1.0 when straight down, 0 when horizontal)
-	float downDot = std::clamp(-viewDir.y, 0.0f, 1.0f);
-	float verticalContribution = heightAbove * downDot;
+//Upload mesh data to GPU pool
+void TerrainChunk::uploadToGPU()
+{
+	if (!mesh.tempVertices || !mesh.vertexAlloc.gpuData)
+		return;
 
-	float effectiveDistance = (horizontalEdge * horizontalBoost) + verticalContribution;
+	writeVertices(mesh.tempVertices->data());
+}
 
-	// Select LOD based on edge distance
-	for (int i = LOD_COUNT - 1; i >= 0; i--)
+void TerrainChunk::writeVertices(const TerrainPBRVertex* vertices)
+{
+	// Both paths write the allocation front to back, compact chunks quantize on the way
+	if (vertexFormat == VERTEX_FORMAT_COMPACT)
 	{
-		if (effectiveDistance >= LOD_DISTANCES[i])
+		int clamped = packTerrainVertices(vertices, getGridParams(LOD_0),
+			getTerrainHeightQuantBase(minHeight), (TerrainCompactVertex*)mesh.vertexAlloc.gpuData);
+		if (clamped > 0)
 		{
-			return static_cast<LODLevel>(i);
+			sceClibPrintf("WARNING: Terrain chunk (%d, %d): %d heights outside the compact vertex range\n",
+				chunkX, chunkZ, clamped);
 		}
 	}
+	else
+	{
+		memcpy(mesh.vertexAlloc.gpuData, vertices, mesh.vertexCount * sizeof(TerrainPBRVertex));
+	}
+}
+
+void TerrainChunk::moveTo(int newChunkX, int newChunkZ)
+{
+	chunkX = newChunkX;
+	chunkZ = newChunkZ;
+	center.x = (chunkX + 0.5f) * chunkSize;
+	center.z = (chunkZ + 0.5f) * chunkSize;
+	updateBounds(0.0f, 0.0f);
+
+	for (int i = 0; i < LOD_COUNT; i++)
+	{
+		geometricError[i] = 0.0f;
+	}
+	resident = false;
+}
+
+void TerrainChunk::adoptMeshData(TerrainChunk& generated)
+{
+	// The pool allocation stays with this chunk, only the CPU mesh changes hands
+	std::swap(mesh.tempVertices, generated.mesh.tempVertices);
+	for (int i = 0; i < LOD_COUNT; i++)
+	{
+		geometricError[i] = generated.geometricError[i];
+	}
+	updateBounds(generated.minHeight, generated.maxHeight);
+}
 
-	return LOD_0;
+bool TerrainChunk::isResident() const
+{
+	return resident;
 }
 
-TerrainChunk::LODMesh* TerrainChunk::getLODMesh(LODLevel lod)
+void TerrainChunk::setResident(bool isResident)
 {
-	return &lodMeshes[lod];
+	resident = isResident;
 }
 
-const TerrainChunk::LODMesh* TerrainChunk::getLODMesh(LODLevel lod) const
+//Release temporary CPU data after upload
+void TerrainChunk::releaseCPUData()
 {
-	return &lodMeshes[lod];
+	delete mesh.tempVertices;
+	mesh.tempVertices = nullptr;
 }
 
-TerrainChunk::LODMesh* TerrainChunk::getCurrentLODMesh()
+TerrainChunk::Mesh* TerrainChunk::getMesh()
 {
-	return &lodMeshes[currentLOD];
+	return &mesh;
 }
 
-const TerrainChunk::LODMesh* TerrainChunk::getCurrentLODMesh() const
+const TerrainChunk::Mesh* TerrainChunk::getMesh() const
 {
-	return &lodMeshes[currentLOD];
+	return &mesh;
 }
 
 Vector3f TerrainChunk::getCenter() const
@@ -277,6 +507,56 @@ float TerrainChunk::getBoundingRadius() const
 	return boundingRadius;
 }
 
+float TerrainChunk::getMinHeight() const
+{
+	return minHeight;
+}
+
+float TerrainChunk::getMaxHeight() const
+{
+	return maxHeight;
+}
+
+float TerrainChunk::getGeometricError(LODLevel lod) const
+{
+	return geometricError[lod];
+}
+
+void TerrainChunk::updateBounds(float minH, float maxH)
+{
+	minHeight = minH;
+	maxHeight = maxH;
+	center.y = (minH + maxH) * 0.5f;
+
+	// Sphere around the chunk's box: half diagonal of the square footprint plus half the height range
+	float halfSize = chunkSize * 0.5f;
+	float halfHeight = (maxH - minH) * 0.5f;
+	boundingRadius = sqrtf(2.0f * halfSize * halfSize + halfHeight * halfHeight);
+}
+
+int TerrainChunk::getChunkX() const
+{
+	return chunkX;
+}
+
+int TerrainChunk::getChunkZ() const
+{
+	return chunkZ;
+}
+
+void TerrainChunk::getInstanceData(TerrainInstanceData& instance) const
+{
+	// Shared meshes are generated at chunk (0,0), so the origin is also the UV offset scaled to texture tiles
+	float uvScale = Terrain::TEXTURE_TILE_COUNT / Terrain::TERRAIN_SIZE;
+	float originX = chunkX * chunkSize;
+	float originZ = chunkZ * chunkSize;
+
+	instance.chunkOrigin[0] = originX;
+	instance.chunkOrigin[1] = originZ;
+	instance.chunkOrigin[2] = originX * uvScale;
+	instance.chunkOrigin[3] = originZ * uvScale;
+}
+
 TerrainChunk::LODLevel TerrainChunk::getCurrentLOD() const
 {
 	return currentLOD;
@@ -287,33 +567,14 @@ void TerrainChunk::setCurrentLOD(LODLevel lod)
 	currentLOD = lod;
 }
 
-void FrustumPlanes::extractFromMatrix(const Matrix4x4& viewProjMatrix)
+int TerrainChunk::getStitchMask() const
 {
-	// Row-major layout:
-	// row0 = m[0],m[1],m[2],m[3]   row1 = m[4]..m[7]
-	// row2 = m[8]..m[11]           row3 = m[12]..m[15]
-	const float* m = viewProjMatrix.getData();
-
-	planes[0] = { m[12]+m[0], m[13]+m[1], m[14]+m[2],  m[15]+m[3]  }; // LEFT
-	planes[1] = { m[12]-m[0], m[13]-m[1], m[14]-m[2],  m[15]-m[3]  }; // RIGHT
-	planes[2] = { m[12]+m[4], m[13]+m[5], m[14]+m[6],  m[15]+m[7]  }; // BOTTOM
-	planes[3] = { m[12]-m[4], m[13]-m[5], m[14]-m[6],  m[15]-m[7]  }; // TOP
-	planes[4] = { m[12]+m[8], m[13]+m[9], m[14]+m[10], m[15]+m[11] }; // NEAR
-	planes[5] = { m[12]-m[8], m[13]-m[9], m[14]-m[10], m[15]-m[11] }; // FAR
+	return stitchMask;
+}
 
-	// Normalize all 6 planes once (instead of per-chunk)
-	for (int i = 0; i < 6; ++i)
-	{
-		float invLen = 1.0f / sqrtf(
-			planes[i].a * planes[i].a +
-			planes[i].b * planes[i].b +
-			planes[i].c * planes[i].c
-		);
-		planes[i].a *= invLen;
-		planes[i].b *= invLen;
-		planes[i].c *= invLen;
-		planes[i].d *= invLen;
-	}
+void TerrainChunk::setStitchMask(int mask)
+{
+	stitchMask = mask;
 }
 
 bool TerrainChunk::isInFrustum(const FrustumPlanes& frustum) const
@@ -332,93 +593,35 @@ bool TerrainChunk::isInFrustum(const FrustumPlanes& frustum) const
 	return true;
 }
 
-void TerrainChunk::generateLODMesh(int verticesPerSide, LODMesh& lodMesh)
+Terrain::Terrain()
+	: renderMode(RENDER_MODE_INSTANCED), pixelErrorThreshold(DEFAULT_PIXEL_ERROR),
+	triangleBudget(0), selectedTriangles(0), autoBudgetTargetMs(0.0f), autoBudgetMin(0), autoBudgetMax(0),
+	smoothedFrameMs(0.0f), heightSource(nullptr), buildThreadCount(MAX_BUILD_THREADS), cachePath(nullptr), windowX(0), windowZ(0), streaming(false),
+	streamFramesInFlight(0), streamUploadBudgetUs(0), streamFrame(0), chunkBoundsDirty(false),
+	hierarchicalCulling(true), chunkBoundsVersion(0),
+	cullHierarchical(true), cullHorizon(true), lodPixelsPerUnit(0.0f), lodPixelThreshold(0.0f), lodTriangleBudget(0), cullStamp(0),
+	cullNodesVisited(0), cullTimeUs(0.0f), visibleChunkCount(0), horizonCulling(true), horizonCulledCount(0),
+	terrainOffset(-TERRAIN_SIZE * 0.5f, 0.0f, -TERRAIN_SIZE * 0.5f)
 {
-	if (!lodMesh.tempVertices || !lodMesh.tempIndices)
-		return;
-
-	lodMesh.tempVertices->clear();
-	lodMesh.tempIndices->clear();
-
-	int gridSize = verticesPerSide - 1;
-	lodMesh.tempVertices->reserve(verticesPerSide * verticesPerSide);
-	lodMesh.tempIndices->reserve(gridSize * gridSize * 6);
-
-	float vertexSpacing = chunkSize / static_cast<float>(gridSize);
-	// Y is up and grid is on XZ plane
-	Vector3f normal = { 0.0f, 1.0f, 0.0f };
-	// Tangent and bitangent for flat terrain (will vary with heightmaps)
-	Vector3f tangent = { 1.0f, 0.0f, 0.0f };
-	Vector3f bitangent = { 0.0f, 0.0f, 1.0f };
-	// For correct tiling of texture
-	float uvScale = Terrain::TEXTURE_TILE_COUNT / Terrain::TERRAIN_SIZE;
-
-	// Generate Vertices
-	for (int z = 0; z < verticesPerSide; z++)
+	for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
 	{
-		for (int x = 0; x < verticesPerSide; x++)
-		{
-			// Position relative to chunk origin
-			Vector3f pos;
-			pos.x = (chunkX * chunkSize) + (x * vertexSpacing);
-			pos.y = 0.0f;
-			pos.z = (chunkZ * chunkSize) + (z * vertexSpacing);
-
-			// UV coordinates - tile across the entire terrain
-			Vector2f uv;
-			uv.x = ((chunkX * chunkSize) + (x * vertexSpacing)) * uvScale;
-			uv.y = ((chunkZ * chunkSize) + (z * vertexSpacing)) * uvScale;
-
-			TerrainPBRVertex vertex(pos, uv, normal, tangent, bitangent);
-			lodMesh.tempVertices->push_back(vertex);
-		}
+		maxGeometricError[lod] = 0.0f;
+		lodRanges[lod] = 0.0f;
+		morphStart[lod] = 0.0f;
 	}
 
-	// Generate indices
-	for (int z = 0; z < gridSize; z++)
+	for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
 	{
-		for (int x = 0; x < gridSize; x++)
+		for (int mask = 0; mask < TERRAIN_STITCH_VARIANTS; mask++)
 		{
-			unsigned int start = z * verticesPerSide + x;
-
-			//Triangle 1
-			lodMesh.tempIndices->push_back(start);
-			lodMesh.tempIndices->push_back(start + verticesPerSide);
-			lodMesh.tempIndices->push_back(start + 1);
-
-			//Triangle 2
-			lodMesh.tempIndices->push_back(start + 1);
-			lodMesh.tempIndices->push_back(start + verticesPerSide);
-			lodMesh.tempIndices->push_back(start + verticesPerSide + 1);
+			indexVariants[lod][mask] = {};
 		}
 	}
 
-	lodMesh.vertexCount = lodMesh.tempVertices->size();
-	lodMesh.indexCount = lodMesh.tempIndices->size();
-}
-
-Terrain::Terrain()
-	: visibleChunkCount(0), terrainOffset(-TERRAIN_SIZE * 0.5f, 0.0f, -TERRAIN_SIZE * 0.5f)
-{
-	// Create all chunks
-	chunks.reserve(CHUNKS_PER_SIDE * CHUNKS_PER_SIDE);
-
-	// To center the grid
-	float halfSize = TERRAIN_SIZE / 2.0f;
-
-	// Vertices
-	for (int z = 0; z < CHUNKS_PER_SIDE; z++)
-	{
-		for (int x = 0; x < CHUNKS_PER_SIDE; x++)
-		{
-			// Adjust chunk positions to center the terrain
-			float chunkWorldX = (x * CHUNK_SIZE) - halfSize;
-			float chunkWorldZ = (z * CHUNK_SIZE) - halfSize;
+	cullView.valid = false;
+	lodView.valid = false;
 
-			auto chunk = std::make_unique<TerrainChunk>(x, z, CHUNK_SIZE);
-			chunks.push_back(std::move(chunk));
-		}
-	}
+	// Chunks are created in initialize() once the buffer pool exists
 
 	//create the model matrix so that chunk centers (0...500) shift to -250...+250 (world pos 0,0)
 	modelMatrix = createTransformationMatrix(
@@ -430,119 +633,965 @@ Terrain::Terrain()
 
 Terrain::~Terrain()
 {
-
+	// The worker may still be generating from the height source
+	if (streamWorker)
+	{
+		streamWorker->stop();
+	}
 }
 
-bool Terrain::initialize()
+bool Terrain::initialize(RenderMode mode, const TerrainHeightSource* source)
 {
-	sceClibPrintf("Initializing terrain system...\n");
+	heightSource = source;
+
+	// A shared mesh can't carry per-chunk heights
+	if (mode == RENDER_MODE_INSTANCED && heightSource)
+	{
+		sceClibPrintf("Terrain: height source set, using per-chunk meshes instead of instancing\n");
+		mode = RENDER_MODE_PER_CHUNK;
+	}
+
+	sceClibPrintf("Initializing terrain system (%s)...\n", mode == RENDER_MODE_INSTANCED ? "instanced" : "per-chunk");
+	renderMode = mode;
+
+	SceUInt64 initStartTime = sceKernelGetProcessTimeWide();
+
+	heightField.init(CHUNKS_PER_SIDE, CHUNK_SIZE / CHUNK_GRID_SIZE);
 
 	//Calculate total memory requirements
 	size_t totalVertexSize = 0;
 	size_t totalIndexSize = 0;
-	size_t chunkVertexSize, chunkIndexSize;
+	size_t chunkVertexSize;
+
+	// Instanced mode only stores a single set of LOD meshes shared by every chunk, the instance origin
+	// offsets them so they keep float positions. Per-chunk meshes use the quantized layout
+	int meshSets = (renderMode == RENDER_MODE_INSTANCED) ? 1 : CHUNKS_PER_SIDE * CHUNKS_PER_SIDE;
+	TerrainChunk::VertexFormat vertexFormat = (renderMode == RENDER_MODE_INSTANCED) ?
+		TerrainChunk::VERTEX_FORMAT_FLOAT : TerrainChunk::VERTEX_FORMAT_COMPACT;
 
-	TerrainChunk::calculateMemoryRequirements(chunkVertexSize, chunkIndexSize);
-	totalVertexSize = chunkVertexSize * CHUNKS_PER_SIDE * CHUNKS_PER_SIDE;
-	totalIndexSize = chunkIndexSize * CHUNKS_PER_SIDE * CHUNKS_PER_SIDE;
+	TerrainChunk::calculateMemoryRequirements(chunkVertexSize, vertexFormat);
+	totalVertexSize = chunkVertexSize * meshSets;
+
+	// A cache baked with the same parameters replaces generation with one sequential read per pool
+	uint32_t cacheKey = getCacheKey(vertexFormat);
+	TerrainCacheFile cache;
+	bool cached = cachePath && cache.open(cachePath, cacheKey) && cache.getVertexBytes() == totalVertexSize;
+	// Indices are shared by every chunk in both modes
+	totalIndexSize = cached ? cache.getIndexBytes() : buildIndexVariants(false);
 
 	sceClibPrintf("Total terrain memory requirements:\n");
-	sceClibPrintf("\tVertices: %u bytes\n", (unsigned)totalVertexSize);
+	sceClibPrintf("\tVertices: %u bytes (%u bytes per vertex)\n", (unsigned)totalVertexSize,
+		(unsigned)TerrainChunk::getVertexStride(vertexFormat));
 	sceClibPrintf("\tIndices: %u bytes\n", (unsigned)totalIndexSize);
 	sceClibPrintf("\tToatl: %u bytes (%.2f MB)\n", (unsigned)(totalVertexSize + totalIndexSize), (totalVertexSize + totalIndexSize) / (1024.0f * 1024.0f));
 
-	//Create buffer pool
-	bufferPool = std::unique_ptr<TerrainBufferPool>(new TerrainBufferPool());
-	if (!bufferPool->init(totalVertexSize, totalIndexSize))
+	if (cached)
 	{
-		sceClibPrintf("ERROR: Failed to initialize terrain buffer pool\n");
-		return false;
+		cached = createChunks(totalVertexSize, totalIndexSize, vertexFormat) && loadCache(cache);
+		if (!cached)
+		{
+			totalIndexSize = buildIndexVariants(false);
+		}
 	}
+	cache.close();
 
-	// Create all chunks
-	chunks.reserve(CHUNKS_PER_SIDE * CHUNKS_PER_SIDE);
-
-	for (int z = 0; z < CHUNKS_PER_SIDE; z++)
+	if (!cached)
 	{
-		for (int x = 0; x < CHUNKS_PER_SIDE; x++)
+		if (!createChunks(totalVertexSize, totalIndexSize, vertexFormat))
 		{
-			auto chunk = std::unique_ptr<TerrainChunk>(new TerrainChunk(x, z, CHUNK_SIZE));
+			return false;
+		}
 
-			chunk->initializeWithPool(bufferPool.get());
-			chunks.push_back(std::move(chunk));
+		buildIndexVariants(true);
+
+		if (renderMode == RENDER_MODE_PER_CHUNK)
+		{
+			buildChunks();
+		}
+		else
+		{
+			TerrainChunk::BuildScratch scratch;
+			sharedMeshChunk->buildInPlace(nullptr, scratch);
 		}
-	}
 
-	sceClibPrintf("Uploading terrain data to GPU...\n");
+		if (cachePath)
+		{
+			saveCache(cacheKey, totalVertexSize, totalIndexSize);
+		}
+	}
 
-	for (auto& chunk : chunks)
+	// Flat instanced chunks have no heights of their own, built and cached chunks filled their tiles already
+	if (renderMode == RENDER_MODE_INSTANCED)
 	{
-		chunk->uploadToGPU();
+		for (const auto& chunk : chunks)
+		{
+			heightField.setFlatTile(chunk->getChunkX(), chunk->getChunkZ(), 0.0f);
+		}
 	}
 
-	sceClibPrintf("Releasing temporary CPU data...\n");
+	// Worst error per LOD drives the shared LOD ranges, so neighbouring chunks always agree on them
+	for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
+	{
+		maxGeometricError[lod] = getErrorFloor(lod);
+		for (const auto& chunk : chunks)
+		{
+			maxGeometricError[lod] = std::max(maxGeometricError[lod], chunk->getGeometricError((TerrainChunk::LODLevel)lod));
+		}
+		sceClibPrintf("Terrain LOD %d geometric error: %.3f\n", lod, maxGeometricError[lod]);
+	}
 
-	for (auto& chunk : chunks)
+	lodTree.clear();
+	int treeSize = 1;
+	while (treeSize < CHUNKS_PER_SIDE)
 	{
-		chunk->releaseCPUData();
+		treeSize *= 2;
 	}
+	buildLODTree(0, 0, treeSize);
+	refitLODTree(0);
+	rebuildChunkBounds();
+
+	previousLODs.assign(chunks.size(), TerrainChunk::LOD_COUNT - 1);
+	visibleStamp.assign(chunks.size(), 0);
+	cullResult.reserve(chunks.size());
+	sortScratch.reserve(chunks.size());
+	horizonVisibleChunks.reserve(chunks.size());
+
+	sceClibPrintf("Terrain initialize: %.2f ms\n", (sceKernelGetProcessTimeWide() - initStartTime) / 1000.0f);
 
 	return true;
 }
 
-const std::vector<TerrainChunk*>& Terrain::getVisibleChunks(const Matrix4x4& viewProjMatrix, const Vector3f& cameraPos)
+bool Terrain::createChunks(size_t vertexPoolSize, size_t indexPoolSize, TerrainChunk::VertexFormat vertexFormat)
 {
-	// Extract frustum planes once (not per-chunk)
-	FrustumPlanes frustum;
-	frustum.extractFromMatrix(viewProjMatrix);
+	chunks.clear();
+	sharedMeshChunk.reset();
+	for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
+	{
+		for (int mask = 0; mask < TERRAIN_STITCH_VARIANTS; mask++)
+		{
+			indexVariants[lod][mask] = {};
+		}
+	}
 
-	// Reuse cached vector — clear() doesn't deallocate, avoids heap alloc per frame
-	visibleChunksCache.clear();
+	//Create buffer pool
+	bufferPool = std::unique_ptr<TerrainBufferPool>(new TerrainBufferPool());
+	if (!bufferPool->init(vertexPoolSize, indexPoolSize))
+	{
+		sceClibPrintf("ERROR: Failed to initialize terrain buffer pool\n");
+		return false;
+	}
 
-	visibleChunkCount = 0;
-	for (auto& chunk : chunks)
+	// Create all chunks, allocating in grid order keeps the pool layout independent of the build threads
+	chunks.reserve(CHUNKS_PER_SIDE * CHUNKS_PER_SIDE);
+
+	for (int z = 0; z < CHUNKS_PER_SIDE; z++)
 	{
-		if (chunk->isInFrustum(frustum))
+		for (int x = 0; x < CHUNKS_PER_SIDE; x++)
 		{
-			visibleChunksCache.push_back(chunk.get());
-			visibleChunkCount++;
+			auto chunk = std::unique_ptr<TerrainChunk>(new TerrainChunk(x, z, CHUNK_SIZE));
+
+			if (renderMode == RENDER_MODE_PER_CHUNK)
+			{
+				chunk->allocateFromPool(bufferPool.get(), vertexFormat);
+			}
+			chunk->setResident(true);
+			chunks.push_back(std::move(chunk));
 		}
 	}
 
-	// Sort front-to-back for better HSR on SGX543 TBDR
-	std::sort(visibleChunksCache.begin(), visibleChunksCache.end(),
-		[&cameraPos](const TerrainChunk* a, const TerrainChunk* b) {
-			Vector3f da = a->getCenter() - cameraPos;
-			Vector3f db = b->getCenter() - cameraPos;
-			return (da.x*da.x + da.y*da.y + da.z*da.z) < (db.x*db.x + db.y*db.y + db.z*db.z);
-		});
+	if (renderMode == RENDER_MODE_INSTANCED)
+	{
+		sharedMeshChunk = std::unique_ptr<TerrainChunk>(new TerrainChunk(0, 0, CHUNK_SIZE));
+		sharedMeshChunk->allocateFromPool(bufferPool.get(), vertexFormat);
+	}
 
-	return visibleChunksCache;
+	return true;
 }
 
-const std::vector<std::unique_ptr<TerrainChunk>>& Terrain::getChunks() const
+void Terrain::getPoolChunks(std::vector<TerrainChunk*>& out) const
 {
-	return chunks;
-}
+	out.clear();
+	if (sharedMeshChunk)
+	{
+		out.push_back(sharedMeshChunk.get());
+		return;
+	}
 
-TerrainChunk* Terrain::getChunk(int chunkX, int chunkZ)
-{
-	if (chunkX < 0 || chunkX >= CHUNKS_PER_SIDE ||
-		chunkZ < 0 || chunkZ >= CHUNKS_PER_SIDE)
+	for (const auto& chunk : chunks)
 	{
-		return nullptr;
+		out.push_back(chunk.get());
 	}
+}
 
-	int index = chunkZ * CHUNKS_PER_SIDE + chunkX;
-	return chunks[index].get();
+uint32_t Terrain::getCacheKey(TerrainChunk::VertexFormat vertexFormat) const
+{
+	// Everything that shapes the pool images or their layout. Generator changes that keep all of these
+	// (a new normal filter, say) must bump TerrainCacheFile::VERSION instead
+	const int layout[] = { CHUNKS_PER_SIDE, CHUNK_GRID_SIZE, TerrainChunk::LOD_COUNT, (int)renderMode, (int)vertexFormat,
+		(int)TerrainChunk::getVertexStride(vertexFormat), usesTriangleStrips() ? 1 : 0, TERRAIN_STRIP_BLOCK_QUADS };
+	const float scales[] = { TERRAIN_SIZE, TEXTURE_TILE_COUNT, TERRAIN_HEIGHT_QUANT_STEP };
+
+	uint32_t key = hashTerrainData(layout, sizeof(layout));
+	key = hashTerrainData(LOD_VERTICES, sizeof(LOD_VERTICES), key);
+	key = hashTerrainData(scales, sizeof(scales), key);
+	uint32_t sourceHash = heightSource ? heightSource->getContentHash() : 0;
+	return hashTerrainData(&sourceHash, sizeof(sourceHash), key);
 }
 
-int Terrain::getTotalVertices() const
+bool Terrain::loadCache(TerrainCacheFile& cache)
+{
+	SceUInt64 startTime = sceKernelGetProcessTimeWide();
+
+	std::vector<TerrainChunk*> poolChunks;
+	getPoolChunks(poolChunks);
+	const std::vector<TerrainCacheFile::ChunkRecord>& chunkRecords = cache.getChunkRecords();
+	const std::vector<TerrainCacheFile::IndexRecord>& indexRecords = cache.getIndexRecords();
+
+	if (chunkRecords.size() != poolChunks.size() ||
+		indexRecords.size() != (size_t)TerrainChunk::LOD_COUNT * TERRAIN_STITCH_VARIANTS)
+	{
+		sceClibPrintf("Terrain cache: record counts don't match this terrain, rebuilding\n");
+		return false;
+	}
+
+	for (size_t i = 0; i < poolChunks.size(); i++)
+	{
+		if (chunkRecords[i].vertexOffset != poolChunks[i]->getMesh()->vertexAlloc.offset)
+		{
+			sceClibPrintf("Terrain cache: vertex layout doesn't match this terrain, rebuilding\n");
+			return false;
+		}
+	}
+
+	// Same allocation order as buildIndexVariants, so offsets have to agree
+	for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
+	{
+		for (int mask = 0; mask < TERRAIN_STITCH_VARIANTS; mask++)
+		{
+			if (getNextLODRatio(lod) == 1 && mask != 0)
+			{
+				indexVariants[lod][mask] = indexVariants[lod][0];
+				continue;
+			}
+
+			const TerrainCacheFile::IndexRecord& record = indexRecords[lod * TERRAIN_STITCH_VARIANTS + mask];
+			IndexVariant& variant = indexVariants[lod][mask];
+			variant.indexAlloc = bufferPool->allocateIndices(record.indexCount * sizeof(uint16_t));
+			variant.indexCount = record.indexCount;
+			variant.triangleCount = record.triangleCount;
+
+			if (variant.indexAlloc.offset != record.indexOffset ||
+				variant.indexAlloc.offset + variant.indexAlloc.size > cache.getIndexBytes())
+			{
+				sceClibPrintf("Terrain cache: index layout doesn't match this terrain, rebuilding\n");
+				return false;
+			}
+		}
+	}
+
+	if (!cache.readPools(bufferPool->getVertexPoolBase(), bufferPool->getIndexPoolBase()))
+	{
+		return false;
+	}
+
+	std::vector<float> heights(TerrainHeightField::VERTICES * TerrainHeightField::VERTICES);
+	for (size_t i = 0; i < poolChunks.size(); i++)
+	{
+		const TerrainCacheFile::ChunkRecord& record = chunkRecords[i];
+		poolChunks[i]->restoreBuild(heightSource, record.minHeight, record.maxHeight, record.geometricError);
+		if (renderMode == RENDER_MODE_PER_CHUNK)
+		{
+			poolChunks[i]->readPoolHeights(heights.data());
+			heightField.setTile(poolChunks[i]->getChunkX(), poolChunks[i]->getChunkZ(), heights.data(), sizeof(float));
+		}
+	}
+
+	sceClibPrintf("Terrain cache: loaded %u bytes from %s in %.2f ms\n", (unsigned)(cache.getVertexBytes() + cache.getIndexBytes()),
+		cachePath, (sceKernelGetProcessTimeWide() - startTime) / 1000.0f);
+	return true;
+}
+
+void Terrain::saveCache(uint32_t cacheKey, size_t vertexBytes, size_t indexBytes) const
+{
+	SceUInt64 startTime = sceKernelGetProcessTimeWide();
+
+	std::vector<TerrainChunk*> poolChunks;
+	getPoolChunks(poolChunks);
+
+	std::vector<TerrainCacheFile::ChunkRecord> chunkRecords(poolChunks.size());
+	for (size_t i = 0; i < poolChunks.size(); i++)
+	{
+		TerrainCacheFile::ChunkRecord& record = chunkRecords[i];
+		record.vertexOffset = (uint32_t)poolChunks[i]->getMesh()->vertexAlloc.offset;
+		record.minHeight = poolChunks[i]->getMinHeight();
+		record.maxHeight = poolChunks[i]->getMaxHeight();
+		for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
+		{
+			record.geometricError[lod] = poolChunks[i]->getGeometricError((TerrainChunk::LODLevel)lod);
+		}
+	}
+
+	std::vector<TerrainCacheFile::IndexRecord> indexRecords(TerrainChunk::LOD_COUNT * TERRAIN_STITCH_VARIANTS);
+	for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
+	{
+		for (int mask = 0; mask < TERRAIN_STITCH_VARIANTS; mask++)
+		{
+			const IndexVariant& variant = indexVariants[lod][mask];
+			TerrainCacheFile::IndexRecord& record = indexRecords[lod * TERRAIN_STITCH_VARIANTS + mask];
+			record.indexOffset = (uint32_t)variant.indexAlloc.offset;
+			record.indexCount = (uint32_t)variant.indexCount;
+			record.triangleCount = (uint32_t)variant.triangleCount;
+		}
+	}
+
+	if (TerrainCacheFile::write(cachePath, cacheKey, chunkRecords, indexRecords,
+		bufferPool->getVertexPoolBase(), vertexBytes, bufferPool->getIndexPoolBase(), indexBytes))
+	{
+		sceClibPrintf("Terrain cache: wrote %s in %.2f ms\n", cachePath, (sceKernelGetProcessTimeWide() - startTime) / 1000.0f);
+	}
+}
+
+void Terrain::buildChunks()
+{
+	const int threadCount = std::max(1, std::min(std::min(buildThreadCount, MAX_BUILD_THREADS), (int)chunks.size()));
+	std::atomic<int> nextChunk(0);
+	TerrainBuildWorker workers[MAX_BUILD_THREADS];
+	SceUID threads[MAX_BUILD_THREADS];
+
+	for (int t = 0; t < threadCount; t++)
+	{
+		workers[t].chunks = &chunks;
+		workers[t].heightSource = heightSource;
+		workers[t].nextChunk = &nextChunk;
+		workers[t].heightField = &heightField;
+		workers[t].busyUs = 0;
+		workers[t].builtCount = 0;
+		threads[t] = -1;
+	}
+
+	SceUInt64 startTime = sceKernelGetProcessTimeWide();
+
+	// Worker 0 is this thread, a worker that fails to start just leaves its chunks to the others
+	for (int t = 1; t < threadCount; t++)
+	{
+		threads[t] = sceKernelCreateThread("terrainBuild", buildThreadEntry, BUILD_THREAD_PRIORITY, BUILD_THREAD_STACK_SIZE,
+			0, BUILD_THREAD_CPU_MASKS[t], NULL);
+		if (threads[t] < 0)
+		{
+			sceClibPrintf("WARNING: Failed to create terrain build thread: 0x%08X\n", threads[t]);
+			continue;
+		}
+
+		// The argument block is copied onto the new thread's stack
+		TerrainBuildWorker* worker = &workers[t];
+		sceKernelStartThread(threads[t], sizeof(worker), &worker);
+	}
+
+	runBuildWorker(workers[0]);
+
+	for (int t = 1; t < threadCount; t++)
+	{
+		if (threads[t] >= 0)
+		{
+			sceKernelWaitThreadEnd(threads[t], NULL, NULL);
+			sceKernelDeleteThread(threads[t]);
+		}
+	}
+
+	SceUInt64 elapsedUs = sceKernelGetProcessTimeWide() - startTime;
+	SceUInt64 busyUs = 0;
+	int builtCount = 0;
+	for (int t = 0; t < threadCount; t++)
+	{
+		busyUs += workers[t].busyUs;
+		builtCount += workers[t].builtCount;
+		sceClibPrintf("\tbuild thread %d: %d chunks\n", t, workers[t].builtCount);
+	}
+
+	sceClibPrintf("Terrain build (%dx%d grid): %d chunks on %d threads in %.2f ms, %.1f us/chunk\n", LOD_VERTICES[TerrainChunk::LOD_0],
+		LOD_VERTICES[TerrainChunk::LOD_0], builtCount, threadCount, elapsedUs / 1000.0f, (float)busyUs / std::max(builtCount, 1));
+}
+
+Terrain::RenderMode Terrain::getRenderMode() const
+{
+	return renderMode;
+}
+
+void Terrain::setBuildThreadCount(int count)
+{
+	buildThreadCount = count;
+}
+
+void Terrain::setCachePath(const char* path)
+{
+	cachePath = path;
+}
+
+const std::vector<TerrainChunk*>& Terrain::getVisibleChunks(const Matrix4x4& viewProjMatrix, const Vector3f& cameraPos)
+{
+	SceUInt64 cullStart = sceKernelGetProcessTimeWide();
+	cullNodesVisited = 0;
+
+	// Nothing moved and no chunk changed: last frame's list is still right
+	if (cullView.valid && cullView.boundsVersion == chunkBoundsVersion && cullHierarchical == hierarchicalCulling &&
+		cullHorizon == horizonCulling && isSameView(viewProjMatrix, cameraPos, cullView.viewProj, cullView.cameraPos))
+	{
+		cullTimeUs = (float)(sceKernelGetProcessTimeWide() - cullStart);
+		return horizonVisibleChunks;
+	}
+
+	// Extract frustum planes once (not per-chunk)
+	FrustumPlanes frustum;
+	frustum.extractFromMatrix(viewProjMatrix);
+
+	// Reuse cached vectors — clear() doesn't deallocate, avoids heap alloc per frame
+	cullResult.clear();
+
+	if (hierarchicalCulling && !lodTree.empty())
+	{
+		cullNode(0, frustum, (1 << 6) - 1);
+	}
+	else
+	{
+		// Streamed chunks waiting for their data aren't in the SoA bounds
+		int visible = chunkBounds.cull(frustum, cullIds.data());
+		for (int i = 0; i < visible; i++)
+		{
+			cullResult.push_back(chunks[cullIds[i]].get());
+		}
+		cullNodesVisited = chunkBounds.size();
+	}
+	visibleChunkCount = (int)cullResult.size();
+
+	// Chunk centers are in terrain local space
+	Vector3f localCam = cameraPos - terrainOffset;
+	auto distanceSq = [&localCam](const TerrainChunk* chunk) {
+		Vector3f d = chunk->getCenter() - localCam;
+		return d.x*d.x + d.y*d.y + d.z*d.z;
+	};
+
+	// Chunks still visible keep last frame's order and new ones go after them,
+	// so the list is nearly sorted and insertion sort does little work
+	cullStamp++;
+	for (const TerrainChunk* chunk : cullResult)
+	{
+		visibleStamp[getSlotIndex(chunk->getChunkX(), chunk->getChunkZ())] = cullStamp;
+	}
+
+	sortScratch.clear();
+	for (TerrainChunk* chunk : visibleChunksCache)
+	{
+		uint32_t& stamp = visibleStamp[getSlotIndex(chunk->getChunkX(), chunk->getChunkZ())];
+		if (stamp == cullStamp)
+		{
+			sortScratch.push_back({ distanceSq(chunk), chunk });
+			stamp = 0;
+		}
+	}
+	for (TerrainChunk* chunk : cullResult)
+	{
+		if (visibleStamp[getSlotIndex(chunk->getChunkX(), chunk->getChunkZ())] == cullStamp)
+		{
+			sortScratch.push_back({ distanceSq(chunk), chunk });
+		}
+	}
+
+	// Sort front-to-back for better HSR on SGX543 TBDR
+	for (size_t i = 1; i < sortScratch.size(); i++)
+	{
+		SortEntry entry = sortScratch[i];
+		size_t j = i;
+		while (j > 0 && sortScratch[j - 1].distanceSq > entry.distanceSq)
+		{
+			sortScratch[j] = sortScratch[j - 1];
+			j--;
+		}
+		sortScratch[j] = entry;
+	}
+
+	visibleChunksCache.clear();
+	for (const SortEntry& entry : sortScratch)
+	{
+		visibleChunksCache.push_back(entry.chunk);
+	}
+
+	// The frustum list keeps every visible chunk so next frame's sort still starts from this order
+	applyHorizonCulling(localCam);
+
+	cullView.valid = true;
+	cullView.viewProj = viewProjMatrix;
+	cullView.cameraPos = cameraPos;
+	cullView.boundsVersion = chunkBoundsVersion;
+	cullHierarchical = hierarchicalCulling;
+	cullHorizon = horizonCulling;
+	cullTimeUs = (float)(sceKernelGetProcessTimeWide() - cullStart);
+
+	return horizonVisibleChunks;
+}
+
+void Terrain::applyHorizonCulling(const Vector3f& localCam)
+{
+	horizonVisibleChunks.clear();
+	horizonCulledCount = 0;
+
+	// Occluders stand for the solid under the surface, which only blocks rays from a camera above it.
+	// Off the window (or under its own chunk) the camera could look up at the terrain from below
+	TerrainChunk* under = getChunk((int)floorf(localCam.x / CHUNK_SIZE), (int)floorf(localCam.z / CHUNK_SIZE));
+	if (!horizonCulling || !under || !under->isResident() || localCam.y < under->getMinHeight())
+	{
+		horizonVisibleChunks = visibleChunksCache;
+		return;
+	}
+
+	// Hidden chunks still occlude: their surface is solid terrain whether or not it gets drawn
+	const float halfSize = CHUNK_SIZE * 0.5f;
+	horizon.reset(localCam);
+	for (TerrainChunk* chunk : visibleChunksCache)
+	{
+		Vector3f center = chunk->getCenter();
+		float x0 = center.x - halfSize, z0 = center.z - halfSize;
+		float x1 = center.x + halfSize, z1 = center.z + halfSize;
+
+		if (horizon.isOccluded(x0, z0, x1, z1, chunk->getMaxHeight()))
+		{
+			horizonCulledCount++;
+		}
+		else
+		{
+			horizonVisibleChunks.push_back(chunk);
+		}
+		horizon.addOccluder(x0, z0, x1, z1, chunk->getMinHeight());
+	}
+}
+
+void Terrain::cullNode(int nodeIndex, const FrustumPlanes& frustum, int planeMask)
+{
+	const LODNode& node = lodTree[nodeIndex];
+	cullNodesVisited++;
+
+	float minX = (windowX + node.chunkX) * CHUNK_SIZE;
+	float minZ = (windowZ + node.chunkZ) * CHUNK_SIZE;
+	float maxX = (windowX + std::min(node.chunkX + node.size, (int)CHUNKS_PER_SIDE)) * CHUNK_SIZE;
+	float maxZ = (windowZ + std::min(node.chunkZ + node.size, (int)CHUNKS_PER_SIDE)) * CHUNK_SIZE;
+
+	for (int i = 0; i < 6; i++)
+	{
+		if (!(planeMask & (1 << i)))
+			continue;
+
+		// Box corners furthest along and against the plane normal
+		const FrustumPlanes::Plane& p = frustum.planes[i];
+		float farDist = p.a * (p.a >= 0.0f ? maxX : minX) + p.b * (p.b >= 0.0f ? node.maxHeight : node.minHeight)
+			+ p.c * (p.c >= 0.0f ? maxZ : minZ) + p.d;
+		if (farDist < 0.0f)
+			return;
+
+		float nearDist = p.a * (p.a >= 0.0f ? minX : maxX) + p.b * (p.b >= 0.0f ? node.minHeight : node.maxHeight)
+			+ p.c * (p.c >= 0.0f ? minZ : maxZ) + p.d;
+		if (nearDist >= 0.0f)
+		{
+			planeMask &= ~(1 << i);
+		}
+	}
+
+	if (planeMask == 0)
+	{
+		acceptNode(node);
+		return;
+	}
+
+	if (node.size == 1)
+	{
+		TerrainChunk* chunk = chunks[getSlotIndex(windowX + node.chunkX, windowZ + node.chunkZ)].get();
+		if (chunk->isResident())
+		{
+			cullResult.push_back(chunk);
+		}
+		return;
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (node.children[i] >= 0)
+		{
+			cullNode(node.children[i], frustum, planeMask);
+		}
+	}
+}
+
+void Terrain::acceptNode(const LODNode& node)
+{
+	int endX = std::min(node.chunkX + node.size, (int)CHUNKS_PER_SIDE);
+	int endZ = std::min(node.chunkZ + node.size, (int)CHUNKS_PER_SIDE);
+	for (int z = node.chunkZ; z < endZ; z++)
+	{
+		for (int x = node.chunkX; x < endX; x++)
+		{
+			TerrainChunk* chunk = chunks[getSlotIndex(windowX + x, windowZ + z)].get();
+			if (chunk->isResident())
+			{
+				cullResult.push_back(chunk);
+			}
+		}
+	}
+}
+
+void Terrain::rebuildChunkBounds()
+{
+	chunkBounds.clear();
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		const TerrainChunk* chunk = chunks[i].get();
+		if (chunk->isResident())
+		{
+			Vector3f center = chunk->getCenter();
+			chunkBounds.add(center.x, center.y, center.z, chunk->getBoundingRadius(), (uint16_t)i);
+		}
+	}
+	cullIds.resize(chunkBounds.capacity());
+	chunkBoundsVersion++;
+}
+
+void Terrain::setHierarchicalCulling(bool enabled)
+{
+	hierarchicalCulling = enabled;
+}
+
+bool Terrain::getHierarchicalCulling() const
+{
+	return hierarchicalCulling;
+}
+
+void Terrain::setHorizonCulling(bool enabled)
+{
+	horizonCulling = enabled;
+}
+
+bool Terrain::getHorizonCulling() const
+{
+	return horizonCulling;
+}
+
+int Terrain::getHorizonCulledCount() const
+{
+	return horizonCulledCount;
+}
+
+int Terrain::getCullNodesVisited() const
+{
+	return cullNodesVisited;
+}
+
+float Terrain::getCullTimeUs() const
+{
+	return cullTimeUs;
+}
+
+const std::vector<std::unique_ptr<TerrainChunk>>& Terrain::getChunks() const
+{
+	return chunks;
+}
+
+TerrainChunk* Terrain::getChunk(int chunkX, int chunkZ)
+{
+	if (chunkX < windowX || chunkX >= windowX + CHUNKS_PER_SIDE ||
+		chunkZ < windowZ || chunkZ >= windowZ + CHUNKS_PER_SIDE)
+	{
+		return nullptr;
+	}
+
+	return chunks[getSlotIndex(chunkX, chunkZ)].get();
+}
+
+int Terrain::getSlotIndex(int chunkX, int chunkZ)
+{
+	int x = ((chunkX % CHUNKS_PER_SIDE) + CHUNKS_PER_SIDE) % CHUNKS_PER_SIDE;
+	int z = ((chunkZ % CHUNKS_PER_SIDE) + CHUNKS_PER_SIDE) % CHUNKS_PER_SIDE;
+	return z * CHUNKS_PER_SIDE + x;
+}
+
+bool Terrain::sampleHeight(float x, float z, float& height) const
+{
+	return heightField.sampleHeight(x - terrainOffset.x, z - terrainOffset.z, height);
+}
+
+int Terrain::sampleHeights(const float* x, const float* z, int count, float* heights) const
+{
+	int hits = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (heightField.sampleHeight(x[i] - terrainOffset.x, z[i] - terrainOffset.z, heights[i]))
+		{
+			hits++;
+		}
+		else
+		{
+			heights[i] = -FLT_MAX;
+		}
+	}
+	return hits;
+}
+
+bool Terrain::clipRayToWindow(const Vector3f& localOrigin, const Vector3f& direction, float maxDistance,
+	float& tMin, float& tMax) const
+{
+	const float bounds[2][2] = {
+		{ windowX * CHUNK_SIZE, (windowX + CHUNKS_PER_SIDE) * CHUNK_SIZE },
+		{ windowZ * CHUNK_SIZE, (windowZ + CHUNKS_PER_SIDE) * CHUNK_SIZE } };
+	const float origin[2] = { localOrigin.x, localOrigin.z };
+	const float dir[2] = { direction.x, direction.z };
+
+	tMin = 0.0f;
+	tMax = maxDistance;
+	for (int axis = 0; axis < 2; axis++)
+	{
+		if (dir[axis] == 0.0f)
+		{
+			if (origin[axis] < bounds[axis][0] || origin[axis] > bounds[axis][1])
+				return false;
+			continue;
+		}
+
+		float t0 = (bounds[axis][0] - origin[axis]) / dir[axis];
+		float t1 = (bounds[axis][1] - origin[axis]) / dir[axis];
+		tMin = std::max(tMin, std::min(t0, t1));
+		tMax = std::min(tMax, std::max(t0, t1));
+	}
+	return tMin <= tMax;
+}
+
+bool Terrain::raycast(const Vector3f& origin, const Vector3f& direction, float maxDistance, TerrainRayHit& hit) const
+{
+	float length = direction.length();
+	if (length <= 0.0f)
+		return false;
+
+	Vector3f localOrigin = origin - terrainOffset;
+	Vector3f unitDirection = direction / length;
+	float tMin, tMax;
+	if (!clipRayToWindow(localOrigin, unitDirection, maxDistance, tMin, tMax) ||
+		!heightField.raycast(localOrigin, unitDirection, tMin, tMax, hit))
+	{
+		return false;
+	}
+
+	hit.position += terrainOffset;
+	return true;
+}
+
+int Terrain::raycasts(const Vector3f* origins, const Vector3f* directions, int count, float maxDistance,
+	TerrainRayHit* hits) const
+{
+	int hitCount = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (raycast(origins[i], directions[i], maxDistance, hits[i]))
+		{
+			hitCount++;
+		}
+		else
+		{
+			hits[i].distance = -1.0f;
+		}
+	}
+	return hitCount;
+}
+
+bool Terrain::enableStreaming(int framesInFlight, float uploadBudgetMs)
+{
+	streamFramesInFlight = framesInFlight;
+	streamUploadBudgetUs = (SceUInt64)(std::max(uploadBudgetMs, 0.0f) * 1000.0f);
+	streamFrame = 0;
+	streamSlots.clear();
+	streamSlots.resize(chunks.size());
+	for (auto& slot : streamSlots)
+	{
+		slot.state = STREAM_RESIDENT;
+		slot.retireFrame = 0;
+	}
+	streamRequestOrder.reserve(chunks.size());
+
+	// Flat instanced chunks have no meshes of their own, moving them is all streaming needs
+	if (renderMode == RENDER_MODE_PER_CHUNK)
+	{
+		streamWorker = std::unique_ptr<TerrainStreamWorker>(new TerrainStreamWorker());
+		if (!streamWorker->start(heightSource, CHUNK_SIZE, (int)chunks.size()))
+		{
+			streamWorker.reset();
+			return false;
+		}
+	}
+
+	streaming = true;
+	return true;
+}
+
+bool Terrain::isStreaming() const
+{
+	return streaming;
+}
+
+void Terrain::updateStreaming(const Vector3f& cameraPos)
+{
+	if (!streaming)
+		return;
+
+	streamFrame++;
+	Vector3f localCam = cameraPos - terrainOffset;
+
+	// The window's center sits on the chunk border between its two middle chunks
+	float offsetX = localCam.x / CHUNK_SIZE - (windowX + CHUNKS_PER_SIDE / 2);
+	float offsetZ = localCam.z / CHUNK_SIZE - (windowZ + CHUNKS_PER_SIDE / 2);
+	if (std::abs(offsetX) > WINDOW_RECENTER_CHUNKS || std::abs(offsetZ) > WINDOW_RECENTER_CHUNKS)
+	{
+		recenterWindow(windowX + (int)floorf(offsetX + 0.5f), windowZ + (int)floorf(offsetZ + 0.5f));
+	}
+
+	if (streamWorker)
+	{
+		TerrainStreamWorker::Result result;
+		while (streamWorker->popResult(result))
+		{
+			StreamSlot& slot = streamSlots[result.slot];
+			if (!streamWorker->isCurrent(result) || slot.state != STREAM_GENERATING)
+			{
+				delete result.chunk;
+				continue;
+			}
+
+			slot.generated.reset(result.chunk);
+			slot.state = STREAM_UPLOADING;
+		}
+
+		queueStreamRequests(localCam);
+		uploadStreamedChunks();
+	}
+
+	if (chunkBoundsDirty)
+	{
+		if (!lodTree.empty())
+		{
+			refitLODTree(0);
+		}
+		rebuildChunkBounds();
+		chunkBoundsDirty = false;
+	}
+}
+
+void Terrain::recenterWindow(int newWindowX, int newWindowZ)
+{
+	int moved = 0;
+	for (int slotIndex = 0; slotIndex < (int)chunks.size(); slotIndex++)
+	{
+		// Grid position this slot covers inside the new window
+		int slotX = slotIndex % CHUNKS_PER_SIDE;
+		int slotZ = slotIndex / CHUNKS_PER_SIDE;
+		int chunkX = newWindowX + (((slotX - newWindowX) % CHUNKS_PER_SIDE) + CHUNKS_PER_SIDE) % CHUNKS_PER_SIDE;
+		int chunkZ = newWindowZ + (((slotZ - newWindowZ) % CHUNKS_PER_SIDE) + CHUNKS_PER_SIDE) % CHUNKS_PER_SIDE;
+
+		TerrainChunk* chunk = chunks[slotIndex].get();
+		if (chunk->getChunkX() == chunkX && chunk->getChunkZ() == chunkZ)
+			continue;
+
+		heightField.clearTile(chunk->getChunkX(), chunk->getChunkZ());
+		chunk->moveTo(chunkX, chunkZ);
+		previousLODs[slotIndex] = TerrainChunk::LOD_COUNT - 1;
+		moved++;
+
+		if (renderMode == RENDER_MODE_INSTANCED)
+		{
+			chunk->setResident(true);
+			heightField.setFlatTile(chunkX, chunkZ, 0.0f);
+			continue;
+		}
+
+		// Anything generated for the old position is stale, the worker skips its queued request too
+		StreamSlot& slot = streamSlots[slotIndex];
+		slot.generated.reset();
+		slot.retireFrame = streamFrame;
+		slot.state = STREAM_WAITING;
+	}
+
+	windowX = newWindowX;
+	windowZ = newWindowZ;
+	chunkBoundsDirty = true;
+	sceClibPrintf("Terrain: window moved to chunk (%d, %d), %d chunks to stream\n", windowX, windowZ, moved);
+}
+
+void Terrain::queueStreamRequests(const Vector3f& localCam)
+{
+	streamRequestOrder.clear();
+	for (int i = 0; i < (int)streamSlots.size(); i++)
+	{
+		if (streamSlots[i].state == STREAM_WAITING)
+		{
+			streamRequestOrder.push_back(i);
+		}
+	}
+
+	// Nearest chunks first, they are the ones most likely to be seen
+	std::sort(streamRequestOrder.begin(), streamRequestOrder.end(),
+		[this, &localCam](int a, int b) {
+			Vector3f da = chunks[a]->getCenter() - localCam;
+			Vector3f db = chunks[b]->getCenter() - localCam;
+			return (da.x*da.x + da.z*da.z) < (db.x*db.x + db.z*db.z);
+		});
+
+	for (int slotIndex : streamRequestOrder)
+	{
+		const TerrainChunk* chunk = chunks[slotIndex].get();
+		if (!streamWorker->request(slotIndex, chunk->getChunkX(), chunk->getChunkZ()))
+			break;
+
+		streamSlots[slotIndex].state = STREAM_GENERATING;
+	}
+}
+
+void Terrain::uploadStreamedChunks()
+{
+	// At least one chunk goes up per frame, so streaming always makes progress
+	SceUInt64 startTime = sceKernelGetProcessTimeWide();
+	bool uploadedAny = false;
+
+	for (int slotIndex = 0; slotIndex < (int)streamSlots.size(); slotIndex++)
+	{
+		StreamSlot& slot = streamSlots[slotIndex];
+		// The GPU may still be reading the previous chunk's vertices
+		if (slot.state != STREAM_UPLOADING || streamFrame - slot.retireFrame < streamFramesInFlight)
+			continue;
+
+		if (uploadedAny && sceKernelGetProcessTimeWide() - startTime >= streamUploadBudgetUs)
+			return;
+
+		TerrainChunk* chunk = chunks[slotIndex].get();
+		chunk->adoptMeshData(*slot.generated);
+		chunk->uploadToGPU();
+		heightField.setTile(chunk->getChunkX(), chunk->getChunkZ(), &(*chunk->getMesh()->tempVertices)[0].y,
+			sizeof(TerrainPBRVertex));
+		uploadedAny = true;
+
+		chunk->releaseCPUData();
+		slot.generated.reset();
+		chunk->setResident(true);
+		slot.state = STREAM_RESIDENT;
+
+		// LOD ranges only ever widen, so neighbouring chunks keep agreeing on them
+		for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
+		{
+			maxGeometricError[lod] = std::max(maxGeometricError[lod], chunk->getGeometricError((TerrainChunk::LODLevel)lod));
+		}
+		chunkBoundsDirty = true;
+	}
+}
+
+int Terrain::getTotalVertices() const
 {
 	int total = 0;
 	for (const auto& chunk : chunks)
 	{
-		total += chunk->getCurrentLODMesh()->vertexCount;
+		// Vertices referenced at the current LOD, the buffer itself always holds the LOD_0 grid
+		int side = TerrainChunk::getVerticesPerSide(chunk->getCurrentLOD());
+		total += side * side;
 	}
 	return total;
 }
@@ -552,21 +1601,542 @@ int Terrain::getTotalIndices() const
 	int total = 0;
 	for (const auto& chunk : chunks)
 	{
-		total += chunk->getCurrentLODMesh()->indexCount;
+		total += getRenderIndices(chunk.get())->indexCount;
 	}
 	return total;
 }
 
-void Terrain::updateLODs(const Vector3f& cameraPos, const Vector3f& viewDir)
+void Terrain::updateLODs(const Vector3f& cameraPos, const Matrix4x4& projectionMatrix, const Matrix4x4& viewProjMatrix,
+	float viewportHeight)
 {
+	// Pixels covered by one world unit at distance 1
+	float pixelsPerUnit = projectionMatrix.getData()[5] * viewportHeight * 0.5f;
+
+	// Same view and inputs as last time: the selection wouldn't change
+	if (lodView.valid && lodView.boundsVersion == chunkBoundsVersion && lodPixelsPerUnit == pixelsPerUnit &&
+		lodPixelThreshold == pixelErrorThreshold && lodTriangleBudget == triangleBudget &&
+		isSameView(viewProjMatrix, cameraPos, lodView.viewProj, lodView.cameraPos))
+	{
+		return;
+	}
+	lodView.valid = true;
+	lodView.viewProj = viewProjMatrix;
+	lodView.cameraPos = cameraPos;
+	lodView.boundsVersion = chunkBoundsVersion;
+	lodPixelsPerUnit = pixelsPerUnit;
+	lodPixelThreshold = pixelErrorThreshold;
+	lodTriangleBudget = triangleBudget;
+
+	// A chunk can reach one diagonal past the chunk that decided its LOD
+	const float chunkDiagonal = CHUNK_SIZE * 1.41421356f;
+	// Ranges are at least this far apart so neighbours differ by at most one LOD and the morph
+	// region of a coarser chunk never reaches the edge it shares with a finer one. Both are measured
+	// from the hysteresis-extended switch distance, where a chunk held at the finer LOD can still be
+	const float minRangeGap = chunkDiagonal * 1.5f;
+
+	for (int lod = 0; lod < TerrainChunk::LOD_COUNT - 1; lod++)
+	{
+		// Switch once the next LOD's error projects under the threshold
+		float range = maxGeometricError[lod + 1] * pixelsPerUnit / pixelErrorThreshold;
+		float rangeStart = (lod > 0) ? lodRanges[lod - 1] : 0.0f;
+		if (lod > 0)
+		{
+			range = std::max(range, rangeStart * (1.0f + LOD_HYSTERESIS) + minRangeGap);
+		}
+		lodRanges[lod] = range;
+
+		float start = range - MORPH_FRACTION * (range - rangeStart);
+		if (lod > 0)
+		{
+			start = std::max(start, rangeStart * (1.0f + LOD_HYSTERESIS) + chunkDiagonal);
+		}
+		morphStart[lod] = std::min(start, range);
+	}
+	lodRanges[TerrainChunk::LOD_COUNT - 1] = FLT_MAX;
+	morphStart[TerrainChunk::LOD_COUNT - 1] = FLT_MAX;
+
 	// Shift camera into local terrain space once (not per-chunk)
 	Vector3f localCam = cameraPos - terrainOffset;
 
+	if (!lodTree.empty())
+	{
+		selectLODs(0, localCam);
+	}
+	applyLODHysteresis(localCam);
+
+	if (triangleBudget > 0)
+	{
+		FrustumPlanes frustum;
+		frustum.extractFromMatrix(viewProjMatrix);
+		applyTriangleBudget(localCam, pixelsPerUnit, frustum);
+	}
+
+	static const int neighbourOffsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	static const int neighbourEdges[4] = { STITCH_EDGE_NEG_X, STITCH_EDGE_POS_X, STITCH_EDGE_NEG_Z, STITCH_EDGE_POS_Z };
+
+	// Refine chunks until no neighbour is more than one LOD finer, so one stitch level per edge is enough
+	// LODs only ever decrease, so this settles within LOD_COUNT passes
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (auto& chunk : chunks)
+		{
+			int lod = chunk->getCurrentLOD();
+			for (int n = 0; n < 4; n++)
+			{
+				TerrainChunk* neighbour = getChunk(chunk->getChunkX() + neighbourOffsets[n][0], chunk->getChunkZ() + neighbourOffsets[n][1]);
+				if (neighbour && lod > neighbour->getCurrentLOD() + 1)
+				{
+					lod = neighbour->getCurrentLOD() + 1;
+				}
+			}
+
+			if (lod != chunk->getCurrentLOD())
+			{
+				chunk->setCurrentLOD((TerrainChunk::LODLevel)lod);
+				changed = true;
+			}
+		}
+	}
+
 	for (auto& chunk : chunks)
 	{
-		TerrainChunk::LODLevel newLOD = chunk->calculateLOD(localCam, viewDir);
-		chunk->setCurrentLOD(newLOD);
+		int mask = 0;
+		for (int n = 0; n < 4; n++)
+		{
+			TerrainChunk* neighbour = getChunk(chunk->getChunkX() + neighbourOffsets[n][0], chunk->getChunkZ() + neighbourOffsets[n][1]);
+			if (neighbour && neighbour->getCurrentLOD() > chunk->getCurrentLOD())
+			{
+				mask |= neighbourEdges[n];
+			}
+		}
+		chunk->setStitchMask(mask);
+	}
+
+	// Count what the neighbour restriction ended up adding, the budget itself is soft
+	FrustumPlanes frustum;
+	frustum.extractFromMatrix(viewProjMatrix);
+	selectedTriangles = 0;
+	for (const auto& chunk : chunks)
+	{
+		if (chunk->isResident() && chunk->isInFrustum(frustum))
+		{
+			selectedTriangles += (int)indexVariants[chunk->getCurrentLOD()][0].triangleCount;
+		}
+	}
+}
+
+void Terrain::applyLODHysteresis(const Vector3f& localCam)
+{
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		TerrainChunk* chunk = chunks[i].get();
+		int lod = chunk->getCurrentLOD();
+		int previous = previousLODs[i];
+
+		// Refinement applies at once, coarsening waits for the margin
+		if (lod > previous)
+		{
+			// Nearest point of the chunk's box, as in selectLODs
+			float minX = chunk->getChunkX() * CHUNK_SIZE, minZ = chunk->getChunkZ() * CHUNK_SIZE;
+			float dx = std::max(std::max(minX - localCam.x, localCam.x - (minX + CHUNK_SIZE)), 0.0f);
+			float dy = std::max(std::max(chunk->getMinHeight() - localCam.y, localCam.y - chunk->getMaxHeight()), 0.0f);
+			float dz = std::max(std::max(minZ - localCam.z, localCam.z - (minZ + CHUNK_SIZE)), 0.0f);
+			float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+
+			while (lod > previous && distance < lodRanges[lod - 1] * (1.0f + LOD_HYSTERESIS))
+			{
+				lod--;
+			}
+			chunk->setCurrentLOD((TerrainChunk::LODLevel)lod);
+		}
+
+		previousLODs[i] = (uint8_t)lod;
+	}
+}
+
+void Terrain::applyTriangleBudget(const Vector3f& localCam, float pixelsPerUnit, const FrustumPlanes& frustum)
+{
+	const int coarsest = TerrainChunk::LOD_COUNT - 1;
+
+	struct Refinement
+	{
+		float priority;
+		int chunkIndex;
+	};
+	auto lowerPriority = [](const Refinement& a, const Refinement& b) { return a.priority < b.priority; };
+
+	// Projected error removed per added triangle when a chunk goes one LOD finer
+	auto refinementPriority = [&](const TerrainChunk* chunk, int lod) -> float
+	{
+		Vector3f d = chunk->getCenter() - localCam;
+		float distance = std::max(sqrtf(d.x * d.x + d.y * d.y + d.z * d.z) - chunk->getBoundingRadius(), 1.0f);
+		float errorNow = std::max(chunk->getGeometricError((TerrainChunk::LODLevel)lod), getErrorFloor(lod));
+		float errorFiner = std::max(chunk->getGeometricError((TerrainChunk::LODLevel)(lod - 1)), getErrorFloor(lod - 1));
+		float addedTriangles = (float)(indexVariants[lod - 1][0].triangleCount - indexVariants[lod][0].triangleCount);
+		return (errorNow - errorFiner) * pixelsPerUnit / distance / addedTriangles;
+	};
+
+	budgetTargetLODs.resize(chunks.size());
+	std::vector<Refinement> heap;
+	heap.reserve(chunks.size());
+	int triangles = 0;
+
+	// Visible chunks start at the coarsest LOD, hidden ones keep the error-based LOD for stitching
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		TerrainChunk* chunk = chunks[i].get();
+		budgetTargetLODs[i] = chunk->getCurrentLOD();
+		if (!chunk->isResident() || !chunk->isInFrustum(frustum))
+			continue;
+
+		chunk->setCurrentLOD((TerrainChunk::LODLevel)coarsest);
+		triangles += (int)indexVariants[coarsest][0].triangleCount;
+		if (budgetTargetLODs[i] < coarsest)
+		{
+			heap.push_back({ refinementPriority(chunk, coarsest), (int)i });
+		}
+	}
+	std::make_heap(heap.begin(), heap.end(), lowerPriority);
+
+	while (!heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), lowerPriority);
+		Refinement best = heap.back();
+		heap.pop_back();
+
+		TerrainChunk* chunk = chunks[best.chunkIndex].get();
+		int lod = chunk->getCurrentLOD();
+		int cost = (int)(indexVariants[lod - 1][0].triangleCount - indexVariants[lod][0].triangleCount);
+		// Skip refinements that don't fit, a cheaper one further down may still do
+		if (triangles + cost > triangleBudget)
+			continue;
+
+		triangles += cost;
+		chunk->setCurrentLOD((TerrainChunk::LODLevel)(lod - 1));
+		if (lod - 1 > budgetTargetLODs[best.chunkIndex])
+		{
+			heap.push_back({ refinementPriority(chunk, lod - 1), best.chunkIndex });
+			std::push_heap(heap.begin(), heap.end(), lowerPriority);
+		}
+	}
+}
+
+void Terrain::setTriangleBudget(int triangles)
+{
+	triangleBudget = std::max(triangles, 0);
+}
+
+int Terrain::getTriangleBudget() const
+{
+	return triangleBudget;
+}
+
+void Terrain::setAutoTriangleBudget(float targetFrameMs, int minTriangles, int maxTriangles)
+{
+	autoBudgetTargetMs = std::max(targetFrameMs, 0.0f);
+	autoBudgetMin = minTriangles;
+	autoBudgetMax = std::max(maxTriangles, minTriangles);
+	smoothedFrameMs = 0.0f;
+
+	if (autoBudgetTargetMs > 0.0f)
+	{
+		triangleBudget = std::clamp(triangleBudget > 0 ? triangleBudget : autoBudgetMax, autoBudgetMin, autoBudgetMax);
+	}
+}
+
+void Terrain::updateTriangleBudget(float frameTimeMs)
+{
+	if (autoBudgetTargetMs <= 0.0f || frameTimeMs <= 0.0f)
+		return;
+
+	smoothedFrameMs = (smoothedFrameMs > 0.0f) ? smoothedFrameMs + (frameTimeMs - smoothedFrameMs) * BUDGET_SMOOTHING : frameTimeMs;
+
+	// Back off in proportion to the overrun, grow slowly while frames land well inside the target
+	float scale;
+	if (smoothedFrameMs > autoBudgetTargetMs * (1.0f + BUDGET_DEAD_BAND))
+	{
+		scale = std::max(autoBudgetTargetMs / smoothedFrameMs, BUDGET_MAX_SHRINK);
+	}
+	else if (smoothedFrameMs < autoBudgetTargetMs * (1.0f - BUDGET_DEAD_BAND))
+	{
+		scale = BUDGET_GROWTH;
+	}
+	else
+	{
+		return;
+	}
+	triangleBudget = std::clamp((int)(triangleBudget * scale), autoBudgetMin, autoBudgetMax);
+}
+
+int Terrain::getSelectedTriangles() const
+{
+	return selectedTriangles;
+}
+
+void Terrain::setPixelErrorThreshold(float pixels)
+{
+	pixelErrorThreshold = std::max(pixels, 0.01f);
+}
+
+float Terrain::getPixelErrorThreshold() const
+{
+	return pixelErrorThreshold;
+}
+
+void Terrain::getMorphParams(TerrainChunk::LODLevel lod, float params[3]) const
+{
+	// The coarsest LOD has nothing to morph toward, a zero scale keeps the factor at 0
+	if (lod == TerrainChunk::LOD_COUNT - 1)
+	{
+		params[0] = 0.0f;
+		params[1] = 0.0f;
+		params[2] = 0.0f;
+		return;
+	}
+
+	params[0] = morphStart[lod];
+	params[1] = 1.0f / std::max(lodRanges[lod] - morphStart[lod], 0.001f);
+	params[2] = 1.0f / TerrainChunk::getGridStep((TerrainChunk::LODLevel)(lod + 1));
+}
+
+void Terrain::getCompactVertexParams(float params[3])
+{
+	params[0] = CHUNK_SIZE / CHUNK_GRID_SIZE;
+	params[1] = TEXTURE_TILE_COUNT / TERRAIN_SIZE;
+	params[2] = TERRAIN_HEIGHT_QUANT_STEP;
+}
+
+TerrainChunk::LODLevel Terrain::getLODForDistance(float distance) const
+{
+	int lod = 0;
+	while (lod < TerrainChunk::LOD_COUNT - 1 && distance >= lodRanges[lod])
+	{
+		lod++;
+	}
+	return (TerrainChunk::LODLevel)lod;
+}
+
+int Terrain::buildLODTree(int chunkX, int chunkZ, int size)
+{
+	if (chunkX >= CHUNKS_PER_SIDE || chunkZ >= CHUNKS_PER_SIDE)
+	{
+		return -1;
+	}
+
+	int index = (int)lodTree.size();
+	lodTree.push_back(LODNode());
+	LODNode node;
+	node.chunkX = chunkX;
+	node.chunkZ = chunkZ;
+	node.size = size;
+
+	node.minHeight = node.maxHeight = 0.0f;
+
+	if (size == 1)
+	{
+		node.children[0] = node.children[1] = node.children[2] = node.children[3] = -1;
+	}
+	else
+	{
+		int half = size / 2;
+		for (int i = 0; i < 4; i++)
+		{
+			node.children[i] = buildLODTree(chunkX + (i & 1) * half, chunkZ + (i >> 1) * half, half);
+		}
+	}
+
+	// Children may have grown the vector, so write through the index
+	lodTree[index] = node;
+	return index;
+}
+
+void Terrain::refitLODTree(int nodeIndex)
+{
+	LODNode& node = lodTree[nodeIndex];
+
+	if (node.size == 1)
+	{
+		const TerrainChunk* chunk = getChunk(windowX + node.chunkX, windowZ + node.chunkZ);
+		node.minHeight = chunk->getMinHeight();
+		node.maxHeight = chunk->getMaxHeight();
+		return;
+	}
+
+	node.minHeight = FLT_MAX;
+	node.maxHeight = -FLT_MAX;
+	for (int i = 0; i < 4; i++)
+	{
+		if (node.children[i] >= 0)
+		{
+			refitLODTree(node.children[i]);
+			node.minHeight = std::min(node.minHeight, lodTree[node.children[i]].minHeight);
+			node.maxHeight = std::max(node.maxHeight, lodTree[node.children[i]].maxHeight);
+		}
+	}
+}
+
+void Terrain::selectLODs(int nodeIndex, const Vector3f& localCam)
+{
+	const LODNode& node = lodTree[nodeIndex];
+	// Nodes cover window positions, chunks are addressed on the grid
+	int startX = windowX + node.chunkX;
+	int startZ = windowZ + node.chunkZ;
+	int endX = windowX + std::min(node.chunkX + node.size, (int)CHUNKS_PER_SIDE);
+	int endZ = windowZ + std::min(node.chunkZ + node.size, (int)CHUNKS_PER_SIDE);
+
+	// Nearest and farthest points of the node's box
+	float boxMinX = startX * CHUNK_SIZE, boxMaxX = endX * CHUNK_SIZE;
+	float boxMinZ = startZ * CHUNK_SIZE, boxMaxZ = endZ * CHUNK_SIZE;
+	float nx = std::max(std::max(boxMinX - localCam.x, localCam.x - boxMaxX), 0.0f);
+	float ny = std::max(std::max(node.minHeight - localCam.y, localCam.y - node.maxHeight), 0.0f);
+	float nz = std::max(std::max(boxMinZ - localCam.z, localCam.z - boxMaxZ), 0.0f);
+	float fx = std::max(std::abs(localCam.x - boxMinX), std::abs(localCam.x - boxMaxX));
+	float fy = std::max(std::abs(localCam.y - node.minHeight), std::abs(localCam.y - node.maxHeight));
+	float fz = std::max(std::abs(localCam.z - boxMinZ), std::abs(localCam.z - boxMaxZ));
+
+	TerrainChunk::LODLevel nearLOD = getLODForDistance(sqrtf(nx * nx + ny * ny + nz * nz));
+	TerrainChunk::LODLevel farLOD = getLODForDistance(sqrtf(fx * fx + fy * fy + fz * fz));
+
+	// The whole node falls in one LOD band (or is a single chunk): no need to go deeper
+	if (nearLOD == farLOD || node.size == 1)
+	{
+		for (int z = startZ; z < endZ; z++)
+		{
+			for (int x = startX; x < endX; x++)
+			{
+				chunks[getSlotIndex(x, z)]->setCurrentLOD(nearLOD);
+			}
+		}
+		return;
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		if (node.children[i] >= 0)
+		{
+			selectLODs(node.children[i], localCam);
+		}
+	}
+}
+
+size_t Terrain::buildIndexVariants(bool upload)
+{
+	std::vector<uint16_t> indices;
+	size_t totalSize = 0;
+
+	for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
+	{
+		TerrainChunk::LODLevel level = (TerrainChunk::LODLevel)lod;
+		int stitchRatio = getNextLODRatio(lod);
+
+		for (int mask = 0; mask < TERRAIN_STITCH_VARIANTS; mask++)
+		{
+			// Nothing is coarser than the last LOD, every mask uses the plain grid
+			if (stitchRatio == 1 && mask != 0)
+			{
+				indexVariants[lod][mask] = indexVariants[lod][0];
+				continue;
+			}
+
+			// Indices address the LOD_0 grid, which holds every coarser LOD's vertices
+			if (usesTriangleStrips())
+			{
+				generateTerrainStripIndices(TerrainChunk::getVerticesPerSide(level), mask, stitchRatio,
+					TerrainChunk::getGridStep(level), indices);
+			}
+			else
+			{
+				generateTerrainIndices(TerrainChunk::getVerticesPerSide(level), mask, stitchRatio,
+					TerrainChunk::getGridStep(level), indices);
+			}
+			size_t size = indices.size() * sizeof(uint16_t);
+			totalSize += ALIGN(size, 16);
+
+			if (upload)
+			{
+				IndexVariant& variant = indexVariants[lod][mask];
+				variant.indexAlloc = bufferPool->allocateIndices(size);
+				variant.indexCount = indices.size();
+				variant.triangleCount = countTerrainTriangles(indices, usesTriangleStrips());
+				memcpy(variant.indexAlloc.gpuData, indices.data(), size);
+			}
+		}
+	}
+
+	return totalSize;
+}
+
+bool Terrain::usesTriangleStrips() const
+{
+	return renderMode == RENDER_MODE_PER_CHUNK;
+}
+
+const Terrain::IndexVariant* Terrain::getIndexVariant(TerrainChunk::LODLevel lod, int stitchMask) const
+{
+	return &indexVariants[lod][stitchMask];
+}
+
+const Terrain::IndexVariant* Terrain::getRenderIndices(const TerrainChunk* chunk) const
+{
+	// Instanced batches share one index buffer per LOD, which is fine while that mode stays flat
+	int mask = (renderMode == RENDER_MODE_INSTANCED) ? 0 : chunk->getStitchMask();
+	return &indexVariants[chunk->getCurrentLOD()][mask];
+}
+
+const TerrainChunk::Mesh* Terrain::getSharedMesh() const
+{
+	if (!sharedMeshChunk)
+	{
+		return nullptr;
+	}
+
+	return sharedMeshChunk->getMesh();
+}
+
+const TerrainChunk::Mesh* Terrain::getRenderMesh(const TerrainChunk* chunk) const
+{
+	if (renderMode == RENDER_MODE_INSTANCED)
+	{
+		return sharedMeshChunk->getMesh();
 	}
+
+	return chunk->getMesh();
+}
+
+int Terrain::buildInstanceBatches(const std::vector<TerrainChunk*>& visibleChunks, TerrainInstanceData* dst,
+	InstanceBatch batches[TerrainChunk::LOD_COUNT]) const
+{
+	// Count chunks per LOD, then prefix-sum into batch offsets
+	for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
+	{
+		batches[lod].firstInstance = 0;
+		batches[lod].instanceCount = 0;
+	}
+
+	for (const TerrainChunk* chunk : visibleChunks)
+	{
+		batches[chunk->getCurrentLOD()].instanceCount++;
+	}
+
+	int offset = 0;
+	for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
+	{
+		batches[lod].firstInstance = offset;
+		offset += batches[lod].instanceCount;
+	}
+
+	// Scatter in visible order so every batch stays sorted front-to-back
+	int written[TerrainChunk::LOD_COUNT] = {};
+	for (const TerrainChunk* chunk : visibleChunks)
+	{
+		int lod = chunk->getCurrentLOD();
+		chunk->getInstanceData(dst[batches[lod].firstInstance + written[lod]]);
+		written[lod]++;
+	}
+
+	return offset;
 }
 
 TerrainBufferPool* Terrain::getBufferPool()
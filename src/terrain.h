@@ -1,9 +1,18 @@
+#pragma once
+
 #include "commonUtils.h"
 #include "matrix.h"
+#include "terrainGenerator.h"
+#include "frustumCull.h"
+#include "horizonCull.h"
+#include "terrainHeightField.h"
 #include <psp2/types.h>
 #include <vector>
 #include <memory>
 
+class TerrainStreamWorker;
+class TerrainCacheFile;
+
 //GPU Buffer Pool for efficient memory usage
 //PSVita CDRAM type memory is very limited and alignment size is much larger than most meshes, leading to lots of waste
 class TerrainBufferPool
@@ -39,13 +48,10 @@ private:
 	size_t currentIndexOffset;
 };
 
-// Pre-extracted frustum planes — extract once per frame, test against all chunks
-struct FrustumPlanes
+// Per-instance data for the shared-mesh terrain path (stream 1 of the instanced terrain vertex program)
+struct TerrainInstanceData
 {
-	struct Plane { float a, b, c, d; };
-	Plane planes[6];
-
-	void extractFromMatrix(const Matrix4x4& viewProjMatrix);
+	float chunkOrigin[4]; // xy = chunk origin on the XZ plane (terrain local), zw = UV offset
 };
 
 class TerrainChunk
@@ -62,16 +68,30 @@ public:
 		LOD_COUNT
 	};
 
-	struct LODMesh
+	// Layout of a chunk's vertices in the pool
+	enum VertexFormat
+	{
+		VERTEX_FORMAT_FLOAT = 0,	// TerrainPBRVertex, the shared instanced meshes
+		VERTEX_FORMAT_COMPACT		// TerrainCompactVertex, dequantized with getVertexOrigin()
+	};
+
+	// The LOD_0 vertex grid, drawn by every LOD: the coarser grids are nested in it, so their index buffers
+	// (owned by Terrain, see Terrain::IndexVariant) address the matching subset of these vertices
+	struct Mesh
 	{
 		TerrainBufferPool::BufferAllocation vertexAlloc;
-		TerrainBufferPool::BufferAllocation indexAlloc;
 		size_t vertexCount;
-		size_t indexCount;
 
 		//CPU-side data for generation (released after GPU upload)
 		std::vector<TerrainPBRVertex>* tempVertices;
-		std::vector<uint16_t>* tempIndices;
+	};
+
+	// Working memory for building chunks straight into the pool, one per build thread and reused for every
+	// chunk it builds. The float grid is kept for the morph and error passes, which read it out of order
+	struct BuildScratch
+	{
+		std::vector<TerrainPBRVertex> vertices;
+		std::vector<float> heights;
 	};
 
 	//static constexpr int MaxResidentLOD = 3; // keep LOD_0...LOD_3 resident
@@ -80,55 +100,92 @@ public:
 	~TerrainChunk();
 
 	// Functions used for use with memory pool
-	void initializeWithPool(TerrainBufferPool* pool);
-	static void calculateMemoryRequirements(size_t& vertexSize, size_t& indexSize);
+	// Reserve this chunk's vertex buffer, it is reused when the chunk moves
+	void allocateFromPool(TerrainBufferPool* pool, VertexFormat format);
+	// Generate the vertex grid into a CPU buffer with bounds, LOD errors and morph targets (safe on a worker thread)
+	void generate(const TerrainHeightSource* heightSource);
+	// Generate into scratch and write the vertices straight to this chunk's pool allocation, no CPU copy is kept.
+	// Chunks own disjoint allocations, so threads may build different chunks at once with their own scratch
+	void buildInPlace(const TerrainHeightSource* heightSource, BuildScratch& scratch);
+	// Take the bounds and errors of a build whose vertices were loaded into the pool from the terrain cache
+	void restoreBuild(const TerrainHeightSource* heightSource, float minHeight, float maxHeight, const float errors[LOD_COUNT]);
+	// Read the LOD_0 heights back from the pool allocation, dequantized as the vertex shader does
+	// CPU reads from CDRAM are slow, only for chunks that have no CPU copy (loaded from the cache)
+	void readPoolHeights(float* out) const;
+	static void calculateMemoryRequirements(size_t& vertexSize, VertexFormat format);
+	static size_t getVertexStride(VertexFormat format);
+	// Vertices per side of a LOD's grid
+	static int getVerticesPerSide(LODLevel lod);
+	// LOD_0 grid units between a LOD's vertices
+	static int getGridStep(LODLevel lod);
+	// Grid a LOD's vertices lie on, LOD_0 is the one generated and stored
+	TerrainGridParams getGridParams(LODLevel lod) const;
+	VertexFormat getVertexFormat() const;
+	// Compact vertex dequantization: xy = chunk origin in grid units, z = height base
+	void getVertexOrigin(float origin[3]) const;
 	//Upload mesh data to GPU pool
 	void uploadToGPU();
 	//Release temporary CPU data after upload
 	void releaseCPUData();
 	// End of functions for use with memory pool
 
-	// Get appropriate LOD based on camera distance
-	LODLevel calculateLOD(const Vector3f& cameraPos, const Vector3f& viewDir) const;
-
-	//Get mesh data for specific LOD
-	LODMesh* getLODMesh(LODLevel lod);
-	const LODMesh* getLODMesh(LODLevel lod) const;
+	// Streaming: move to another grid position (not resident until new data is uploaded),
+	// then take the CPU mesh, bounds and errors of a chunk generated for that position
+	void moveTo(int chunkX, int chunkZ);
+	void adoptMeshData(TerrainChunk& generated);
+	// Resident chunks have GPU data for their position and can be drawn
+	bool isResident() const;
+	void setResident(bool resident);
 
-	//Get current LOD mesh based on last calculated LOD
-	LODMesh* getCurrentLODMesh();
-	const LODMesh* getCurrentLODMesh() const;
+	// Vertex data shared by every LOD
+	Mesh* getMesh();
+	const Mesh* getMesh() const;
 
 	Vector3f getCenter() const;
 	float getBoundingRadius() const;
+	float getMinHeight() const;
+	float getMaxHeight() const;
+	// Largest height difference between a LOD's surface and LOD_0, never smaller than the finer LODs' error
+	float getGeometricError(LODLevel lod) const;
+	int getChunkX() const;
+	int getChunkZ() const;
+	// Fill the per-instance origin used when drawing the shared LOD meshes
+	void getInstanceData(TerrainInstanceData& instance) const;
 	LODLevel getCurrentLOD() const;
 	void setCurrentLOD(LODLevel lod);
+	// Edges bordering a coarser neighbour (TerrainStitchEdge bits)
+	int getStitchMask() const;
+	void setStitchMask(int mask);
 
 	// Check if chunk is in frustum (using pre-extracted planes)
 	bool isInFrustum(const FrustumPlanes& frustum) const;
 
 
 private:
-	void generateLODMesh(int verticesPerSide, LODMesh& lodMesh);
+	// Fit the bounding sphere to the generated height range
+	void updateBounds(float minHeight, float maxHeight);
+	// Measure every LOD's geometric error and store each vertex's morph delta toward the LOD after the
+	// coarsest one containing it, the only LOD where the vertex is drawn off the next LOD's surface
+	void computeMorphTargets(TerrainPBRVertex* vertices);
+	// Fill a LOD_0 grid with vertices, bounds, errors and morph targets
+	void generateGrid(TerrainPBRVertex* vertices, std::vector<float>& heightScratch);
+	// Write a LOD_0 grid to the pool allocation in this chunk's vertex format
+	void writeVertices(const TerrainPBRVertex* vertices);
 
 	TerrainBufferPool* bufferPool;
+	const TerrainHeightSource* heightSource;
 	int chunkX, chunkZ; // Coordinates in the terrain grid
 	Vector3f center;	// World space center of chunk
 	float boundingRadius;
+	float minHeight, maxHeight;
+	float geometricError[LOD_COUNT];
 	float chunkSize;	// World size of this chunk
 
-	LODMesh lodMeshes[LOD_COUNT];
+	Mesh mesh;
 	LODLevel currentLOD;
-
-	// Distance thresholds for edge-aware LOD (chunk size - 500 / 10 = 62.5)
-	static constexpr float LOD_DISTANCES[LOD_COUNT] = {
-		0.0f,	// LOD_0: 0 - 2 units
-		2.0f,	// LOD_1: 2 - 4 units
-		4.0f,	// LOD_2: 2 - 16
-		16.0f,	// LOD_3: 16 - 64
-		64.0f	// LOD_4: 64+
-		//75.0f	// LOD_5: 75+
-	};
+	int stitchMask;
+	bool resident;
+	VertexFormat vertexFormat;
 };
 
 class Terrain
@@ -141,32 +198,265 @@ public:
 	static constexpr float CHUNK_SIZE = TERRAIN_SIZE / CHUNKS_PER_SIDE;
 	static constexpr float TEXTURE_TILE_COUNT = 100.0f; // Number of texture repititions across the entire terrain tile
 
+	enum RenderMode
+	{
+		RENDER_MODE_PER_CHUNK = 0,	// every chunk owns its LOD meshes, one draw per chunk
+		RENDER_MODE_INSTANCED		// one shared mesh per LOD, chunk origin comes from the instance stream
+	};
+
+	// Shared triangle list for one LOD and stitch mask
+	struct IndexVariant
+	{
+		TerrainBufferPool::BufferAllocation indexAlloc;
+		size_t indexCount;
+		size_t triangleCount;	// strips count only their non-degenerate triangles
+	};
+
+	// Visible chunks of one LOD, packed contiguously in the instance buffer
+	struct InstanceBatch
+	{
+		int firstInstance;
+		int instanceCount;
+	};
+
 	Terrain();
 	~Terrain();
 
-	bool initialize();
-	// Get chunks visible after frustum culling, sorted front-to-back (returns reference to internal cache — no allocation)
+	// Instanced mode needs flat terrain, so a height source forces per-chunk meshes
+	bool initialize(RenderMode mode = RENDER_MODE_INSTANCED, const TerrainHeightSource* heightSource = nullptr);
+	RenderMode getRenderMode() const;
+	// Threads building the chunks in initialize(), the calling thread included (1 builds serially, default 3)
+	void setBuildThreadCount(int count);
+	// Baked terrain cache: initialize() loads the pools from this file when it was built with the same
+	// parameters and height source, and writes it after generating otherwise. Null (default) always generates
+	void setCachePath(const char* path);
+	// Get chunks visible after frustum and horizon culling, sorted front-to-back (returns reference to internal cache — no allocation)
+	// The previous list is reused while the view hasn't changed, and re-sorted from the previous order otherwise
 	const std::vector<TerrainChunk*>& getVisibleChunks(const Matrix4x4& viewProjMatrix, const Vector3f& cameraPos);
+	// Cull through the quadtree (default) or test every chunk's sphere in SoA batches, to compare the two
+	void setHierarchicalCulling(bool enabled);
+	bool getHierarchicalCulling() const;
+	// Drop frustum-visible chunks hidden behind nearer hills (default on), see HorizonBuffer
+	void setHorizonCulling(bool enabled);
+	bool getHorizonCulling() const;
+	// Frustum-visible chunks the horizon removed in the last getVisibleChunks call
+	int getHorizonCulledCount() const;
+	// Cost of the last getVisibleChunks call: quadtree nodes (or chunks) tested and time spent culling
+	int getCullNodesVisited() const;
+	float getCullTimeUs() const;
+	// Height and ray queries against the resident chunks' LOD_0 heights, bilinear inside each grid cell (the drawn
+	// triangles split the cells, and coarser LODs stray from them by up to their geometric error). World space
+	// Heights under (x, z), false over chunks that aren't resident
+	bool sampleHeight(float x, float z, float& height) const;
+	// Heights for count (x, z) pairs, misses get -FLT_MAX. Returns the number of hits
+	int sampleHeights(const float* x, const float* z, int count, float* heights) const;
+	// Nearest ground point along the ray within maxDistance, direction need not be normalized. Walks the chunks
+	// under the ray and descends each one's min/max pyramid, see TerrainHeightField
+	bool raycast(const Vector3f& origin, const Vector3f& direction, float maxDistance, TerrainRayHit& hit) const;
+	// count rays sharing maxDistance, misses get a distance of -1. Returns the number of hits
+	int raycasts(const Vector3f* origins, const Vector3f* directions, int count, float maxDistance, TerrainRayHit* hits) const;
 	// Get all chunks (for initialization)
 	const std::vector<std::unique_ptr<TerrainChunk>>& getChunks() const;
-	// Get chunk at specified grid coordinate
+	// Get chunk at specified grid coordinate, nullptr outside the current window
 	TerrainChunk* getChunk(int chunkX, int chunkZ);
+	// Chunks live in a toroidal grid: a chunk's slot only depends on its position modulo the window size.
+	// Per-slot state kept outside the terrain is indexed with it too
+	static int getSlotIndex(int chunkX, int chunkZ);
+
+	// Keep the chunk window centered on the camera. Chunks leaving the window reuse their pool slots
+	// for the chunks entering it, which are generated on a worker thread and uploaded under
+	// uploadBudgetMs per frame. Slots are only rewritten framesInFlight frames after their last draw
+	// The height source passed to initialize must outlive the terrain
+	bool enableStreaming(int framesInFlight, float uploadBudgetMs);
+	bool isStreaming() const;
+	// Call once per frame before updateLODs
+	void updateStreaming(const Vector3f& cameraPos);
 	
 	int getTotalVertices() const;
 	int getTotalIndices() const;
 
-	// Update LODs for all chunks
-	void updateLODs(const Vector3f& cameraPos, const Vector3f& viewDir);
+	// Select LODs through the quadtree so each LOD's geometric error stays under the pixel threshold
+	// on screen, then coarsen visible chunks to fit the triangle budget (if one is set).
+	// Neighbours are kept within one LOD of each other and each chunk's stitch mask is set
+	// from the neighbours that ended up coarser. Chunks only coarsen once past the switch distance
+	// by a margin, and nothing is recomputed while the view and inputs are unchanged
+	void updateLODs(const Vector3f& cameraPos, const Matrix4x4& projectionMatrix, const Matrix4x4& viewProjMatrix,
+		float viewportHeight);
+
+	// Maximum projected geometric error in pixels before a finer LOD is selected
+	void setPixelErrorThreshold(float pixels);
+	float getPixelErrorThreshold() const;
+	// Vertex morph uniform for a LOD: x = distance where the morph starts, y = 1 / morph length,
+	// z = 1 / grid step of the next LOD (vertices on that grid already lie on its surface)
+	void getMorphParams(TerrainChunk::LODLevel lod, float params[3]) const;
+	// Compact vertex uniform shared by every chunk: x = world units per grid unit, y = texture tiles per world unit, z = height step
+	static void getCompactVertexParams(float params[3]);
+
+	// Triangles allowed for visible chunks, 0 disables the budget
+	void setTriangleBudget(int triangles);
+	int getTriangleBudget() const;
+	// Automatic mode: updateTriangleBudget scales the budget so frame time settles within 5% of targetFrameMs
+	// A target of 0 returns to a fixed budget
+	void setAutoTriangleBudget(float targetFrameMs, int minTriangles, int maxTriangles);
+	void updateTriangleBudget(float frameTimeMs);
+	// Triangles in the visible chunks at the LODs picked by the last updateLODs
+	int getSelectedTriangles() const;
+
+	// Per-chunk meshes are drawn as triangle strips, the instanced batches as lists because
+	// a strip would run on across the index wrap from one instance into the next
+	bool usesTriangleStrips() const;
+	// Index buffer for a LOD with the given coarser-neighbour edges stitched
+	const IndexVariant* getIndexVariant(TerrainChunk::LODLevel lod, int stitchMask) const;
+	// Index buffer used to draw a chunk at its current LOD and stitch mask
+	const IndexVariant* getRenderIndices(const TerrainChunk* chunk) const;
+
+	// Mesh shared by every chunk (instanced mode only)
+	const TerrainChunk::Mesh* getSharedMesh() const;
+	// Vertices used to draw a chunk (shared or per-chunk depending on the mode)
+	const TerrainChunk::Mesh* getRenderMesh(const TerrainChunk* chunk) const;
+	// Group visible chunks by LOD into dst (front-to-back order is kept inside each batch)
+	// dst must hold at least visibleChunks.size() entries, returns the number of instances written
+	int buildInstanceBatches(const std::vector<TerrainChunk*>& visibleChunks, TerrainInstanceData* dst,
+		InstanceBatch batches[TerrainChunk::LOD_COUNT]) const;
 
 	TerrainBufferPool* getBufferPool();
 	Matrix4x4& getModelMatrix();
 
 private:
+	// Quadtree over the chunk grid used for LOD selection, leaves are single chunks
+	struct LODNode
+	{
+		int chunkX, chunkZ, size;	// covered chunks (size may run past the grid edge)
+		float minHeight, maxHeight;
+		int children[4];			// -1 when absent, all -1 for leaves
+	};
+
+	int buildLODTree(int chunkX, int chunkZ, int size);
+	// Recompute node height ranges from the chunks currently in the window
+	void refitLODTree(int nodeIndex);
+	// Test a node's box against the planes still set in planeMask, children skip planes the parent is inside of
+	void cullNode(int nodeIndex, const FrustumPlanes& frustum, int planeMask);
+	// Add every resident chunk under a node that is entirely inside the frustum
+	void acceptNode(const LODNode& node);
+	// Refill the SoA bounds from the resident chunks
+	void rebuildChunkBounds();
+	// Walk the sorted frustum-visible chunks, keeping those that rise above the horizon of the ones before them
+	void applyHorizonCulling(const Vector3f& localCam);
+	// Hold chunks at their previous finer LOD until they are clearly past the switch distance
+	void applyLODHysteresis(const Vector3f& localCam);
+	void selectLODs(int nodeIndex, const Vector3f& localCam);
+	TerrainChunk::LODLevel getLODForDistance(float distance) const;
+	// Greedy refinement of visible chunks from the coarsest LOD by projected error removed per added triangle
+	void applyTriangleBudget(const Vector3f& localCam, float pixelsPerUnit, const FrustumPlanes& frustum);
+
+	// Generate every index variant, uploading them when the pool is ready. Returns the pool space they need
+	size_t buildIndexVariants(bool upload);
+	// Create the buffer pool and every chunk with its pool allocation, in the order the cache relies on
+	bool createChunks(size_t vertexPoolSize, size_t indexPoolSize, TerrainChunk::VertexFormat vertexFormat);
+	// Build every allocated chunk straight into the pool on up to buildThreadCount threads
+	void buildChunks();
+	// Chunks that own vertices in the pool, in allocation order
+	void getPoolChunks(std::vector<TerrainChunk*>& out) const;
+	// Hash of the generation parameters and height source, a cache is only used when its key matches
+	uint32_t getCacheKey(TerrainChunk::VertexFormat vertexFormat) const;
+	bool loadCache(TerrainCacheFile& cache);
+	void saveCache(uint32_t cacheKey, size_t vertexBytes, size_t indexBytes) const;
+
+	void recenterWindow(int newWindowX, int newWindowZ);
+	void queueStreamRequests(const Vector3f& localCam);
+	void uploadStreamedChunks();
+	// Ray span over the current window's footprint within [0, maxDistance], terrain local. False when it misses
+	bool clipRayToWindow(const Vector3f& localOrigin, const Vector3f& direction, float maxDistance, float& tMin, float& tMax) const;
+
 	std::vector<std::unique_ptr<TerrainChunk> > chunks;
 	std::unique_ptr<TerrainBufferPool> bufferPool;
+	RenderMode renderMode;
+	// Chunk (0,0) template whose meshes are shared by every chunk in instanced mode
+	std::unique_ptr<TerrainChunk> sharedMeshChunk;
+	// Index buffers shared by every chunk, [lod][stitch mask]
+	IndexVariant indexVariants[TerrainChunk::LOD_COUNT][TERRAIN_STITCH_VARIANTS];
+
+	std::vector<LODNode> lodTree;
+	float pixelErrorThreshold;
+	float maxGeometricError[TerrainChunk::LOD_COUNT];	// worst chunk per LOD, including the error floor
+	float lodRanges[TerrainChunk::LOD_COUNT];			// distance where each LOD hands over to the next coarser one
+	float morphStart[TerrainChunk::LOD_COUNT];
+
+	int triangleBudget;
+	int selectedTriangles;
+	float autoBudgetTargetMs;			// 0 when the budget is fixed
+	int autoBudgetMin, autoBudgetMax;
+	float smoothedFrameMs;
+	std::vector<int> budgetTargetLODs;	// per chunk, finest LOD the error threshold asks for
+
+	enum StreamState
+	{
+		STREAM_RESIDENT = 0,
+		STREAM_WAITING,		// needs a generation request
+		STREAM_GENERATING,	// queued on the worker
+		STREAM_UPLOADING	// generated, waiting for upload budget and for the GPU to finish with the slot
+	};
+
+	struct StreamSlot
+	{
+		StreamState state;
+		int retireFrame;	// last frame the slot's previous chunk could have been drawn
+		std::unique_ptr<TerrainChunk> generated;
+	};
+
+	const TerrainHeightSource* heightSource;
+	int buildThreadCount;
+	const char* cachePath;
+	int windowX, windowZ;	// grid position of the window's first chunk
+	bool streaming;
+	int streamFramesInFlight;
+	SceUInt64 streamUploadBudgetUs;
+	int streamFrame;
+	bool chunkBoundsDirty;	// quadtree heights and SoA bounds need refreshing
+	std::vector<StreamSlot> streamSlots;
+	std::vector<int> streamRequestOrder;	// reused each frame to avoid heap allocation
+	std::unique_ptr<TerrainStreamWorker> streamWorker;
+	TerrainHeightField heightField;	// resident chunk heights for the queries
 	Matrix4x4 modelMatrix;
+	bool hierarchicalCulling;
+	SphereBoundsSoA chunkBounds;	// resident chunks, ids are chunk slots
+	std::vector<uint16_t> cullIds;
+	int chunkBoundsVersion;			// bumped whenever bounds or residency change
+
+	// Temporal coherence: inputs of the last cull and LOD update, reused while the view is still
+	struct ViewState
+	{
+		bool valid;
+		Matrix4x4 viewProj;
+		Vector3f cameraPos;
+		int boundsVersion;
+	};
+	ViewState cullView;
+	bool cullHierarchical;
+	bool cullHorizon;
+	ViewState lodView;
+	float lodPixelsPerUnit;
+	float lodPixelThreshold;
+	int lodTriangleBudget;
+	std::vector<uint8_t> previousLODs;	// per chunk, LOD picked by the error threshold last update
+
+	struct SortEntry
+	{
+		float distanceSq;
+		TerrainChunk* chunk;
+	};
+	std::vector<TerrainChunk*> cullResult;
+	std::vector<SortEntry> sortScratch;
+	std::vector<uint32_t> visibleStamp;	// per chunk, cullStamp of the last cull that saw it
+	uint32_t cullStamp;
+	int cullNodesVisited;
+	float cullTimeUs;
 	int visibleChunkCount;
-	std::vector<TerrainChunk*> visibleChunksCache; // reused each frame to avoid heap allocation
+	std::vector<TerrainChunk*> visibleChunksCache; // frustum-visible, reused each frame to avoid heap allocation
+	bool horizonCulling;
+	HorizonBuffer horizon;
+	int horizonCulledCount;
+	std::vector<TerrainChunk*> horizonVisibleChunks; // what getVisibleChunks returns
 
 	// Terrain position offset (for multiple terrain tiles) and to position the first tile centered at 0,0
 	Vector3f terrainOffset;
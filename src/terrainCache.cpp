@@ -0,0 +1,184 @@
+#include "terrainCache.h"
+#include <psp2/kernel/clib.h>
+#include <psp2/io/fcntl.h>
+
+static const uint32_t TERRAIN_CACHE_MAGIC = 0x42435254; // "TRCB"
+// Guards the metadata allocations against a corrupt header, far above any real record count
+static const uint32_t TERRAIN_CACHE_MAX_RECORDS = 65536;
+
+// Write size bytes to an open file, false on a short write
+static bool writeAll(int fd, const void* data, size_t size)
+{
+	return sceIoWrite(fd, data, (SceSize)size) == (int)size;
+}
+
+TerrainCacheFile::TerrainCacheFile()
+	: header(), fd(-1)
+{
+
+}
+
+TerrainCacheFile::~TerrainCacheFile()
+{
+	close();
+}
+
+bool TerrainCacheFile::open(const char* path, uint32_t paramHash)
+{
+	close();
+
+	fd = sceIoOpen(path, SCE_O_RDONLY, 0);
+	if (fd < 0)
+	{
+		fd = -1;
+		return false;
+	}
+
+	if (!read(&header, sizeof(header)))
+	{
+		close();
+		return false;
+	}
+
+	if (header.magic != TERRAIN_CACHE_MAGIC || header.version != VERSION)
+	{
+		sceClibPrintf("Terrain cache: %s is from another version, rebuilding\n", path);
+		close();
+		return false;
+	}
+
+	if (header.paramHash != paramHash)
+	{
+		sceClibPrintf("Terrain cache: generation parameters changed, rebuilding\n");
+		close();
+		return false;
+	}
+
+	if (header.chunkCount > TERRAIN_CACHE_MAX_RECORDS || header.indexRecordCount > TERRAIN_CACHE_MAX_RECORDS)
+	{
+		sceClibPrintf("Terrain cache: %s is corrupt, rebuilding\n", path);
+		close();
+		return false;
+	}
+
+	chunkRecords.resize(header.chunkCount);
+	indexRecords.resize(header.indexRecordCount);
+	if (!read(chunkRecords.data(), chunkRecords.size() * sizeof(ChunkRecord)) ||
+		!read(indexRecords.data(), indexRecords.size() * sizeof(IndexRecord)))
+	{
+		sceClibPrintf("Terrain cache: %s is truncated, rebuilding\n", path);
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void TerrainCacheFile::close()
+{
+	if (fd >= 0)
+	{
+		sceIoClose(fd);
+	}
+
+	fd = -1;
+	chunkRecords.clear();
+	indexRecords.clear();
+}
+
+size_t TerrainCacheFile::getVertexBytes() const
+{
+	return header.vertexBytes;
+}
+
+size_t TerrainCacheFile::getIndexBytes() const
+{
+	return header.indexBytes;
+}
+
+const std::vector<TerrainCacheFile::ChunkRecord>& TerrainCacheFile::getChunkRecords() const
+{
+	return chunkRecords;
+}
+
+const std::vector<TerrainCacheFile::IndexRecord>& TerrainCacheFile::getIndexRecords() const
+{
+	return indexRecords;
+}
+
+bool TerrainCacheFile::readPools(void* vertexDst, void* indexDst)
+{
+	if (!read(vertexDst, header.vertexBytes) || !read(indexDst, header.indexBytes))
+	{
+		sceClibPrintf("Terrain cache: pool images are truncated, rebuilding\n");
+		return false;
+	}
+
+	uint32_t checksum = getMetadataChecksum();
+	checksum = hashTerrainData(vertexDst, header.vertexBytes, checksum);
+	checksum = hashTerrainData(indexDst, header.indexBytes, checksum);
+	if (checksum != header.checksum)
+	{
+		sceClibPrintf("Terrain cache: checksum mismatch, rebuilding\n");
+		return false;
+	}
+
+	return true;
+}
+
+bool TerrainCacheFile::write(const char* path, uint32_t paramHash, const std::vector<ChunkRecord>& chunks,
+	const std::vector<IndexRecord>& indices, const void* vertexData, size_t vertexBytes,
+	const void* indexData, size_t indexBytes)
+{
+	TerrainCacheFile file;
+	file.header.magic = TERRAIN_CACHE_MAGIC;
+	file.header.version = VERSION;
+	file.header.paramHash = paramHash;
+	file.header.chunkCount = (uint32_t)chunks.size();
+	file.header.indexRecordCount = (uint32_t)indices.size();
+	file.header.vertexBytes = (uint32_t)vertexBytes;
+	file.header.indexBytes = (uint32_t)indexBytes;
+	file.chunkRecords = chunks;
+	file.indexRecords = indices;
+
+	uint32_t checksum = file.getMetadataChecksum();
+	checksum = hashTerrainData(vertexData, vertexBytes, checksum);
+	file.header.checksum = hashTerrainData(indexData, indexBytes, checksum);
+
+	int out = sceIoOpen(path, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
+	if (out < 0)
+	{
+		sceClibPrintf("Terrain cache: could not create %s (0x%08X)\n", path, out);
+		return false;
+	}
+
+	bool ok = writeAll(out, &file.header, sizeof(file.header)) &&
+		writeAll(out, chunks.data(), chunks.size() * sizeof(ChunkRecord)) &&
+		writeAll(out, indices.data(), indices.size() * sizeof(IndexRecord)) &&
+		writeAll(out, vertexData, vertexBytes) &&
+		writeAll(out, indexData, indexBytes);
+
+	sceIoClose(out);
+
+	if (!ok)
+	{
+		sceClibPrintf("Terrain cache: failed to write %s\n", path);
+	}
+	return ok;
+}
+
+bool TerrainCacheFile::read(void* dst, size_t size)
+{
+	if (size == 0)
+		return true;
+
+	if (fd < 0)
+		return false;
+	return sceIoRead(fd, dst, (SceSize)size) == (int)size;
+}
+
+uint32_t TerrainCacheFile::getMetadataChecksum() const
+{
+	uint32_t checksum = hashTerrainData(chunkRecords.data(), chunkRecords.size() * sizeof(ChunkRecord), header.paramHash);
+	return hashTerrainData(indexRecords.data(), indexRecords.size() * sizeof(IndexRecord), checksum);
+}
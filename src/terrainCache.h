@@ -0,0 +1,74 @@
+#pragma once
+
+#include "terrain.h"
+#include <cstdint>
+#include <vector>
+
+// Versioned binary snapshot of a built terrain: the used part of the vertex and index pools plus the chunk
+// and index metadata needed to draw them without regenerating anything
+// Layout: Header, ChunkRecord[chunkCount], IndexRecord[indexRecordCount], vertex pool image, index pool image
+class TerrainCacheFile
+{
+public:
+	// Bump when the file layout or the generator output changes without any keyed parameter changing
+	static const uint32_t VERSION = 1;
+
+	// One record per chunk owning vertices, in pool allocation order
+	struct ChunkRecord
+	{
+		uint32_t vertexOffset;
+		float minHeight, maxHeight;
+		float geometricError[TerrainChunk::LOD_COUNT];
+	};
+
+	// One record per LOD and stitch mask (Terrain::IndexVariant)
+	struct IndexRecord
+	{
+		uint32_t indexOffset;
+		uint32_t indexCount;
+		uint32_t triangleCount;
+	};
+
+	TerrainCacheFile();
+	~TerrainCacheFile();
+
+	// Read the header and metadata. False when the file is missing, truncated, from another version
+	// or was built with different generation parameters (paramHash)
+	bool open(const char* path, uint32_t paramHash);
+	void close();
+
+	size_t getVertexBytes() const;
+	size_t getIndexBytes() const;
+	const std::vector<ChunkRecord>& getChunkRecords() const;
+	const std::vector<IndexRecord>& getIndexRecords() const;
+
+	// Read both pool images straight into their destinations (one sequential read each),
+	// then verify the checksum over everything read. The destinations hold garbage on failure
+	bool readPools(void* vertexDst, void* indexDst);
+
+	static bool write(const char* path, uint32_t paramHash, const std::vector<ChunkRecord>& chunks,
+		const std::vector<IndexRecord>& indices, const void* vertexData, size_t vertexBytes,
+		const void* indexData, size_t indexBytes);
+
+private:
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t paramHash;
+		uint32_t checksum;	// hashTerrainData over the records and pool images, seeded with paramHash
+		uint32_t chunkCount;
+		uint32_t indexRecordCount;
+		uint32_t vertexBytes;
+		uint32_t indexBytes;
+	};
+
+	// Read the next size bytes of the file
+	bool read(void* dst, size_t size);
+	uint32_t getMetadataChecksum() const;
+
+	Header header;
+	std::vector<ChunkRecord> chunkRecords;
+	std::vector<IndexRecord> indexRecords;
+	int fd;
+};
@@ -0,0 +1,314 @@
+#include "terrainDrawRecords.h"
+#include "memory.h"
+#include <psp2/kernel/clib.h>
+
+TerrainDrawRecords::TerrainDrawRecords()
+	: setCount(0), vertexProgram(nullptr), chunkOriginParam(nullptr), cacheParamsParam(nullptr), lodParam(nullptr),
+	perFrameContainer(0), cache(nullptr), fragmentContainer(0),
+	recordMemoryUID(-1), recordMemory(nullptr), fragmentMemoryUID(-1), fragmentMemory(nullptr)
+{
+	for (int i = 0; i < PASS_COUNT; i++)
+	{
+		fragmentStateValid[i] = false;
+		passUsesPerFrameBuffer[i] = false;
+	}
+}
+
+TerrainDrawRecords::~TerrainDrawRecords()
+{
+	release();
+}
+
+bool TerrainDrawRecords::init(Terrain& terrain, int setCountIn, const SceGxmVertexProgram* vertexProgramIn,
+	const SceGxmProgramParameter* chunkOriginParamIn, const SceGxmProgramParameter* cacheParamsParamIn,
+	const SceGxmProgramParameter* lodParamIn, unsigned int perFrameContainerIn, const TerrainMaterialCache* cacheIn)
+{
+	release();
+	if (!vertexProgramIn || !chunkOriginParamIn || !cacheParamsParamIn || !lodParamIn || setCountIn <= 0)
+	{
+		sceClibPrintf("Terrain draw records: missing vertex program parameters\n");
+		return false;
+	}
+
+	setCount = setCountIn;
+	vertexProgram = vertexProgramIn;
+	chunkOriginParam = chunkOriginParamIn;
+	cacheParamsParam = cacheParamsParamIn;
+	lodParam = lodParamIn;
+	perFrameContainer = perFrameContainerIn;
+	cache = cacheIn;
+	frameBuffers.assign(setCount, FrameBuffers{ nullptr, nullptr });
+
+	// Each record's draw and vertex state extra data, then its default uniforms, all read by the GPU
+	const size_t drawBytes = ALIGN(sceGxmGetPrecomputedDrawSize(vertexProgram), SCE_GXM_PRECOMPUTED_ALIGNMENT);
+	const size_t stateBytes = ALIGN(sceGxmGetPrecomputedVertexStateSize(vertexProgram), SCE_GXM_PRECOMPUTED_ALIGNMENT);
+	const size_t defaultBytes = ALIGN(sceGxmProgramGetDefaultUniformBufferSize(sceGxmVertexProgramGetProgram(vertexProgram)),
+		SCE_GXM_PRECOMPUTED_ALIGNMENT);
+	const size_t recordBytes = drawBytes + stateBytes + defaultBytes;
+	const int slotCount = Terrain::CHUNKS_PER_SIDE * Terrain::CHUNKS_PER_SIDE;
+	const int recordCount = setCount * slotCount * TerrainChunk::LOD_COUNT;
+
+	recordMemory = gpuAllocMap(recordCount * recordBytes, SCE_KERNEL_MEMBLOCK_TYPE_USER_RW_UNCACHE,
+		SCE_GXM_MEMORY_ATTRIB_READ, &recordMemoryUID);
+	if (!recordMemory)
+	{
+		sceClibPrintf("Terrain draw records: allocation failed\n");
+		recordMemoryUID = -1;
+		return false;
+	}
+	sceClibMemset(recordMemory, 0, recordCount * recordBytes);
+
+	records.resize(recordCount);
+	for (int i = 0; i < recordCount; i++)
+	{
+		Record& record = records[i];
+		uint8_t* memory = (uint8_t*)recordMemory + i * recordBytes;
+		int err = sceGxmPrecomputedDrawInit(&record.draw, vertexProgram, memory);
+		if (err == SCE_OK)
+		{
+			err = sceGxmPrecomputedVertexStateInit(&record.vertexState, vertexProgram, memory + drawBytes);
+		}
+		if (err != SCE_OK)
+		{
+			sceClibPrintf("Terrain draw records: precomputed init failed: 0x%08X\n", err);
+			release();
+			return false;
+		}
+
+		record.defaults = memory + drawBytes + stateBytes;
+		sceGxmPrecomputedVertexStateSetDefaultUniformBuffer(&record.vertexState, record.defaults);
+		record.perFrameBuffer = nullptr;
+		record.vertexData = nullptr;
+		record.chunkX = record.chunkZ = 0;
+		record.stitchMask = -1;
+	}
+
+	// Every resident chunk at every LOD, the rest are baked as they stream in and get drawn
+	int baked = 0;
+	for (const auto& owned : terrain.getChunks())
+	{
+		const TerrainChunk* chunk = owned.get();
+		if (!chunk->isResident())
+			continue;
+
+		int slot = Terrain::getSlotIndex(chunk->getChunkX(), chunk->getChunkZ());
+		for (int set = 0; set < setCount; set++)
+		{
+			for (int lod = 0; lod < TerrainChunk::LOD_COUNT; lod++)
+			{
+				bake(getRecord(set, slot, (TerrainChunk::LODLevel)lod), terrain, chunk, (TerrainChunk::LODLevel)lod);
+				baked++;
+			}
+		}
+	}
+
+	sceClibPrintf("Terrain draw records: %d baked of %d, %u bytes of GPU data each\n", baked, recordCount,
+		(unsigned)recordBytes);
+	return true;
+}
+
+bool TerrainDrawRecords::initFragmentStates(const PassDesc passes[PASS_COUNT], unsigned int fragmentContainerIn)
+{
+	if (fragmentMemory)
+	{
+		gpuFreeUnmap(fragmentMemoryUID);
+		fragmentMemory = nullptr;
+		fragmentMemoryUID = -1;
+	}
+
+	size_t stateBytes[PASS_COUNT], passDefaultBytes[PASS_COUNT];
+	size_t totalBytes = 0;
+	for (int i = 0; i < PASS_COUNT; i++)
+	{
+		fragmentStateValid[i] = false;
+		passUsesPerFrameBuffer[i] = passes[i].usesPerFrameBuffer;
+		if (!passes[i].program)
+		{
+			stateBytes[i] = passDefaultBytes[i] = 0;
+			continue;
+		}
+		stateBytes[i] = ALIGN(sceGxmGetPrecomputedFragmentStateSize(passes[i].program), SCE_GXM_PRECOMPUTED_ALIGNMENT);
+		passDefaultBytes[i] = ALIGN(sceGxmProgramGetDefaultUniformBufferSize(sceGxmFragmentProgramGetProgram(passes[i].program)),
+			SCE_GXM_PRECOMPUTED_ALIGNMENT);
+		totalBytes += (stateBytes[i] + passDefaultBytes[i]) * setCount;
+	}
+	fragmentContainer = fragmentContainerIn;
+	fragmentStates.resize((size_t)setCount * PASS_COUNT);
+
+	fragmentMemory = gpuAllocMap(totalBytes, SCE_KERNEL_MEMBLOCK_TYPE_USER_RW_UNCACHE, SCE_GXM_MEMORY_ATTRIB_READ,
+		&fragmentMemoryUID);
+	if (!fragmentMemory)
+	{
+		sceClibPrintf("Terrain draw records: fragment state allocation failed\n");
+		fragmentMemoryUID = -1;
+		return false;
+	}
+	sceClibMemset(fragmentMemory, 0, totalBytes);
+
+	uint8_t* memory = (uint8_t*)fragmentMemory;
+	for (int set = 0; set < setCount; set++)
+	{
+		for (int i = 0; i < PASS_COUNT; i++)
+		{
+			const PassDesc& pass = passes[i];
+			if (!pass.program)
+				continue;
+
+			SceGxmPrecomputedFragmentState& state = fragmentStates[set * PASS_COUNT + i];
+			int err = sceGxmPrecomputedFragmentStateInit(&state, pass.program, memory);
+			if (err != SCE_OK)
+			{
+				sceClibPrintf("Terrain draw records: fragment state %d init failed: 0x%08X\n", i, err);
+				return false;
+			}
+			memory += stateBytes[i];
+
+			if (passDefaultBytes[i] > 0)
+			{
+				if (pass.f0Param)
+				{
+					sceGxmSetUniformDataF(memory, pass.f0Param, 0, 3, pass.f0);
+				}
+				sceGxmPrecomputedFragmentStateSetDefaultUniformBuffer(&state, memory);
+				memory += passDefaultBytes[i];
+			}
+			for (int unit = 0; unit < MAX_PASS_TEXTURES; unit++)
+			{
+				if (pass.textures[unit])
+				{
+					sceGxmPrecomputedFragmentStateSetTexture(&state, unit, pass.textures[unit]);
+				}
+			}
+		}
+		// Bound by the set's next beginFrame
+		frameBuffers[set].fragment = nullptr;
+	}
+	for (int i = 0; i < PASS_COUNT; i++)
+	{
+		fragmentStateValid[i] = passes[i].program != nullptr;
+	}
+	return true;
+}
+
+void TerrainDrawRecords::release()
+{
+	if (recordMemory)
+	{
+		gpuFreeUnmap(recordMemoryUID);
+		recordMemory = nullptr;
+		recordMemoryUID = -1;
+	}
+	if (fragmentMemory)
+	{
+		gpuFreeUnmap(fragmentMemoryUID);
+		fragmentMemory = nullptr;
+		fragmentMemoryUID = -1;
+	}
+	for (int i = 0; i < PASS_COUNT; i++)
+	{
+		fragmentStateValid[i] = false;
+	}
+	records.clear();
+	fragmentStates.clear();
+	frameBuffers.clear();
+	setCount = 0;
+}
+
+bool TerrainDrawRecords::isInitialized() const
+{
+	return recordMemory != nullptr;
+}
+
+void TerrainDrawRecords::beginFrame(int set, const void* vertexBuffer, const void* fragmentBuffer)
+{
+	FrameBuffers& buffers = frameBuffers[set];
+	buffers.vertex = vertexBuffer;
+	if (buffers.fragment == fragmentBuffer || fragmentStates.empty())
+		return;
+
+	for (int i = 0; i < PASS_COUNT; i++)
+	{
+		if (fragmentStateValid[i] && passUsesPerFrameBuffer[i])
+		{
+			sceGxmPrecomputedFragmentStateSetUniformBuffer(&fragmentStates[set * PASS_COUNT + i], fragmentContainer,
+				fragmentBuffer);
+		}
+	}
+	buffers.fragment = fragmentBuffer;
+}
+
+void TerrainDrawRecords::draw(SceGxmContext* context, int set, Terrain& terrain, const TerrainChunk* chunk)
+{
+	TerrainChunk::LODLevel lod = chunk->getCurrentLOD();
+	Record& record = getRecord(set, Terrain::getSlotIndex(chunk->getChunkX(), chunk->getChunkZ()), lod);
+	const void* vertexData = (uint8_t*)terrain.getBufferPool()->getVertexPoolBase() + chunk->getMesh()->vertexAlloc.offset;
+
+	if (record.vertexData != vertexData || record.chunkX != chunk->getChunkX() || record.chunkZ != chunk->getChunkZ())
+	{
+		bake(record, terrain, chunk, lod);
+	}
+	else if (record.stitchMask != chunk->getStitchMask())
+	{
+		setIndices(record, terrain, chunk, lod);
+	}
+	if (record.perFrameBuffer != frameBuffers[set].vertex)
+	{
+		sceGxmPrecomputedVertexStateSetUniformBuffer(&record.vertexState, perFrameContainer, frameBuffers[set].vertex);
+		record.perFrameBuffer = frameBuffers[set].vertex;
+	}
+
+	sceGxmSetPrecomputedVertexState(context, &record.vertexState);
+	sceGxmDrawPrecomputed(context, &record.draw);
+}
+
+void TerrainDrawRecords::setFragmentState(SceGxmContext* context, int set, Pass pass) const
+{
+	if (fragmentStateValid[pass])
+	{
+		sceGxmSetPrecomputedFragmentState(context, &fragmentStates[set * PASS_COUNT + pass]);
+	}
+}
+
+void TerrainDrawRecords::clearState(SceGxmContext* context) const
+{
+	sceGxmSetPrecomputedVertexState(context, NULL);
+	sceGxmSetPrecomputedFragmentState(context, NULL);
+}
+
+TerrainDrawRecords::Record& TerrainDrawRecords::getRecord(int set, int slot, TerrainChunk::LODLevel lod)
+{
+	return records[((size_t)set * Terrain::CHUNKS_PER_SIDE * Terrain::CHUNKS_PER_SIDE + slot) * TerrainChunk::LOD_COUNT + lod];
+}
+
+void TerrainDrawRecords::bake(Record& record, Terrain& terrain, const TerrainChunk* chunk, TerrainChunk::LODLevel lod)
+{
+	const void* vertexData = (uint8_t*)terrain.getBufferPool()->getVertexPoolBase() + chunk->getMesh()->vertexAlloc.offset;
+	sceGxmPrecomputedDrawSetVertexStream(&record.draw, 0, vertexData);
+	setIndices(record, terrain, chunk, lod);
+
+	float chunkOrigin[3];
+	chunk->getVertexOrigin(chunkOrigin);
+	float cacheParams[3] = { 0.0f, 0.0f, 0.0f };
+	if (cache && cache->isInitialized())
+	{
+		cache->getTileParams(chunk, cacheParams);
+	}
+	float lodIndex = (float)lod;
+	sceGxmSetUniformDataF(record.defaults, chunkOriginParam, 0, 3, chunkOrigin);
+	sceGxmSetUniformDataF(record.defaults, cacheParamsParam, 0, 3, cacheParams);
+	sceGxmSetUniformDataF(record.defaults, lodParam, 0, 1, &lodIndex);
+
+	record.vertexData = vertexData;
+	record.chunkX = chunk->getChunkX();
+	record.chunkZ = chunk->getChunkZ();
+}
+
+void TerrainDrawRecords::setIndices(Record& record, Terrain& terrain, const TerrainChunk* chunk, TerrainChunk::LODLevel lod)
+{
+	const Terrain::IndexVariant* indices = terrain.getIndexVariant(lod, chunk->getStitchMask());
+	void* indexData = (uint8_t*)terrain.getBufferPool()->getIndexPoolBase() + indices->indexAlloc.offset;
+	sceGxmPrecomputedDrawSetParams(&record.draw,
+		terrain.usesTriangleStrips() ? SCE_GXM_PRIMITIVE_TRIANGLE_STRIP : SCE_GXM_PRIMITIVE_TRIANGLES,
+		SCE_GXM_INDEX_FORMAT_U16, indexData, (unsigned int)indices->indexCount);
+	record.stitchMask = chunk->getStitchMask();
+}
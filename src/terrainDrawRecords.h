@@ -0,0 +1,107 @@
+#pragma once
+
+#include "terrain.h"
+#include "terrainMaterialCache.h"
+#include <psp2/gxm.h>
+#include <psp2/types.h>
+#include <vector>
+
+// Precomputed GXM draws for the per-chunk terrain, one record per chunk slot and LOD
+// A record holds the chunk's vertex stream and LOD indices (SceGxmPrecomputedDraw) and its vertex state: the per-frame
+// uniform buffer binding and a default uniform block with the chunk's dequantization origin, material cache tile and
+// LOD. None of it changes while the chunk stays in its slot, the terrain vertex program reads the per-frame values
+// from its uniform buffer, so replaying a chunk skips the validation and default reservation of sceGxmDraw
+// Every display buffer has its own set of records and fragment states: a chunk streamed into a slot, restitched
+// against new neighbours or given a new per-frame buffer only rewrites the set being built, which the GPU has
+// finished reading
+class TerrainDrawRecords
+{
+public:
+	// Fragment passes over the per-chunk terrain, each with its precomputed fragment state
+	enum Pass
+	{
+		PASS_FULL = 0,	// near chunks, lit per pixel
+		PASS_CACHED,	// distant chunks sampling the material cache
+		PASS_SIMPLE,	// distant chunks without a baked tile
+		PASS_COUNT
+	};
+
+	static const int MAX_PASS_TEXTURES = 4;
+
+	// A pass's program, its textures by unit (nullptr leaves a unit unset) and the optional float3 default f0Param
+	struct PassDesc
+	{
+		const SceGxmFragmentProgram* program;
+		const SceGxmTexture* textures[MAX_PASS_TEXTURES];
+		bool usesPerFrameBuffer;
+		const SceGxmProgramParameter* f0Param;
+		float f0[3];
+	};
+
+	TerrainDrawRecords();
+	~TerrainDrawRecords();
+
+	// Bake a record for every resident chunk at every LOD in setCount sets. The params are vertexProgram's per-chunk
+	// defaults, its per-frame buffer is at perFrameContainer. cache may be nullptr (or uninitialized) when distant
+	// chunks aren't cached
+	bool init(Terrain& terrain, int setCount, const SceGxmVertexProgram* vertexProgram,
+		const SceGxmProgramParameter* chunkOriginParam, const SceGxmProgramParameter* cacheParamsParam,
+		const SceGxmProgramParameter* lodParam, unsigned int perFrameContainer, const TerrainMaterialCache* cache);
+	// (Re)build every set's fragment states, again whenever the programs are re-patched. The GPU must be idle
+	bool initFragmentStates(const PassDesc passes[PASS_COUNT], unsigned int fragmentContainer);
+	void release();
+	bool isInitialized() const;
+
+	// The per-frame uniform buffers set's records and fragment states read this frame, call before replaying from
+	// it. Records pick up a new vertex buffer as they are drawn
+	void beginFrame(int set, const void* vertexBuffer, const void* fragmentBuffer);
+	// Replay a visible chunk at its current LOD from set's records, rewriting its record first if another chunk
+	// was baked into it or the chunk's stitch mask changed. The pass's fragment state must be set
+	void draw(SceGxmContext* context, int set, Terrain& terrain, const TerrainChunk* chunk);
+	void setFragmentState(SceGxmContext* context, int set, Pass pass) const;
+	// Back to the context's own vertex and fragment state, call after the last replayed chunk
+	void clearState(SceGxmContext* context) const;
+
+private:
+	struct Record
+	{
+		SceGxmPrecomputedDraw draw;
+		SceGxmPrecomputedVertexState vertexState;
+		void* defaults;			// default uniform block in GPU memory
+		const void* perFrameBuffer;	// bound in vertexState
+		const void* vertexData;	// nullptr until baked
+		int chunkX, chunkZ;
+		int stitchMask;
+	};
+
+	Record& getRecord(int set, int slot, TerrainChunk::LODLevel lod);
+	void bake(Record& record, Terrain& terrain, const TerrainChunk* chunk, TerrainChunk::LODLevel lod);
+	void setIndices(Record& record, Terrain& terrain, const TerrainChunk* chunk, TerrainChunk::LODLevel lod);
+
+	std::vector<Record> records;
+	int setCount;
+	const SceGxmVertexProgram* vertexProgram;
+	const SceGxmProgramParameter* chunkOriginParam;
+	const SceGxmProgramParameter* cacheParamsParam;
+	const SceGxmProgramParameter* lodParam;
+	unsigned int perFrameContainer;
+	const TerrainMaterialCache* cache;
+
+	// Per set, this frame's vertex buffer and the fragment buffer its fragment states are bound to
+	struct FrameBuffers
+	{
+		const void* vertex;
+		const void* fragment;
+	};
+	std::vector<FrameBuffers> frameBuffers;
+
+	std::vector<SceGxmPrecomputedFragmentState> fragmentStates;	// PASS_COUNT per set
+	bool fragmentStateValid[PASS_COUNT];
+	bool passUsesPerFrameBuffer[PASS_COUNT];
+	unsigned int fragmentContainer;
+
+	SceUID recordMemoryUID;
+	void* recordMemory;
+	SceUID fragmentMemoryUID;
+	void* fragmentMemory;
+};
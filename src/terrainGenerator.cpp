@@ -0,0 +1,430 @@
+#include "terrainGenerator.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TERRAIN_GENERATOR_NEON 1
+#endif
+
+// Normal and tangent for one vertex from its four neighbours (scalar path and NEON tail)
+static inline void computeFrameScalar(float hL, float hR, float hD, float hU, float invTwoSpacing,
+	TerrainPBRVertex& v)
+{
+	float dhdx = (hR - hL) * invTwoSpacing;
+	float dhdz = (hU - hD) * invTwoSpacing;
+
+	// N = normalize(-dh/dx, 1, -dh/dz), T = normalize(1, dh/dx, 0)
+	float invN = 1.0f / sqrtf(dhdx * dhdx + dhdz * dhdz + 1.0f);
+	float invT = 1.0f / sqrtf(dhdx * dhdx + 1.0f);
+
+	v.nx = floatToS16N(-dhdx * invN);
+	v.ny = floatToS16N(invN);
+	v.nz = floatToS16N(-dhdz * invN);
+	v.tx = floatToS16N(invT);
+	v.ty = floatToS16N(dhdx * invT);
+	v.tz = 0;
+}
+
+#ifdef TERRAIN_GENERATOR_NEON
+// 1/sqrt(x) from the estimate plus two Newton-Raphson steps
+static inline float32x4_t rsqrtNeon(float32x4_t x)
+{
+	float32x4_t e = vrsqrteq_f32(x);
+	e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(x, e), e));
+	e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(x, e), e));
+	return e;
+}
+
+// Scale [-1,1] floats to S16N, clamped so estimate error can't wrap
+static inline int16x4_t toS16N(float32x4_t v)
+{
+	v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(-1.0f)), vdupq_n_f32(1.0f));
+	return vmovn_s32(vcvtq_s32_f32(vmulq_n_f32(v, 32767.0f)));
+}
+#endif
+
+void generateTerrainGrid(const TerrainHeightSource* source, const TerrainGridParams& params,
+	TerrainPBRVertex* out, float& minHeight, float& maxHeight)
+{
+	std::vector<float> heights;
+	generateTerrainGrid(source, params, out, minHeight, maxHeight, heights);
+}
+
+void generateTerrainGrid(const TerrainHeightSource* source, const TerrainGridParams& params,
+	TerrainPBRVertex* out, float& minHeight, float& maxHeight, std::vector<float>& heights)
+{
+	const int n = params.verticesPerSide;
+	// Heights carry a one vertex border so central differences also work on chunk edges
+	const int paddedSide = n + 2;
+	heights.assign(paddedSide * paddedSide, 0.0f);
+
+	if (source)
+	{
+		for (int z = 0; z < paddedSide; z++)
+		{
+			source->sampleRow(params.gridX0 - params.step,
+				params.gridZ0 + (z - 1) * params.step,
+				params.step, paddedSide, &heights[z * paddedSide]);
+		}
+	}
+
+	const float worldStep = params.step * params.gridSpacing;
+	const float invTwoSpacing = 1.0f / (2.0f * worldStep);
+	const int16_t handedness = floatToS16N(-1.0f); // (N x T) . B is negative for any heightfield slope
+
+	minHeight = heights[paddedSide + 1];
+	maxHeight = minHeight;
+
+	for (int z = 0; z < n; z++)
+	{
+		const float* rowC = &heights[(z + 1) * paddedSide + 1];
+		const float* rowD = rowC - paddedSide;
+		const float* rowU = rowC + paddedSide;
+		TerrainPBRVertex* dst = out + z * n;
+
+		float gridZ = (float)(params.gridZ0 + z * params.step);
+
+		// Positions, UVs and height range
+		for (int x = 0; x < n; x++)
+		{
+			float gridX = (float)(params.gridX0 + x * params.step);
+			TerrainPBRVertex& v = dst[x];
+			v.x = gridX * params.gridSpacing;
+			v.y = rowC[x];
+			v.z = gridZ * params.gridSpacing;
+			v.u = v.x * params.uvScale;
+			v.v = v.z * params.uvScale;
+			v.tw = handedness;
+			v.morphDelta = 0;
+
+			minHeight = std::min(minHeight, rowC[x]);
+			maxHeight = std::max(maxHeight, rowC[x]);
+		}
+
+		// Normals and tangents, 4 vertices at a time
+		int x = 0;
+#ifdef TERRAIN_GENERATOR_NEON
+		const float32x4_t one = vdupq_n_f32(1.0f);
+		const float32x4_t scale = vdupq_n_f32(invTwoSpacing);
+		for (; x + 4 <= n; x += 4)
+		{
+			float32x4_t dhdx = vmulq_f32(vsubq_f32(vld1q_f32(rowC + x + 1), vld1q_f32(rowC + x - 1)), scale);
+			float32x4_t dhdz = vmulq_f32(vsubq_f32(vld1q_f32(rowU + x), vld1q_f32(rowD + x)), scale);
+
+			float32x4_t dx2 = vmulq_f32(dhdx, dhdx);
+			float32x4_t invN = rsqrtNeon(vaddq_f32(vmlaq_f32(dx2, dhdz, dhdz), one));
+			float32x4_t invT = rsqrtNeon(vaddq_f32(dx2, one));
+
+			int16_t nx[4], ny[4], nz[4], tx[4], ty[4];
+			vst1_s16(nx, toS16N(vnegq_f32(vmulq_f32(dhdx, invN))));
+			vst1_s16(ny, toS16N(invN));
+			vst1_s16(nz, toS16N(vnegq_f32(vmulq_f32(dhdz, invN))));
+			vst1_s16(tx, toS16N(invT));
+			vst1_s16(ty, toS16N(vmulq_f32(dhdx, invT)));
+
+			for (int i = 0; i < 4; i++)
+			{
+				TerrainPBRVertex& v = dst[x + i];
+				v.nx = nx[i]; v.ny = ny[i]; v.nz = nz[i];
+				v.tx = tx[i]; v.ty = ty[i]; v.tz = 0;
+			}
+		}
+#endif
+		for (; x < n; x++)
+		{
+			computeFrameScalar(rowC[x - 1], rowC[x + 1], rowD[x], rowU[x], invTwoSpacing, dst[x]);
+		}
+	}
+}
+
+// Vertex addressing shared by the list and strip index generators
+struct StitchedGrid
+{
+	int n, gridSize, bufferSide;
+	int stitchMask, stitchRatio, gridStep;
+
+	StitchedGrid(int verticesPerSide, int mask, int ratio, int step)
+		: n(verticesPerSide), gridSize(verticesPerSide - 1), bufferSide((verticesPerSide - 1) * step + 1),
+		stitchMask(mask), stitchRatio(ratio), gridStep(step)
+	{
+	}
+
+	// Snapping along the edge is a chain of edge collapses, which keeps the triangulation watertight.
+	// Snapping to the nearest coarse vertex (ties down) also avoids flips at corners stitched on both edges
+	int snap(int v) const
+	{
+		int r = v % stitchRatio;
+		return (r * 2 > stitchRatio) ? v - r + stitchRatio : v - r;
+	}
+
+	// Grid index of vertex (x, z) after stitching
+	uint16_t vertexIndex(int x, int z) const
+	{
+		if ((z == 0 && (stitchMask & STITCH_EDGE_NEG_Z)) || (z == gridSize && (stitchMask & STITCH_EDGE_POS_Z)))
+			x = snap(x);
+		if ((x == 0 && (stitchMask & STITCH_EDGE_NEG_X)) || (x == gridSize && (stitchMask & STITCH_EDGE_POS_X)))
+			z = snap(z);
+		return (uint16_t)(z * n + x);
+	}
+
+	// Grid index to the LOD_0 vertex buffer the grid is nested in
+	uint16_t bufferIndex(uint16_t i) const
+	{
+		return (uint16_t)((i / n) * gridStep * bufferSide + (i % n) * gridStep);
+	}
+
+	// Collapsed triangles either share a vertex or, at a corner stitched on both edges, lie on the diagonal
+	bool isCollapsed(uint16_t a, uint16_t b, uint16_t c) const
+	{
+		int abx = b % n - a % n, abz = b / n - a / n;
+		int acx = c % n - a % n, acz = c / n - a / n;
+		return abx * acz - abz * acx == 0;
+	}
+};
+
+void generateTerrainIndices(int verticesPerSide, int stitchMask, int stitchRatio, int gridStep, std::vector<uint16_t>& out)
+{
+	const StitchedGrid grid(verticesPerSide, stitchMask, stitchRatio, gridStep);
+	out.clear();
+	out.reserve(grid.gridSize * grid.gridSize * 6);
+
+	auto addTriangle = [&](uint16_t a, uint16_t b, uint16_t c)
+	{
+		if (grid.isCollapsed(a, b, c))
+			return;
+		out.push_back(grid.bufferIndex(a));
+		out.push_back(grid.bufferIndex(b));
+		out.push_back(grid.bufferIndex(c));
+	};
+
+	for (int z = 0; z < grid.gridSize; z++)
+	{
+		for (int x = 0; x < grid.gridSize; x++)
+		{
+			uint16_t i00 = grid.vertexIndex(x, z);
+			uint16_t i10 = grid.vertexIndex(x + 1, z);
+			uint16_t i01 = grid.vertexIndex(x, z + 1);
+			uint16_t i11 = grid.vertexIndex(x + 1, z + 1);
+
+			addTriangle(i00, i01, i10);
+			addTriangle(i10, i01, i11);
+		}
+	}
+}
+
+void generateTerrainStripIndices(int verticesPerSide, int stitchMask, int stitchRatio, int gridStep, std::vector<uint16_t>& out)
+{
+	const StitchedGrid grid(verticesPerSide, stitchMask, stitchRatio, gridStep);
+	const int gridSize = grid.gridSize;
+	out.clear();
+
+	// The grid is walked in columns of TERRAIN_STRIP_BLOCK_QUADS quads, row by row inside a column, so the
+	// previous row's lower vertices are still in the post-transform cache when the next row reuses them
+	for (int x0 = 0; x0 < gridSize; x0 += TERRAIN_STRIP_BLOCK_QUADS)
+	{
+		int x1 = std::min(x0 + TERRAIN_STRIP_BLOCK_QUADS, gridSize);
+
+		for (int z = 0; z < gridSize; z++)
+		{
+			// Repeating the last and the next index joins rows with degenerate triangles, every row has an
+			// even index count so the winding parity carries over
+			if (!out.empty())
+			{
+				uint16_t last = out.back();
+				out.push_back(last);
+				out.push_back(grid.bufferIndex(grid.vertexIndex(x0, z)));
+			}
+
+			// Each quad is (x, z) (x, z + 1) (x + 1, z) then (x + 1, z) (x, z + 1) (x + 1, z + 1),
+			// the same split as the list version. Collapsed stitch triangles stay in as degenerates
+			uint16_t top = 0, bottom = 0;
+			for (int x = x0; x <= x1; x++)
+			{
+				uint16_t nextTop = grid.vertexIndex(x, z);
+				uint16_t nextBottom = grid.vertexIndex(x, z + 1);
+
+				// A triangle collapsed onto the diagonal repeats no vertex. Repeating its middle vertex twice
+				// turns it into degenerates and keeps the winding parity
+				if (x > x0 && top != bottom && bottom != nextTop && top != nextTop && grid.isCollapsed(top, bottom, nextTop))
+				{
+					out.push_back(grid.bufferIndex(bottom));
+					out.push_back(grid.bufferIndex(bottom));
+				}
+				out.push_back(grid.bufferIndex(nextTop));
+				if (x > x0 && bottom != nextTop && nextTop != nextBottom && bottom != nextBottom &&
+					grid.isCollapsed(bottom, nextTop, nextBottom))
+				{
+					out.push_back(grid.bufferIndex(nextTop));
+					out.push_back(grid.bufferIndex(nextTop));
+				}
+				out.push_back(grid.bufferIndex(nextBottom));
+
+				top = nextTop;
+				bottom = nextBottom;
+			}
+		}
+	}
+}
+
+int countTerrainTriangles(const std::vector<uint16_t>& indices, bool strip)
+{
+	if (!strip)
+		return (int)indices.size() / 3;
+
+	// Strips form a triangle at every index from the third on, degenerate ones are rejected before shading
+	int triangles = 0;
+	for (size_t i = 2; i < indices.size(); i++)
+	{
+		uint16_t a = indices[i - 2], b = indices[i - 1], c = indices[i];
+		triangles += (a != b && b != c && a != c);
+	}
+	return triangles;
+}
+
+float sampleCoarseGridHeight(const TerrainPBRVertex* grid, int verticesPerSide, int coarseStep, int x, int z)
+{
+	const int n = verticesPerSide;
+	int coarseCells = (n - 1) / coarseStep;
+	int cellX = std::min(x / coarseStep, coarseCells - 1);
+	int cellZ = std::min(z / coarseStep, coarseCells - 1);
+	float fx = (float)(x - cellX * coarseStep) / coarseStep;
+	float fz = (float)(z - cellZ * coarseStep) / coarseStep;
+
+	const TerrainPBRVertex* cell = grid + (cellZ * n + cellX) * coarseStep;
+	float h00 = cell[0].y;
+	float h10 = cell[coarseStep].y;
+	float h01 = cell[coarseStep * n].y;
+	float h11 = cell[coarseStep * n + coarseStep].y;
+
+	// Cells are split along the (1,0)-(0,1) diagonal, matching generateTerrainIndices
+	if (fx + fz <= 1.0f)
+		return h00 + (h10 - h00) * fx + (h01 - h00) * fz;
+	return h11 + (h01 - h11) * (1.0f - fx) + (h10 - h11) * (1.0f - fz);
+}
+
+static const float TERRAIN_HEIGHT_QUANT_INV_STEP = 1.0f / TERRAIN_HEIGHT_QUANT_STEP;
+
+float getTerrainHeightQuantBase(float minHeight)
+{
+	return floorf(minHeight * TERRAIN_HEIGHT_QUANT_INV_STEP) * TERRAIN_HEIGHT_QUANT_STEP;
+}
+
+int packTerrainVertices(const TerrainPBRVertex* in, const TerrainGridParams& params, float heightBase,
+	TerrainCompactVertex* out)
+{
+	const int n = params.verticesPerSide;
+	// Scaling by a power of two is exact, so quantizing against absolute steps gives every chunk the same result
+	const int baseSteps = (int)(heightBase * TERRAIN_HEIGHT_QUANT_INV_STEP);
+	int clamped = 0;
+
+	for (int z = 0; z < n; z++)
+	{
+		for (int x = 0; x < n; x++)
+		{
+			const TerrainPBRVertex& v = in[z * n + x];
+			TerrainCompactVertex& c = out[z * n + x];
+
+			int steps = (int)floorf(v.y * TERRAIN_HEIGHT_QUANT_INV_STEP + 0.5f) - baseSteps;
+			if (steps < 0 || steps > 0xFFFF)
+			{
+				steps = std::min(std::max(steps, 0), 0xFFFF);
+				clamped++;
+			}
+
+			c.gx = (uint16_t)(x * params.step);
+			c.h = (uint16_t)steps;
+			c.gz = (uint16_t)(z * params.step);
+			c.morphDelta = v.morphDelta;
+
+			// Octahedral projection onto the XZ diamond, the lower hemisphere folds over its edges
+			float nx = v.nx / 32767.0f, ny = v.ny / 32767.0f, nz = v.nz / 32767.0f;
+			float invL1 = 1.0f / (fabsf(nx) + fabsf(ny) + fabsf(nz));
+			float ox = nx * invL1, oz = nz * invL1;
+			if (ny < 0.0f)
+			{
+				float fx = (1.0f - fabsf(oz)) * (ox >= 0.0f ? 1.0f : -1.0f);
+				float fz = (1.0f - fabsf(ox)) * (oz >= 0.0f ? 1.0f : -1.0f);
+				ox = fx;
+				oz = fz;
+			}
+			c.octX = floatToS16N(ox);
+			c.octZ = floatToS16N(oz);
+		}
+	}
+	return clamped;
+}
+
+void unpackTerrainVertex(const TerrainCompactVertex& in, const TerrainGridParams& params, float heightBase,
+	TerrainPBRVertex& out)
+{
+	out.x = ((float)params.gridX0 + (float)in.gx) * params.gridSpacing;
+	out.y = heightBase + (float)in.h * TERRAIN_HEIGHT_QUANT_STEP;
+	out.z = ((float)params.gridZ0 + (float)in.gz) * params.gridSpacing;
+	out.u = out.x * params.uvScale;
+	out.v = out.z * params.uvScale;
+	out.morphDelta = in.morphDelta;
+
+	float nx = std::max(in.octX / 32767.0f, -1.0f);
+	float nz = std::max(in.octZ / 32767.0f, -1.0f);
+	float ny = 1.0f - fabsf(nx) - fabsf(nz);
+	float fold = std::max(-ny, 0.0f);
+	nx += (nx >= 0.0f) ? -fold : fold;
+	nz += (nz >= 0.0f) ? -fold : fold;
+	float invN = 1.0f / sqrtf(nx * nx + ny * ny + nz * nz);
+	nx *= invN; ny *= invN; nz *= invN;
+	out.nx = floatToS16N(nx);
+	out.ny = floatToS16N(ny);
+	out.nz = floatToS16N(nz);
+
+	// Heightfield tangents lie in the XY plane: T = normalize(1, dh/dx, 0) with dh/dx = -N.x / N.y
+	float invT = 1.0f / sqrtf(nx * nx + ny * ny);
+	out.tx = floatToS16N(ny * invT);
+	out.ty = floatToS16N(-nx * invT);
+	out.tz = 0;
+	out.tw = floatToS16N(-1.0f);
+}
+
+uint32_t hashTerrainData(const void* data, size_t size, uint32_t seed)
+{
+	// MurmurHash3 (x86, 32-bit) body and finalizer, chaining through the seed
+	const uint8_t* bytes = (const uint8_t*)data;
+	const uint32_t c1 = 0xCC9E2D51u;
+	const uint32_t c2 = 0x1B873593u;
+	uint32_t h = seed;
+
+	size_t words = size / 4;
+	for (size_t i = 0; i < words; i++)
+	{
+		uint32_t k;
+		memcpy(&k, bytes + i * 4, sizeof(k));
+		k *= c1;
+		k = (k << 15) | (k >> 17);
+		k *= c2;
+		h ^= k;
+		h = (h << 13) | (h >> 19);
+		h = h * 5 + 0xE6546B64u;
+	}
+
+	uint32_t tail = 0;
+	for (size_t i = words * 4; i < size; i++)
+	{
+		tail |= (uint32_t)bytes[i] << ((i & 3) * 8);
+	}
+	if (size & 3)
+	{
+		tail *= c1;
+		tail = (tail << 15) | (tail >> 17);
+		tail *= c2;
+		h ^= tail;
+	}
+
+	h ^= (uint32_t)size;
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	return h;
+}
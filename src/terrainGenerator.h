@@ -0,0 +1,86 @@
+#pragma once
+
+#include "commonUtils.h"
+#include <vector>
+
+// Source of terrain heights, addressed in terrain grid units (one unit = LOD_0 vertex spacing)
+// Integer addressing keeps vertices on shared chunk edges bit-identical between neighbours
+class TerrainHeightSource
+{
+public:
+	virtual ~TerrainHeightSource() {}
+
+	// Fill out[i] with the height at (gridX0 + i * stride, gridZ) for i in [0, count)
+	virtual void sampleRow(int gridX0, int gridZ, int stride, int count, float* out) const = 0;
+
+	// Hash of everything the sampled heights depend on, part of the baked terrain cache key
+	virtual uint32_t getContentHash() const = 0;
+};
+
+// 32-bit hash of a block of bytes, chained through seed. Used for cache keys and checksums,
+// it reads whole words so it keeps up with large pool images
+uint32_t hashTerrainData(const void* data, size_t size, uint32_t seed = 0);
+
+// Describes one square grid of vertices to generate
+struct TerrainGridParams
+{
+	int gridX0, gridZ0;		// first vertex in terrain grid units
+	int step;				// grid units between vertices (1 at LOD_0)
+	int verticesPerSide;
+	float gridSpacing;		// world units per grid unit
+	float uvScale;			// texture tiles per world unit
+};
+
+// Fills verticesPerSide^2 vertices with heights, central-difference normals and tangents
+// source may be null for flat terrain, minHeight/maxHeight receive the height range of the grid
+void generateTerrainGrid(const TerrainHeightSource* source, const TerrainGridParams& params,
+	TerrainPBRVertex* out, float& minHeight, float& maxHeight);
+// Same, with the padded height rows sampled into heightScratch so repeated builds don't reallocate
+void generateTerrainGrid(const TerrainHeightSource* source, const TerrainGridParams& params,
+	TerrainPBRVertex* out, float& minHeight, float& maxHeight, std::vector<float>& heightScratch);
+
+// Chunk edges that border a coarser neighbour, combined into a 4-bit stitch mask
+enum TerrainStitchEdge
+{
+	STITCH_EDGE_NEG_X = 1 << 0,
+	STITCH_EDGE_POS_X = 1 << 1,
+	STITCH_EDGE_NEG_Z = 1 << 2,
+	STITCH_EDGE_POS_Z = 1 << 3,
+};
+static const int TERRAIN_STITCH_VARIANTS = 16;
+
+// Triangle list indices for a verticesPerSide^2 grid. Edges in stitchMask collapse their vertices onto
+// every stitchRatio-th one so they line up with the coarser neighbour, degenerate triangles are dropped
+// The grid is nested in a vertex buffer gridStep times denser (the LOD_0 grid), which the indices address
+void generateTerrainIndices(int verticesPerSide, int stitchMask, int stitchRatio, int gridStep, std::vector<uint16_t>& out);
+
+// Quads per column of the strip order. A column's row (2 * (quads + 1) vertices) has to fit the post-transform cache,
+// whose size isn't documented: 5 keeps the previous row's vertices in a 12 entry FIFO
+static const int TERRAIN_STRIP_BLOCK_QUADS = 5;
+
+// Same triangles as generateTerrainIndices as one triangle strip, rows joined with degenerate triangles and
+// walked in cache-sized columns. Stitched edges keep their collapsed triangles as degenerates
+void generateTerrainStripIndices(int verticesPerSide, int stitchMask, int stitchRatio, int gridStep, std::vector<uint16_t>& out);
+
+// Triangles with three distinct vertices in a triangle list or strip
+int countTerrainTriangles(const std::vector<uint16_t>& indices, bool strip);
+
+// Height at vertex (x, z) of the triangulated surface through every coarseStep-th vertex of a verticesPerSide^2 grid
+// Used for morph targets and for the geometric error of each LOD
+float sampleCoarseGridHeight(const TerrainPBRVertex* grid, int verticesPerSide, int coarseStep, int x, int z);
+
+// Height step of TerrainCompactVertex. A power of two, and chunk bases are whole steps, so a height quantizes
+// to the same value in every chunk that shares it and dequantizes exactly
+static const float TERRAIN_HEIGHT_QUANT_STEP = 1.0f / 512.0f;
+
+// Lowest representable height of a chunk whose lowest vertex is minHeight
+float getTerrainHeightQuantBase(float minHeight);
+
+// Packs a grid made by generateTerrainGrid into compact vertices, heights are stored above heightBase
+// Returns the number of heights that didn't fit in 16 bits and were clamped
+int packTerrainVertices(const TerrainPBRVertex* in, const TerrainGridParams& params, float heightBase,
+	TerrainCompactVertex* out);
+
+// CPU mirror of terrain_v.cg's dequantization, position, UV, normal and tangent as the float path stores them
+void unpackTerrainVertex(const TerrainCompactVertex& in, const TerrainGridParams& params, float heightBase,
+	TerrainPBRVertex& out);
@@ -0,0 +1,395 @@
+#include "terrainHeightField.h"
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+
+// Stand-in for 1 / 0 in the slab tests, large enough to push a parallel ray's slab out to infinity
+// without turning (edge - origin) * inverse into NaN when the ray lies on the edge
+static const float HEIGHT_FIELD_INV_ZERO = 1e30f;
+// Crossings this close past a cell's edge still count, so rounding can't slip a ray between two cells
+static const float HEIGHT_FIELD_EDGE_EPSILON = 1e-4f;
+
+static const int PYRAMID_LEVEL_OFFSET[] = { 0, 1024, 1280, 1344, 1360, 1364 };
+
+static inline int getPyramidSide(int level)
+{
+	return (TerrainHeightField::CELLS / 2) >> level;
+}
+
+static inline int floorDiv(int value, int divisor)
+{
+	return (value >= 0) ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+static inline float inverseOrLarge(float value)
+{
+	return (value != 0.0f) ? 1.0f / value : (std::signbit(value) ? -HEIGHT_FIELD_INV_ZERO : HEIGHT_FIELD_INV_ZERO);
+}
+
+// Ray span inside [x0, x1] x [z0, z1] narrowed into [tNear, tFar], false when it misses
+static inline bool clipToFootprint(const Vector3f& origin, const Vector3f& invDirection, float x0, float z0, float x1, float z1,
+	float& tNear, float& tFar)
+{
+	float tx0 = (x0 - origin.x) * invDirection.x;
+	float tx1 = (x1 - origin.x) * invDirection.x;
+	float tz0 = (z0 - origin.z) * invDirection.z;
+	float tz1 = (z1 - origin.z) * invDirection.z;
+	tNear = std::max(tNear, std::max(std::min(tx0, tx1), std::min(tz0, tz1)));
+	tFar = std::min(tFar, std::min(std::max(tx0, tx1), std::max(tz0, tz1)));
+	return tNear <= tFar;
+}
+
+TerrainHeightField::TerrainHeightField()
+	: tilesPerSide(0), cellSize(1.0f), invCellSize(1.0f), tileSize(CELLS)
+{
+}
+
+void TerrainHeightField::init(int tilesPerSideIn, float cellSizeIn)
+{
+	tilesPerSide = tilesPerSideIn;
+	cellSize = cellSizeIn;
+	invCellSize = 1.0f / cellSize;
+	tileSize = cellSize * CELLS;
+
+	tiles.clear();
+	tiles.resize(tilesPerSide * tilesPerSide);
+	for (Tile& tile : tiles)
+	{
+		tile.valid = false;
+		tile.chunkX = tile.chunkZ = 0;
+	}
+}
+
+TerrainHeightField::Tile& TerrainHeightField::getSlot(int chunkX, int chunkZ)
+{
+	int x = ((chunkX % tilesPerSide) + tilesPerSide) % tilesPerSide;
+	int z = ((chunkZ % tilesPerSide) + tilesPerSide) % tilesPerSide;
+	return tiles[z * tilesPerSide + x];
+}
+
+const TerrainHeightField::Tile* TerrainHeightField::findTile(int chunkX, int chunkZ) const
+{
+	if (tiles.empty())
+		return nullptr;
+
+	int x = ((chunkX % tilesPerSide) + tilesPerSide) % tilesPerSide;
+	int z = ((chunkZ % tilesPerSide) + tilesPerSide) % tilesPerSide;
+	const Tile& tile = tiles[z * tilesPerSide + x];
+	return (tile.valid && tile.chunkX == chunkX && tile.chunkZ == chunkZ) ? &tile : nullptr;
+}
+
+void TerrainHeightField::setTile(int chunkX, int chunkZ, const float* heights, size_t stride)
+{
+	if (tiles.empty())
+		return;
+
+	Tile& tile = getSlot(chunkX, chunkZ);
+	const uint8_t* src = (const uint8_t*)heights;
+	for (int i = 0; i < VERTICES * VERTICES; i++)
+	{
+		tile.heights[i] = *(const float*)(src + i * stride);
+	}
+	tile.chunkX = chunkX;
+	tile.chunkZ = chunkZ;
+	buildPyramid(tile);
+	tile.valid = true;
+}
+
+void TerrainHeightField::setFlatTile(int chunkX, int chunkZ, float height)
+{
+	setTile(chunkX, chunkZ, &height, 0);
+}
+
+void TerrainHeightField::clearTile(int chunkX, int chunkZ)
+{
+	if (tiles.empty())
+		return;
+
+	Tile& tile = getSlot(chunkX, chunkZ);
+	if (tile.chunkX == chunkX && tile.chunkZ == chunkZ)
+	{
+		tile.valid = false;
+	}
+}
+
+void TerrainHeightField::buildPyramid(Tile& tile)
+{
+	// Level 0 from the 3x3 vertices under each node, a bilinear cell never leaves its corners' range
+	const int side0 = getPyramidSide(0);
+	for (int z = 0; z < side0; z++)
+	{
+		for (int x = 0; x < side0; x++)
+		{
+			float lo = FLT_MAX, hi = -FLT_MAX;
+			for (int vz = 2 * z; vz <= 2 * z + 2; vz++)
+			{
+				const float* row = tile.heights + vz * VERTICES + 2 * x;
+				lo = std::min(lo, std::min(row[0], std::min(row[1], row[2])));
+				hi = std::max(hi, std::max(row[0], std::max(row[1], row[2])));
+			}
+			tile.minHeight[z * side0 + x] = lo;
+			tile.maxHeight[z * side0 + x] = hi;
+		}
+	}
+
+	for (int level = 1; level < PYRAMID_LEVELS; level++)
+	{
+		const int side = getPyramidSide(level);
+		const int childSide = side * 2;
+		const float* childMin = tile.minHeight + PYRAMID_LEVEL_OFFSET[level - 1];
+		const float* childMax = tile.maxHeight + PYRAMID_LEVEL_OFFSET[level - 1];
+		for (int z = 0; z < side; z++)
+		{
+			for (int x = 0; x < side; x++)
+			{
+				int c = 2 * z * childSide + 2 * x;
+				tile.minHeight[PYRAMID_LEVEL_OFFSET[level] + z * side + x] = std::min(
+					std::min(childMin[c], childMin[c + 1]), std::min(childMin[c + childSide], childMin[c + childSide + 1]));
+				tile.maxHeight[PYRAMID_LEVEL_OFFSET[level] + z * side + x] = std::max(
+					std::max(childMax[c], childMax[c + 1]), std::max(childMax[c + childSide], childMax[c + childSide + 1]));
+			}
+		}
+	}
+}
+
+bool TerrainHeightField::sampleHeight(float x, float z, float& height) const
+{
+	float gx = x * invCellSize;
+	float gz = z * invCellSize;
+	float cellX = floorf(gx);
+	float cellZ = floorf(gz);
+	int cx = (int)cellX;
+	int cz = (int)cellZ;
+	int chunkX = floorDiv(cx, CELLS);
+	int chunkZ = floorDiv(cz, CELLS);
+
+	const Tile* tile = findTile(chunkX, chunkZ);
+	if (!tile)
+		return false;
+
+	const float* h = tile->heights + (cz - chunkZ * CELLS) * VERTICES + (cx - chunkX * CELLS);
+	float fx = gx - cellX;
+	float fz = gz - cellZ;
+	float height0 = h[0] + (h[1] - h[0]) * fx;
+	float height1 = h[VERTICES] + (h[VERTICES + 1] - h[VERTICES]) * fx;
+	height = height0 + (height1 - height0) * fz;
+	return true;
+}
+
+bool TerrainHeightField::raycast(const Vector3f& origin, const Vector3f& direction, float tMin, float tMax,
+	TerrainRayHit& hit) const
+{
+	if (tiles.empty() || tMin > tMax)
+		return false;
+
+	// Walk the tiles under the ray in order (2D DDA), the first tile with a hit has the nearest one
+	Vector3f start = origin + direction * tMin;
+	int tileX = (int)floorf(start.x / tileSize);
+	int tileZ = (int)floorf(start.z / tileSize);
+	const int stepX = (direction.x >= 0.0f) ? 1 : -1;
+	const int stepZ = (direction.z >= 0.0f) ? 1 : -1;
+	const float invX = inverseOrLarge(direction.x);
+	const float invZ = inverseOrLarge(direction.z);
+	float tNextX = ((tileX + (stepX > 0)) * tileSize - origin.x) * invX;
+	float tNextZ = ((tileZ + (stepZ > 0)) * tileSize - origin.z) * invZ;
+	const float tDeltaX = tileSize * std::abs(invX);
+	const float tDeltaZ = tileSize * std::abs(invZ);
+
+	float tEnter = tMin;
+	while (true)
+	{
+		float tExit = std::min(std::min(tNextX, tNextZ), tMax);
+
+		const Tile* tile = findTile(tileX, tileZ);
+		if (tile)
+		{
+			Vector3f tileOrigin(origin.x - tileX * tileSize, origin.y, origin.z - tileZ * tileSize);
+			hit.distance = (tExit < tMax) ? tExit + HEIGHT_FIELD_EDGE_EPSILON : tMax;
+			if (raycastTile(*tile, tileOrigin, direction, tEnter, hit))
+			{
+				hit.position = origin + direction * hit.distance;
+				return true;
+			}
+		}
+
+		if (tExit >= tMax)
+			return false;
+
+		if (tNextX < tNextZ)
+		{
+			tEnter = tNextX;
+			tNextX += tDeltaX;
+			tileX += stepX;
+		}
+		else
+		{
+			tEnter = tNextZ;
+			tNextZ += tDeltaZ;
+			tileZ += stepZ;
+		}
+	}
+}
+
+bool TerrainHeightField::raycastTile(const Tile& tile, const Vector3f& origin, const Vector3f& direction, float tMin,
+	TerrainRayHit& hit) const
+{
+	struct Node
+	{
+		int level, x, z;
+		float tNear;
+	};
+
+	const Vector3f invDirection(inverseOrLarge(direction.x), inverseOrLarge(direction.y), inverseOrLarge(direction.z));
+
+	// Node box test: footprint, then everything up to the node's highest point (the ground below is solid)
+	auto enter = [&](int level, int x, int z, float& tNear) -> bool
+	{
+		float size = cellSize * (2 << level);
+		float tFar = hit.distance;
+		tNear = tMin;
+		if (!clipToFootprint(origin, invDirection, x * size, z * size, (x + 1) * size, (z + 1) * size, tNear, tFar))
+			return false;
+
+		int node = PYRAMID_LEVEL_OFFSET[level] + z * getPyramidSide(level) + x;
+		float ty0 = (-FLT_MAX - origin.y) * invDirection.y;
+		float ty1 = (tile.maxHeight[node] - origin.y) * invDirection.y;
+		tNear = std::max(tNear, std::min(ty0, ty1));
+		tFar = std::min(tFar, std::max(ty0, ty1));
+		return tNear <= tFar;
+	};
+
+	// Nearest node on top, children are pushed far to near
+	Node stack[4 * PYRAMID_LEVELS];
+	int top = 0;
+	float rootNear;
+	if (!enter(PYRAMID_LEVELS - 1, 0, 0, rootNear))
+		return false;
+	stack[top++] = { PYRAMID_LEVELS - 1, 0, 0, rootNear };
+
+	bool found = false;
+	while (top > 0)
+	{
+		Node node = stack[--top];
+		if (node.tNear >= hit.distance)
+			continue;
+
+		// Entering a node below its lowest point means the ray is already in the ground: it starts there, or it
+		// crossed the surface nearer and that crossing replaces this one
+		int index = PYRAMID_LEVEL_OFFSET[node.level] + node.z * getPyramidSide(node.level) + node.x;
+		if (origin.y + direction.y * node.tNear <= tile.minHeight[index])
+		{
+			hit.distance = node.tNear;
+			hit.normal = getNormal(tile, origin.x + direction.x * node.tNear, origin.z + direction.z * node.tNear);
+			found = true;
+			continue;
+		}
+
+		if (node.level == 0)
+		{
+			for (int i = 0; i < 4; i++)
+			{
+				found |= raycastCell(tile, 2 * node.x + (i & 1), 2 * node.z + (i >> 1), origin, direction,
+					node.tNear, hit.distance, hit);
+			}
+			continue;
+		}
+
+		Node children[4];
+		int count = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			Node child = { node.level - 1, 2 * node.x + (i & 1), 2 * node.z + (i >> 1), 0.0f };
+			if (!enter(child.level, child.x, child.z, child.tNear))
+				continue;
+
+			int j = count++;
+			while (j > 0 && children[j - 1].tNear < child.tNear)
+			{
+				children[j] = children[j - 1];
+				j--;
+			}
+			children[j] = child;
+		}
+		for (int i = 0; i < count; i++)
+		{
+			stack[top++] = children[i];
+		}
+	}
+	return found;
+}
+
+Vector3f TerrainHeightField::getNormal(const Tile& tile, float x, float z) const
+{
+	float gx = std::min(std::max(x * invCellSize, 0.0f), (float)CELLS);
+	float gz = std::min(std::max(z * invCellSize, 0.0f), (float)CELLS);
+	int cellX = std::min((int)gx, CELLS - 1);
+	int cellZ = std::min((int)gz, CELLS - 1);
+	float u = gx - cellX;
+	float v = gz - cellZ;
+
+	const float* h = tile.heights + cellZ * VERTICES + cellX;
+	float c = h[0] - h[1] - h[VERTICES] + h[VERTICES + 1];
+	return Vector3f(-(h[1] - h[0] + c * v) * invCellSize, 1.0f, -(h[VERTICES] - h[0] + c * u) * invCellSize).normalized();
+}
+
+bool TerrainHeightField::raycastCell(const Tile& tile, int cellX, int cellZ, const Vector3f& origin,
+	const Vector3f& direction, float tMin, float tMax, TerrainRayHit& hit) const
+{
+	const float x0 = cellX * cellSize;
+	const float z0 = cellZ * cellSize;
+	const Vector3f invDirection(inverseOrLarge(direction.x), 0.0f, inverseOrLarge(direction.z));
+	float ta = tMin, tb = tMax;
+	if (!clipToFootprint(origin, invDirection, x0, z0, x0 + cellSize, z0 + cellSize, ta, tb))
+		return false;
+
+	const float* h = tile.heights + cellZ * VERTICES + cellX;
+	const float a = h[1] - h[0];
+	const float b = h[VERTICES] - h[0];
+	const float c = h[0] - h[1] - h[VERTICES] + h[VERTICES + 1];
+
+	// Cell coordinates along the ray, s = t - ta: u = u0 + du * s, v = v0 + dv * s
+	const float u0 = (origin.x + direction.x * ta - x0) * invCellSize;
+	const float v0 = (origin.z + direction.z * ta - z0) * invCellSize;
+	const float du = direction.x * invCellSize;
+	const float dv = direction.z * invCellSize;
+
+	// Height above the bilinear surface along the ray, A s^2 + B s + C
+	const float A = -c * du * dv;
+	const float B = direction.y - (a * du + b * dv + c * (u0 * dv + v0 * du));
+	const float C = origin.y + direction.y * ta - (h[0] + a * u0 + b * v0 + c * u0 * v0);
+
+	float s = 0.0f;
+	if (C > 0.0f)
+	{
+		// Nearest root where the ray goes down through the surface, q keeps the small root accurate as A -> 0
+		float discriminant = B * B - 4.0f * A * C;
+		if (discriminant < 0.0f)
+			return false;
+
+		float root = sqrtf(discriminant);
+		float q = -0.5f * (B + (B < 0.0f ? -root : root));
+		float roots[2] = { (A != 0.0f) ? q / A : FLT_MAX, (q != 0.0f) ? C / q : FLT_MAX };
+		float span = tb - ta;
+		s = FLT_MAX;
+		for (float r : roots)
+		{
+			if (r >= -HEIGHT_FIELD_EDGE_EPSILON && r <= span + HEIGHT_FIELD_EDGE_EPSILON && 2.0f * A * r + B <= 0.0f)
+			{
+				s = std::min(s, r);
+			}
+		}
+		if (s == FLT_MAX)
+			return false;
+		s = std::min(std::max(s, 0.0f), span);
+	}
+
+	float t = ta + s;
+	if (t >= hit.distance)
+		return false;
+
+	float u = std::min(std::max(u0 + du * s, 0.0f), 1.0f);
+	float v = std::min(std::max(v0 + dv * s, 0.0f), 1.0f);
+	hit.distance = t;
+	hit.normal = Vector3f(-(a + c * v) * invCellSize, 1.0f, -(b + c * u) * invCellSize).normalized();
+	return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "commonUtils.h"
+#include <vector>
+#include <cstddef>
+
+// Terrain surface point found by a ray query
+struct TerrainRayHit
+{
+	float distance;		// along the ray from its origin
+	Vector3f position;
+	Vector3f normal;
+};
+
+// CPU copy of the chunk heights for height and ray queries, one tile per chunk slot of the terrain window
+// A tile holds a chunk's LOD_0 vertex grid and a min/max pyramid over it, the surface is bilinear inside each
+// grid cell. Positions are terrain local (chunk (0, 0) starts at the origin) in world units
+// Tiles are written by chunk, so different chunks may be set from different threads
+class TerrainHeightField
+{
+public:
+	static const int CELLS = 64;	// grid cells per tile side, Terrain::CHUNK_GRID_SIZE
+	static const int VERTICES = CELLS + 1;
+
+	TerrainHeightField();
+
+	// Empty field for a window of tilesPerSide^2 chunks, cellSize world units per grid cell
+	void init(int tilesPerSide, float cellSize);
+	// Copy a chunk's VERTICES^2 heights (row-major, stride bytes apart) into its slot and build the pyramid
+	void setTile(int chunkX, int chunkZ, const float* heights, size_t stride);
+	void setFlatTile(int chunkX, int chunkZ, float height);
+	// Queries over the chunk miss until its tile is set again
+	void clearTile(int chunkX, int chunkZ);
+
+	// Bilinear height at (x, z), false over chunks without a tile
+	bool sampleHeight(float x, float z, float& height) const;
+	// Nearest surface point on the ray between tMin and tMax, direction normalized. The ground below the surface
+	// is solid, so a ray starting under it hits where it starts. Chunks without a tile let the ray through
+	bool raycast(const Vector3f& origin, const Vector3f& direction, float tMin, float tMax, TerrainRayHit& hit) const;
+
+private:
+	// Pyramid level 0 nodes span 2x2 cells, each level up halves the nodes per side down to the tile's root
+	static const int PYRAMID_LEVELS = 6;
+	static const int PYRAMID_NODES = (32 * 32 + 16 * 16 + 8 * 8 + 4 * 4 + 2 * 2 + 1);
+
+	struct Tile
+	{
+		bool valid;
+		int chunkX, chunkZ;
+		float heights[VERTICES * VERTICES];
+		float minHeight[PYRAMID_NODES];
+		float maxHeight[PYRAMID_NODES];
+	};
+
+	const Tile* findTile(int chunkX, int chunkZ) const;
+	Tile& getSlot(int chunkX, int chunkZ);
+	void buildPyramid(Tile& tile);
+	// Descend a tile's pyramid front to back, origin relative to the tile. hit.distance bounds the search on entry
+	bool raycastTile(const Tile& tile, const Vector3f& origin, const Vector3f& direction, float tMin,
+		TerrainRayHit& hit) const;
+	// Surface normal at a tile-local position
+	Vector3f getNormal(const Tile& tile, float x, float z) const;
+	// First crossing of the bilinear surface of cell (cellX, cellZ) between tMin and tMax, origin relative to the tile
+	bool raycastCell(const Tile& tile, int cellX, int cellZ, const Vector3f& origin, const Vector3f& direction,
+		float tMin, float tMax, TerrainRayHit& hit) const;
+
+	std::vector<Tile> tiles;
+	int tilesPerSide;
+	float cellSize;
+	float invCellSize;
+	float tileSize;
+};
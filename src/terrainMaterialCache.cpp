@@ -0,0 +1,259 @@
+#include "terrainMaterialCache.h"
+#include "memory.h"
+#include <psp2/kernel/clib.h>
+#include <cfloat>
+#include <algorithm>
+
+// Depth of every baked fragment, the heightfield seen from above never overlaps itself
+static const float MATERIAL_CACHE_BAKE_DEPTH = 0.5f;
+
+TerrainMaterialCache::TerrainMaterialCache()
+	: tilesPerFrame(0), frame(0), atlasUID(-1), atlasAddr(nullptr), texture(), colorSurface(), renderTarget(nullptr)
+{
+	for (Tile& tile : tiles)
+	{
+		tile.valid = false;
+		tile.chunkX = tile.chunkZ = 0;
+		tile.bakeFrame = 0;
+	}
+}
+
+TerrainMaterialCache::~TerrainMaterialCache()
+{
+	release();
+}
+
+bool TerrainMaterialCache::init(int tilesPerFrameIn)
+{
+	release();
+	tilesPerFrame = std::min(std::max(tilesPerFrameIn, 1), MAX_TILES_PER_FRAME);
+
+	const size_t atlasBytes = (size_t)ATLAS_SIZE * ATLAS_SIZE * 4;
+	atlasAddr = gpuAllocMap(atlasBytes, SCE_KERNEL_MEMBLOCK_TYPE_USER_CDRAM_RW, SCE_GXM_MEMORY_ATTRIB_RW, &atlasUID);
+	if (!atlasAddr)
+	{
+		sceClibPrintf("Terrain material cache: atlas allocation failed\n");
+		atlasUID = -1;
+		return false;
+	}
+	sceClibMemset(atlasAddr, 0, atlasBytes);
+
+	int err = sceGxmColorSurfaceInit(&colorSurface,
+		SCE_GXM_COLOR_FORMAT_A8B8G8R8,
+		SCE_GXM_COLOR_SURFACE_LINEAR,
+		SCE_GXM_COLOR_SURFACE_SCALE_NONE,
+		SCE_GXM_OUTPUT_REGISTER_SIZE_32BIT,
+		ATLAS_SIZE, ATLAS_SIZE, ATLAS_SIZE,
+		atlasAddr);
+	if (err != SCE_OK)
+	{
+		sceClibPrintf("Terrain material cache: sceGxmColorSurfaceInit(): 0x%08X\n", err);
+		release();
+		return false;
+	}
+
+	err = sceGxmTextureInitLinear(&texture, atlasAddr, SCE_GXM_TEXTURE_FORMAT_U8U8U8U8_ABGR, ATLAS_SIZE, ATLAS_SIZE, 0);
+	if (err != SCE_OK)
+	{
+		sceClibPrintf("Terrain material cache: sceGxmTextureInitLinear(): 0x%08X\n", err);
+		release();
+		return false;
+	}
+	sceGxmTextureSetMinFilter(&texture, SCE_GXM_TEXTURE_FILTER_LINEAR);
+	sceGxmTextureSetMagFilter(&texture, SCE_GXM_TEXTURE_FILTER_LINEAR);
+	sceGxmTextureSetUAddrMode(&texture, SCE_GXM_TEXTURE_ADDR_CLAMP);
+	sceGxmTextureSetVAddrMode(&texture, SCE_GXM_TEXTURE_ADDR_CLAMP);
+
+	// One scene per baked tile
+	SceGxmRenderTargetParams renderTargetParams;
+	sceClibMemset(&renderTargetParams, 0, sizeof(SceGxmRenderTargetParams));
+	renderTargetParams.flags = 0;
+	renderTargetParams.width = ATLAS_SIZE;
+	renderTargetParams.height = ATLAS_SIZE;
+	renderTargetParams.scenesPerFrame = (unsigned short)tilesPerFrame;
+	renderTargetParams.multisampleMode = SCE_GXM_MULTISAMPLE_NONE;
+	renderTargetParams.multisampleLocations = 0;
+	renderTargetParams.driverMemBlock = -1;
+
+	err = sceGxmCreateRenderTarget(&renderTargetParams, &renderTarget);
+	if (err != SCE_OK)
+	{
+		sceClibPrintf("Terrain material cache: sceGxmCreateRenderTarget(): 0x%08X\n", err);
+		renderTarget = nullptr;
+		release();
+		return false;
+	}
+
+	sceClibPrintf("Terrain material cache: %dx%d atlas, %d texel tiles, %d tiles per frame\n",
+		ATLAS_SIZE, ATLAS_SIZE, TILE_TEXELS, tilesPerFrame);
+	return true;
+}
+
+void TerrainMaterialCache::release()
+{
+	if (renderTarget)
+	{
+		sceGxmDestroyRenderTarget(renderTarget);
+		renderTarget = nullptr;
+	}
+	if (atlasAddr)
+	{
+		gpuFreeUnmap(atlasUID);
+		atlasAddr = nullptr;
+		atlasUID = -1;
+	}
+	for (Tile& tile : tiles)
+	{
+		tile.valid = false;
+	}
+}
+
+bool TerrainMaterialCache::isInitialized() const
+{
+	return renderTarget != nullptr;
+}
+
+int TerrainMaterialCache::selectTiles(const Terrain& terrain, TerrainChunk::LODLevel minLOD, const Vector3f& localCam,
+	TerrainChunk* out[])
+{
+	if (!isInitialized())
+		return 0;
+
+	// Best tilesPerFrame candidates kept sorted by (stale, key): missing tiles by distance, stale ones by bake frame
+	struct Candidate
+	{
+		bool stale;
+		float key;
+		TerrainChunk* chunk;
+	};
+	Candidate best[MAX_TILES_PER_FRAME];
+	int count = 0;
+
+	for (const auto& owned : terrain.getChunks())
+	{
+		TerrainChunk* chunk = owned.get();
+		if (!chunk->isResident() || chunk->getCurrentLOD() < minLOD)
+			continue;
+
+		Candidate candidate;
+		candidate.chunk = chunk;
+		candidate.stale = isBaked(chunk);
+		if (candidate.stale)
+		{
+			candidate.key = (float)tiles[Terrain::getSlotIndex(chunk->getChunkX(), chunk->getChunkZ())].bakeFrame;
+		}
+		else
+		{
+			Vector3f d = chunk->getCenter() - localCam;
+			candidate.key = d.x * d.x + d.z * d.z;
+		}
+
+		auto before = [](const Candidate& a, const Candidate& b)
+		{
+			return a.stale != b.stale ? !a.stale : a.key < b.key;
+		};
+		if (count == tilesPerFrame && !before(candidate, best[count - 1]))
+			continue;
+
+		int i = (count < tilesPerFrame) ? count++ : count - 1;
+		while (i > 0 && before(candidate, best[i - 1]))
+		{
+			best[i] = best[i - 1];
+			i--;
+		}
+		best[i] = candidate;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		out[i] = best[i].chunk;
+	}
+	return count;
+}
+
+void TerrainMaterialCache::markBaked(const TerrainChunk* chunk)
+{
+	Tile& tile = tiles[Terrain::getSlotIndex(chunk->getChunkX(), chunk->getChunkZ())];
+	tile.valid = true;
+	tile.chunkX = chunk->getChunkX();
+	tile.chunkZ = chunk->getChunkZ();
+	tile.bakeFrame = frame;
+}
+
+void TerrainMaterialCache::endFrame()
+{
+	frame++;
+}
+
+bool TerrainMaterialCache::isBaked(const TerrainChunk* chunk) const
+{
+	const Tile& tile = tiles[Terrain::getSlotIndex(chunk->getChunkX(), chunk->getChunkZ())];
+	return tile.valid && tile.chunkX == chunk->getChunkX() && tile.chunkZ == chunk->getChunkZ();
+}
+
+void TerrainMaterialCache::getBakeProjection(const TerrainChunk* chunk, const Matrix4x4& modelMatrix,
+	Matrix4x4& projection) const
+{
+	int px, pz;
+	getTileOrigin(Terrain::getSlotIndex(chunk->getChunkX(), chunk->getChunkZ()), px, pz);
+
+	// World position of the chunk origin, texel centers are texelStep apart from it
+	const float* model = modelMatrix.getData();
+	float originX = chunk->getChunkX() * Terrain::CHUNK_SIZE + model[3];
+	float originZ = chunk->getChunkZ() * Terrain::CHUNK_SIZE + model[11];
+	float texelStep = Terrain::CHUNK_SIZE / (TILE_TEXELS - 1);
+
+	// pixel = tile origin + 0.5 + (world - chunk origin) / texelStep, NDC y points up the atlas rows
+	float scale = 2.0f / (ATLAS_SIZE * texelStep);
+	float* m = projection.getData();
+	for (int i = 0; i < 16; i++)
+	{
+		m[i] = 0.0f;
+	}
+	m[0] = scale;
+	m[3] = 2.0f * (px + 0.5f) / ATLAS_SIZE - 1.0f - scale * originX;
+	m[6] = -scale;
+	m[7] = 1.0f - 2.0f * (pz + 0.5f) / ATLAS_SIZE + scale * originZ;
+	m[11] = MATERIAL_CACHE_BAKE_DEPTH;
+	m[15] = 1.0f;
+}
+
+void TerrainMaterialCache::getBakeRegion(const TerrainChunk* chunk, SceGxmValidRegion& region) const
+{
+	int px, pz;
+	getTileOrigin(Terrain::getSlotIndex(chunk->getChunkX(), chunk->getChunkZ()), px, pz);
+	region.xMin = px;
+	region.yMin = pz;
+	region.xMax = px + TILE_TEXELS - 1;
+	region.yMax = pz + TILE_TEXELS - 1;
+}
+
+void TerrainMaterialCache::getTileParams(const TerrainChunk* chunk, float params[3]) const
+{
+	int px, pz;
+	getTileOrigin(Terrain::getSlotIndex(chunk->getChunkX(), chunk->getChunkZ()), px, pz);
+	params[0] = (px + 0.5f) / ATLAS_SIZE;
+	params[1] = (pz + 0.5f) / ATLAS_SIZE;
+	params[2] = (float)(TILE_TEXELS - 1) / (Terrain::CHUNK_GRID_SIZE * ATLAS_SIZE);
+}
+
+SceGxmRenderTarget* TerrainMaterialCache::getRenderTarget() const
+{
+	return renderTarget;
+}
+
+const SceGxmColorSurface* TerrainMaterialCache::getColorSurface() const
+{
+	return &colorSurface;
+}
+
+const SceGxmTexture* TerrainMaterialCache::getTexture() const
+{
+	return &texture;
+}
+
+void TerrainMaterialCache::getTileOrigin(int tileIndex, int& px, int& pz)
+{
+	px = (tileIndex % TILES_PER_SIDE) * TILE_TEXELS;
+	pz = (tileIndex / TILES_PER_SIDE) * TILE_TEXELS;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "terrain.h"
+#include <psp2/gxm.h>
+#include <psp2/types.h>
+
+// Render-to-texture cache of lit terrain albedo, one tile per chunk slot of the terrain window
+// Tiles are baked from above with the distant terrain shading and sampled by distant chunks instead of lighting
+// them per pixel. A chunk's tile is its slot modulo the window, so streaming a chunk in only invalidates its own tile
+// Texel centers on a tile's first and last row and column lie on the chunk's edges, so bilinear filtering never
+// reaches into the neighbouring tile (which belongs to the other side of the window at the wrap)
+class TerrainMaterialCache
+{
+public:
+	static const int TILE_TEXELS = 64;	// multiple of the 32 pixel macrotile, tiles are baked one valid region each
+	static const int TILES_PER_SIDE = Terrain::CHUNKS_PER_SIDE;
+	static const int ATLAS_SIZE = TILE_TEXELS * TILES_PER_SIDE;
+	static const int MAX_TILES_PER_FRAME = 16;
+
+	TerrainMaterialCache();
+	~TerrainMaterialCache();
+
+	// Allocate the atlas with its color surface and render target, tilesPerFrame bake scenes per frame
+	bool init(int tilesPerFrame);
+	void release();
+	bool isInitialized() const;
+
+	// Pick this frame's tiles, at most tilesPerFrame resident chunks at minLOD or coarser: chunks whose tile
+	// holds another chunk (or nothing) nearest first, then the longest-baked tiles so lighting keeps up
+	// Returns the number written to out, which must hold MAX_TILES_PER_FRAME
+	int selectTiles(const Terrain& terrain, TerrainChunk::LODLevel minLOD, const Vector3f& localCam, TerrainChunk* out[]);
+	// Mark a chunk's tile as holding its material from this frame, call once the bake is submitted
+	void markBaked(const TerrainChunk* chunk);
+	// Advance the frame counter used to find stale tiles
+	void endFrame();
+	// True when the chunk's tile holds this chunk, otherwise it must be lit in the fragment shader
+	bool isBaked(const TerrainChunk* chunk) const;
+
+	// Projection for baking a chunk with the terrain vertex program (view left as identity): its footprint
+	// seen from above, placed over its tile in the atlas. modelMatrix is the terrain's, a translation
+	void getBakeProjection(const TerrainChunk* chunk, const Matrix4x4& modelMatrix, Matrix4x4& projection) const;
+	// Atlas pixels covered by a chunk's tile, inclusive
+	void getBakeRegion(const TerrainChunk* chunk, SceGxmValidRegion& region) const;
+	// Vertex uniform for sampling a chunk's tile: xy = atlas UV at the chunk origin, z = atlas UV per grid unit
+	void getTileParams(const TerrainChunk* chunk, float params[3]) const;
+
+	SceGxmRenderTarget* getRenderTarget() const;
+	const SceGxmColorSurface* getColorSurface() const;
+	const SceGxmTexture* getTexture() const;
+
+private:
+	struct Tile
+	{
+		bool valid;
+		int chunkX, chunkZ;	// chunk the tile was baked for
+		int bakeFrame;
+	};
+
+	// Atlas pixel of a chunk tile's first texel
+	static void getTileOrigin(int tileIndex, int& px, int& pz);
+
+	Tile tiles[TILES_PER_SIDE * TILES_PER_SIDE];
+	int tilesPerFrame;
+	int frame;
+
+	SceUID atlasUID;
+	void* atlasAddr;
+	SceGxmTexture texture;
+	SceGxmColorSurface colorSurface;
+	SceGxmRenderTarget* renderTarget;
+};
@@ -0,0 +1,271 @@
+#include "terrainNoise.h"
+#include <cstring>
+#include <algorithm>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TERRAIN_NOISE_NEON 1
+#endif
+
+// Simplex skew/unskew factors for 2D: (sqrt(3) - 1) / 2 and (3 - sqrt(3)) / 6
+static const float SIMPLEX_F2 = 0.36602540378f;
+static const float SIMPLEX_G2 = 0.21132486540f;
+static const float SIMPLEX_SCALE = 70.0f;
+
+// Corner falloff below this is dropped. NEON flushes denormals to zero while VFP does not,
+// so keeping t^4 * gradient in the normal range is what keeps both paths bit-identical
+static const float SIMPLEX_MIN_FALLOFF = 1.0f / (1 << 20);
+
+static const uint32_t HASH_PRIME_X = 0x8DA6B343u;
+static const uint32_t HASH_PRIME_Z = 0xD8163841u;
+
+static inline uint32_t hashFinalize(uint32_t h)
+{
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	h *= 0x297A2D39u;
+	h ^= h >> 15;
+	return h;
+}
+
+static inline uint32_t hashLattice(int32_t ix, int32_t iz, uint32_t seed)
+{
+	return hashFinalize(((uint32_t)ix * HASH_PRIME_X) ^ ((uint32_t)iz * HASH_PRIME_Z) ^ seed);
+}
+
+// floorf through an integer round trip, the vector path uses the same sequence
+static inline int32_t floorToInt(float x)
+{
+	int32_t i = (int32_t)x;
+	return (x < (float)i) ? i - 1 : i;
+}
+
+static inline float flipSign(float x, uint32_t signBit)
+{
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	bits ^= signBit;
+	memcpy(&x, &bits, sizeof(bits));
+	return x;
+}
+
+// Gradient selected from hash bits: bit 2 swaps the axes, bits 0/1 flip their signs
+// giving the 8 gradients (+-1, +-0.5) and (+-0.5, +-1)
+static inline float cornerContribution(uint32_t h, float x, float y)
+{
+	float t = (0.5f - x * x) - y * y;
+	t = (t < SIMPLEX_MIN_FALLOFF) ? 0.0f : t;
+
+	float u = (h & 4) ? y : x;
+	float v = (h & 4) ? x : y;
+	float g = flipSign(u, (h & 1) << 31) + flipSign(v, (h & 2) << 30) * 0.5f;
+
+	float t2 = t * t;
+	return (t2 * t2) * g;
+}
+
+static float simplexScalar(float x, float y, uint32_t seed)
+{
+	float s = (x + y) * SIMPLEX_F2;
+	int32_t i = floorToInt(x + s);
+	int32_t j = floorToInt(y + s);
+
+	float t = (float)(i + j) * SIMPLEX_G2;
+	float x0 = x - ((float)i - t);
+	float y0 = y - ((float)j - t);
+
+	// Upper or lower triangle of the skewed cell
+	int32_t i1 = (x0 > y0) ? 1 : 0;
+	int32_t j1 = 1 - i1;
+
+	float x1 = (x0 - (float)i1) + SIMPLEX_G2;
+	float y1 = (y0 - (float)j1) + SIMPLEX_G2;
+	float x2 = (x0 - 1.0f) + 2.0f * SIMPLEX_G2;
+	float y2 = (y0 - 1.0f) + 2.0f * SIMPLEX_G2;
+
+	float n0 = cornerContribution(hashLattice(i, j, seed), x0, y0);
+	float n1 = cornerContribution(hashLattice(i + i1, j + j1, seed), x1, y1);
+	float n2 = cornerContribution(hashLattice(i + 1, j + 1, seed), x2, y2);
+
+	return ((n0 + n1) + n2) * SIMPLEX_SCALE;
+}
+
+#ifdef TERRAIN_NOISE_NEON
+static inline uint32x4_t hashFinalizeNeon(uint32x4_t h)
+{
+	h = veorq_u32(h, vshrq_n_u32(h, 15));
+	h = vmulq_u32(h, vdupq_n_u32(0x2C1B3C6Du));
+	h = veorq_u32(h, vshrq_n_u32(h, 12));
+	h = vmulq_u32(h, vdupq_n_u32(0x297A2D39u));
+	h = veorq_u32(h, vshrq_n_u32(h, 15));
+	return h;
+}
+
+static inline uint32x4_t hashLatticeNeon(int32x4_t ix, int32x4_t iz, uint32x4_t seed)
+{
+	uint32x4_t hx = vmulq_u32(vreinterpretq_u32_s32(ix), vdupq_n_u32(HASH_PRIME_X));
+	uint32x4_t hz = vmulq_u32(vreinterpretq_u32_s32(iz), vdupq_n_u32(HASH_PRIME_Z));
+	return hashFinalizeNeon(veorq_u32(veorq_u32(hx, hz), seed));
+}
+
+static inline int32x4_t floorToIntNeon(float32x4_t x)
+{
+	int32x4_t i = vcvtq_s32_f32(x);
+	// All-ones mask is -1 where truncation rounded up
+	uint32x4_t roundedUp = vcltq_f32(x, vcvtq_f32_s32(i));
+	return vaddq_s32(i, vreinterpretq_s32_u32(roundedUp));
+}
+
+static inline float32x4_t cornerContributionNeon(uint32x4_t h, float32x4_t x, float32x4_t y)
+{
+	float32x4_t t = vsubq_f32(vsubq_f32(vdupq_n_f32(0.5f), vmulq_f32(x, x)), vmulq_f32(y, y));
+	uint32x4_t keep = vcgeq_f32(t, vdupq_n_f32(SIMPLEX_MIN_FALLOFF));
+	t = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(t), keep));
+
+	uint32x4_t swap = vtstq_u32(h, vdupq_n_u32(4));
+	float32x4_t u = vbslq_f32(swap, y, x);
+	float32x4_t v = vbslq_f32(swap, x, y);
+	uint32x4_t signU = vshlq_n_u32(vandq_u32(h, vdupq_n_u32(1)), 31);
+	uint32x4_t signV = vshlq_n_u32(vandq_u32(h, vdupq_n_u32(2)), 30);
+	u = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(u), signU));
+	v = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(v), signV));
+	float32x4_t g = vaddq_f32(u, vmulq_n_f32(v, 0.5f));
+
+	float32x4_t t2 = vmulq_f32(t, t);
+	return vmulq_f32(vmulq_f32(t2, t2), g);
+}
+
+static float32x4_t simplexNeon(float32x4_t x, float32x4_t y, uint32x4_t seed)
+{
+	float32x4_t s = vmulq_n_f32(vaddq_f32(x, y), SIMPLEX_F2);
+	int32x4_t i = floorToIntNeon(vaddq_f32(x, s));
+	int32x4_t j = floorToIntNeon(vaddq_f32(y, s));
+
+	float32x4_t t = vmulq_n_f32(vcvtq_f32_s32(vaddq_s32(i, j)), SIMPLEX_G2);
+	float32x4_t x0 = vsubq_f32(x, vsubq_f32(vcvtq_f32_s32(i), t));
+	float32x4_t y0 = vsubq_f32(y, vsubq_f32(vcvtq_f32_s32(j), t));
+
+	uint32x4_t lower = vcgtq_f32(x0, y0);
+	int32x4_t i1 = vreinterpretq_s32_u32(vandq_u32(lower, vdupq_n_u32(1)));
+	int32x4_t j1 = vsubq_s32(vdupq_n_s32(1), i1);
+
+	const float32x4_t g2 = vdupq_n_f32(SIMPLEX_G2);
+	const float32x4_t one = vdupq_n_f32(1.0f);
+	const float32x4_t twoG2 = vdupq_n_f32(2.0f * SIMPLEX_G2);
+	float32x4_t x1 = vaddq_f32(vsubq_f32(x0, vcvtq_f32_s32(i1)), g2);
+	float32x4_t y1 = vaddq_f32(vsubq_f32(y0, vcvtq_f32_s32(j1)), g2);
+	float32x4_t x2 = vaddq_f32(vsubq_f32(x0, one), twoG2);
+	float32x4_t y2 = vaddq_f32(vsubq_f32(y0, one), twoG2);
+
+	const int32x4_t oneI = vdupq_n_s32(1);
+	float32x4_t n0 = cornerContributionNeon(hashLatticeNeon(i, j, seed), x0, y0);
+	float32x4_t n1 = cornerContributionNeon(hashLatticeNeon(vaddq_s32(i, i1), vaddq_s32(j, j1), seed), x1, y1);
+	float32x4_t n2 = cornerContributionNeon(hashLatticeNeon(vaddq_s32(i, oneI), vaddq_s32(j, oneI), seed), x2, y2);
+
+	return vmulq_n_f32(vaddq_f32(vaddq_f32(n0, n1), n2), SIMPLEX_SCALE);
+}
+#endif
+
+NoiseHeightSource::NoiseHeightSource()
+{
+	Params defaults;
+	defaults.seed = 1337;
+	defaults.octaves = 6;
+	defaults.frequency = 1.0f / 256.0f;
+	defaults.lacunarity = 2.0f;
+	defaults.gain = 0.5f;
+	defaults.heightScale = 8.0f;
+	defaults.heightOffset = 6.0f;
+	setParams(defaults);
+}
+
+NoiseHeightSource::NoiseHeightSource(const Params& params)
+{
+	setParams(params);
+}
+
+void NoiseHeightSource::setParams(const Params& newParams)
+{
+	params = newParams;
+	params.octaves = std::clamp(params.octaves, 1, MAX_OCTAVES);
+
+	float frequency = params.frequency;
+	float amplitude = 1.0f;
+	float amplitudeSum = 0.0f;
+	for (int o = 0; o < params.octaves; o++)
+	{
+		octaveFrequency[o] = frequency;
+		octaveAmplitude[o] = amplitude;
+		// Per-octave seeds keep octaves from lining up at the lattice origin
+		octaveSeed[o] = hashFinalize(params.seed + (uint32_t)o * 0x9E3779B9u);
+		amplitudeSum += amplitude;
+		frequency *= params.lacunarity;
+		amplitude *= params.gain;
+	}
+
+	for (int o = 0; o < params.octaves; o++)
+	{
+		octaveAmplitude[o] *= params.heightScale / amplitudeSum;
+	}
+}
+
+const NoiseHeightSource::Params& NoiseHeightSource::getParams() const
+{
+	return params;
+}
+
+uint32_t NoiseHeightSource::getContentHash() const
+{
+	// Heights come from the params alone, hashed field by field so padding never matters
+	uint32_t hash = hashTerrainData(&params.seed, sizeof(params.seed), 0x4E4F4953u);
+	hash = hashTerrainData(&params.octaves, sizeof(params.octaves), hash);
+	hash = hashTerrainData(&params.frequency, sizeof(params.frequency), hash);
+	hash = hashTerrainData(&params.lacunarity, sizeof(params.lacunarity), hash);
+	hash = hashTerrainData(&params.gain, sizeof(params.gain), hash);
+	hash = hashTerrainData(&params.heightScale, sizeof(params.heightScale), hash);
+	return hashTerrainData(&params.heightOffset, sizeof(params.heightOffset), hash);
+}
+
+void NoiseHeightSource::sampleRowScalar(int gridX0, int gridZ, int stride, int count, float* out) const
+{
+	const float z = (float)gridZ;
+	for (int i = 0; i < count; i++)
+	{
+		const float x = (float)(gridX0 + i * stride);
+		float sum = 0.0f;
+		for (int o = 0; o < params.octaves; o++)
+		{
+			sum = sum + simplexScalar(x * octaveFrequency[o], z * octaveFrequency[o], octaveSeed[o]) * octaveAmplitude[o];
+		}
+		out[i] = params.heightOffset + sum;
+	}
+}
+
+void NoiseHeightSource::sampleRow(int gridX0, int gridZ, int stride, int count, float* out) const
+{
+	int i = 0;
+#ifdef TERRAIN_NOISE_NEON
+	const int32_t laneOffsets[4] = { 0, stride, 2 * stride, 3 * stride };
+	const int32x4_t lanes = vld1q_s32(laneOffsets);
+	const float32x4_t z = vdupq_n_f32((float)gridZ);
+	const float32x4_t offset = vdupq_n_f32(params.heightOffset);
+
+	for (; i + 4 <= count; i += 4)
+	{
+		const float32x4_t x = vcvtq_f32_s32(vaddq_s32(vdupq_n_s32(gridX0 + i * stride), lanes));
+		float32x4_t sum = vdupq_n_f32(0.0f);
+		for (int o = 0; o < params.octaves; o++)
+		{
+			float32x4_t n = simplexNeon(vmulq_n_f32(x, octaveFrequency[o]), vmulq_n_f32(z, octaveFrequency[o]),
+				vdupq_n_u32(octaveSeed[o]));
+			sum = vaddq_f32(sum, vmulq_n_f32(n, octaveAmplitude[o]));
+		}
+		vst1q_f32(out + i, vaddq_f32(offset, sum));
+	}
+#endif
+	if (i < count)
+	{
+		sampleRowScalar(gridX0 + i * stride, gridZ, stride, count - i, out + i);
+	}
+}
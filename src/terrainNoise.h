@@ -0,0 +1,43 @@
+#pragma once
+
+#include "terrainGenerator.h"
+#include <cstdint>
+
+// Procedural fBm over 2D simplex noise, evaluated 4 samples at a time
+// Heights depend only on (grid position, seed): any chunk can be regenerated on demand
+// The NEON and scalar paths perform the same float operations in the same order,
+// so both produce bit-identical heights
+class NoiseHeightSource : public TerrainHeightSource
+{
+public:
+	static const int MAX_OCTAVES = 8;
+
+	struct Params
+	{
+		uint32_t seed;
+		int octaves;
+		float frequency;	// noise cycles per grid unit for the first octave
+		float lacunarity;	// frequency multiplier per octave
+		float gain;			// amplitude multiplier per octave
+		float heightScale;	// fBm in [-1,1] maps to heightOffset +/- heightScale
+		float heightOffset;
+	};
+
+	NoiseHeightSource();
+	explicit NoiseHeightSource(const Params& params);
+
+	void setParams(const Params& params);
+	const Params& getParams() const;
+
+	void sampleRow(int gridX0, int gridZ, int stride, int count, float* out) const override;
+	uint32_t getContentHash() const override;
+
+	// Reference path, used by the vector path for row tails and by the host test
+	void sampleRowScalar(int gridX0, int gridZ, int stride, int count, float* out) const;
+
+private:
+	Params params;
+	float octaveFrequency[MAX_OCTAVES];
+	float octaveAmplitude[MAX_OCTAVES];	// normalized so the weights sum to heightScale
+	uint32_t octaveSeed[MAX_OCTAVES];
+};
@@ -0,0 +1,202 @@
+#include "terrainScatter.h"
+#include <cstdint>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+// Share of a chunk's list drawn at each LOD up to SCATTER_LOD
+static const float SCATTER_DENSITY[TerrainScatter::SCATTER_LOD + 1] = { 1.0f, 0.4f };
+// Rock sizes, skewed towards the small end
+static const float SCATTER_MIN_SCALE = 0.1f;
+static const float SCATTER_MAX_SCALE = 0.6f;
+// Share of a rock's height sunk into the ground
+static const float SCATTER_SINK = 0.35f;
+
+// Seed of a chunk's list, the same chunk gets the same rocks every time it comes near
+static uint32_t hashChunk(int chunkX, int chunkZ)
+{
+	uint32_t h = (uint32_t)chunkX * 0x8da6b343u ^ (uint32_t)chunkZ * 0xd8163841u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+TerrainScatter::TerrainScatter()
+	: pool(MAX_CHUNKS * INSTANCES_PER_CHUNK), generatedCount(0)
+{
+	for (Range& range : ranges)
+	{
+		range.valid = false;
+		range.chunkX = range.chunkZ = 0;
+		range.block = -1;
+		range.count = 0;
+	}
+	freeBlocks.reserve(MAX_CHUNKS);
+	for (int i = MAX_CHUNKS - 1; i >= 0; i--)
+	{
+		freeBlocks.push_back(i);
+	}
+	candidates.reserve(Terrain::CHUNKS_PER_SIDE * Terrain::CHUNKS_PER_SIDE);
+}
+
+void TerrainScatter::update(const Terrain& terrain, const Matrix4x4& modelMatrix, const Vector3f& cameraPosition)
+{
+	const float* model = modelMatrix.getData();
+	Vector3f localCam(cameraPosition.x - model[3], cameraPosition.y - model[7], cameraPosition.z - model[11]);
+	generatedCount = 0;
+	candidates.clear();
+
+	// Every chunk of the window owns its slot, so one pass finds both the ranges to free and the chunks to fill
+	for (const auto& owned : terrain.getChunks())
+	{
+		const TerrainChunk* chunk = owned.get();
+		Range& range = ranges[Terrain::getSlotIndex(chunk->getChunkX(), chunk->getChunkZ())];
+		bool inNearSet = chunk->isResident() && chunk->getCurrentLOD() <= SCATTER_LOD;
+		bool current = range.valid && range.chunkX == chunk->getChunkX() && range.chunkZ == chunk->getChunkZ();
+
+		if (range.valid && (!current || !inNearSet))
+		{
+			freeRange(range);
+		}
+		if (inNearSet && !range.valid)
+		{
+			Vector3f d = chunk->getCenter() - localCam;
+			candidates.push_back({ d.x * d.x + d.z * d.z, chunk });
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end(),
+		[](const std::pair<float, const TerrainChunk*>& a, const std::pair<float, const TerrainChunk*>& b)
+		{
+			return a.first < b.first;
+		});
+
+	for (const auto& candidate : candidates)
+	{
+		if (freeBlocks.empty())
+			break;
+
+		const TerrainChunk* chunk = candidate.second;
+		Range& range = ranges[Terrain::getSlotIndex(chunk->getChunkX(), chunk->getChunkZ())];
+		range.block = freeBlocks.back();
+		freeBlocks.pop_back();
+		generate(terrain, modelMatrix, chunk, range);
+		generatedCount++;
+	}
+}
+
+void TerrainScatter::generate(const Terrain& terrain, const Matrix4x4& modelMatrix, const TerrainChunk* chunk,
+	Range& range)
+{
+	const float* model = modelMatrix.getData();
+	float originX = chunk->getChunkX() * Terrain::CHUNK_SIZE;
+	float originZ = chunk->getChunkZ() * Terrain::CHUNK_SIZE;
+
+	// xorshift32 from the chunk's seed
+	uint32_t state = hashChunk(chunk->getChunkX(), chunk->getChunkZ()) | 1u;
+	auto next = [&state]()
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return (state >> 8) * (1.0f / 16777216.0f);
+	};
+
+	TerrainScatterInstance* instances = &pool[(size_t)range.block * INSTANCES_PER_CHUNK];
+	float worldX[INSTANCES_PER_CHUNK], worldZ[INSTANCES_PER_CHUNK], heights[INSTANCES_PER_CHUNK];
+	for (int i = 0; i < INSTANCES_PER_CHUNK; i++)
+	{
+		TerrainScatterInstance& instance = instances[i];
+		instance.x = next() * Terrain::CHUNK_SIZE;
+		instance.z = next() * Terrain::CHUNK_SIZE;
+		float yaw = next() * 6.2831853f;
+		float size = next();
+		instance.cosYaw = cosf(yaw);
+		instance.sinYaw = sinf(yaw);
+		instance.scale = SCATTER_MIN_SCALE + (SCATTER_MAX_SCALE - SCATTER_MIN_SCALE) * size * size * size;
+		worldX[i] = originX + instance.x + model[3];
+		worldZ[i] = originZ + instance.z + model[11];
+	}
+	terrain.sampleHeights(worldX, worldZ, INSTANCES_PER_CHUNK, heights);
+
+	// Keep the ones that landed in generation order, which keeps every prefix an even thinning
+	int count = 0;
+	for (int i = 0; i < INSTANCES_PER_CHUNK; i++)
+	{
+		if (heights[i] == -FLT_MAX)
+			continue;
+
+		TerrainScatterInstance instance = instances[i];
+		instance.y = heights[i] - model[7] + (0.5f - SCATTER_SINK) * instance.scale;
+		instances[count++] = instance;
+	}
+
+	range.valid = true;
+	range.chunkX = chunk->getChunkX();
+	range.chunkZ = chunk->getChunkZ();
+	range.count = count;
+}
+
+void TerrainScatter::freeRange(Range& range)
+{
+	freeBlocks.push_back(range.block);
+	range.valid = false;
+	range.block = -1;
+	range.count = 0;
+}
+
+int TerrainScatter::writeInstances(const std::vector<TerrainChunk*>& visibleChunks, const Matrix4x4& modelMatrix,
+	const Vector3f& origin, float* matrices, int maxInstances) const
+{
+	const float* model = modelMatrix.getData();
+	int written = 0;
+
+	// Visible chunks come front to back, so a full buffer drops the farthest rocks
+	for (const TerrainChunk* chunk : visibleChunks)
+	{
+		TerrainChunk::LODLevel lod = chunk->getCurrentLOD();
+		if (lod > SCATTER_LOD)
+			continue;
+
+		const Range& range = ranges[Terrain::getSlotIndex(chunk->getChunkX(), chunk->getChunkZ())];
+		if (!range.valid || range.chunkX != chunk->getChunkX() || range.chunkZ != chunk->getChunkZ())
+			continue;
+
+		int count = std::min((int)ceilf(range.count * SCATTER_DENSITY[lod]), maxInstances - written);
+		// Chunk origin relative to the render origin, once per chunk so instances only add small offsets
+		float ox = chunk->getChunkX() * Terrain::CHUNK_SIZE + model[3] - origin.x;
+		float oy = model[7] - origin.y;
+		float oz = chunk->getChunkZ() * Terrain::CHUNK_SIZE + model[11] - origin.z;
+
+		const TerrainScatterInstance* instances = &pool[(size_t)range.block * INSTANCES_PER_CHUNK];
+		for (int i = 0; i < count; i++)
+		{
+			const TerrainScatterInstance& instance = instances[i];
+			float c = instance.cosYaw * instance.scale;
+			float s = instance.sinYaw * instance.scale;
+			// Translation * rotation about Y * uniform scale, the last row is implied
+			float* m = matrices + (size_t)written * 12;
+			m[0] = c;		m[1] = 0.0f;			m[2] = s;		m[3] = ox + instance.x;
+			m[4] = 0.0f;	m[5] = instance.scale;	m[6] = 0.0f;	m[7] = oy + instance.y;
+			m[8] = -s;		m[9] = 0.0f;			m[10] = c;		m[11] = oz + instance.z;
+			written++;
+		}
+
+		if (written == maxInstances)
+			break;
+	}
+	return written;
+}
+
+int TerrainScatter::getActiveChunkCount() const
+{
+	return MAX_CHUNKS - (int)freeBlocks.size();
+}
+
+int TerrainScatter::getGeneratedCount() const
+{
+	return generatedCount;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "terrain.h"
+#include <vector>
+#include <utility>
+
+// Detail object on the terrain. The mesh is unit sized and centered on its origin
+struct TerrainScatterInstance
+{
+	float x, y, z;	// mesh center, relative to the chunk origin
+	float cosYaw, sinYaw;
+	float scale;
+};
+
+// Detail objects scattered over the chunks near the camera, drawn as one instanced batch
+// A chunk's list is generated from its grid coordinates and the height field the first time it reaches SCATTER_LOD
+// or finer, and kept in a fixed range of one shared pool until the chunk coarsens or streams out. Instances are
+// generated in random order, so any prefix of a list thins it evenly: coarser chunks draw a shorter prefix
+class TerrainScatter
+{
+public:
+	static const int INSTANCES_PER_CHUNK = 96;
+	static const int MAX_CHUNKS = 48;	// pool ranges, the nearest chunks get one when more qualify
+	static const TerrainChunk::LODLevel SCATTER_LOD = TerrainChunk::LOD_1;
+
+	TerrainScatter();
+
+	// Free the ranges of chunks that left SCATTER_LOD or the window, then generate lists for the chunks that
+	// reached it, nearest first. modelMatrix is the terrain's, a translation
+	void update(const Terrain& terrain, const Matrix4x4& modelMatrix, const Vector3f& cameraPosition);
+	// Write the visible chunks' instances, thinned by their LOD, as the top three rows of row-major model matrices
+	// relative to origin (12 floats each, at most maxInstances). Returns the number written
+	int writeInstances(const std::vector<TerrainChunk*>& visibleChunks, const Matrix4x4& modelMatrix,
+		const Vector3f& origin, float* matrices, int maxInstances) const;
+
+	// Chunks holding a range
+	int getActiveChunkCount() const;
+	// Lists generated by the last update
+	int getGeneratedCount() const;
+
+private:
+	struct Range
+	{
+		bool valid;
+		int chunkX, chunkZ;	// chunk the range was generated for
+		int block;		// pool offset in INSTANCES_PER_CHUNK units
+		int count;		// instances that landed on the height field
+	};
+
+	void generate(const Terrain& terrain, const Matrix4x4& modelMatrix, const TerrainChunk* chunk, Range& range);
+	void freeRange(Range& range);
+
+	Range ranges[Terrain::CHUNKS_PER_SIDE * Terrain::CHUNKS_PER_SIDE];
+	std::vector<TerrainScatterInstance> pool;
+	std::vector<int> freeBlocks;
+	std::vector<std::pair<float, const TerrainChunk*>> candidates; // reused by update
+	int generatedCount;
+};
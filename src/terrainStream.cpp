@@ -0,0 +1,170 @@
+#include "terrainStream.h"
+#include "terrain.h"
+#include <psp2/kernel/clib.h>
+#include <psp2/kernel/threadmgr.h>
+
+// Below the main thread's priority and away from its core, generation only fills idle time
+static const int STREAM_THREAD_PRIORITY = 0x10000100 + 16;
+static const int STREAM_THREAD_STACK_SIZE = 256 * 1024;
+
+TerrainStreamWorker::TerrainStreamWorker()
+	: heightSource(nullptr), chunkSize(0.0f), thread(-1), workSema(-1), stopping(false),
+	requestHead(0), requestTail(0), resultHead(0), resultTail(0), slotCount(0)
+{
+
+}
+
+TerrainStreamWorker::~TerrainStreamWorker()
+{
+	stop();
+}
+
+bool TerrainStreamWorker::start(const TerrainHeightSource* source, float size, int slots)
+{
+	heightSource = source;
+	chunkSize = size;
+	slotCount = slots;
+	slotSerial.reset(new std::atomic<uint32_t>[slots]);
+	for (int i = 0; i < slots; i++)
+	{
+		slotSerial[i].store(0);
+	}
+	stopping.store(false);
+
+	workSema = sceKernelCreateSema("terrainStreamWork", 0, 0, QUEUE_SIZE, NULL);
+	if (workSema < 0)
+	{
+		sceClibPrintf("ERROR: Failed to create terrain stream semaphore: 0x%08X\n", workSema);
+		return false;
+	}
+
+	thread = sceKernelCreateThread("terrainStream", threadEntry, STREAM_THREAD_PRIORITY, STREAM_THREAD_STACK_SIZE,
+		0, SCE_KERNEL_CPU_MASK_USER_1, NULL);
+	if (thread < 0)
+	{
+		sceClibPrintf("ERROR: Failed to create terrain stream thread: 0x%08X\n", thread);
+		sceKernelDeleteSema(workSema);
+		workSema = -1;
+		return false;
+	}
+
+	// The argument block is copied onto the new thread's stack
+	TerrainStreamWorker* self = this;
+	sceKernelStartThread(thread, sizeof(self), &self);
+	return true;
+}
+
+void TerrainStreamWorker::stop()
+{
+	if (thread >= 0)
+	{
+		stopping.store(true);
+		sceKernelSignalSema(workSema, 1);
+		sceKernelWaitThreadEnd(thread, NULL, NULL);
+		sceKernelDeleteThread(thread);
+		thread = -1;
+	}
+
+	if (workSema >= 0)
+	{
+		sceKernelDeleteSema(workSema);
+		workSema = -1;
+	}
+
+	Result result;
+	while (popResult(result))
+	{
+		delete result.chunk;
+	}
+	requestHead.store(0);
+	requestTail.store(0);
+}
+
+bool TerrainStreamWorker::request(int slot, int chunkX, int chunkZ)
+{
+	uint32_t head = requestHead.load(std::memory_order_relaxed);
+	if (head - requestTail.load(std::memory_order_acquire) >= (uint32_t)QUEUE_SIZE)
+	{
+		return false;
+	}
+
+	// Bumping the serial first lets the worker skip any older request still queued for this slot
+	uint32_t serial = slotSerial[slot].load(std::memory_order_relaxed) + 1;
+	slotSerial[slot].store(serial, std::memory_order_release);
+
+	Request& req = requests[head & (QUEUE_SIZE - 1)];
+	req.slot = slot;
+	req.chunkX = chunkX;
+	req.chunkZ = chunkZ;
+	req.serial = serial;
+	requestHead.store(head + 1, std::memory_order_release);
+
+	sceKernelSignalSema(workSema, 1);
+	return true;
+}
+
+bool TerrainStreamWorker::popResult(Result& result)
+{
+	uint32_t tail = resultTail.load(std::memory_order_relaxed);
+	if (tail == resultHead.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+
+	result = results[tail & (QUEUE_SIZE - 1)];
+	resultTail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+bool TerrainStreamWorker::isCurrent(const Result& result) const
+{
+	return result.serial == slotSerial[result.slot].load(std::memory_order_acquire);
+}
+
+int TerrainStreamWorker::threadEntry(SceSize /*args*/, void* argp)
+{
+	TerrainStreamWorker* self = *(TerrainStreamWorker**)argp;
+	self->run();
+	return 0; // stop() waits for the thread to end and deletes it
+}
+
+void TerrainStreamWorker::run()
+{
+	while (true)
+	{
+		sceKernelWaitSema(workSema, 1, NULL);
+		if (stopping.load())
+			break;
+
+		uint32_t tail = requestTail.load(std::memory_order_relaxed);
+		if (tail == requestHead.load(std::memory_order_acquire))
+			continue;
+
+		Request req = requests[tail & (QUEUE_SIZE - 1)];
+		requestTail.store(tail + 1, std::memory_order_release);
+
+		if (req.serial != slotSerial[req.slot].load(std::memory_order_acquire))
+			continue;
+
+		TerrainChunk* chunk = new TerrainChunk(req.chunkX, req.chunkZ, chunkSize);
+		chunk->generate(heightSource);
+
+		// The main thread drains results every frame, so a full ring only ever waits a frame
+		uint32_t head = resultHead.load(std::memory_order_relaxed);
+		while (head - resultTail.load(std::memory_order_acquire) >= (uint32_t)QUEUE_SIZE)
+		{
+			if (stopping.load())
+			{
+				delete chunk;
+				return;
+			}
+			sceKernelDelayThread(1000);
+		}
+
+		Result& result = results[head & (QUEUE_SIZE - 1)];
+		result.slot = req.slot;
+		result.serial = req.serial;
+		result.chunk = chunk;
+		resultHead.store(head + 1, std::memory_order_release);
+	}
+}
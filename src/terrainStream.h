@@ -0,0 +1,64 @@
+#pragma once
+
+#include "terrainGenerator.h"
+#include <psp2/types.h>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+class TerrainChunk;
+
+// Generates streamed terrain chunks on a worker thread
+// Requests and results travel through single-producer/single-consumer rings, so neither side locks
+// A newer request for a slot supersedes older ones: stale requests are skipped and stale results
+// are reported through isCurrent so the main thread can drop them
+class TerrainStreamWorker
+{
+public:
+	static const int QUEUE_SIZE = 256; // power of two
+
+	struct Result
+	{
+		int slot;
+		uint32_t serial;
+		TerrainChunk* chunk; // owned by the caller once popped
+	};
+
+	TerrainStreamWorker();
+	~TerrainStreamWorker();
+
+	// heightSource must stay valid until stop()
+	bool start(const TerrainHeightSource* heightSource, float chunkSize, int slotCount);
+	void stop();
+
+	// Queue generation of a chunk for a slot, returns false when the queue is full
+	bool request(int slot, int chunkX, int chunkZ);
+	// Next generated chunk, returns false when nothing is ready
+	bool popResult(Result& result);
+	// False when the slot was requested again after this result's request
+	bool isCurrent(const Result& result) const;
+
+private:
+	struct Request
+	{
+		int slot;
+		int chunkX, chunkZ;
+		uint32_t serial;
+	};
+
+	static int threadEntry(SceSize args, void* argp);
+	void run();
+
+	const TerrainHeightSource* heightSource;
+	float chunkSize;
+	SceUID thread;
+	SceUID workSema;
+	std::atomic<bool> stopping;
+
+	Request requests[QUEUE_SIZE];
+	std::atomic<uint32_t> requestHead, requestTail;
+	Result results[QUEUE_SIZE];
+	std::atomic<uint32_t> resultHead, resultTail;
+	std::unique_ptr<std::atomic<uint32_t>[]> slotSerial;
+	int slotCount;
+};
@@ -0,0 +1,115 @@
+#include "hostTest.h"
+#include "terrainGenerator.h"
+#include "terrainNoise.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// LOD_0 chunk grid of the terrain: 65x65 vertices, 0.8 world units apart
+static const int CELLS = 64;
+static const int VERTICES_PER_SIDE = CELLS + 1;
+static const float GRID_SPACING = 0.8f;
+static const float UV_SCALE = 100.0f / 512.0f;
+
+// Reconstruction bounds of TerrainCompactVertex: heights round to the nearest step, UVs come from exact grid
+// positions, 16-bit octahedral normals stay well under 0.1 degrees (1 - cos < 1e-6)
+static const float POSITION_TOLERANCE = TERRAIN_HEIGHT_QUANT_STEP * 0.5f + 1e-5f;
+static const float UV_TOLERANCE = 1e-4f;
+static const float DIRECTION_TOLERANCE = 1e-6f;
+
+static float directionError(int16_t ax, int16_t ay, int16_t az, int16_t bx, int16_t by, int16_t bz)
+{
+	// S16N truncation shortens both vectors slightly, so compare directions only
+	float dot = ((float)ax * bx + (float)ay * by + (float)az * bz) /
+		sqrtf(((float)ax * ax + (float)ay * ay + (float)az * az) * ((float)bx * bx + (float)by * by + (float)bz * bz));
+	return 1.0f - dot;
+}
+
+// Round-trips two neighbouring chunks through the compact format. Besides the error bounds, the shared edge has
+// to dequantize to the same positions from both chunks' height bases, and morph deltas pass through unchanged
+static bool testRoundTrip(const TerrainHeightSource& source, const char* name)
+{
+	const int n = VERTICES_PER_SIDE;
+	TestRandom random(11);
+	float maxPositionError = 0.0f, maxUVError = 0.0f, maxNormalError = 0.0f, maxTangentError = 0.0f;
+	std::vector<TerrainPBRVertex> reference(n * n);
+	std::vector<TerrainCompactVertex> packed(n * n);
+	std::vector<TerrainPBRVertex> leftEdge;
+
+	for (int c = 0; c < 2; c++)
+	{
+		TerrainGridParams params;
+		params.gridX0 = (c - 1) * CELLS;
+		params.gridZ0 = 3 * CELLS;
+		params.step = 1;
+		params.verticesPerSide = n;
+		params.gridSpacing = GRID_SPACING;
+		params.uvScale = UV_SCALE;
+
+		float minHeight, maxHeight;
+		generateTerrainGrid(&source, params, reference.data(), minHeight, maxHeight);
+		for (TerrainPBRVertex& v : reference)
+		{
+			v.morphDelta = floatToF16(random.range(-2.0f, 2.0f));
+		}
+
+		const float heightBase = getTerrainHeightQuantBase(minHeight);
+		int clamped = packTerrainVertices(reference.data(), params, heightBase, packed.data());
+		HOST_CHECK(clamped == 0, "%s: %d heights clamped over a %.2f unit range", name, clamped, maxHeight - minHeight);
+
+		for (int i = 0; i < n * n; i++)
+		{
+			const TerrainPBRVertex& ref = reference[i];
+			TerrainPBRVertex v;
+			unpackTerrainVertex(packed[i], params, heightBase, v);
+
+			maxPositionError = std::max(maxPositionError,
+				std::max(std::abs(v.x - ref.x), std::max(std::abs(v.y - ref.y), std::abs(v.z - ref.z))));
+			maxUVError = std::max(maxUVError, std::max(std::abs(v.u - ref.u), std::abs(v.v - ref.v)));
+			maxNormalError = std::max(maxNormalError, directionError(v.nx, v.ny, v.nz, ref.nx, ref.ny, ref.nz));
+			maxTangentError = std::max(maxTangentError, directionError(v.tx, v.ty, v.tz, ref.tx, ref.ty, ref.tz));
+			HOST_CHECK(v.morphDelta == ref.morphDelta && v.tw == ref.tw, "%s: vertex %d morph delta or handedness changed",
+				name, i);
+
+			// The right chunk's first column against the left's last
+			int x = i % n;
+			if (c == 0 && x == n - 1)
+			{
+				leftEdge.push_back(v);
+			}
+			else if (c == 1 && x == 0)
+			{
+				const TerrainPBRVertex& l = leftEdge[i / n];
+				HOST_CHECK(memcmp(&l.x, &v.x, sizeof(float) * 3) == 0, "%s: edge vertex %d differs between the chunks",
+					name, i / n);
+			}
+		}
+	}
+
+	printf("Compact vertices (%s): %u -> %u bytes, max error position %.6f uv %.6f normal %.2e tangent %.2e (1 - cos)\n",
+		name, (unsigned)sizeof(TerrainPBRVertex), (unsigned)sizeof(TerrainCompactVertex),
+		maxPositionError, maxUVError, maxNormalError, maxTangentError);
+	HOST_CHECK(maxPositionError <= POSITION_TOLERANCE, "%s: position error %f over %f", name, maxPositionError,
+		POSITION_TOLERANCE);
+	HOST_CHECK(maxUVError <= UV_TOLERANCE, "%s: UV error %f over %f", name, maxUVError, UV_TOLERANCE);
+	HOST_CHECK(maxNormalError <= DIRECTION_TOLERANCE, "%s: normal error %e over %e", name, maxNormalError,
+		DIRECTION_TOLERANCE);
+	HOST_CHECK(maxTangentError <= DIRECTION_TOLERANCE, "%s: tangent error %e over %e", name, maxTangentError,
+		DIRECTION_TOLERANCE);
+	return true;
+}
+
+// Default noise terrain, and a steeper one whose chunks span a larger height range
+int main()
+{
+	NoiseHeightSource noise;
+	NoiseHeightSource::Params steepParams = noise.getParams();
+	steepParams.heightScale *= 4.0f;
+	steepParams.frequency *= 2.0f;
+	NoiseHeightSource steep(steepParams);
+
+	if (!testRoundTrip(noise, "noise") || !testRoundTrip(steep, "steep noise"))
+		return 1;
+	return 0;
+}
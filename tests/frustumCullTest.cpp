@@ -0,0 +1,171 @@
+#include "hostTest.h"
+#include "frustumCull.h"
+#include "matrix.h"
+#include <cmath>
+#include <vector>
+
+// Same layout as the terrain window: 10x10 chunks of 51.2 units, spheres around each chunk's box
+static const int CHUNKS_PER_SIDE = 10;
+static const float CHUNK_SIZE = 51.2f;
+static const float WINDOW_SIZE = CHUNKS_PER_SIDE * CHUNK_SIZE;
+
+struct Sphere
+{
+	float x, y, z, radius;
+};
+
+// Matches TerrainChunk::isInFrustum, the per-chunk path the batch culler replaces
+static bool isSphereInFrustum(const FrustumPlanes& frustum, const Sphere& sphere)
+{
+	for (int i = 0; i < 6; ++i)
+	{
+		float dist = frustum.planes[i].a * sphere.x
+			+ frustum.planes[i].b * sphere.y
+			+ frustum.planes[i].c * sphere.z
+			+ frustum.planes[i].d;
+
+		if (dist < -sphere.radius)
+			return false;
+	}
+	return true;
+}
+
+static std::vector<Sphere> makeChunkSpheres()
+{
+	TestRandom random(7);
+	std::vector<Sphere> spheres;
+	for (int z = 0; z < CHUNKS_PER_SIDE; z++)
+	{
+		for (int x = 0; x < CHUNKS_PER_SIDE; x++)
+		{
+			float minHeight = random.range(-5.0f, 20.0f);
+			float maxHeight = minHeight + random.range(0.0f, 30.0f);
+			float halfSize = CHUNK_SIZE * 0.5f;
+			float halfHeight = (maxHeight - minHeight) * 0.5f;
+			spheres.push_back({ (x + 0.5f) * CHUNK_SIZE, (minHeight + maxHeight) * 0.5f, (z + 0.5f) * CHUNK_SIZE,
+				sqrtf(2.0f * halfSize * halfSize + halfHeight * halfHeight) });
+		}
+	}
+	return spheres;
+}
+
+// Cameras over and around the window, looking anywhere from level to steeply down
+static FrustumPlanes makeTestFrustum(int index)
+{
+	TestRandom random(index);
+	float span = WINDOW_SIZE * 1.5f;
+	Vector3f position(-WINDOW_SIZE * 0.25f + random.next() * span, 1.0f + random.next() * 80.0f,
+		-WINDOW_SIZE * 0.25f + random.next() * span);
+	Vector3f rotation(-1.2f + random.next() * 1.6f, random.next() * 6.2831853f, 0.0f);
+
+	FrustumPlanes frustum;
+	frustum.extractFromMatrix(createProjectionMatrix(45.0f, 960.0f / 544.0f, 0.1f, 1000.0f) *
+		createViewMatrix(position, rotation));
+	return frustum;
+}
+
+// Both batch paths have to agree with the per-sphere test exactly, in id order
+static bool testCullingAgreement(const std::vector<Sphere>& spheres, const SphereBoundsSoA& bounds)
+{
+	const int frustumCount = 256;
+	std::vector<uint16_t> vectorIds(bounds.capacity());
+	std::vector<uint16_t> scalarIds(bounds.capacity());
+	int totalVisible = 0;
+
+	for (int f = 0; f < frustumCount; f++)
+	{
+		FrustumPlanes frustum = makeTestFrustum(f);
+		int vectorCount = bounds.cull(frustum, vectorIds.data());
+		int scalarCount = bounds.cullScalar(frustum, scalarIds.data());
+
+		int v = 0, s = 0;
+		for (size_t i = 0; i < spheres.size(); i++)
+		{
+			bool expected = isSphereInFrustum(frustum, spheres[i]);
+			bool vectorHit = (v < vectorCount && vectorIds[v] == i);
+			bool scalarHit = (s < scalarCount && scalarIds[s] == i);
+			HOST_CHECK(vectorHit == expected && scalarHit == expected,
+				"frustum %d sphere %d expected %d vector %d scalar %d", f, (int)i, expected, vectorHit, scalarHit);
+			v += vectorHit;
+			s += scalarHit;
+			totalVisible += expected;
+		}
+		HOST_CHECK(v == vectorCount && s == scalarCount, "frustum %d returned ids past the expected ones", f);
+	}
+
+	printf("Culling: batch paths match the per-sphere test (%d frusta, %d visible spheres)\n", frustumCount, totalVisible);
+	return true;
+}
+
+static void benchmarkCulling(const std::vector<Sphere>& spheres, const SphereBoundsSoA& bounds)
+{
+	const int frustumCount = 64;
+	const int repeats = 2000;
+	std::vector<FrustumPlanes> frusta;
+	for (int f = 0; f < frustumCount; f++)
+	{
+		frusta.push_back(makeTestFrustum(f));
+	}
+
+	std::vector<uint16_t> ids(bounds.capacity());
+	int checksum = 0;
+
+	double startTime = getHostTimeUs();
+	for (int r = 0; r < repeats; r++)
+	{
+		for (const FrustumPlanes& frustum : frusta)
+		{
+			for (const Sphere& sphere : spheres)
+			{
+				checksum += isSphereInFrustum(frustum, sphere);
+			}
+		}
+	}
+	double sphereTime = getHostTimeUs() - startTime;
+
+	startTime = getHostTimeUs();
+	for (int r = 0; r < repeats; r++)
+	{
+		for (const FrustumPlanes& frustum : frusta)
+		{
+			checksum += bounds.cullScalar(frustum, ids.data());
+		}
+	}
+	double scalarTime = getHostTimeUs() - startTime;
+
+	startTime = getHostTimeUs();
+	for (int r = 0; r < repeats; r++)
+	{
+		for (const FrustumPlanes& frustum : frusta)
+		{
+			checksum += bounds.cull(frustum, ids.data());
+		}
+	}
+	double vectorTime = getHostTimeUs() - startTime;
+
+	const double tests = (double)repeats * frustumCount * spheres.size();
+	printf("Culling: %.2f ns/chunk per-sphere, %.2f ns/chunk SoA scalar, %.2f ns/chunk SoA %s (checksum %d)\n",
+		sphereTime * 1000.0 / tests, scalarTime * 1000.0 / tests, vectorTime * 1000.0 / tests,
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+		"NEON",
+#else
+		"batch (scalar fallback)",
+#endif
+		checksum);
+}
+
+int main()
+{
+	std::vector<Sphere> spheres = makeChunkSpheres();
+	SphereBoundsSoA bounds;
+	for (size_t i = 0; i < spheres.size(); i++)
+	{
+		bounds.add(spheres[i].x, spheres[i].y, spheres[i].z, spheres[i].radius, (uint16_t)i);
+	}
+
+	if (!testCullingAgreement(spheres, bounds))
+		return 1;
+
+	benchmarkCulling(spheres, bounds);
+	return 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+// Shared by the host tests: a wall clock for the benchmarks and a deterministic random sequence, so every run
+// checks and times the same inputs
+
+inline double getHostTimeUs()
+{
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class TestRandom
+{
+public:
+	explicit TestRandom(uint32_t seed) : state(0x9E3779B9u * (seed + 1)) {}
+
+	// Uniform in [0, 1)
+	float next()
+	{
+		state = state * 1664525u + 1013904223u;
+		return (state >> 8) * (1.0f / 16777216.0f);
+	}
+
+	float range(float minValue, float maxValue)
+	{
+		return minValue + next() * (maxValue - minValue);
+	}
+
+private:
+	uint32_t state;
+};
+
+// Prints the failure and makes the enclosing bool function return false
+#define HOST_CHECK(condition, ...) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			printf("FAILED %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			return false; \
+		} \
+	} while (0)
@@ -0,0 +1,163 @@
+#include "hostTest.h"
+#include "terrainGenerator.h"
+#include "terrainNoise.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// LOD_0 chunk grid of the terrain: 65x65 vertices, 0.8 world units apart
+static const int VERTICES_PER_SIDE = 65;
+static const float GRID_SPACING = 0.8f;
+static const float UV_SCALE = 100.0f / 512.0f;
+
+// A tilted plane, so every vertex has the same exact normal and tangent
+class SlopeHeightSource : public TerrainHeightSource
+{
+public:
+	SlopeHeightSource(float slopeX, float slopeZ) : slopeX(slopeX), slopeZ(slopeZ) {}
+
+	void sampleRow(int gridX0, int gridZ, int stride, int count, float* out) const override
+	{
+		for (int i = 0; i < count; i++)
+		{
+			out[i] = (gridX0 + i * stride) * slopeX + gridZ * slopeZ;
+		}
+	}
+
+	uint32_t getContentHash() const override
+	{
+		return 0;
+	}
+
+private:
+	float slopeX, slopeZ;	// height per grid unit
+};
+
+static TerrainGridParams makeGridParams(int gridX0, int gridZ0, int step)
+{
+	TerrainGridParams params;
+	params.gridX0 = gridX0;
+	params.gridZ0 = gridZ0;
+	params.step = step;
+	params.verticesPerSide = (VERTICES_PER_SIDE - 1) / step + 1;
+	params.gridSpacing = GRID_SPACING;
+	params.uvScale = UV_SCALE;
+	return params;
+}
+
+// Positions, UVs, height range and the normal/tangent frame against the analytic plane, within S16N rounding
+// (and the NEON reciprocal square root estimate on ARM)
+static bool testSlope()
+{
+	const float slopeX = 0.3f, slopeZ = -0.7f;
+	SlopeHeightSource source(slopeX, slopeZ);
+	const int steps[] = { 1, 2, 8 };
+	const float tolerance = 2.0f / 32767.0f;
+
+	for (int step : steps)
+	{
+		TerrainGridParams params = makeGridParams(-64, 192, step);
+		std::vector<TerrainPBRVertex> grid(params.verticesPerSide * params.verticesPerSide);
+		float minHeight, maxHeight;
+		generateTerrainGrid(&source, params, grid.data(), minHeight, maxHeight);
+
+		// dh/dx and dh/dz in world units
+		const float dhdx = slopeX / GRID_SPACING, dhdz = slopeZ / GRID_SPACING;
+		const float invN = 1.0f / sqrtf(dhdx * dhdx + dhdz * dhdz + 1.0f);
+		const float invT = 1.0f / sqrtf(dhdx * dhdx + 1.0f);
+		const float normal[3] = { -dhdx * invN, invN, -dhdz * invN };
+		const float tangent[3] = { invT, dhdx * invT, 0.0f };
+
+		float expectedMin = FLT_MAX, expectedMax = -FLT_MAX;
+		for (int z = 0; z < params.verticesPerSide; z++)
+		{
+			for (int x = 0; x < params.verticesPerSide; x++)
+			{
+				const TerrainPBRVertex& v = grid[z * params.verticesPerSide + x];
+				int gridX = params.gridX0 + x * step, gridZ = params.gridZ0 + z * step;
+				float height = gridX * slopeX + gridZ * slopeZ;
+				expectedMin = std::min(expectedMin, height);
+				expectedMax = std::max(expectedMax, height);
+
+				HOST_CHECK(v.x == gridX * GRID_SPACING && v.z == gridZ * GRID_SPACING && v.y == height,
+					"step %d vertex (%d, %d) at (%f, %f, %f)", step, x, z, v.x, v.y, v.z);
+				HOST_CHECK(v.u == v.x * UV_SCALE && v.v == v.z * UV_SCALE, "step %d vertex (%d, %d) UV", step, x, z);
+
+				const int16_t n[3] = { v.nx, v.ny, v.nz };
+				const int16_t t[3] = { v.tx, v.ty, v.tz };
+				for (int i = 0; i < 3; i++)
+				{
+					HOST_CHECK(std::abs(n[i] / 32767.0f - normal[i]) <= tolerance &&
+						std::abs(t[i] / 32767.0f - tangent[i]) <= tolerance,
+						"step %d vertex (%d, %d) component %d: normal %d tangent %d", step, x, z, i, n[i], t[i]);
+				}
+				HOST_CHECK(v.tw < 0, "step %d vertex (%d, %d) handedness %d", step, x, z, v.tw);
+			}
+		}
+		HOST_CHECK(minHeight == expectedMin && maxHeight == expectedMax, "step %d height range %f..%f, expected %f..%f",
+			step, minHeight, maxHeight, expectedMin, expectedMax);
+	}
+
+	printf("Generator: slope grids match the analytic surface\n");
+	return true;
+}
+
+// Neighbouring chunks share their edge vertices bit for bit
+static bool testSharedEdges()
+{
+	NoiseHeightSource noise;
+	const int cells = VERTICES_PER_SIDE - 1;
+	const int n = VERTICES_PER_SIDE;
+	std::vector<TerrainPBRVertex> left(n * n), right(n * n);
+	float minHeight, maxHeight;
+	generateTerrainGrid(&noise, makeGridParams(-cells, 5 * cells, 1), left.data(), minHeight, maxHeight);
+	generateTerrainGrid(&noise, makeGridParams(0, 5 * cells, 1), right.data(), minHeight, maxHeight);
+
+	for (int z = 0; z < n; z++)
+	{
+		const TerrainPBRVertex& l = left[z * n + n - 1];
+		const TerrainPBRVertex& r = right[z * n];
+		HOST_CHECK(memcmp(&l, &r, sizeof(TerrainPBRVertex)) == 0, "edge vertex %d differs between the chunks", z);
+	}
+
+	printf("Generator: neighbouring chunks share their edge vertices\n");
+	return true;
+}
+
+// us per LOD_0 chunk grid, flat (frame generation only) and over noise (sampling included)
+static void benchmarkGenerator()
+{
+	const int chunks = 400;
+	NoiseHeightSource noise;
+	std::vector<TerrainPBRVertex> grid(VERTICES_PER_SIDE * VERTICES_PER_SIDE);
+	std::vector<float> heightScratch;
+	float minHeight, maxHeight, checksum = 0.0f;
+
+	const TerrainHeightSource* sources[2] = { nullptr, &noise };
+	double times[2];
+	for (int s = 0; s < 2; s++)
+	{
+		double startTime = getHostTimeUs();
+		for (int c = 0; c < chunks; c++)
+		{
+			TerrainGridParams params = makeGridParams((c % 20) * (VERTICES_PER_SIDE - 1), (c / 20) * (VERTICES_PER_SIDE - 1), 1);
+			generateTerrainGrid(sources[s], params, grid.data(), minHeight, maxHeight, heightScratch);
+			checksum += maxHeight + grid[c].nx;
+		}
+		times[s] = (getHostTimeUs() - startTime) / chunks;
+	}
+
+	printf("Generator (%dx%d grid): %.1f us/chunk flat, %.1f us/chunk over noise (checksum %.3f)\n",
+		VERTICES_PER_SIDE, VERTICES_PER_SIDE, times[0], times[1], checksum);
+}
+
+int main()
+{
+	if (!testSlope() || !testSharedEdges())
+		return 1;
+
+	benchmarkGenerator();
+	return 0;
+}
@@ -0,0 +1,139 @@
+#include "hostTest.h"
+#include "terrainGenerator.h"
+#include <algorithm>
+#include <array>
+#include <vector>
+
+// Index buffers of every terrain LOD, lists against strips: bytes and simulated post-transform cache ACMR/ATVR
+// Also checks that the strips draw exactly the list triangles with the same winding
+
+// Vertices per side of each LOD, nested in the 65x65 LOD_0 grid (Terrain's LOD_VERTICES)
+static const int LOD_VERTICES[] = { 65, 33, 17, 9, 3 };
+static const int LOD_COUNT = sizeof(LOD_VERTICES) / sizeof(LOD_VERTICES[0]);
+static const int CHUNK_GRID_SIZE = 64;
+
+// Post-transform cache behaviour of an index buffer
+struct IndexStats
+{
+	int indices;
+	int triangles;			// non-degenerate
+	int uniqueVertices;
+	int vertexTransforms;	// cache misses
+	float acmr;				// vertex transforms per triangle
+	float atvr;				// vertex transforms per unique vertex, 1.0 is ideal
+};
+
+// Simulates a FIFO post-transform cache of cacheSize vertices over a triangle list or strip
+static void measureIndices(const std::vector<uint16_t>& indices, bool strip, int cacheSize, IndexStats& stats)
+{
+	stats = {};
+	stats.indices = (int)indices.size();
+
+	// FIFO post-transform cache: a vertex is shaded on a miss and stays for cacheSize misses
+	std::vector<int> cache(cacheSize, -1);
+	int cacheHead = 0;
+	std::vector<bool> seen;
+
+	for (size_t i = 0; i < indices.size(); i++)
+	{
+		uint16_t index = indices[i];
+		if (std::find(cache.begin(), cache.end(), (int)index) == cache.end())
+		{
+			cache[cacheHead] = index;
+			cacheHead = (cacheHead + 1) % cacheSize;
+			stats.vertexTransforms++;
+		}
+
+		if (index >= seen.size())
+		{
+			seen.resize(index + 1, false);
+		}
+		if (!seen[index])
+		{
+			seen[index] = true;
+			stats.uniqueVertices++;
+		}
+	}
+
+	stats.triangles = countTerrainTriangles(indices, strip);
+	stats.acmr = stats.triangles > 0 ? (float)stats.vertexTransforms / stats.triangles : 0.0f;
+	stats.atvr = stats.uniqueVertices > 0 ? (float)stats.vertexTransforms / stats.uniqueVertices : 0.0f;
+}
+
+// Non-degenerate triangles in drawing winding, rotated to start at their lowest index and sorted
+static std::vector<std::array<uint16_t, 3> > collectTriangles(const std::vector<uint16_t>& indices, bool strip)
+{
+	std::vector<std::array<uint16_t, 3> > triangles;
+	const size_t stride = strip ? 1 : 3;
+	for (size_t i = 2; i < indices.size(); i += stride)
+	{
+		std::array<uint16_t, 3> t = { indices[i - 2], indices[i - 1], indices[i] };
+		if (t[0] == t[1] || t[1] == t[2] || t[0] == t[2])
+			continue;
+
+		// Every other strip triangle is wound backwards
+		if (strip && ((i - 2) & 1))
+		{
+			std::swap(t[1], t[2]);
+		}
+		std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+		triangles.push_back(t);
+	}
+	std::sort(triangles.begin(), triangles.end());
+	return triangles;
+}
+
+static bool checkIndices()
+{
+	std::vector<uint16_t> list, strip;
+	for (int lod = 0; lod < LOD_COUNT; lod++)
+	{
+		const int gridStep = CHUNK_GRID_SIZE / (LOD_VERTICES[lod] - 1);
+		for (int stitchMask = 0; stitchMask < TERRAIN_STITCH_VARIANTS; stitchMask++)
+		{
+			// Stitched edges line up with the next coarser LOD
+			int stitchRatio = (lod + 1 < LOD_COUNT) ? (LOD_VERTICES[lod] - 1) / (LOD_VERTICES[lod + 1] - 1) : 1;
+			generateTerrainIndices(LOD_VERTICES[lod], stitchMask, stitchRatio, gridStep, list);
+			generateTerrainStripIndices(LOD_VERTICES[lod], stitchMask, stitchRatio, gridStep, strip);
+			HOST_CHECK(collectTriangles(list, false) == collectTriangles(strip, true),
+				"LOD %d stitch mask %d: the strip doesn't draw the list's triangles", lod, stitchMask);
+		}
+	}
+
+	printf("Indices: strips draw the list triangles with the same winding at every LOD and stitch mask\n");
+	return true;
+}
+
+static void reportIndexStats()
+{
+	// The post-transform cache size isn't documented, so show a small and a large FIFO
+	const int cacheSizes[2] = { 12, 32 };
+	std::vector<uint16_t> list, strip;
+
+	for (int lod = 0; lod < LOD_COUNT; lod++)
+	{
+		const int gridStep = CHUNK_GRID_SIZE / (LOD_VERTICES[lod] - 1);
+		generateTerrainIndices(LOD_VERTICES[lod], 0, 1, gridStep, list);
+		generateTerrainStripIndices(LOD_VERTICES[lod], 0, 1, gridStep, strip);
+
+		for (int c = 0; c < 2; c++)
+		{
+			IndexStats listStats, stripStats;
+			measureIndices(list, false, cacheSizes[c], listStats);
+			measureIndices(strip, true, cacheSizes[c], stripStats);
+			printf("Indices LOD %d cache %d: list %d bytes ACMR %.3f ATVR %.3f, strip %d bytes ACMR %.3f ATVR %.3f\n",
+				lod, cacheSizes[c],
+				listStats.indices * (int)sizeof(uint16_t), listStats.acmr, listStats.atvr,
+				stripStats.indices * (int)sizeof(uint16_t), stripStats.acmr, stripStats.atvr);
+		}
+	}
+}
+
+int main()
+{
+	if (!checkIndices())
+		return 1;
+
+	reportIndexStats();
+	return 0;
+}
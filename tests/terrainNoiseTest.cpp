@@ -0,0 +1,114 @@
+#include "hostTest.h"
+#include "terrainNoise.h"
+#include <cstring>
+#include <vector>
+
+// Odd counts exercise the scalar tail, negative and far origins exercise floor and hash wrap
+static const int ORIGINS[][2] = { { 0, 0 }, { -37, -129 }, { 613, 5 }, { -4096, 70000 }, { 123457, -98765 } };
+static const int STRIDES[] = { 1, 2, 8, 32 };
+static const int ROW_LENGTH = 67;
+
+// The vector path has to match the scalar one bit for bit
+static bool testVectorMatchesScalar(const NoiseHeightSource& noise)
+{
+	float vectorRow[ROW_LENGTH];
+	float scalarRow[ROW_LENGTH];
+
+	for (const auto& origin : ORIGINS)
+	{
+		for (int stride : STRIDES)
+		{
+			for (int z = 0; z < 16; z++)
+			{
+				int gridZ = origin[1] + z * stride;
+				noise.sampleRow(origin[0], gridZ, stride, ROW_LENGTH, vectorRow);
+				noise.sampleRowScalar(origin[0], gridZ, stride, ROW_LENGTH, scalarRow);
+				for (int i = 0; i < ROW_LENGTH; i++)
+				{
+					HOST_CHECK(memcmp(&vectorRow[i], &scalarRow[i], sizeof(float)) == 0,
+						"at (%d, %d): vector %f scalar %f", origin[0] + i * stride, gridZ, vectorRow[i], scalarRow[i]);
+				}
+			}
+		}
+	}
+
+	printf("Noise: vector and scalar paths match\n");
+	return true;
+}
+
+// A height depends only on its grid position and the params: another source, another row origin or another
+// stride give the same bits, so chunks regenerate identically in any order
+static bool testDeterminism(const NoiseHeightSource& noise)
+{
+	NoiseHeightSource other(noise.getParams());
+	float row[ROW_LENGTH];
+	float otherRow[ROW_LENGTH];
+	float single;
+
+	for (const auto& origin : ORIGINS)
+	{
+		for (int stride : STRIDES)
+		{
+			noise.sampleRow(origin[0], origin[1], stride, ROW_LENGTH, row);
+			other.sampleRow(origin[0], origin[1], stride, ROW_LENGTH, otherRow);
+			HOST_CHECK(memcmp(row, otherRow, sizeof(row)) == 0, "two sources disagree on the row at (%d, %d)",
+				origin[0], origin[1]);
+
+			for (int i = 0; i < ROW_LENGTH; i++)
+			{
+				noise.sampleRow(origin[0] + i * stride, origin[1], 1, 1, &single);
+				HOST_CHECK(memcmp(&single, &row[i], sizeof(float)) == 0, "(%d, %d) depends on the row it is sampled in",
+					origin[0] + i * stride, origin[1]);
+			}
+		}
+	}
+
+	NoiseHeightSource::Params reseeded = noise.getParams();
+	reseeded.seed++;
+	NoiseHeightSource otherSeed(reseeded);
+	otherSeed.sampleRow(0, 0, 1, ROW_LENGTH, otherRow);
+	noise.sampleRow(0, 0, 1, ROW_LENGTH, row);
+	HOST_CHECK(memcmp(row, otherRow, sizeof(row)) != 0, "changing the seed left the heights unchanged");
+	HOST_CHECK(noise.getContentHash() != otherSeed.getContentHash(), "changing the seed left the content hash unchanged");
+
+	printf("Noise: heights depend only on position and params\n");
+	return true;
+}
+
+static void benchmarkNoise(const NoiseHeightSource& noise)
+{
+	const int rows = 1024;
+	const int rowLength = 256;
+	std::vector<float> row(rowLength);
+	float checksum = 0.0f;
+
+	double startTime = getHostTimeUs();
+	for (int z = 0; z < rows; z++)
+	{
+		noise.sampleRow(0, z, 1, rowLength, row.data());
+		checksum += row[z % rowLength];
+	}
+	double vectorTime = getHostTimeUs() - startTime;
+
+	startTime = getHostTimeUs();
+	for (int z = 0; z < rows; z++)
+	{
+		noise.sampleRowScalar(0, z, 1, rowLength, row.data());
+		checksum += row[z % rowLength];
+	}
+	double scalarTime = getHostTimeUs() - startTime;
+
+	const double samples = (double)rows * rowLength;
+	printf("Noise (%d octaves): %.1f ns/sample sampleRow, %.1f ns/sample scalar (checksum %.3f)\n",
+		noise.getParams().octaves, vectorTime * 1000.0 / samples, scalarTime * 1000.0 / samples, checksum);
+}
+
+int main()
+{
+	NoiseHeightSource noise;
+	if (!testVectorMatchesScalar(noise) || !testDeterminism(noise))
+		return 1;
+
+	benchmarkNoise(noise);
+	return 0;
+}
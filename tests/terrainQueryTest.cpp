@@ -0,0 +1,194 @@
+#include "hostTest.h"
+#include "terrainGenerator.h"
+#include "terrainHeightField.h"
+#include "terrainNoise.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+// Terrain window of 10x10 chunks, 64 cells of 0.8 world units each
+static const int CHUNKS_PER_SIDE = 10;
+static const int CELLS = TerrainHeightField::CELLS;
+static const float GRID_SPACING = 0.8f;
+static const float WINDOW_SIZE = CHUNKS_PER_SIDE * CELLS * GRID_SPACING;
+
+// Fills every tile from the noise terrain the way Terrain does from the chunk build's LOD_0 vertices
+static void buildField(const TerrainHeightSource& source, TerrainHeightField& field)
+{
+	const int n = TerrainHeightField::VERTICES;
+	std::vector<TerrainPBRVertex> grid(n * n);
+	field.init(CHUNKS_PER_SIDE, GRID_SPACING);
+	for (int chunkZ = 0; chunkZ < CHUNKS_PER_SIDE; chunkZ++)
+	{
+		for (int chunkX = 0; chunkX < CHUNKS_PER_SIDE; chunkX++)
+		{
+			TerrainGridParams params;
+			params.gridX0 = chunkX * CELLS;
+			params.gridZ0 = chunkZ * CELLS;
+			params.step = 1;
+			params.verticesPerSide = n;
+			params.gridSpacing = GRID_SPACING;
+			params.uvScale = 1.0f;
+
+			float minHeight, maxHeight;
+			generateTerrainGrid(&source, params, grid.data(), minHeight, maxHeight);
+			field.setTile(chunkX, chunkZ, &grid[0].y, sizeof(TerrainPBRVertex));
+		}
+	}
+}
+
+// Spread of rays over the window starting above the ground, pointing from slightly up to steeply down
+static void makeTestRay(const TerrainHeightField& field, TestRandom& random, Vector3f& origin, Vector3f& direction)
+{
+	origin.x = random.next() * WINDOW_SIZE;
+	origin.z = random.next() * WINDOW_SIZE;
+	float ground = 0.0f;
+	field.sampleHeight(origin.x, origin.z, ground);
+	origin.y = ground + 0.5f + random.next() * 40.0f;
+
+	float yaw = random.next() * 6.2831853f;
+	float pitch = random.range(-1.2f, 0.2f);
+	direction = Vector3f(cosf(pitch) * cosf(yaw), sinf(pitch), cosf(pitch) * sinf(yaw));
+}
+
+// Ray hits lie on the bilinear surface sampleHeight sees, and nothing of the ray before the hit is under it
+static bool testRaycasts(const TerrainHeightField& field)
+{
+	const int rayCount = 1024;
+	const float maxDistance = 200.0f;
+	const float marchStep = 0.1f;
+	const float tolerance = 1e-3f;
+	TestRandom random(19);
+	int hitCount = 0;
+	float worstError = 0.0f;
+
+	for (int i = 0; i < rayCount; i++)
+	{
+		Vector3f origin, direction;
+		makeTestRay(field, random, origin, direction);
+		TerrainRayHit hit;
+		bool found = field.raycast(origin, direction, 0.0f, maxDistance, hit);
+
+		float end = found ? hit.distance : maxDistance;
+		for (float t = 0.0f; t < end; t += marchStep)
+		{
+			Vector3f p = origin + direction * t;
+			float height;
+			HOST_CHECK(!field.sampleHeight(p.x, p.z, height) || p.y >= height - tolerance,
+				"ray %d passes %.4f under the surface at %.2f before its hit at %.2f", i, height - p.y, t,
+				found ? hit.distance : -1.0f);
+		}
+
+		if (found)
+		{
+			float height;
+			float error = field.sampleHeight(hit.position.x, hit.position.z, height) ?
+				std::abs(height - hit.position.y) : FLT_MAX;
+			worstError = std::max(worstError, error);
+			HOST_CHECK(error <= tolerance, "ray %d hit %.4f off the surface at distance %.2f", i, error, hit.distance);
+			hitCount++;
+		}
+	}
+
+	printf("Terrain queries: %d of %d rays hit, worst hit height error %.6f\n", hitCount, rayCount, worstError);
+	HOST_CHECK(hitCount > 0, "no ray hit the terrain");
+	return true;
+}
+
+// Ground is solid, a ray starting under it hits where it starts. Cleared tiles let queries through
+static bool testEdgeCases(TerrainHeightField& field)
+{
+	const float x = 76.9f, z = 230.1f;
+	float height;
+	HOST_CHECK(field.sampleHeight(x, z, height), "no height inside the window");
+
+	TerrainRayHit hit;
+	HOST_CHECK(field.raycast(Vector3f(x, height - 1.0f, z), Vector3f(1.0f, 0.0f, 0.0f), 0.0f, 50.0f, hit) &&
+		hit.distance == 0.0f, "a ray starting under the ground doesn't hit at its origin");
+	HOST_CHECK(field.raycast(Vector3f(x, height + 10.0f, z), Vector3f(0.0f, -1.0f, 0.0f), 0.0f, 50.0f, hit) &&
+		std::abs(hit.distance - 10.0f) <= 1e-3f && hit.normal.y > 0.0f, "a straight down ray misses the surface");
+	HOST_CHECK(!field.raycast(Vector3f(x, 1000.0f, z), Vector3f(0.0f, 1.0f, 0.0f), 0.0f, 50.0f, hit),
+		"a ray pointing up hit the terrain");
+	HOST_CHECK(!field.sampleHeight(-1.0f, z, height) && !field.sampleHeight(x, WINDOW_SIZE + 1.0f, height),
+		"height outside the window");
+
+	const int chunkX = (int)(x / (CELLS * GRID_SPACING)), chunkZ = (int)(z / (CELLS * GRID_SPACING));
+	field.clearTile(chunkX, chunkZ);
+	HOST_CHECK(!field.sampleHeight(x, z, height), "height over a cleared tile");
+	HOST_CHECK(!field.raycast(Vector3f(x, 1000.0f, z), Vector3f(0.0f, -1.0f, 0.0f), 0.0f, 2000.0f, hit),
+		"ray hit a cleared tile");
+
+	field.setFlatTile(chunkX, chunkZ, 5.0f);
+	HOST_CHECK(field.sampleHeight(x, z, height) && height == 5.0f, "flat tile height %f", height);
+	HOST_CHECK(field.raycast(Vector3f(x, 15.0f, z), Vector3f(0.6f, -0.8f, 0.0f), 0.0f, 50.0f, hit) &&
+		std::abs(hit.distance - 12.5f) <= 1e-3f && std::abs(hit.position.y - 5.0f) <= 1e-4f,
+		"ray onto a flat tile hit at %f", hit.distance);
+	return true;
+}
+
+// ns/query for height samples, short rays like a camera collision probe and long ones like picking
+static void reportPerformance(const TerrainHeightField& field)
+{
+	const int queryCount = 4096;
+	const int repeats = 16;
+	TestRandom random(23);
+	std::vector<Vector3f> origins(queryCount), directions(queryCount);
+	for (int i = 0; i < queryCount; i++)
+	{
+		makeTestRay(field, random, origins[i], directions[i]);
+	}
+
+	float checksum = 0.0f;
+	double startTime = getHostTimeUs();
+	for (int r = 0; r < repeats; r++)
+	{
+		for (int i = 0; i < queryCount; i++)
+		{
+			float height;
+			if (field.sampleHeight(origins[i].x, origins[i].z, height))
+			{
+				checksum += height;
+			}
+		}
+	}
+	double sampleTime = getHostTimeUs() - startTime;
+
+	const float distances[2] = { 10.0f, 200.0f };
+	double rayTime[2];
+	for (int d = 0; d < 2; d++)
+	{
+		startTime = getHostTimeUs();
+		for (int r = 0; r < repeats; r++)
+		{
+			for (int i = 0; i < queryCount; i++)
+			{
+				TerrainRayHit hit;
+				if (field.raycast(origins[i], directions[i], 0.0f, distances[d], hit))
+				{
+					checksum += hit.distance;
+				}
+			}
+		}
+		rayTime[d] = getHostTimeUs() - startTime;
+	}
+
+	const double queries = (double)repeats * queryCount;
+	printf("Terrain queries: sampleHeight %.1f ns, raycast %.0f units %.1f ns, %.0f units %.1f ns (checksum %.1f)\n",
+		sampleTime * 1000.0 / queries, distances[0], rayTime[0] * 1000.0 / queries,
+		distances[1], rayTime[1] * 1000.0 / queries, checksum);
+}
+
+int main()
+{
+	NoiseHeightSource noise;
+	TerrainHeightField field;
+	buildField(noise, field);
+
+	if (!testRaycasts(field))
+		return 1;
+	reportPerformance(field);
+	if (!testEdgeCases(field))
+		return 1;
+	return 0;
+}